@@ -0,0 +1,214 @@
+#include "BlockPool.h"
+
+BlockPool::BlockPool()
+{
+	this->mClassCount = 0;
+	this->mArena = NULL;
+	this->mArenaSize = 0;
+	this->mPsram = false;
+	this->mFallbacks = 0;
+	this->mFallbackBytes = 0;
+}
+
+BlockPool::~BlockPool()
+{
+	free(this->mArena);
+}
+
+bool BlockPool::begin()
+{
+	return this->begin(false);
+}
+
+bool BlockPool::begin(bool psram)
+{
+	const uint32_t sizes[] = BLOCK_POOL_SIZES;
+	const uint16_t counts[] = BLOCK_POOL_COUNTS;
+	return this->begin(sizes, counts, sizeof(sizes) / sizeof(sizes[0]), psram);
+}
+
+bool BlockPool::begin(const uint32_t *sizes, const uint16_t *counts, uint8_t classes, bool psram)
+{
+	if (this->mArena != NULL || classes == 0 || classes > BLOCK_POOL_MAX_CLASSES)
+	{
+		return false;
+	}
+	uint32_t total = 0;
+	uint32_t bitmap = 0;
+	for (uint8_t i = 0; i < classes; i++)
+	{
+		if (sizes[i] < sizeof(void *) || (sizes[i] & 7) != 0 || (i > 0 && sizes[i] <= sizes[i - 1]))
+		{
+			return false;
+		}
+		total += sizes[i] * counts[i];
+		bitmap += (counts[i] + 7) / 8;
+	}
+	// the in-use bitmaps follow the blocks in the same allocation
+	this->mArena = (uint8_t *)(psram ? ps_malloc(total + bitmap) : malloc(total + bitmap));
+	if (this->mArena == NULL)
+	{
+		return false;
+	}
+	this->mArenaSize = total;
+	this->mPsram = psram;
+	this->mClassCount = classes;
+
+	uint8_t *p = this->mArena;
+	uint8_t *used = this->mArena + total;
+	memset(used, 0, bitmap);
+	for (uint8_t i = 0; i < classes; i++)
+	{
+		BlockClass *c = &this->mClasses[i];
+		c->size = sizes[i];
+		c->count = counts[i];
+		c->inUse = 0;
+		c->highWater = 0;
+		c->base = p;
+		c->free = NULL;
+		c->used = used;
+		used += (counts[i] + 7) / 8;
+		// thread the free list so blocks are handed out in address order
+		for (uint16_t b = counts[i]; b > 0; b--)
+		{
+			void *block = p + (uint32_t)(b - 1) * sizes[i];
+			*(void **)block = c->free;
+			c->free = block;
+		}
+		p += sizes[i] * counts[i];
+	}
+	return true;
+}
+
+int8_t BlockPool::findClass(const void *block)
+{
+	const uint8_t *p = (const uint8_t *)block;
+	if (this->mArena == NULL || p < this->mArena || p >= this->mArena + this->mArenaSize)
+	{
+		return BLOCK_POOL_NONE;
+	}
+	for (uint8_t i = 0; i < this->mClassCount; i++)
+	{
+		BlockClass *c = &this->mClasses[i];
+		if (p < c->base + c->size * c->count)
+		{
+			return i;
+		}
+	}
+	return BLOCK_POOL_NONE;
+}
+
+int32_t BlockPool::findBlock(uint8_t index, const void *block)
+{
+	BlockClass *c = &this->mClasses[index];
+	uint32_t offset = (const uint8_t *)block - c->base;
+	return (offset % c->size == 0) ? (int32_t)(offset / c->size) : -1;
+}
+
+void *BlockPool::allocate(uint32_t size, bool zero)
+{
+	for (uint8_t i = 0; i < this->mClassCount; i++)
+	{
+		BlockClass *c = &this->mClasses[i];
+		if (size <= c->size && c->free != NULL)
+		{
+			void *block = c->free;
+			c->free = *(void **)block;
+			uint32_t b = this->findBlock(i, block);
+			c->used[b / 8] |= (1 << (b % 8));
+			if (++c->inUse > c->highWater)
+			{
+				c->highWater = c->inUse;
+			}
+			if (zero)
+			{
+				memset(block, 0, size);
+			}
+			return block;
+		}
+	}
+
+	this->mFallbacks++;
+	this->mFallbackBytes += size;
+	if (this->mPsram)
+	{
+		return zero ? ps_calloc(size, 1) : ps_malloc(size);
+	}
+	return zero ? calloc(size, 1) : malloc(size);
+}
+
+bool BlockPool::release(void *block)
+{
+	if (block == NULL)
+	{
+		return true;
+	}
+	int8_t index = this->findClass(block);
+	if (index == BLOCK_POOL_NONE)
+	{
+		free(block);
+		return true;
+	}
+	BlockClass *c = &this->mClasses[index];
+	int32_t b = this->findBlock(index, block);
+	if (b < 0 || (c->used[b / 8] & (1 << (b % 8))) == 0)
+	{
+		return false;
+	}
+	c->used[b / 8] &= ~(1 << (b % 8));
+	*(void **)block = c->free;
+	c->free = block;
+	c->inUse--;
+	return true;
+}
+
+bool BlockPool::owns(const void *block)
+{
+	return this->findClass(block) != BLOCK_POOL_NONE;
+}
+
+uint32_t BlockPool::capacity(const void *block)
+{
+	int8_t index = this->findClass(block);
+	return (index == BLOCK_POOL_NONE) ? 0 : this->mClasses[index].size;
+}
+
+uint8_t BlockPool::getClassCount()
+{
+	return this->mClassCount;
+}
+
+uint32_t BlockPool::getClassSize(uint8_t index)
+{
+	return (index < this->mClassCount) ? this->mClasses[index].size : 0;
+}
+
+uint16_t BlockPool::getBlockCount(uint8_t index)
+{
+	return (index < this->mClassCount) ? this->mClasses[index].count : 0;
+}
+
+uint16_t BlockPool::getInUse(uint8_t index)
+{
+	return (index < this->mClassCount) ? this->mClasses[index].inUse : 0;
+}
+
+uint16_t BlockPool::getHighWater(uint8_t index)
+{
+	return (index < this->mClassCount) ? this->mClasses[index].highWater : 0;
+}
+
+uint32_t BlockPool::getFallbacks()
+{
+	return this->mFallbacks;
+}
+
+uint32_t BlockPool::getFallbackBytes()
+{
+	return this->mFallbackBytes;
+}
+
+uint32_t BlockPool::getArenaSize()
+{
+	return this->mArenaSize;
+}
@@ -0,0 +1,72 @@
+#ifndef BLOCK_POOL_H_
+#define BLOCK_POOL_H_
+
+#include <Arduino.h>
+
+#define BLOCK_POOL_MAX_CLASSES 8
+// default classes: block sizes (multiples of 8, ascending) and blocks per class
+#ifndef BLOCK_POOL_SIZES
+#define BLOCK_POOL_SIZES {64, 256, 1024, 4096}
+#endif
+#ifndef BLOCK_POOL_COUNTS
+#define BLOCK_POOL_COUNTS {16, 8, 4, 2}
+#endif
+#define BLOCK_POOL_NONE -1
+
+struct BlockClass
+{
+	uint32_t size;
+	uint16_t count;
+	uint16_t inUse;
+	uint16_t highWater;
+	uint8_t *base;
+	void *free; // singly linked through the first word of each free block
+	uint8_t *used; // one bit per block, set while it is handed out
+};
+
+// Fixed-size blocks in size classes carved from one allocation. allocate() takes the smallest class
+// that fits and falls back to the heap when it is empty or the size is too large; release() tells the
+// two apart by address, and refuses addresses inside the arena that are not a handed-out block.
+// Not thread-safe: use a pool from the task that owns its Messages.
+class BlockPool
+{
+private:
+	BlockClass mClasses[BLOCK_POOL_MAX_CLASSES];
+	uint8_t mClassCount;
+	uint8_t *mArena;
+	uint32_t mArenaSize;
+	bool mPsram;
+	uint32_t mFallbacks;
+	uint32_t mFallbackBytes;
+
+	int8_t findClass(const void *block);
+	// block number within class index, or -1 when block is not at a block start
+	int32_t findBlock(uint8_t index, const void *block);
+
+public:
+	BlockPool();
+	~BlockPool();
+
+	bool begin();
+	bool begin(bool psram);
+	bool begin(const uint32_t *sizes, const uint16_t *counts, uint8_t classes, bool psram);
+
+	// zero = false leaves the contents undefined, for callers that overwrite the whole block
+	void *allocate(uint32_t size, bool zero);
+	// false for an arena address that is not the start of a block, or a block already released
+	bool release(void *block);
+	bool owns(const void *block);
+	// usable bytes of a block from allocate(); 0 for heap fallbacks
+	uint32_t capacity(const void *block);
+
+	uint8_t getClassCount();
+	uint32_t getClassSize(uint8_t index);
+	uint16_t getBlockCount(uint8_t index);
+	uint16_t getInUse(uint8_t index);
+	uint16_t getHighWater(uint8_t index);
+	uint32_t getFallbacks();
+	uint32_t getFallbackBytes();
+	uint32_t getArenaSize();
+};
+
+#endif
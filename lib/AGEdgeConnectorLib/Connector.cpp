@@ -12,8 +12,53 @@ Connector::Connector()
 
 	this->mPsramEnabled = false;
 	this->mLastMillis = 0;
+	this->mPublishQos = 0;
+	this->mTimestampOptions = CONNECTOR_TIMESTAMP_TEXT;
+	this->mInflightWindow = CONNECTOR_INFLIGHT_WINDOW;
+	this->mInflightStoreSize = 0;
+	this->mCleanSession = true;
+	this->mCoalesceBytes = 0;
+	this->mCoalesceDelay = 0;
+	this->mCoalesceOnLoop = true;
+	this->mSubscriptionCount = 0;
+	this->mSubscriptionViewCount = 0;
+	this->mSubscriptionViewBusy = false;
+	memset(this->mSubacks, 0, sizeof(this->mSubacks));
+	this->mSubackNext = 0;
+	this->mHandlers = NULL;
+	this->mDispatching = 0;
+	this->mUnbindPending = false;
+	this->mConnectAttempt = false;
+	this->mOnline = false;
+	this->mSavedEndpoint = ENDPOINT_NONE;
+	this->mConnectStartedAt = 0;
+	this->mMetricsInterval = 0;
+	this->mMetricsAt = 0;
+	this->mSessionCount = 0;
+	this->mPublishRoute = CONNECTOR_SESSION_PRIMARY;
+	this->mDispatchSession = 0;
+	this->mArena = NULL;
+	this->mTaskRunning = false;
+	this->mTaskStop = false;
+	this->mConnectedSessions = 0;
+	this->mInflightView = 0;
+	this->mAckLatencyView = 0;
+	for (uint8_t i = 0; i < CONNECTOR_MAX_SESSIONS; i++)
+	{
+		this->mLateEvents[i] = CONNECTOR_SLOT_NONE;
+	}
+	this->mTaskSlots = CONNECTOR_TASK_SLOTS;
+	this->mTaskSlotSize = CONNECTOR_TASK_SLOT_SIZE;
+#ifdef ESP32
+	this->mTask = NULL;
+#endif
 	this->mEthernetClient = NULL;
 	this->mWiFiClient = NULL;
+#if TLS_CLIENT_ENABLED
+	this->mTlsClient = NULL;
+	this->mTlsEnabled = false;
+	this->mTlsCaCert = NULL;
+#endif
 	this->mMqttClient = NULL;
 	this->mHttpClient = new HTTPClient();
 
@@ -21,6 +66,13 @@ Connector::Connector()
 	this->onDisconnect = NULL;
 	this->onMessage = NULL;
 	this->onUnknownMessage = NULL;
+	this->onChunkBegin = NULL;
+	this->onChunkData = NULL;
+	this->onChunkEnd = NULL;
+	this->onSession = NULL;
+	this->mChunkTopic[0] = '\0';
+	this->mChunkOffset = 0;
+	this->mChunkAnnounced = false;
 
 	this->mConnection.host[0] = '\0';
 	this->mConnection.defaultHost[0] = '\0';
@@ -38,16 +90,29 @@ Connector::Connector()
 
 Connector::~Connector()
 {
+	this->endTask();
 	if (this->mEthernetClient)
 		delete this->mEthernetClient;
+#if TLS_CLIENT_ENABLED
+	if (this->mTlsClient)
+		delete this->mTlsClient;
+#endif
 	if (this->mWiFiClient)
 		delete this->mWiFiClient;
 	if (this->mMqttClient)
 		delete this->mMqttClient;
 	if (this->mHttpClient)
 		delete this->mHttpClient;
-	if (this->mMqttBuffer)
-		free(this->mMqttBuffer);
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		if (this->mSessions[i].mqtt)
+			delete this->mSessions[i].mqtt;
+		if (this->mSessions[i].client)
+			delete this->mSessions[i].client;
+	}
+	// the MQTT clients only borrow their buffers
+	free(this->mArena);
+	delete[] this->mHandlers;
 }
 
 void Connector::enablePsram()
@@ -57,6 +122,22 @@ void Connector::enablePsram()
 	this->mSubscribeMessage.enablePsram();
 }
 
+void Connector::setMessagePool(BlockPool *pool)
+{
+	this->mPublishMessage.setPool(pool);
+	this->mSubscribeMessage.setPool(pool);
+}
+
+void Connector::setTimestampOptions(uint8_t options)
+{
+	this->mTimestampOptions = options;
+}
+
+Timestamp *Connector::getTimestamp()
+{
+	return &this->mTimestamp;
+}
+
 const char *Connector::getName()
 {
 	return this->mDescriptor.name;
@@ -163,16 +244,106 @@ void Connector::setConnection(const char *host, uint16_t port)
 {
 	snprintf(this->mConnection.host, CONNECTOR_HOST_SIZE, host);
 	this->mConnection.port = port;
+	this->mEndpoints.setFirst(host, port);
 }
 
 void Connector::setConnection(const char *host, uint16_t port, const char *username, const char *password)
 {
 	snprintf(this->mConnection.host, CONNECTOR_HOST_SIZE, host);
 	this->mConnection.port = port;
+	this->mEndpoints.setFirst(host, port);
 	snprintf(this->mConnection.username, CONNECTOR_HOST_SIZE, username);
 	snprintf(this->mConnection.password, CONNECTOR_HOST_SIZE, password);
 }
 
+#if TLS_CLIENT_ENABLED
+void Connector::setTls(const char *caCert)
+{
+	this->mTlsEnabled = true;
+	this->mTlsCaCert = caCert;
+}
+
+bool Connector::isTlsResumed()
+{
+	return (this->mTlsClient == NULL) ? false : this->mTlsClient->isResumed();
+}
+
+unsigned long Connector::getTlsHandshakeTime()
+{
+	return (this->mTlsClient == NULL) ? 0 : this->mTlsClient->getHandshakeTime();
+}
+#endif
+
+Client *Connector::transport(Client *client)
+{
+#if TLS_CLIENT_ENABLED
+	if (this->mTlsEnabled)
+	{
+		this->mTlsClient = new TlsClient(*client);
+		if (this->mTlsCaCert != NULL)
+		{
+			this->mTlsClient->setCACert(this->mTlsCaCert);
+		}
+		else
+		{
+			this->mTlsClient->setInsecure();
+		}
+		return this->mTlsClient;
+	}
+#endif
+	return client;
+}
+
+bool Connector::addConnection(const char *host, uint16_t port)
+{
+	return this->mEndpoints.add(host, port);
+}
+
+void Connector::setDnsTtl(unsigned long ttl)
+{
+	this->mEndpoints.setDnsTtl(ttl);
+}
+
+const char *Connector::getEndpoint()
+{
+	int8_t current = this->mEndpoints.current();
+	return (current == ENDPOINT_NONE) ? this->mConnection.defaultHost : this->mEndpoints.get(current)->host;
+}
+
+// The last endpoint that accepted us is kept in NVS and tried first after a reboot.
+void Connector::loadLastEndpoint()
+{
+	char host[ENDPOINT_HOST_SIZE];
+	Preferences preferences;
+	if (!preferences.begin(CONNECTOR_PREFERENCES, true))
+	{
+		return;
+	}
+	if (preferences.getString("host", host, ENDPOINT_HOST_SIZE) > 0)
+	{
+		this->mEndpoints.prefer(host, preferences.getUShort("port", CONNECTOR_PORT));
+	}
+	preferences.end();
+}
+
+void Connector::saveLastEndpoint()
+{
+	int8_t current = this->mEndpoints.current();
+	if (current == ENDPOINT_NONE || current == this->mSavedEndpoint)
+	{
+		return;
+	}
+	Endpoint *endpoint = this->mEndpoints.get(current);
+	Preferences preferences;
+	if (preferences.begin(CONNECTOR_PREFERENCES, false))
+	{
+		preferences.putString("host", endpoint->host);
+		preferences.putUShort("port", endpoint->port);
+		preferences.end();
+		this->mSavedEndpoint = current;
+	}
+}
+
 bool Connector::waitForEthernetAvailable(uint8_t seconds)
 {
 	uint32_t t = 0;
@@ -224,231 +395,1381 @@ bool Connector::subscribe(const char *topic)
 
 bool Connector::subscribe(const char *topic, uint8_t qos)
 {
-	if (this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
-	{
-		return this->mMqttClient->subscribe(topic, qos);
-	}
-	return false;
+	return this->subscribe(&topic, &qos, 1);
 }
 
-bool Connector::unsubscribe(const char *topic)
+bool Connector::subscribe(const char **topics, const uint8_t *qos, uint8_t count)
 {
-	if (this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
+	if (count == 0)
 	{
-		return this->mMqttClient->unsubscribe(topic);
+		return true;
 	}
-	return false;
-}
-
-bool Connector::publish(const char *topic, Message *msg, bool retain)
-{
-	if (this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
+	if (count > CONNECTOR_MAX_SUBSCRIPTIONS)
 	{
-		uint32_t size = msg->toPayload(this->mMqttBuffer, sizeof(this->mMqttBuffer));
-		return this->mMqttClient->publish(topic, this->mMqttBuffer, size, retain);
+		return false;
 	}
-	return false;
-}
-
-bool Connector::publish(const char *topic, const char *dataType, const char *format, ...)
-{
-	if (this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (strlen(topics[i]) >= CONNECTOR_TOPIC_SIZE)
+		{
+			return false;
+		}
+	}
+	if (this->deferred())
 	{
-		this->mPublishMessage.reset();
-		this->mPublishMessage.version = MESSAGE_VERSION;
-		this->mPublishMessage.type = MESSAGE_TYPE_VALUE;
-		this->mPublishMessage.setLastModified();
-		this->mPublishMessage.setDataType(dataType);
+		// one slot, so the engine sends the batch as one SUBSCRIBE: a qos byte and the filter with its NUL per entry
+		MqttSegment segments[2 * CONNECTOR_MAX_SUBSCRIPTIONS];
+		for (uint8_t i = 0; i < count; i++)
+		{
+			segments[2 * i].data = &qos[i];
+			segments[2 * i].length = 1;
+			segments[2 * i + 1].data = (const uint8_t *)topics[i];
+			segments[2 * i + 1].length = strlen(topics[i]) + 1;
+		}
+		return this->post(CONNECTOR_SLOT_SUBSCRIBE, CONNECTOR_SESSION_PRIMARY, "", segments, 2 * count, false, 0);
+	}
 
-		va_list va;
-		va_start(va, format);
-		vsnprintf(this->mMessageBuffer, MESSAGE_BUFFER_SIZE, format, va);
-		va_end(va);
+	// make room for every new filter before marking anything pending
+	uint8_t added = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (this->findSubscription(topics[i]) >= 0)
+		{
+			continue;
+		}
+		uint8_t j = 0;
+		while (j < i && strcmp(topics[j], topics[i]) != 0)
+		{
+			j++;
+		}
+		if (j == i)
+		{
+			added++;
+		}
+	}
+	if (this->mSubscriptionCount + added > CONNECTOR_MAX_SUBSCRIPTIONS)
+	{
+		return false;
+	}
 
-		uint32_t length = strlen(this->mMessageBuffer);
-		this->mPublishMessage.setData((uint8_t *)this->mMessageBuffer, length);
+	uint8_t pending[CONNECTOR_MAX_SUBSCRIPTIONS];
+	uint8_t pendingCount = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		int index = this->findSubscription(topics[i]);
+		if (index >= 0)
+		{
+			if ((this->mSubscriptions[index].sessions & CONNECTOR_SESSION_PRIMARY) && this->mSubscriptions[index].qos[0] == qos[i] && this->mSubscriptions[index].granted != CONNECTOR_SUBSCRIPTION_FAILURE)
+			{
+				// already requested on this session
+				continue;
+			}
+		}
+		else
+		{
+			index = this->mSubscriptionCount++;
+			strncpy(this->mSubscriptions[index].topic, topics[i], CONNECTOR_TOPIC_SIZE);
+			this->mSubscriptions[index].sessions = 0;
+		}
+		this->mSubscriptions[index].sessions |= CONNECTOR_SESSION_PRIMARY;
+		this->mSubscriptions[index].qos[0] = qos[i];
+		this->mSubscriptions[index].granted = CONNECTOR_SUBSCRIPTION_PENDING;
+		this->mSubscriptions[index].msgId = 0;
+		// a filter repeated with another qos goes out once, with the last qos
+		uint8_t n = 0;
+		while (n < pendingCount && pending[n] != index)
+		{
+			n++;
+		}
+		if (n == pendingCount)
+		{
+			pending[pendingCount++] = index;
+		}
+	}
 
-		uint32_t size = this->mPublishMessage.toPayload(this->mMqttBuffer, sizeof(this->mMqttBuffer));
-		return this->mMqttClient->publish(topic, this->mMqttBuffer, size, false);
+	if (pendingCount > 0 && this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
+	{
+		return this->sendSubscriptions(pending, pendingCount);
 	}
-	return false;
+	return true;
 }
 
-bool Connector::publish(const char *topic, const char *dataType, uint8_t *data, uint32_t dataSize)
+bool Connector::unsubscribe(const char *topic)
 {
-	if (this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
-	{
-		this->mPublishMessage.reset();
-		this->mPublishMessage.version = MESSAGE_VERSION;
-		this->mPublishMessage.type = MESSAGE_TYPE_VALUE;
-		this->mPublishMessage.setLastModified();
-		this->mPublishMessage.setDataType(dataType);
-		this->mPublishMessage.setData(data, dataSize);
-
-		uint32_t size = this->mPublishMessage.toPayload(this->mMqttBuffer, sizeof(this->mMqttBuffer));
-		return this->mMqttClient->publish(topic, this->mMqttBuffer, size, false);
-	}
-	return false;
+	return this->unsubscribe(&topic, 1);
 }
 
-bool Connector::publishJSON(const char *topic, const char *format, ...)
+bool Connector::unsubscribe(const char **topics, uint8_t count)
 {
+	if (this->deferred())
+	{
+		for (uint8_t i = 0; i < count; i++)
+		{
+			if (!this->post(CONNECTOR_SLOT_UNSUBSCRIBE, CONNECTOR_SESSION_PRIMARY, topics[i], NULL, 0, false, 0))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		int index = this->findSubscription(topics[i]);
+		if (index >= 0)
+		{
+			this->releaseSubscription(index, CONNECTOR_SESSION_PRIMARY);
+		}
+	}
 	if (this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
 	{
-		this->mPublishMessage.reset();
-		this->mPublishMessage.version = MESSAGE_VERSION;
-		this->mPublishMessage.type = MESSAGE_TYPE_VALUE;
-		this->mPublishMessage.setLastModified();
-		this->mPublishMessage.setDataType("application/json");
-
-		va_list va;
-		va_start(va, format);
-		vsnprintf(this->mMessageBuffer, MESSAGE_BUFFER_SIZE, format, va);
-		va_end(va);
-
-		uint32_t length = strlen(this->mMessageBuffer);
-		this->mPublishMessage.setData((uint8_t *)this->mMessageBuffer, length);
-
-		uint32_t size = this->mPublishMessage.toPayload(this->mMqttBuffer, sizeof(this->mMqttBuffer));
-		return this->mMqttClient->publish(topic, this->mMqttBuffer, size, false);
+		return this->mMqttClient->unsubscribe(topics, count);
 	}
-	return false;
+	// clean sessions start empty, so dropping the entries is enough
+	return true;
 }
 
-void Connector::close()
+uint8_t Connector::getSubscriptionCount()
 {
-	if (this->mMqttClient != NULL)
+	if (this->deferred())
 	{
-		this->mMqttClient->disconnect();
+		this->lockView();
+		uint8_t count = this->mSubscriptionViewCount;
+		this->mSubscriptionViewBusy = false;
+		return count;
 	}
+	return this->mSubscriptionCount;
 }
 
-void Connector::dispatchMessage(char *topic, uint8_t *payload, unsigned int size)
+uint8_t Connector::getGrantedQos(const char *topic)
 {
-	if (this->mSubscribeMessage.fromPayload(payload, size))
+	if (this->deferred())
 	{
-		if (this->onMessage != NULL)
+		uint8_t granted = CONNECTOR_SUBSCRIPTION_FAILURE;
+		this->lockView();
+		for (uint8_t i = 0; i < this->mSubscriptionViewCount; i++)
 		{
-			this->onMessage(this, topic, &this->mSubscribeMessage);
+			if (strcmp(this->mSubscriptionView[i].topic, topic) == 0)
+			{
+				granted = this->mSubscriptionView[i].granted;
+				break;
+			}
 		}
+		this->mSubscriptionViewBusy = false;
+		return granted;
 	}
-	else
+	int index = this->findSubscription(topic);
+	if (index < 0 || !(this->mSubscriptions[index].sessions & CONNECTOR_SESSION_PRIMARY))
 	{
-		if (this->onUnknownMessage != NULL)
-		{
-			this->onUnknownMessage(this, topic, &this->mSubscribeMessage);
-		}
+		return CONNECTOR_SUBSCRIPTION_FAILURE;
 	}
+	return this->mSubscriptions[index].granted;
 }
 
-void Connector::setOnConnectCallback(CONNECTOR_CALLBACK_CONNECT)
+int16_t Connector::subscribe(const char *topic, uint8_t qos, CONNECTOR_CALLBACK_HANDLER)
 {
-	this->onConnect = onConnect;
+	int16_t handle = this->bind(topic, handler);
+	if (handle != TOPIC_TREE_NONE && !this->subscribe(topic, qos))
+	{
+		this->unbind(handle);
+		return TOPIC_TREE_NONE;
+	}
+	return handle;
 }
 
-void Connector::setOnDisconnectCallback(CONNECTOR_CALLBACK_DISCONNECT)
+bool Connector::unsubscribe(int16_t handle)
 {
-	this->onDisconnect = onDisconnect;
+	char filter[CONNECTOR_TOPIC_SIZE];
+	if (!this->mTopicTree.isLinked(handle) || !this->mTopicTree.getFilter(handle, filter, sizeof(filter)))
+	{
+		return false;
+	}
+	this->unbind(handle);
+	if (this->mTopicTree.contains(filter))
+	{
+		// still routed to another handler
+		return true;
+	}
+	return this->unsubscribe(filter);
 }
 
-void Connector::setOnMessageCallback(CONNECTOR_CALLBACK_MESSAGE)
+int16_t Connector::bind(const char *filter, CONNECTOR_CALLBACK_HANDLER)
 {
-	this->onMessage = onMessage;
+	if (handler == NULL)
+	{
+		return TOPIC_TREE_NONE;
+	}
+	if (this->mHandlers == NULL)
+	{
+		if (!this->mTopicTree.begin(CONNECTOR_TOPIC_NODES, CONNECTOR_MAX_HANDLERS, CONNECTOR_TOPIC_LABEL_SIZE))
+		{
+			return TOPIC_TREE_NONE;
+		}
+		this->mHandlers = new std::function<void(Connector *, const char *, Message *)>[CONNECTOR_MAX_HANDLERS];
+	}
+	int16_t handle = this->mTopicTree.add(filter);
+	if (handle != TOPIC_TREE_NONE)
+	{
+		this->mHandlers[handle] = handler;
+	}
+	return handle;
 }
 
-void Connector::setOnUnknownMessageCallback(CONNECTOR_CALLBACK_UNKNOWN_MESSAGE)
+void Connector::unbind(int16_t handle)
 {
-	this->onUnknownMessage = onUnknownMessage;
+	if (!this->mTopicTree.isLinked(handle))
+	{
+		return;
+	}
+	this->mTopicTree.detach(handle);
+	if (this->mDispatching > 0)
+	{
+		// the handler may be the one running: keep it until dispatch returns
+		this->mUnbindPending = true;
+		return;
+	}
+	this->mHandlers[handle] = NULL;
+	this->mTopicTree.release(handle);
 }
 
-bool Connector::begin()
+void Connector::releaseUnbound()
 {
-
-	this->mNetwork.status = CONNECTOR_STATUS_NO_NETWORK;
-
-	if (this->mNetwork.type == CONNECTOR_TYPE_ETHERNET)
+	this->mUnbindPending = false;
+	for (int16_t i = 0; i < CONNECTOR_MAX_HANDLERS; i++)
 	{
-		if (this->waitForEthernetAvailable(CONNECTOR_TIMEOUT))
+		if (this->mHandlers[i] != NULL && !this->mTopicTree.isLinked(i))
 		{
-			this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+			this->mHandlers[i] = NULL;
+			this->mTopicTree.release(i);
 		}
-		this->mEthernetClient = new EthernetClient();
-		this->mMqttClient = new MqttClient(*this->mEthernetClient);
 	}
-	else if (this->mNetwork.type == CONNECTOR_TYPE_WIFI)
+}
+
+int Connector::findSubscription(const char *topic)
+{
+	for (uint8_t i = 0; i < this->mSubscriptionCount; i++)
 	{
-		WiFi.mode(WIFI_STA);
-		WiFi.setAutoReconnect(false);
-		WiFi.begin(this->mNetwork.ssid, this->mNetwork.password);
-		if (this->waitForWiFiAvailable(CONNECTOR_TIMEOUT))
+		if (strcmp(this->mSubscriptions[i].topic, topic) == 0)
 		{
-			this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+			return i;
 		}
-		this->mWiFiClient = new WiFiClient();
-		this->mMqttClient = new MqttClient(*this->mWiFiClient);
-	}
-	else
-	{
-		return true;
 	}
+	return -1;
+}
 
-	if (this->mPsramEnabled)
+// Swap-removes an entry; SUBSCRIBE batches awaiting their SUBACK follow the moved entry.
+void Connector::removeSubscription(uint8_t index)
+{
+	uint8_t last = --this->mSubscriptionCount;
+	Subscription *to = &this->mSubscriptions[index];
+	Subscription *from = &this->mSubscriptions[last];
+	memcpy(to->topic, from->topic, CONNECTOR_TOPIC_SIZE);
+	memcpy(to->qos, from->qos, CONNECTOR_MAX_SESSIONS);
+	to->granted = from->granted.load();
+	to->msgId = from->msgId;
+	to->sessions = from->sessions;
+	for (uint8_t i = 0; i < CONNECTOR_MAX_SUBACKS; i++)
 	{
-		if (psramInit())
+		SubscribeBatch *batch = &this->mSubacks[i];
+		for (uint8_t n = 0; batch->msgId != 0 && n < batch->count; n++)
 		{
-			this->mMqttClient->setBufferSize(CONNECTOR_MQTT_PSRAM_BUFFER_SIZE, true);
-			this->mMqttBuffer = (uint8_t *)ps_malloc(CONNECTOR_MQTT_PSRAM_BUFFER_SIZE);
+			if (batch->indexes[n] == index)
+			{
+				batch->indexes[n] = CONNECTOR_SUBACK_NONE;
+			}
+			else if (batch->indexes[n] == last)
+			{
+				batch->indexes[n] = index;
+			}
 		}
-		else
+	}
+}
+
+// Drops the sessions from the entry; a SUBACK still due for the primary no longer maps to it.
+void Connector::releaseSubscription(uint8_t index, uint8_t sessions)
+{
+	Subscription *subscription = &this->mSubscriptions[index];
+	if (sessions & subscription->sessions & CONNECTOR_SESSION_PRIMARY)
+	{
+		subscription->granted = CONNECTOR_SUBSCRIPTION_FAILURE;
+		subscription->msgId = 0;
+		for (uint8_t i = 0; i < CONNECTOR_MAX_SUBACKS; i++)
 		{
-			this->mMqttClient->setBufferSize(CONNECTOR_MQTT_BUFFER_SIZE);
-			this->mMqttBuffer = (uint8_t *)malloc(CONNECTOR_MQTT_BUFFER_SIZE);
+			SubscribeBatch *batch = &this->mSubacks[i];
+			for (uint8_t n = 0; batch->msgId != 0 && n < batch->count; n++)
+			{
+				if (batch->indexes[n] == index)
+				{
+					batch->indexes[n] = CONNECTOR_SUBACK_NONE;
+				}
+			}
 		}
 	}
-	else
+	subscription->sessions &= ~sessions;
+	if (subscription->sessions == 0)
 	{
-		this->mMqttClient->setBufferSize(CONNECTOR_MQTT_BUFFER_SIZE);
-		this->mMqttBuffer = (uint8_t *)malloc(CONNECTOR_MQTT_BUFFER_SIZE);
+		this->removeSubscription(index);
 	}
+}
 
-	MQTT_CALLBACK_SIGNATURE = [=](char *topic, uint8_t *payload, unsigned int length)
+bool Connector::sendSubscriptions(uint8_t *indexes, uint8_t count)
+{
+	const char *topics[CONNECTOR_MAX_SUBSCRIPTIONS];
+	uint8_t qos[CONNECTOR_MAX_SUBSCRIPTIONS] = {0};
+	uint16_t msgId = 0;
+	for (uint8_t i = 0; i < count; i++)
 	{
-		this->dispatchMessage(topic, payload, length);
-	};
-	this->mMqttClient->setCallback(callback);
+		topics[i] = this->mSubscriptions[indexes[i]].topic;
+		qos[i] = this->mSubscriptions[indexes[i]].qos[0];
+	}
+	if (!this->mMqttClient->subscribe(topics, qos, count, &msgId))
+	{
+		return false;
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		this->mSubscriptions[indexes[i]].msgId = msgId;
+		this->mSubscriptions[indexes[i]].granted = CONNECTOR_SUBSCRIPTION_PENDING;
+	}
+	// the oldest batch is overwritten when the broker is slow to answer; its entries stay pending
+	SubscribeBatch *batch = &this->mSubacks[this->mSubackNext];
+	this->mSubackNext = (this->mSubackNext + 1) % CONNECTOR_MAX_SUBACKS;
+	batch->msgId = msgId;
+	batch->count = count;
+	memcpy(batch->indexes, indexes, count);
 	return true;
 }
 
-bool Connector::loop()
+void Connector::restoreSubscriptions()
 {
-	return this->loop(0);
+	uint8_t indexes[CONNECTOR_MAX_SUBSCRIPTIONS];
+	uint8_t count = 0;
+	// packet ids restart with the connection
+	memset(this->mSubacks, 0, sizeof(this->mSubacks));
+	for (uint8_t i = 0; i < this->mSubscriptionCount; i++)
+	{
+		if (this->mSubscriptions[i].sessions & CONNECTOR_SESSION_PRIMARY)
+		{
+			indexes[count++] = i;
+		}
+	}
+	if (count > 0)
+	{
+		this->sendSubscriptions(indexes, count);
+	}
 }
 
-bool Connector::loop(unsigned long intervals)
+// SUBACK return codes follow the filter order of the SUBSCRIBE with the same id.
+void Connector::handleSuback(uint16_t msgId, uint8_t *codes, uint8_t count)
 {
-
-	if (this->mNetwork.type == CONNECTOR_TYPE_ETHERNET)
+	for (uint8_t i = 0; i < CONNECTOR_MAX_SUBACKS; i++)
 	{
-		if (Ethernet.linkStatus() == LinkON)
+		SubscribeBatch *batch = &this->mSubacks[i];
+		if (msgId == 0 || batch->msgId != msgId)
 		{
-			if (this->mNetwork.status == CONNECTOR_STATUS_NO_NETWORK)
-			{
-				this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
-			}
-			Ethernet.maintain();
+			continue;
 		}
-		else
+		for (uint8_t n = 0; n < batch->count && n < count; n++)
 		{
-			this->mNetwork.status = CONNECTOR_STATUS_NO_NETWORK;
-			if (this->waitForEthernetAvailable(CONNECTOR_TIMEOUT))
+			uint8_t index = batch->indexes[n];
+			if (index != CONNECTOR_SUBACK_NONE && this->mSubscriptions[index].msgId == msgId && this->mSubscriptions[index].granted == CONNECTOR_SUBSCRIPTION_PENDING)
 			{
-				this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+				this->mSubscriptions[index].granted = codes[n];
 			}
 		}
+		batch->msgId = 0;
+		return;
 	}
-	else if (this->mNetwork.type == CONNECTOR_TYPE_WIFI)
-	{
-		if (WiFi.status() == WL_CONNECTED)
+}
+
+bool Connector::publish(const char *topic, Message *msg, bool retain)
+{
+	if (this->routable(this->mPublishRoute))
+	{
+		return this->publishMessage(this->mPublishRoute, topic, msg, msg->getData(), msg->getSize(), retain, this->mPublishQos);
+	}
+	this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+	return false;
+}
+
+bool Connector::publish(const char *topic, Message *msg, bool retain, uint8_t qos)
+{
+	if (this->routable(this->mPublishRoute))
+	{
+		return this->publishMessage(this->mPublishRoute, topic, msg, msg->getData(), msg->getSize(), retain, qos);
+	}
+	this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+	return false;
+}
+
+bool Connector::publish(const char *topic, const char *dataType, const char *format, ...)
+{
+	if (this->routable(this->mPublishRoute))
+	{
+		this->preparePublish(dataType);
+
+		va_list va;
+		va_start(va, format);
+		vsnprintf(this->mMessageBuffer, MESSAGE_BUFFER_SIZE, format, va);
+		va_end(va);
+
+		uint32_t length = strlen(this->mMessageBuffer);
+		return this->publishMessage(this->mPublishRoute, topic, &this->mPublishMessage, (uint8_t *)this->mMessageBuffer, length, false, this->mPublishQos);
+	}
+	this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+	return false;
+}
+
+bool Connector::publish(const char *topic, const char *dataType, uint8_t *data, uint32_t dataSize)
+{
+	if (this->routable(this->mPublishRoute))
+	{
+		this->preparePublish(dataType);
+		return this->publishMessage(this->mPublishRoute, topic, &this->mPublishMessage, data, dataSize, false, this->mPublishQos);
+	}
+	this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+	return false;
+}
+
+bool Connector::publishJSON(const char *topic, const char *format, ...)
+{
+	if (this->routable(this->mPublishRoute))
+	{
+		this->preparePublish("application/json");
+
+		va_list va;
+		va_start(va, format);
+		vsnprintf(this->mMessageBuffer, MESSAGE_BUFFER_SIZE, format, va);
+		va_end(va);
+
+		uint32_t length = strlen(this->mMessageBuffer);
+		return this->publishMessage(this->mPublishRoute, topic, &this->mPublishMessage, (uint8_t *)this->mMessageBuffer, length, false, this->mPublishQos);
+	}
+	this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+	return false;
+}
+
+bool Connector::publishTo(uint8_t sessions, const char *topic, Message *msg, bool retain, uint8_t qos)
+{
+	if (this->routable(sessions))
+	{
+		return this->publishMessage(sessions, topic, msg, msg->getData(), msg->getSize(), retain, qos);
+	}
+	this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+	return false;
+}
+
+// The options go in with one capacity check and are indexed as they are appended.
+void Connector::preparePublish(const char *dataType)
+{
+	this->mPublishMessage.reset();
+	this->mPublishMessage.version = MESSAGE_VERSION;
+	this->mPublishMessage.type = MESSAGE_TYPE_VALUE;
+
+	const char *names[3];
+	const char *values[3];
+	uint8_t count = 0;
+	uint64_t now = this->mTimestamp.now();
+	char epoch[TIMESTAMP_EPOCH_SIZE];
+	if (this->mTimestampOptions & CONNECTOR_TIMESTAMP_TEXT)
+	{
+		uint32_t length;
+		names[count] = "last-modified";
+		values[count++] = this->mTimestamp.getText(now, &length);
+	}
+	if (this->mTimestampOptions & CONNECTOR_TIMESTAMP_MILLIS)
+	{
+		Timestamp::formatEpoch(now, epoch);
+		names[count] = "last-modified-ms";
+		values[count++] = epoch;
+	}
+	names[count] = "data-type";
+	values[count++] = dataType;
+	this->mPublishMessage.setOptions(names, values, count);
+}
+
+// Frame header, options, size and body go out as separate segments; the body is never staged.
+// The same segments are handed to every connected session of the route.
+bool Connector::publishMessage(uint8_t sessions, const char *topic, Message *msg, const uint8_t *body, uint32_t bodySize, bool retain, uint8_t qos)
+{
+	uint8_t header[MESSAGE_HEADER_SIZE];
+	uint8_t size[4];
+	MqttSegment segments[4];
+	uint8_t count = this->frameSegments(msg, bodySize, header, size, segments);
+
+	segments[count].data = body;
+	segments[count++].length = bodySize;
+	if (this->deferred())
+	{
+		return this->post(CONNECTOR_SLOT_PUBLISH, sessions, topic, segments, count, retain, qos);
+	}
+
+	MqttClient *clients[CONNECTOR_MAX_SESSIONS];
+	Metrics *metrics[CONNECTOR_MAX_SESSIONS];
+	uint8_t targets = this->routeClients(sessions, clients, metrics);
+	bool published = true;
+	for (uint8_t i = 0; i < targets; i++)
+	{
+		if (!clients[i]->publish(topic, segments, count, retain, qos))
+		{
+			metrics[i]->increment(METRICS_PUBLISH_FAILURES);
+			published = false;
+		}
+	}
+	return published;
+}
+
+// Connected clients of a session mask, primary first; clients and metrics may be NULL to only count them
+uint8_t Connector::routeClients(uint8_t sessions, MqttClient **clients, Metrics **metrics)
+{
+	uint8_t count = 0;
+	if ((sessions & CONNECTOR_SESSION_PRIMARY) && this->mMqttClient && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED)
+	{
+		if (clients != NULL)
+		{
+			clients[count] = this->mMqttClient;
+			metrics[count] = &this->mMetrics;
+		}
+		count++;
+	}
+	for (uint8_t i = 1; i <= this->mSessionCount; i++)
+	{
+		if ((sessions & (1 << i)) && this->isSessionConnected(i))
+		{
+			if (clients != NULL)
+			{
+				clients[count] = this->mSessions[i - 1].mqtt;
+				metrics[count] = &this->mSessions[i - 1].metrics;
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+// Everything of the frame that precedes the body
+uint8_t Connector::frameSegments(Message *msg, uint32_t bodySize, uint8_t *header, uint8_t *size, MqttSegment *segments)
+{
+	uint8_t count = 0;
+
+	segments[count].data = header;
+	segments[count++].length = msg->toHeader(header);
+	segments[count].data = (const uint8_t *)msg->getOptions();
+	segments[count++].length = msg->getOptionLength();
+	if (msg->type == MESSAGE_TYPE_VALUE)
+	{
+		msg->writeInt32(size, bodySize);
+		segments[count].data = size;
+		segments[count++].length = 4;
+	}
+	return count;
+}
+
+bool Connector::publishStream(const char *topic, const char *dataType, uint32_t dataSize, CONNECTOR_CALLBACK_SOURCE)
+{
+	// the body cannot be staged in a queue slot
+	MqttClient *clients[CONNECTOR_MAX_SESSIONS];
+	Metrics *metrics[CONNECTOR_MAX_SESSIONS];
+	uint8_t targets = this->deferred() ? 0 : this->routeClients(this->mPublishRoute, clients, metrics);
+	if (targets == 0)
+	{
+		this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+		return false;
+	}
+
+	this->preparePublish(dataType);
+
+	uint8_t header[MESSAGE_HEADER_SIZE];
+	uint8_t size[4];
+	MqttSegment segments[3];
+	uint8_t count = this->frameSegments(&this->mPublishMessage, dataSize, header, size, segments);
+	uint32_t length = dataSize;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		length += segments[i].length;
+	}
+
+	// sessions that refuse the header are left out of the body
+	uint8_t started = 0;
+	for (uint8_t t = 0; t < targets; t++)
+	{
+		if (!clients[t]->beginPublish(topic, length, false))
+		{
+			metrics[t]->increment(METRICS_PUBLISH_FAILURES);
+			continue;
+		}
+		for (uint8_t i = 0; i < count; i++)
+		{
+			clients[t]->write(segments[i].data, segments[i].length);
+		}
+		clients[started] = clients[t];
+		metrics[started++] = metrics[t];
+	}
+
+	// the source is read once per chunk and the chunk is copied to every session
+	uint32_t offset = 0;
+	while (started > 0 && offset < dataSize)
+	{
+		uint32_t chunk = dataSize - offset;
+		if (chunk > MESSAGE_BUFFER_SIZE)
+		{
+			chunk = MESSAGE_BUFFER_SIZE;
+		}
+		chunk = source(this, (uint8_t *)this->mMessageBuffer, chunk);
+		if (chunk == 0)
+		{
+			break;
+		}
+		for (uint8_t t = 0; t < started; t++)
+		{
+			clients[t]->write((uint8_t *)this->mMessageBuffer, chunk);
+		}
+		offset += chunk;
+		yield();
+	}
+	// a short body makes endPublish drop the connection
+	bool published = (started == targets);
+	for (uint8_t t = 0; t < started; t++)
+	{
+		if (clients[t]->endPublish() != 1)
+		{
+			metrics[t]->increment(METRICS_PUBLISH_FAILURES);
+			published = false;
+		}
+	}
+	return published;
+}
+
+bool Connector::publishStream(const char *topic, const char *dataType, Stream &stream, uint32_t dataSize)
+{
+	return this->publishStream(topic, dataType, dataSize, [&stream](Connector * /* connector */, uint8_t *buffer, uint32_t size) -> uint32_t
+														 { return stream.readBytes(buffer, size); });
+}
+
+void Connector::setPublishQos(uint8_t qos)
+{
+	this->mPublishQos = qos;
+}
+
+void Connector::setCleanSession(bool cleanSession)
+{
+	this->mCleanSession = cleanSession;
+}
+
+void Connector::setInflightWindow(uint8_t window, uint32_t storeSize)
+{
+	this->mInflightWindow = window;
+	this->mInflightStoreSize = storeSize;
+	if (this->mMqttClient != NULL)
+	{
+		this->mMqttClient->setInflightWindow(window, storeSize);
+	}
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		if (this->mSessions[i].mqtt != NULL)
+		{
+			this->mSessions[i].mqtt->setInflightWindow(window, storeSize);
+		}
+	}
+}
+
+uint8_t Connector::getInflightCount()
+{
+	if (this->deferred())
+	{
+		return this->mInflightView;
+	}
+	return (this->mMqttClient == NULL) ? 0 : this->mMqttClient->getInflightCount();
+}
+
+unsigned long Connector::getAckLatency()
+{
+	if (this->deferred())
+	{
+		return this->mAckLatencyView;
+	}
+	return (this->mMqttClient == NULL) ? 0 : this->mMqttClient->getAckLatency();
+}
+
+void Connector::setWriteCoalescing(uint32_t maxBytes, uint16_t maxDelay, bool flushOnLoop)
+{
+	this->mCoalesceBytes = maxBytes;
+	this->mCoalesceDelay = maxDelay;
+	this->mCoalesceOnLoop = flushOnLoop;
+	if (this->mMqttClient != NULL)
+	{
+		this->mMqttClient->setWriteCoalescing(maxBytes, maxDelay, flushOnLoop);
+	}
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		if (this->mSessions[i].mqtt != NULL)
+		{
+			this->mSessions[i].mqtt->setWriteCoalescing(maxBytes, maxDelay, flushOnLoop);
+		}
+	}
+}
+
+void Connector::flush()
+{
+	if (this->deferred())
+	{
+		this->post(CONNECTOR_SLOT_FLUSH, CONNECTOR_SESSIONS_ALL, "", NULL, 0, false, 0);
+		return;
+	}
+	if (this->mMqttClient != NULL)
+	{
+		this->mMqttClient->flush();
+	}
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		if (this->mSessions[i].mqtt != NULL)
+		{
+			this->mSessions[i].mqtt->flush();
+		}
+	}
+}
+
+void Connector::close()
+{
+	if (this->deferred())
+	{
+		this->post(CONNECTOR_SLOT_CLOSE, CONNECTOR_SESSIONS_ALL, "", NULL, 0, false, 0);
+		return;
+	}
+	if (this->mMqttClient != NULL)
+	{
+		this->mMqttClient->disconnect();
+	}
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		if (this->mSessions[i].mqtt != NULL)
+		{
+			this->mSessions[i].mqtt->disconnect();
+		}
+	}
+}
+
+void Connector::dispatchMessage(char *topic, uint8_t *payload, unsigned int size)
+{
+	unsigned long started = micros();
+	if (this->mSubscribeMessage.fromPayload(payload, size))
+	{
+		int16_t handles[CONNECTOR_MAX_DISPATCH];
+		uint8_t count = this->mTopicTree.match(topic, handles, CONNECTOR_MAX_DISPATCH);
+		if (count > CONNECTOR_MAX_DISPATCH)
+		{
+			this->getMetrics(this->mDispatchSession)->increment(METRICS_DISPATCH_TRUNCATED, count - CONNECTOR_MAX_DISPATCH);
+		}
+		this->mDispatching++;
+		for (uint8_t i = 0; i < count && i < CONNECTOR_MAX_DISPATCH; i++)
+		{
+			// an earlier handler may have unbound this one
+			if (this->mTopicTree.isLinked(handles[i]) && this->mHandlers[handles[i]] != NULL)
+			{
+				this->mHandlers[handles[i]](this, topic, &this->mSubscribeMessage);
+			}
+		}
+		this->mDispatching--;
+		if (this->mDispatching == 0 && this->mUnbindPending)
+		{
+			this->releaseUnbound();
+		}
+		if (count == 0 && this->onMessage != NULL)
+		{
+			this->onMessage(this, topic, &this->mSubscribeMessage);
+		}
+	}
+	else
+	{
+		if (this->onUnknownMessage != NULL)
+		{
+			this->onUnknownMessage(this, topic, &this->mSubscribeMessage);
+		}
+	}
+	this->getMetrics(this->mDispatchSession)->record(METRICS_CALLBACK_TIME, micros() - started);
+}
+
+void Connector::announceChunk()
+{
+	if (!this->mChunkAnnounced)
+	{
+		this->mChunkAnnounced = true;
+		if (this->onChunkBegin != NULL)
+		{
+			this->onChunkBegin(this, this->mChunkTopic, &this->mSubscribeMessage);
+		}
+	}
+}
+
+// Strips the Message frame from each chunk and forwards only body bytes.
+void Connector::dispatchChunk(const uint8_t *chunk, uint32_t length)
+{
+	while (length > 0)
+	{
+		const uint8_t *body;
+		uint32_t bodyLength;
+		uint32_t consumed = this->mSubscribeMessage.decode(chunk, length, &body, &bodyLength);
+		if (bodyLength > 0)
+		{
+			this->announceChunk();
+			if (this->onChunkData != NULL)
+			{
+				this->onChunkData(this, this->mChunkOffset, body, bodyLength);
+			}
+			this->mChunkOffset += bodyLength;
+		}
+		chunk += consumed;
+		length -= consumed;
+	}
+}
+
+void Connector::setOnChunkCallbacks(CONNECTOR_CALLBACK_CHUNK_BEGIN, CONNECTOR_CALLBACK_CHUNK_DATA, CONNECTOR_CALLBACK_CHUNK_END)
+{
+	this->onChunkBegin = onChunkBegin;
+	this->onChunkData = onChunkData;
+	this->onChunkEnd = onChunkEnd;
+}
+
+void Connector::setOnConnectCallback(CONNECTOR_CALLBACK_CONNECT)
+{
+	this->onConnect = onConnect;
+}
+
+void Connector::setOnDisconnectCallback(CONNECTOR_CALLBACK_DISCONNECT)
+{
+	this->onDisconnect = onDisconnect;
+}
+
+void Connector::setOnMessageCallback(CONNECTOR_CALLBACK_MESSAGE)
+{
+	this->onMessage = onMessage;
+}
+
+void Connector::setOnUnknownMessageCallback(CONNECTOR_CALLBACK_UNKNOWN_MESSAGE)
+{
+	this->onUnknownMessage = onUnknownMessage;
+}
+
+void Connector::updateClientId()
+{
+	if (strlen(this->mConnection.clientId) == 0)
+	{
+		// Use Descriptors
+		snprintf(this->mConnection.clientGroup, CONNECTOR_CLIENT_GROUP_SIZE, "device/%s", this->mDescriptor.name);
+		snprintf(this->mConnection.clientId, CONNECTOR_CLIENT_ID_SIZE, "device/%s/%s", this->mDescriptor.name, this->mDescriptor.sn);
+		strncpy(this->mConnection.username, this->mDescriptor.model, CONNECTOR_MODEL_SIZE);
+		strncpy(this->mConnection.password, this->mDescriptor.accessCode, CONNECTOR_ACCESS_CODE_SIZE);
+	}
+}
+
+bool Connector::begin()
+{
+#ifdef ESP32
+	// cached last-modified text is formatted again once SNTP sets the clock
+	sntp_set_time_sync_notification_cb(Timestamp::clockSet);
+#endif
+	this->updateClientId();
+	this->loadLastEndpoint();
+	this->mSavedEndpoint = this->mEndpoints.current();
+
+	this->mNetwork.status = CONNECTOR_STATUS_NO_NETWORK;
+
+	if (this->mNetwork.type == CONNECTOR_TYPE_ETHERNET)
+	{
+		if (this->waitForEthernetAvailable(CONNECTOR_TIMEOUT))
+		{
+			this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+		}
+		this->mEthernetClient = new EthernetClient();
+		this->mMqttClient = new MqttClient(*this->transport(this->mEthernetClient));
+	}
+	else if (this->mNetwork.type == CONNECTOR_TYPE_WIFI)
+	{
+		WiFi.mode(WIFI_STA);
+		WiFi.setAutoReconnect(false);
+		WiFi.begin(this->mNetwork.ssid, this->mNetwork.password);
+		if (this->waitForWiFiAvailable(CONNECTOR_TIMEOUT))
+		{
+			this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+		}
+		this->mWiFiClient = new WiFiClient();
+		this->mMqttClient = new MqttClient(*this->transport(this->mWiFiClient));
+		this->mEndpoints.setResolver([](const char *host, IPAddress &address) -> bool
+																 { return WiFi.hostByName(host, address) == 1; });
+	}
+	else
+	{
+		return true;
+	}
+
+	for (uint8_t i = 1; i <= this->mSessionCount; i++)
+	{
+		this->beginSession(i);
+	}
+	if (!this->allocateArena())
+	{
+		return false;
+	}
+
+	this->mMqttClient->setInflightWindow(this->mInflightWindow, this->mInflightStoreSize);
+	if (this->mCoalesceBytes > 0)
+	{
+		this->mMqttClient->setWriteCoalescing(this->mCoalesceBytes, this->mCoalesceDelay, this->mCoalesceOnLoop);
+	}
+
+	MQTT_CALLBACK_SIGNATURE = [=](char *topic, uint8_t *payload, unsigned int length)
+	{
+		this->receive(0, topic, payload, length);
+	};
+	this->mMqttClient->setCallback(callback);
+
+	MQTT_SUBACK_SIGNATURE = [=](uint16_t msgId, uint8_t *codes, uint8_t count)
+	{
+		this->handleSuback(msgId, codes, count);
+	};
+	this->mMqttClient->setSubackCallback(subackCallback);
+
+	this->attachChunks();
+	this->mMqttClient->setMetrics(&this->mMetrics);
+	return true;
+}
+
+void Connector::attachChunks()
+{
+	MQTT_CHUNK_BEGIN_SIGNATURE = [=](char *topic, uint32_t length)
+	{
+		strncpy(this->mChunkTopic, topic, CONNECTOR_TOPIC_SIZE - 1);
+		this->mChunkTopic[CONNECTOR_TOPIC_SIZE - 1] = '\0';
+		this->mChunkOffset = 0;
+		this->mChunkAnnounced = false;
+		this->mSubscribeMessage.beginDecode(length);
+	};
+	MQTT_CHUNK_DATA_SIGNATURE = [=](uint32_t /* offset */, const uint8_t *chunk, uint32_t length)
+	{
+		this->dispatchChunk(chunk, length);
+	};
+	MQTT_CHUNK_END_SIGNATURE = [=]()
+	{
+		this->announceChunk();
+		if (this->onChunkEnd != NULL)
+		{
+			this->onChunkEnd(this, this->mChunkTopic, &this->mSubscribeMessage);
+		}
+	};
+	this->mMqttClient->setChunkCallbacks(chunkBegin, chunkData, chunkEnd);
+}
+
+// Called on every loop while offline; only the first call after a connection reports it.
+// Failed connect attempts are reported by loop() as they fail.
+void Connector::reportDisconnect()
+{
+	if (!this->mOnline)
+	{
+		return;
+	}
+	this->mOnline = false;
+	this->mReconnect.disconnected();
+	this->mMetrics.increment(METRICS_DISCONNECTS);
+	this->notify(CONNECTOR_SLOT_DISCONNECT, 0);
+}
+
+void Connector::setReconnectBackoff(unsigned long baseDelay, unsigned long maxDelay, unsigned long stableAfter)
+{
+	this->mReconnect.setBackoff(baseDelay, maxDelay, stableAfter);
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		this->mSessions[i].reconnect.setBackoff(baseDelay, maxDelay, stableAfter);
+	}
+}
+
+ReconnectPolicy *Connector::getReconnectPolicy()
+{
+	return &this->mReconnect;
+}
+
+Metrics *Connector::getMetrics()
+{
+	return &this->mMetrics;
+}
+
+void Connector::setMetricsInterval(unsigned long interval)
+{
+	this->mMetricsInterval = interval;
+	this->mMetricsAt = millis();
+}
+
+// Snapshot goes to <clientId>/metrics
+bool Connector::publishMetrics()
+{
+	char topic[CONNECTOR_TOPIC_SIZE];
+	if (snprintf(topic, CONNECTOR_TOPIC_SIZE, "%s%s", this->mConnection.clientId, CONNECTOR_METRICS_TOPIC) >= CONNECTOR_TOPIC_SIZE)
+	{
+		return false;
+	}
+	size_t length = this->mMetrics.format(this->mMessageBuffer, MESSAGE_BUFFER_SIZE);
+	if (length == 0)
+	{
+		return false;
+	}
+	return this->publish(topic, "application/json", (uint8_t *)this->mMessageBuffer, length);
+}
+
+int8_t Connector::addSession(const char *host, uint16_t port)
+{
+	return this->addSession(host, port, CONNECTOR_SESSION_BUFFER_SIZE);
+}
+
+int8_t Connector::addSession(const char *host, uint16_t port, uint32_t bufferSize)
+{
+	// the arena is laid out in begin()
+	if (this->mMqttClient != NULL || this->mSessionCount >= CONNECTOR_MAX_SESSIONS - 1 || bufferSize == 0)
+	{
+		return CONNECTOR_SESSION_NONE;
+	}
+	Session *session = &this->mSessions[this->mSessionCount];
+	snprintf(session->host, CONNECTOR_HOST_SIZE, "%s", host);
+	session->port = port;
+	session->bufferSize = bufferSize;
+	session->client = NULL;
+	session->mqtt = NULL;
+	session->connectAttempt = false;
+	session->online = false;
+	session->connectStartedAt = 0;
+	return ++this->mSessionCount;
+}
+
+uint8_t Connector::getSessionCount()
+{
+	return 1 + this->mSessionCount;
+}
+
+bool Connector::isSessionConnected(uint8_t session)
+{
+	if (session == 0)
+	{
+		return this->mMqttClient != NULL && this->mNetwork.status == CONNECTOR_STATUS_CONNECTED;
+	}
+	if (session > this->mSessionCount || this->mSessions[session - 1].mqtt == NULL)
+	{
+		return false;
+	}
+	return this->mNetwork.status != CONNECTOR_STATUS_NO_NETWORK && this->mSessions[session - 1].mqtt->connected();
+}
+
+Metrics *Connector::getMetrics(uint8_t session)
+{
+	if (session == 0)
+	{
+		return &this->mMetrics;
+	}
+	return (session > this->mSessionCount) ? NULL : &this->mSessions[session - 1].metrics;
+}
+
+void Connector::setPublishRoute(uint8_t sessions)
+{
+	this->mPublishRoute = sessions;
+}
+
+// The filter entry is shared by its sessions, each with its own QoS; SUBACK codes are tracked for the primary only.
+bool Connector::subscribeTo(uint8_t sessions, const char *topic, uint8_t qos)
+{
+	if (this->deferred())
+	{
+		return this->post(CONNECTOR_SLOT_SUBSCRIBE, sessions, topic, NULL, 0, false, qos);
+	}
+	if ((sessions & CONNECTOR_SESSION_PRIMARY) && !this->subscribe(topic, qos))
+	{
+		return false;
+	}
+	uint8_t others = sessions & ~CONNECTOR_SESSION_PRIMARY;
+	if (others == 0)
+	{
+		return true;
+	}
+	if (strlen(topic) >= CONNECTOR_TOPIC_SIZE)
+	{
+		return false;
+	}
+	int index = this->findSubscription(topic);
+	if (index < 0)
+	{
+		if (this->mSubscriptionCount >= CONNECTOR_MAX_SUBSCRIPTIONS)
+		{
+			return false;
+		}
+		index = this->mSubscriptionCount++;
+		strncpy(this->mSubscriptions[index].topic, topic, CONNECTOR_TOPIC_SIZE);
+		this->mSubscriptions[index].granted = CONNECTOR_SUBSCRIPTION_FAILURE;
+		this->mSubscriptions[index].msgId = 0;
+		this->mSubscriptions[index].sessions = 0;
+	}
+
+	bool subscribed = true;
+	for (uint8_t i = 1; i <= this->mSessionCount; i++)
+	{
+		uint8_t mask = 1 << i;
+		Subscription *subscription = &this->mSubscriptions[index];
+		if ((others & mask) && !((subscription->sessions & mask) && subscription->qos[i] == qos))
+		{
+			subscription->sessions |= mask;
+			subscription->qos[i] = qos;
+			if (this->isSessionConnected(i))
+			{
+				subscribed = this->mSessions[i - 1].mqtt->subscribe(topic, qos) && subscribed;
+			}
+		}
+	}
+	return subscribed;
+}
+
+bool Connector::unsubscribeFrom(uint8_t sessions, const char *topic)
+{
+	if (this->deferred())
+	{
+		return this->post(CONNECTOR_SLOT_UNSUBSCRIBE, sessions, topic, NULL, 0, false, 0);
+	}
+	int index = this->findSubscription(topic);
+	if (index < 0)
+	{
+		return true;
+	}
+	uint8_t held = this->mSubscriptions[index].sessions & sessions;
+	this->releaseSubscription(index, sessions);
+	bool unsubscribed = true;
+	for (uint8_t i = 0; i <= this->mSessionCount; i++)
+	{
+		if ((held & (1 << i)) && this->isSessionConnected(i))
+		{
+			MqttClient *mqtt = (i == 0) ? this->mMqttClient : this->mSessions[i - 1].mqtt;
+			unsubscribed = mqtt->unsubscribe(topic) && unsubscribed;
+		}
+	}
+	return unsubscribed;
+}
+
+uint8_t Connector::getDispatchSession()
+{
+	return this->mDispatchSession;
+}
+
+void Connector::setOnSessionCallback(CONNECTOR_CALLBACK_SESSION)
+{
+	this->onSession = onSession;
+}
+
+// Secondary sessions reuse the network type and credentials of the primary, without TLS and chunked delivery.
+void Connector::beginSession(uint8_t index)
+{
+	Session *session = &this->mSessions[index - 1];
+	if (this->mNetwork.type == CONNECTOR_TYPE_ETHERNET)
+	{
+		session->client = new EthernetClient();
+	}
+	else
+	{
+		session->client = new WiFiClient();
+	}
+	session->mqtt = new MqttClient(*session->client);
+
+	session->mqtt->setInflightWindow(this->mInflightWindow, this->mInflightStoreSize);
+	if (this->mCoalesceBytes > 0)
+	{
+		session->mqtt->setWriteCoalescing(this->mCoalesceBytes, this->mCoalesceDelay, this->mCoalesceOnLoop);
+	}
+
+	MQTT_CALLBACK_SIGNATURE = [=](char *topic, uint8_t *payload, unsigned int length)
+	{
+		this->receive(index, topic, payload, length);
+	};
+	session->mqtt->setCallback(callback);
+	session->mqtt->setMetrics(&session->metrics);
+}
+
+// One allocation holds every MQTT buffer; with PSRAM the sessions are carved out of the large primary buffer.
+bool Connector::allocateArena()
+{
+	uint32_t sessionSize = 0;
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		sessionSize += this->mSessions[i].bufferSize;
+	}
+
+	uint32_t primarySize = 0;
+	if (this->mPsramEnabled && psramInit() && sessionSize < CONNECTOR_MQTT_PSRAM_BUFFER_SIZE - CONNECTOR_MQTT_BUFFER_SIZE)
+	{
+		primarySize = CONNECTOR_MQTT_PSRAM_BUFFER_SIZE - sessionSize;
+		this->mArena = (uint8_t *)ps_malloc(CONNECTOR_MQTT_PSRAM_BUFFER_SIZE);
+	}
+	if (this->mArena == NULL)
+	{
+		primarySize = CONNECTOR_MQTT_BUFFER_SIZE;
+		this->mArena = (uint8_t *)malloc(primarySize + sessionSize);
+	}
+	if (this->mArena == NULL)
+	{
+		return false;
+	}
+
+	this->mMqttClient->setBuffer(this->mArena, primarySize);
+	uint8_t *slice = this->mArena + primarySize;
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		this->mSessions[i].mqtt->setBuffer(slice, this->mSessions[i].bufferSize);
+		slice += this->mSessions[i].bufferSize;
+	}
+	return true;
+}
+
+void Connector::restoreSessionSubscriptions(uint8_t index)
+{
+	const char *topics[CONNECTOR_MAX_SUBSCRIPTIONS];
+	uint8_t qos[CONNECTOR_MAX_SUBSCRIPTIONS];
+	uint8_t count = 0;
+	uint16_t msgId = 0;
+	for (uint8_t i = 0; i < this->mSubscriptionCount; i++)
+	{
+		if (this->mSubscriptions[i].sessions & (1 << index))
+		{
+			topics[count] = this->mSubscriptions[i].topic;
+			qos[count++] = this->mSubscriptions[i].qos[index];
+		}
+	}
+	if (count > 0)
+	{
+		this->mSessions[index - 1].mqtt->subscribe(topics, qos, count, &msgId);
+	}
+}
+
+void Connector::reportSessionDisconnect(uint8_t index)
+{
+	Session *session = &this->mSessions[index - 1];
+	if (!session->online)
+	{
+		return;
+	}
+	session->online = false;
+	session->reconnect.disconnected();
+	session->metrics.increment(METRICS_DISCONNECTS);
+	this->notify(CONNECTOR_SLOT_SESSION_DOWN, index);
+}
+
+// Same connect state machine as the primary, against a single fixed endpoint.
+void Connector::loopSession(uint8_t index)
+{
+	Session *session = &this->mSessions[index - 1];
+	if (session->mqtt == NULL)
+	{
+		return;
+	}
+	if (this->mNetwork.status == CONNECTOR_STATUS_NO_NETWORK)
+	{
+		this->reportSessionDisconnect(index);
+		return;
+	}
+
+	if (!session->mqtt->connected() && !session->mqtt->connecting())
+	{
+		this->reportSessionDisconnect(index);
+		if (session->connectAttempt)
+		{
+			session->connectAttempt = false;
+			session->reconnect.failed();
+			session->metrics.increment(METRICS_CONNECT_FAILURES);
+		}
+		if (session->reconnect.ready())
+		{
+			session->mqtt->setServer(session->host, session->port);
+			if (strlen(this->mConnection.username) > 0 && strlen(this->mConnection.password) > 0)
+			{
+				session->mqtt->beginConnect(this->mConnection.clientId, this->mConnection.username, this->mConnection.password, NULL, 0, false, NULL, this->mCleanSession);
+			}
+			else
+			{
+				session->mqtt->beginConnect(this->mConnection.clientId, NULL, NULL, NULL, 0, false, NULL, this->mCleanSession);
+			}
+			session->connectAttempt = true;
+			session->connectStartedAt = micros();
+		}
+	}
+	session->mqtt->loop();
+
+	if (!session->online && session->mqtt->connected())
+	{
+		session->online = true;
+		session->connectAttempt = false;
+		session->reconnect.connected();
+		session->metrics.increment(METRICS_CONNECTS);
+		session->metrics.record(METRICS_CONNECT_TIME, micros() - session->connectStartedAt);
+		this->restoreSessionSubscriptions(index);
+		this->notify(CONNECTOR_SLOT_SESSION_UP, index);
+	}
+}
+
+bool Connector::loop()
+{
+	return this->loop(0);
+}
+
+bool Connector::loop(unsigned long intervals)
+{
+	// in threaded mode the engine runs elsewhere and this only delivers what it queued
+	this->drainInbound();
+	if (!this->mTaskRunning)
+	{
+		this->service();
+	}
+
+	if (this->mMetricsInterval > 0 && this->routable(CONNECTOR_SESSION_PRIMARY) && millis() - this->mMetricsAt >= this->mMetricsInterval)
+	{
+		this->mMetricsAt = millis();
+		this->publishMetrics();
+	}
+
+	if (intervals > 0)
+	{
+		unsigned long now = millis();
+		if (this->mLastMillis + intervals < now)
+		{
+			this->mLastMillis = now;
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		return true;
+	}
+}
+
+// One pass of the network engine: link state, connects and MQTT traffic of every session.
+void Connector::service()
+{
+	unsigned long started = micros();
+
+	if (this->mNetwork.type == CONNECTOR_TYPE_ETHERNET)
+	{
+		if (Ethernet.linkStatus() == LinkON)
+		{
+			if (this->mNetwork.status == CONNECTOR_STATUS_NO_NETWORK)
+			{
+				this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+			}
+			Ethernet.maintain();
+		}
+		else
+		{
+			this->mNetwork.status = CONNECTOR_STATUS_NO_NETWORK;
+			if (this->waitForEthernetAvailable(CONNECTOR_TIMEOUT))
+			{
+				this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
+			}
+		}
+	}
+	else if (this->mNetwork.type == CONNECTOR_TYPE_WIFI)
+	{
+		if (WiFi.status() == WL_CONNECTED)
 		{
 			if (this->mNetwork.status == CONNECTOR_STATUS_NO_NETWORK)
 			{
@@ -466,78 +1787,456 @@ bool Connector::loop(unsigned long intervals)
 		}
 	}
 
+	if (this->mNetwork.status == CONNECTOR_STATUS_NO_NETWORK)
+	{
+		this->reportDisconnect();
+	}
+
 	if (this->mMqttClient != NULL && this->mNetwork.status != CONNECTOR_STATUS_NO_NETWORK)
 	{
 		if (this->mMqttClient->connected())
 		{
 			this->mNetwork.status = CONNECTOR_STATUS_CONNECTED;
 		}
-		else
+		else if (!this->mMqttClient->connecting())
 		{
 			this->mNetwork.status = CONNECTOR_STATUS_DISCONNECTED;
-			if (this->onDisconnect != NULL)
+			this->reportDisconnect();
+			if (this->mConnectAttempt)
 			{
-				this->onDisconnect(this);
+				// never online, so reportDisconnect stayed quiet: a failed attempt is reported on its own
+				this->mConnectAttempt = false;
+				this->mReconnect.failed();
+				this->mMetrics.increment(METRICS_CONNECT_FAILURES);
+				this->mEndpoints.failed();
+				this->notify(CONNECTOR_SLOT_DISCONNECT, 0);
 			}
 
-			if (strlen(this->mConnection.host) > 0)
-			{
-				this->mMqttClient->setServer(this->mConnection.host, this->mConnection.port);
-			}
-			else
+			if (this->mReconnect.ready())
 			{
-				// Network Plug & Play
-				this->mMqttClient->setServer(this->mConnection.defaultHost, this->mConnection.port);
-			}
+				Endpoint *endpoint = this->mEndpoints.select();
+				IPAddress address;
+#if TLS_CLIENT_ENABLED
+				if (this->mTlsClient != NULL)
+				{
+					// the certificate is checked against the name even when connecting by cached address
+					this->mTlsClient->setHostname((endpoint != NULL) ? endpoint->host : this->mConnection.defaultHost);
+				}
+#endif
+				if (endpoint != NULL && this->mEndpoints.resolve(address))
+				{
+					this->mMqttClient->setServer(address, endpoint->port);
+				}
+				else if (endpoint != NULL)
+				{
+					this->mMqttClient->setServer(endpoint->host, endpoint->port);
+				}
+				else
+				{
+					// Network Plug & Play
+					this->mMqttClient->setServer(this->mConnection.defaultHost, this->mConnection.port);
+				}
 
-			bool success = false;
+				this->updateClientId();
 
-			if (strlen(this->mConnection.clientId) == 0)
-			{
-				// Use Descriptors
-				snprintf(this->mConnection.clientGroup, CONNECTOR_CLIENT_GROUP_SIZE, "device/%s", this->mDescriptor.name);
-				snprintf(this->mConnection.clientId, CONNECTOR_CLIENT_ID_SIZE, "device/%s/%s", this->mDescriptor.name, this->mDescriptor.sn);
-				strncpy(this->mConnection.username, this->mDescriptor.model, CONNECTOR_MODEL_SIZE);
-				strncpy(this->mConnection.password, this->mDescriptor.accessCode, CONNECTOR_ACCESS_CODE_SIZE);
+				if (strlen(this->mConnection.username) > 0 && strlen(this->mConnection.password) > 0)
+				{
+					this->mMqttClient->beginConnect(this->mConnection.clientId, this->mConnection.username, this->mConnection.password, NULL, 0, false, NULL, this->mCleanSession);
+				}
+				else
+				{
+					this->mMqttClient->beginConnect(this->mConnection.clientId, NULL, NULL, NULL, 0, false, NULL, this->mCleanSession);
+				}
+				this->mConnectAttempt = true;
+				this->mConnectStartedAt = micros();
 			}
+		}
+		this->mMqttClient->loop();
 
-			if (strlen(this->mConnection.username) > 0 && strlen(this->mConnection.password) > 0)
+		if (this->mNetwork.status != CONNECTOR_STATUS_CONNECTED && this->mMqttClient->connected())
+		{
+			this->mNetwork.status = CONNECTOR_STATUS_CONNECTED;
+			this->mConnectAttempt = false;
+			this->mOnline = true;
+			this->mReconnect.connected();
+			this->mMetrics.increment(METRICS_CONNECTS);
+			this->mMetrics.record(METRICS_CONNECT_TIME, micros() - this->mConnectStartedAt);
+			this->mEndpoints.succeeded();
+			this->saveLastEndpoint();
+			this->restoreSubscriptions();
+			this->notify(CONNECTOR_SLOT_CONNECT, 0);
+		}
+	}
+
+	for (uint8_t i = 1; i <= this->mSessionCount; i++)
+	{
+		this->loopSession(i);
+	}
+	this->mMetrics.record(METRICS_LOOP_TIME, micros() - started);
+}
+
+void Connector::setTaskQueue(uint16_t slots, uint32_t slotSize)
+{
+	this->mTaskSlots = slots;
+	this->mTaskSlotSize = slotSize;
+}
+
+bool Connector::beginTask()
+{
+	return this->beginTask(CONNECTOR_TASK_CORE);
+}
+
+bool Connector::beginTask(uint8_t core)
+{
+	if (this->mMqttClient == NULL || this->mTaskRunning)
+	{
+		return false;
+	}
+	// every packet an MQTT buffer accepts must fit one inbound slot
+	uint32_t largest = this->mMqttClient->getBufferSize();
+	for (uint8_t i = 0; i < this->mSessionCount; i++)
+	{
+		if (this->mSessions[i].mqtt != NULL && this->mSessions[i].mqtt->getBufferSize() > largest)
+		{
+			largest = this->mSessions[i].mqtt->getBufferSize();
+		}
+	}
+	uint32_t slotSize = (this->mTaskSlotSize == 0) ? largest : this->mTaskSlotSize;
+	if (slotSize < largest)
+	{
+		return false;
+	}
+	// slots are allocated on the first run and kept
+	if ((this->mOutbound.capacity() == 0 && !this->mOutbound.begin(this->mTaskSlots, slotSize, this->mPsramEnabled)) ||
+			(this->mInbound.capacity() == 0 && !this->mInbound.begin(this->mTaskSlots, slotSize, this->mPsramEnabled)) ||
+			this->mInbound.getSlotSize() < largest)
+	{
+		return false;
+	}
+	// a streamed message cannot cross the inbound queue, so oversize packets are dropped instead
+	this->mMqttClient->setChunkCallbacks(NULL, NULL, NULL);
+
+	// callers see the current state until the first pass
+	this->publishView();
+	this->mTaskStop = false;
+#ifdef ESP32
+	if (xTaskCreatePinnedToCore(Connector::runTask, "connector", CONNECTOR_TASK_STACK, this, CONNECTOR_TASK_PRIORITY, &this->mTask, core) != pdPASS)
+	{
+		return false;
+	}
+#else
+	// threads are not pinned on the host
+	(void)core;
+	this->mTask = std::thread(Connector::runTask, this);
+#endif
+	// releases the task, which now sees its own handle
+	this->mTaskRunning = true;
+	return true;
+}
+
+void Connector::endTask()
+{
+	if (!this->mTaskRunning)
+	{
+		return;
+	}
+	this->mTaskStop = true;
+#ifdef ESP32
+	while (this->mTaskRunning)
+	{
+		delay(CONNECTOR_TASK_IDLE);
+	}
+	this->mTask = NULL;
+#else
+	this->mTask.join();
+#endif
+	// whatever the app queued last is sent from here
+	this->drainOutbound();
+	this->attachChunks();
+}
+
+bool Connector::isTaskRunning()
+{
+	return this->mTaskRunning;
+}
+
+SpscRing *Connector::getOutboundQueue()
+{
+	return &this->mOutbound;
+}
+
+SpscRing *Connector::getInboundQueue()
+{
+	return &this->mInbound;
+}
+
+void Connector::runTask(void *connector)
+{
+	Connector *self = (Connector *)connector;
+	while (!self->mTaskRunning)
+	{
+		delay(CONNECTOR_TASK_IDLE);
+	}
+	while (!self->mTaskStop)
+	{
+		self->drainOutbound();
+		self->service();
+
+		uint8_t connected = 0;
+		for (uint8_t i = 0; i <= self->mSessionCount; i++)
+		{
+			if (self->isSessionConnected(i))
 			{
-				success = this->mMqttClient->connect(this->mConnection.clientId, this->mConnection.username, this->mConnection.password);
+				connected |= 1 << i;
 			}
-			else
+		}
+		self->mConnectedSessions = connected;
+		self->publishView();
+		delay(CONNECTOR_TASK_IDLE);
+	}
+	self->mTaskRunning = false;
+#ifdef ESP32
+	vTaskDelete(NULL);
+#endif
+}
+
+// Engine side: what the accessors answer on other tasks. The subscription copy waits for the next pass
+// while a reader holds it.
+void Connector::publishView()
+{
+	this->mInflightView = this->getInflightCount();
+	this->mAckLatencyView = this->getAckLatency();
+	bool busy = false;
+	if (!this->mSubscriptionViewBusy.compare_exchange_strong(busy, true))
+	{
+		return;
+	}
+	for (uint8_t i = 0; i < this->mSubscriptionCount; i++)
+	{
+		Subscription *subscription = &this->mSubscriptions[i];
+		memcpy(this->mSubscriptionView[i].topic, subscription->topic, CONNECTOR_TOPIC_SIZE);
+		this->mSubscriptionView[i].granted = (subscription->sessions & CONNECTOR_SESSION_PRIMARY) ? subscription->granted.load() : CONNECTOR_SUBSCRIPTION_FAILURE;
+	}
+	this->mSubscriptionViewCount = this->mSubscriptionCount;
+	this->mSubscriptionViewBusy = false;
+}
+
+// Reader side; the engine holds the copy only while it refreshes it.
+void Connector::lockView()
+{
+	bool busy = false;
+	while (!this->mSubscriptionViewBusy.compare_exchange_weak(busy, true))
+	{
+		busy = false;
+		yield();
+	}
+}
+
+// True on any task other than the network task while threaded mode runs; such calls are queued.
+bool Connector::deferred()
+{
+	if (!this->mTaskRunning)
+	{
+		return false;
+	}
+#ifdef ESP32
+	return xTaskGetCurrentTaskHandle() != this->mTask;
+#else
+	return std::this_thread::get_id() != this->mTask.get_id();
+#endif
+}
+
+// From other tasks this is the connection state seen by the last engine pass.
+bool Connector::routable(uint8_t sessions)
+{
+	if (this->deferred())
+	{
+		return (this->mConnectedSessions & sessions) != 0;
+	}
+	return this->routeClients(sessions, NULL, NULL) > 0;
+}
+
+// Segments are copied back to back into one outbound slot.
+bool Connector::post(uint8_t kind, uint8_t sessions, const char *topic, const MqttSegment *segments, uint8_t count, bool retain, uint8_t qos)
+{
+	uint32_t length = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		length += segments[i].length;
+	}
+	if (length > this->mOutbound.getSlotSize() || strlen(topic) >= SPSC_RING_TOPIC_SIZE)
+	{
+		this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
+		return false;
+	}
+	RingSlot *slot = this->mOutbound.claim();
+	if (slot == NULL)
+	{
+		this->mMetrics.increment(METRICS_QUEUE_DROPS);
+		return false;
+	}
+	slot->kind = kind;
+	slot->session = sessions;
+	slot->qos = qos;
+	slot->retain = retain;
+	slot->length = length;
+	strcpy(slot->topic, topic);
+	length = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		memcpy(slot->data + length, segments[i].data, segments[i].length);
+		length += segments[i].length;
+	}
+	this->mOutbound.push();
+	return true;
+}
+
+// MQTT callback of every session; in threaded mode the payload is copied out for loop() to dispatch.
+void Connector::receive(uint8_t session, char *topic, uint8_t *payload, unsigned int length)
+{
+	if (!this->mTaskRunning)
+	{
+		this->mDispatchSession = session;
+		this->dispatchMessage(topic, payload, length);
+		this->mDispatchSession = 0;
+		return;
+	}
+	RingSlot *slot = this->mInbound.claim();
+	if (slot == NULL || length > this->mInbound.getSlotSize() || strlen(topic) >= SPSC_RING_TOPIC_SIZE)
+	{
+		this->getMetrics(session)->increment(METRICS_QUEUE_DROPS);
+		return;
+	}
+	slot->kind = CONNECTOR_SLOT_MESSAGE;
+	slot->session = session;
+	slot->length = length;
+	strcpy(slot->topic, topic);
+	memcpy(slot->data, payload, length);
+	this->mInbound.push();
+}
+
+void Connector::notify(uint8_t kind, uint8_t session)
+{
+	if (!this->mTaskRunning)
+	{
+		this->fire(kind, session);
+		return;
+	}
+	// once one event waits outside the queue the later ones follow it there, so the newest is fired last
+	RingSlot *slot = NULL;
+	if (this->mLateEvents[session] != CONNECTOR_SLOT_NONE || (slot = this->mInbound.claim()) == NULL)
+	{
+		this->mLateEvents[session] = kind;
+		return;
+	}
+	slot->kind = kind;
+	slot->session = session;
+	slot->length = 0;
+	slot->topic[0] = '\0';
+	this->mInbound.push();
+}
+
+void Connector::fire(uint8_t kind, uint8_t session)
+{
+	if (kind == CONNECTOR_SLOT_CONNECT && this->onConnect != NULL)
+	{
+		this->onConnect(this);
+	}
+	else if (kind == CONNECTOR_SLOT_DISCONNECT && this->onDisconnect != NULL)
+	{
+		this->onDisconnect(this);
+	}
+	else if ((kind == CONNECTOR_SLOT_SESSION_UP || kind == CONNECTOR_SLOT_SESSION_DOWN) && this->onSession != NULL)
+	{
+		this->onSession(this, session, kind == CONNECTOR_SLOT_SESSION_UP);
+	}
+}
+
+// Network task side: replays what the app queued against the live sessions.
+void Connector::drainOutbound()
+{
+	RingSlot *slot;
+	while ((slot = this->mOutbound.peek()) != NULL)
+	{
+		if (slot->kind == CONNECTOR_SLOT_PUBLISH)
+		{
+			MqttSegment segment = {slot->data, slot->length};
+			MqttClient *clients[CONNECTOR_MAX_SESSIONS];
+			Metrics *metrics[CONNECTOR_MAX_SESSIONS];
+			uint8_t targets = this->routeClients(slot->session, clients, metrics);
+			if (targets == 0)
 			{
-				success = this->mMqttClient->connect(this->mConnection.clientId);
+				this->mMetrics.increment(METRICS_PUBLISH_FAILURES);
 			}
-
-			if (success)
+			for (uint8_t i = 0; i < targets; i++)
 			{
-				this->mNetwork.status = CONNECTOR_STATUS_CONNECTED;
-				if (this->onConnect != NULL)
+				if (!clients[i]->publish(slot->topic, &segment, 1, slot->retain, slot->qos))
 				{
-					this->onConnect(this);
+					metrics[i]->increment(METRICS_PUBLISH_FAILURES);
 				}
 			}
 		}
-		this->mMqttClient->loop();
+		else if (slot->kind == CONNECTOR_SLOT_SUBSCRIBE && slot->length > 0)
+		{
+			// subscribe(topics, qos, count) batch
+			const char *topics[CONNECTOR_MAX_SUBSCRIPTIONS];
+			uint8_t qos[CONNECTOR_MAX_SUBSCRIPTIONS];
+			uint8_t count = 0;
+			uint32_t pos = 0;
+			while (pos < slot->length && count < CONNECTOR_MAX_SUBSCRIPTIONS)
+			{
+				qos[count] = slot->data[pos++];
+				topics[count] = (const char *)slot->data + pos;
+				pos += strlen(topics[count++]) + 1;
+			}
+			this->subscribe(topics, qos, count);
+		}
+		else if (slot->kind == CONNECTOR_SLOT_SUBSCRIBE)
+		{
+			this->subscribeTo(slot->session, slot->topic, slot->qos);
+		}
+		else if (slot->kind == CONNECTOR_SLOT_UNSUBSCRIBE)
+		{
+			this->unsubscribeFrom(slot->session, slot->topic);
+		}
+		else if (slot->kind == CONNECTOR_SLOT_FLUSH)
+		{
+			this->flush();
+		}
+		else if (slot->kind == CONNECTOR_SLOT_CLOSE)
+		{
+			this->close();
+		}
+		this->mOutbound.pop();
 	}
+}
 
-	if (intervals > 0)
+// App task side: messages and connection events in the order the engine produced them; events that
+// found the queue full come last.
+void Connector::drainInbound()
+{
+	RingSlot *slot;
+	while ((slot = this->mInbound.peek()) != NULL)
 	{
-		unsigned long now = millis();
-		if (this->mLastMillis + intervals < now)
+		if (slot->kind == CONNECTOR_SLOT_MESSAGE)
 		{
-			this->mLastMillis = now;
-			return true;
+			this->mDispatchSession = slot->session;
+			this->dispatchMessage(slot->topic, slot->data, slot->length);
+			this->mDispatchSession = 0;
 		}
 		else
 		{
-			return false;
+			this->fire(slot->kind, slot->session);
 		}
+		this->mInbound.pop();
 	}
-	else
+	for (uint8_t i = 0; i <= this->mSessionCount; i++)
 	{
-		return true;
+		uint8_t kind = this->mLateEvents[i].exchange(CONNECTOR_SLOT_NONE);
+		if (kind != CONNECTOR_SLOT_NONE)
+		{
+			this->fire(kind, i);
+		}
 	}
 }
 
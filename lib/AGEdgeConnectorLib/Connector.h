@@ -9,8 +9,21 @@
 #include <UIPEthernet.h>
 #include <HTTPClient.h>
 #include <Update.h>
+#include <Preferences.h>
 #include "MqttClient.h"
 #include "Message.h"
+#include "TopicTree.h"
+#include "ReconnectPolicy.h"
+#include "EndpointList.h"
+#include "TlsClient.h"
+#include "Metrics.h"
+#include "SpscRing.h"
+#include "Timestamp.h"
+#ifdef ESP32
+#include "esp_sntp.h"
+#else
+#include <thread>
+#endif
 
 #define CONNECTOR_NAME_SIZE 64
 #define CONNECTOR_VENDOR_SIZE 64
@@ -29,6 +42,8 @@
 
 #define CONNECTOR_HOST_SIZE 64
 #define CONNECTOR_PORT 16300
+#define CONNECTOR_PREFERENCES "agconnector"
+#define CONNECTOR_METRICS_TOPIC "/metrics"
 #define CONNECTOR_CLIENT_ID_SIZE 128
 #define CONNECTOR_CLIENT_GROUP_SIZE 128
 #define CONNECTOR_ACCESS_CODE_SIZE 64
@@ -39,11 +54,68 @@
 
 #define CONNECTOR_MQTT_BUFFER_SIZE 4096
 #define CONNECTOR_MQTT_PSRAM_BUFFER_SIZE 1048000
+#define CONNECTOR_INFLIGHT_WINDOW 4
+
+#define CONNECTOR_MAX_SUBSCRIPTIONS 16
+#define CONNECTOR_TOPIC_SIZE 128
+#define CONNECTOR_SUBSCRIPTION_PENDING 0xFF
+#define CONNECTOR_SUBSCRIPTION_FAILURE 0x80
+#define CONNECTOR_MAX_DISPATCH 8
+// Handler table and topic tree, allocated on the first bind()
+#ifndef CONNECTOR_MAX_HANDLERS
+#define CONNECTOR_MAX_HANDLERS 64
+#endif
+#ifndef CONNECTOR_TOPIC_NODES
+#define CONNECTOR_TOPIC_NODES 128
+#endif
+#ifndef CONNECTOR_TOPIC_LABEL_SIZE
+#define CONNECTOR_TOPIC_LABEL_SIZE 2048
+#endif
+#define CONNECTOR_MAX_SUBACKS 4 // SUBSCRIBE packets awaiting their SUBACK
+#define CONNECTOR_SUBACK_NONE 0xFF
+
+#define CONNECTOR_MAX_SESSIONS 3 // primary included
+#define CONNECTOR_SESSION_BUFFER_SIZE 2048
+#define CONNECTOR_SESSION_PRIMARY 0x01
+#define CONNECTOR_SESSIONS_ALL 0xFF
+#define CONNECTOR_SESSION_NONE -1
+
+#define CONNECTOR_TIMESTAMP_TEXT 0x01	// last-modified
+#define CONNECTOR_TIMESTAMP_MILLIS 0x02 // last-modified-ms
+
+#ifndef CONNECTOR_TASK_SLOTS
+#define CONNECTOR_TASK_SLOTS 4 // per direction, power of two
+#endif
+#ifndef CONNECTOR_TASK_SLOT_SIZE
+#define CONNECTOR_TASK_SLOT_SIZE 0 // payload bytes per slot, 0 for the largest MQTT buffer
+#endif
+#define CONNECTOR_TASK_STACK 8192
+#define CONNECTOR_TASK_PRIORITY 1
+#define CONNECTOR_TASK_CORE 0 // Arduino loop() runs on core 1
+#define CONNECTOR_TASK_IDLE 1 // ms between engine passes
+
+#define CONNECTOR_SLOT_MESSAGE 0
+#define CONNECTOR_SLOT_PUBLISH 1
+#define CONNECTOR_SLOT_SUBSCRIBE 2
+#define CONNECTOR_SLOT_UNSUBSCRIBE 3
+#define CONNECTOR_SLOT_FLUSH 4
+#define CONNECTOR_SLOT_CLOSE 5
+#define CONNECTOR_SLOT_CONNECT 6
+#define CONNECTOR_SLOT_DISCONNECT 7
+#define CONNECTOR_SLOT_SESSION_UP 8
+#define CONNECTOR_SLOT_SESSION_DOWN 9
+#define CONNECTOR_SLOT_NONE 0xFF
 
 #define CONNECTOR_CALLBACK_CONNECT std::function<void(Connector *)> onConnect
 #define CONNECTOR_CALLBACK_DISCONNECT std::function<void(Connector *)> onDisconnect
 #define CONNECTOR_CALLBACK_MESSAGE std::function<void(Connector *, const char *, Message *)> onMessage
 #define CONNECTOR_CALLBACK_UNKNOWN_MESSAGE std::function<void(Connector *, const char *, Message *)> onUnknownMessage
+#define CONNECTOR_CALLBACK_HANDLER std::function<void(Connector *, const char *, Message *)> handler
+#define CONNECTOR_CALLBACK_CHUNK_BEGIN std::function<void(Connector *, const char *, Message *)> onChunkBegin
+#define CONNECTOR_CALLBACK_CHUNK_DATA std::function<void(Connector *, uint32_t, const uint8_t *, uint32_t)> onChunkData
+#define CONNECTOR_CALLBACK_CHUNK_END std::function<void(Connector *, const char *, Message *)> onChunkEnd
+#define CONNECTOR_CALLBACK_SOURCE std::function<uint32_t(Connector *, uint8_t *, uint32_t)> source
+#define CONNECTOR_CALLBACK_SESSION std::function<void(Connector *, uint8_t, bool)> onSession
 
 struct Descriptor
 {
@@ -76,6 +148,46 @@ struct Connection
 	char clientId[CONNECTOR_CLIENT_ID_SIZE];
 };
 
+struct Subscription
+{
+	char topic[CONNECTOR_TOPIC_SIZE];
+	uint8_t qos[CONNECTOR_MAX_SESSIONS]; // requested QoS by session, primary first
+	// primary SUBACK return code or CONNECTOR_SUBSCRIPTION_PENDING; written by the engine, read by getGrantedQos()
+	std::atomic<uint8_t> granted;
+	uint16_t msgId; // engine side only
+	uint8_t sessions; // mask of sessions the filter is subscribed on; the entry goes with the last one
+};
+
+// Copy of a Subscription as of the last engine pass, read by getGrantedQos() on other tasks
+struct SubscriptionView
+{
+	char topic[CONNECTOR_TOPIC_SIZE];
+	uint8_t granted; // CONNECTOR_SUBSCRIPTION_FAILURE when not on the primary session
+};
+
+// Subscription indexes of one SUBSCRIBE in packet order; SUBACK codes map through it
+struct SubscribeBatch
+{
+	uint16_t msgId; // 0 when free
+	uint8_t count;
+	uint8_t indexes[CONNECTOR_MAX_SUBSCRIPTIONS]; // CONNECTOR_SUBACK_NONE once unsubscribed
+};
+
+// Extra broker connection; its MQTT buffer is a slice of the Connector arena
+struct Session
+{
+	char host[CONNECTOR_HOST_SIZE];
+	uint16_t port;
+	uint32_t bufferSize;
+	Client *client;
+	MqttClient *mqtt;
+	ReconnectPolicy reconnect;
+	Metrics metrics;
+	bool connectAttempt;
+	bool online;
+	unsigned long connectStartedAt;
+};
+
 class Connector
 {
 private:
@@ -84,27 +196,137 @@ private:
 	AG_Network mNetwork;
 	bool mPsramEnabled;
 	unsigned long mLastMillis;
+	uint8_t mPublishQos;
+	uint8_t mInflightWindow;
+	uint32_t mInflightStoreSize;
+	bool mCleanSession;
+	uint32_t mCoalesceBytes;
+	uint16_t mCoalesceDelay;
+	bool mCoalesceOnLoop;
 
-	uint8_t *mMqttBuffer;
 	char mMessageBuffer[MESSAGE_BUFFER_SIZE];
 
 	EthernetClient *mEthernetClient;
 	WiFiClient *mWiFiClient;
+#if TLS_CLIENT_ENABLED
+	TlsClient *mTlsClient;
+	bool mTlsEnabled;
+	const char *mTlsCaCert;
+#endif
 	MqttClient *mMqttClient;
 	HTTPClient *mHttpClient;
 	Message mPublishMessage;
 	Message mSubscribeMessage;
+	Timestamp mTimestamp;
+	uint8_t mTimestampOptions;
+
+	ReconnectPolicy mReconnect;
+	bool mConnectAttempt;
+	bool mOnline;
+
+	EndpointList mEndpoints;
+	int8_t mSavedEndpoint;
+
+	Metrics mMetrics;
+	unsigned long mConnectStartedAt;
+	unsigned long mMetricsInterval;
+	unsigned long mMetricsAt;
+
+	Session mSessions[CONNECTOR_MAX_SESSIONS - 1];
+	uint8_t mSessionCount;
+	uint8_t mPublishRoute;
+	uint8_t mDispatchSession;
+	uint8_t *mArena;
+
+	SpscRing mOutbound; // app task -> network task
+	SpscRing mInbound;	// network task -> app task
+	std::atomic<bool> mTaskRunning;
+	std::atomic<bool> mTaskStop;
+	std::atomic<uint8_t> mConnectedSessions; // as of the last engine pass
+	std::atomic<uint8_t> mInflightView;		 // primary session, as of the last engine pass
+	std::atomic<unsigned long> mAckLatencyView;
+	std::atomic<uint8_t> mLateEvents[CONNECTOR_MAX_SESSIONS]; // newest connection event that found the inbound queue full
+	uint16_t mTaskSlots;
+	uint32_t mTaskSlotSize;
+#ifdef ESP32
+	TaskHandle_t mTask;
+#else
+	std::thread mTask;
+#endif
+
+	Subscription mSubscriptions[CONNECTOR_MAX_SUBSCRIPTIONS];
+	uint8_t mSubscriptionCount;
+	SubscriptionView mSubscriptionView[CONNECTOR_MAX_SUBSCRIPTIONS]; // written by the engine while it holds mSubscriptionViewBusy
+	uint8_t mSubscriptionViewCount;
+	std::atomic<bool> mSubscriptionViewBusy;
+	SubscribeBatch mSubacks[CONNECTOR_MAX_SUBACKS];
+	uint8_t mSubackNext;
+
+	TopicTree mTopicTree;
+	std::function<void(Connector *, const char *, Message *)> *mHandlers;
+	uint8_t mDispatching;	 // dispatchMessage depth; unbind() only detaches meanwhile
+	bool mUnbindPending;
 
 	CONNECTOR_CALLBACK_CONNECT;
 	CONNECTOR_CALLBACK_DISCONNECT;
 	CONNECTOR_CALLBACK_MESSAGE;
 	CONNECTOR_CALLBACK_UNKNOWN_MESSAGE;
+	CONNECTOR_CALLBACK_CHUNK_BEGIN;
+	CONNECTOR_CALLBACK_CHUNK_DATA;
+	CONNECTOR_CALLBACK_CHUNK_END;
+	CONNECTOR_CALLBACK_SESSION;
+
+	char mChunkTopic[CONNECTOR_TOPIC_SIZE];
+	uint32_t mChunkOffset;
+	bool mChunkAnnounced;
+
+	void preparePublish(const char *dataType);
+	bool publishMessage(uint8_t sessions, const char *topic, Message *msg, const uint8_t *body, uint32_t bodySize, bool retain, uint8_t qos);
+	uint8_t routeClients(uint8_t sessions, MqttClient **clients, Metrics **metrics);
+	bool allocateArena();
+	void beginSession(uint8_t index);
+	void loopSession(uint8_t index);
+	void restoreSessionSubscriptions(uint8_t index);
+	void reportSessionDisconnect(uint8_t index);
+	bool routable(uint8_t sessions);
+	void service();
+	bool deferred();
+	bool post(uint8_t kind, uint8_t sessions, const char *topic, const MqttSegment *segments, uint8_t count, bool retain, uint8_t qos);
+	void receive(uint8_t session, char *topic, uint8_t *payload, unsigned int length);
+	void notify(uint8_t kind, uint8_t session);
+	void fire(uint8_t kind, uint8_t session);
+	void drainOutbound();
+	void drainInbound();
+	static void runTask(void *connector);
+	void publishView();
+	void lockView();
+	uint8_t frameSegments(Message *msg, uint32_t bodySize, uint8_t *header, uint8_t *size, MqttSegment *segments);
+	int findSubscription(const char *topic);
+	void releaseUnbound(); // frees the handlers unbound while dispatching
+	void removeSubscription(uint8_t index);
+	void releaseSubscription(uint8_t index, uint8_t sessions);
+	bool sendSubscriptions(uint8_t *indexes, uint8_t count);
+	void restoreSubscriptions();
+	void handleSuback(uint16_t msgId, uint8_t *codes, uint8_t count);
+	void updateClientId();
+	void reportDisconnect();
+	void loadLastEndpoint();
+	Client *transport(Client *client);
+	void saveLastEndpoint();
+	void dispatchChunk(const uint8_t *chunk, uint32_t length);
+	void announceChunk();
+	void attachChunks();
 
 public:
 	Connector();
 	~Connector();
 
 	void enablePsram();
+	// Block pool for the bodies of the publish and subscribe messages; NULL restores heap allocation
+	void setMessagePool(BlockPool *pool);
+	// Which of last-modified and last-modified-ms the publish helpers set; CONNECTOR_TIMESTAMP_TEXT by default
+	void setTimestampOptions(uint8_t options);
+	Timestamp *getTimestamp();
 
 	const char *getName();
 	const char *getVendor();
@@ -125,33 +347,122 @@ public:
 	const char *getClientGroup();
 	const char *getClientId();
 
+	// The first broker. Call it before addConnection: calling it again replaces only the first entry,
+	// so brokers added since are kept
 	void setConnection(const char *host, uint16_t port);
 	void setConnection(const char *host, uint16_t port, const char *username, const char *password);
+	// Failover brokers, tried in order after the current one fails ENDPOINT_FAILOVER_FAILURES times
+	bool addConnection(const char *host, uint16_t port);
+	void setDnsTtl(unsigned long ttl);
+	const char *getEndpoint();
+
+#if TLS_CLIENT_ENABLED
+	// TLS over the network client; caCert NULL encrypts without verifying the broker. Call before begin()
+	void setTls(const char *caCert);
+	bool isTlsResumed();
+	unsigned long getTlsHandshakeTime();
+#endif
+
+	// Counters and timing histograms; setMetricsInterval(ms) also publishes them periodically, 0 stops it
+	Metrics *getMetrics();
+	void setMetricsInterval(unsigned long interval);
+	bool publishMetrics();
+
+	// Extra broker sessions (index 1..) share the dispatch path, handlers and message buffers. Call before begin()
+	int8_t addSession(const char *host, uint16_t port);
+	int8_t addSession(const char *host, uint16_t port, uint32_t bufferSize);
+	uint8_t getSessionCount();
+	bool isSessionConnected(uint8_t session);
+	Metrics *getMetrics(uint8_t session);
+	// Session mask used by the publish helpers; CONNECTOR_SESSION_PRIMARY by default
+	void setPublishRoute(uint8_t sessions);
+	bool publishTo(uint8_t sessions, const char *topic, Message *msg, bool retain, uint8_t qos);
+	bool subscribeTo(uint8_t sessions, const char *topic, uint8_t qos);
+	// subscribe()/unsubscribe() act on the primary only; other sessions keep their filters
+	bool unsubscribeFrom(uint8_t sessions, const char *topic);
+	// Session the message being dispatched arrived on
+	uint8_t getDispatchSession();
+	void setOnSessionCallback(CONNECTOR_CALLBACK_SESSION);
 
 	bool waitForEthernetAvailable(uint8_t seconds);
 	bool waitForWiFiAvailable(uint8_t seconds);
 
+	// Subscriptions persist across reconnects and are restored in one SUBSCRIBE
 	bool subscribe(const char *topic);
 	bool subscribe(const char *topic, uint8_t qos);
+	bool subscribe(const char **topics, const uint8_t *qos, uint8_t count);
 	bool unsubscribe(const char *topic);
+	bool unsubscribe(const char **topics, uint8_t count);
+	// From other tasks while threaded mode runs, both answer as of the last engine pass
+	uint8_t getSubscriptionCount();
+	uint8_t getGrantedQos(const char *topic);
+
+	// Per-filter handlers ('+' and '#' allowed); messages no handler matches go to onMessage.
+	// A handler may unbind itself or others: the slot is freed once dispatch returns.
+	int16_t subscribe(const char *topic, uint8_t qos, CONNECTOR_CALLBACK_HANDLER);
+	bool unsubscribe(int16_t handle);
+	int16_t bind(const char *filter, CONNECTOR_CALLBACK_HANDLER);
+	void unbind(int16_t handle);
 	bool publish(const char *topic, Message *msg, bool retain);
+	bool publish(const char *topic, Message *msg, bool retain, uint8_t qos);
 	bool publish(const char *topic, const char *dataType, const char *format, ...);
 	bool publish(const char *topic, const char *dataType, uint8_t *data, uint32_t dataSize);
 	bool publishJSON(const char *topic, const char *format, ...);
+
+	// QoS 0 publish of a body of known size pulled in MESSAGE_BUFFER_SIZE chunks from a source or stream
+	bool publishStream(const char *topic, const char *dataType, uint32_t dataSize, CONNECTOR_CALLBACK_SOURCE);
+	bool publishStream(const char *topic, const char *dataType, Stream &stream, uint32_t dataSize);
+
+	// QoS used by the publish helpers. QoS 1/2 publishes use a window of CONNECTOR_INFLIGHT_WINDOW;
+	// storeSize 0 lets the retransmission store grow on demand. Set both before begin().
+	void setPublishQos(uint8_t qos);
+	void setInflightWindow(uint8_t window, uint32_t storeSize);
+	// getInflightCount and getAckLatency are also as of the last engine pass from other tasks
+	uint8_t getInflightCount();
+	// Connects with cleanSession=1 by default. false asks the broker to keep the session, and unacknowledged
+	// QoS 1/2 publishes are resent with DUP after a reconnect that reports it present. Set before begin().
+	void setCleanSession(bool cleanSession);
+	unsigned long getAckLatency();
+
+	// Outbound write coalescing, see MqttClient::setWriteCoalescing
+	void setWriteCoalescing(uint32_t maxBytes, uint16_t maxDelay, bool flushOnLoop);
+	void flush();
 	void close();
 
 	void notifyStatus();
 
+	// Reconnect attempts back off exponentially with full jitter up to maxDelay (ms)
+	void setReconnectBackoff(unsigned long baseDelay, unsigned long maxDelay, unsigned long stableAfter);
+	ReconnectPolicy *getReconnectPolicy();
+
 	void dispatchMessage(char *topic, uint8_t *payload, unsigned int size);
 	void setOnConnectCallback(CONNECTOR_CALLBACK_CONNECT);
+	// Once when a connection is lost and once after every connect attempt that fails
 	void setOnDisconnectCallback(CONNECTOR_CALLBACK_DISCONNECT);
 	void setOnMessageCallback(CONNECTOR_CALLBACK_MESSAGE);
 	void setOnUnknownMessageCallback(CONNECTOR_CALLBACK_UNKNOWN_MESSAGE);
+	// QoS 0/1 messages larger than the MQTT buffer: begin (options decoded, getSize() = body length), data..., end
+	void setOnChunkCallbacks(CONNECTOR_CALLBACK_CHUNK_BEGIN, CONNECTOR_CALLBACK_CHUNK_DATA, CONNECTOR_CALLBACK_CHUNK_END);
 
 	bool begin();
 	bool loop();
 	bool loop(unsigned long intervals);
 
+	// Optional threaded mode, started after begin(): the MQTT engine runs in its own task (FreeRTOS on ESP32,
+	// std::thread on native). Publishes, subscription changes, flush and close are queued to it; messages and
+	// connection callbacks are delivered from loop() on the calling task. Publishes over the slot size fail
+	// and publishStream is unavailable while it runs. Messages are dropped when the inbound queue is full;
+	// connection events never are, the newest one per session waits for loop() instead.
+	// setTaskQueue() sets the slots per direction and their size before the first beginTask(); slotSize 0
+	// sizes them from the largest MQTT buffer, and beginTask() fails when a slot is smaller than a buffer.
+	void setTaskQueue(uint16_t slots, uint32_t slotSize);
+	bool beginTask();
+	bool beginTask(uint8_t core);
+	void endTask();
+	bool isTaskRunning();
+	SpscRing *getOutboundQueue();
+	SpscRing *getInboundQueue();
+
 	bool OTA(const char *url);
 };
 
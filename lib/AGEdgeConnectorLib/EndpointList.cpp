@@ -0,0 +1,167 @@
+#include "EndpointList.h"
+
+EndpointList::EndpointList()
+{
+	this->mDnsTtl = ENDPOINT_DNS_TTL;
+	this->resolver = NULL;
+	this->clear();
+}
+
+void EndpointList::clear()
+{
+	this->mCount = 0;
+	this->mCurrent = ENDPOINT_NONE;
+}
+
+bool EndpointList::add(const char *host, uint16_t port)
+{
+	if (this->mCount >= ENDPOINT_LIST_MAX || host == NULL || strlen(host) == 0)
+	{
+		return false;
+	}
+	this->fill(&this->mEndpoints[this->mCount++], host, port);
+	return true;
+}
+
+bool EndpointList::setFirst(const char *host, uint16_t port)
+{
+	if (this->mCount == 0)
+	{
+		return this->add(host, port);
+	}
+	if (host == NULL || strlen(host) == 0)
+	{
+		return false;
+	}
+	this->fill(&this->mEndpoints[0], host, port);
+	this->mCurrent = ENDPOINT_NONE;
+	return true;
+}
+
+void EndpointList::fill(Endpoint *e, const char *host, uint16_t port)
+{
+	snprintf(e->host, ENDPOINT_HOST_SIZE, "%s", host);
+	e->port = port;
+	e->score = 0;
+	e->failures = 0;
+	e->resolved = false;
+	e->resolvedAt = 0;
+	// literal addresses never go through DNS
+	e->literal = e->address.fromString(e->host);
+}
+
+uint8_t EndpointList::count()
+{
+	return this->mCount;
+}
+
+Endpoint *EndpointList::get(uint8_t index)
+{
+	return (index < this->mCount) ? &this->mEndpoints[index] : NULL;
+}
+
+void EndpointList::setResolver(ENDPOINT_RESOLVER_SIGNATURE)
+{
+	this->resolver = resolver;
+}
+
+void EndpointList::setDnsTtl(unsigned long ttl)
+{
+	this->mDnsTtl = ttl;
+}
+
+int8_t EndpointList::current()
+{
+	return this->mCurrent;
+}
+
+Endpoint *EndpointList::select()
+{
+	if (this->mCount == 0)
+	{
+		return NULL;
+	}
+	if (this->mCurrent != ENDPOINT_NONE && this->mEndpoints[this->mCurrent].failures < ENDPOINT_FAILOVER_FAILURES)
+	{
+		return &this->mEndpoints[this->mCurrent];
+	}
+
+	int8_t best = ENDPOINT_NONE;
+	for (uint8_t i = 0; i < this->mCount; i++)
+	{
+		if (i == this->mCurrent && this->mCount > 1)
+		{
+			continue;
+		}
+		if (best == ENDPOINT_NONE || this->mEndpoints[i].score > this->mEndpoints[best].score)
+		{
+			best = i;
+		}
+	}
+	if (this->mCurrent != ENDPOINT_NONE)
+	{
+		this->mEndpoints[this->mCurrent].failures = 0;
+	}
+	this->mCurrent = best;
+	return &this->mEndpoints[best];
+}
+
+bool EndpointList::resolve(IPAddress &address)
+{
+	if (this->mCurrent == ENDPOINT_NONE)
+	{
+		return false;
+	}
+	Endpoint *e = &this->mEndpoints[this->mCurrent];
+	if (!e->literal && (!e->resolved || millis() - e->resolvedAt >= this->mDnsTtl))
+	{
+		e->resolved = this->resolver != NULL && this->resolver(e->host, e->address);
+		e->resolvedAt = millis();
+	}
+	if (e->literal || e->resolved)
+	{
+		address = e->address;
+		return true;
+	}
+	return false;
+}
+
+bool EndpointList::prefer(const char *host, uint16_t port)
+{
+	for (uint8_t i = 0; i < this->mCount; i++)
+	{
+		if (this->mEndpoints[i].port == port && strcmp(this->mEndpoints[i].host, host) == 0)
+		{
+			this->mCurrent = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void EndpointList::succeeded()
+{
+	if (this->mCurrent == ENDPOINT_NONE)
+	{
+		return;
+	}
+	Endpoint *e = &this->mEndpoints[this->mCurrent];
+	e->failures = 0;
+	if (e->score < ENDPOINT_SCORE_MAX)
+	{
+		e->score++;
+	}
+}
+
+void EndpointList::failed()
+{
+	if (this->mCurrent == ENDPOINT_NONE)
+	{
+		return;
+	}
+	Endpoint *e = &this->mEndpoints[this->mCurrent];
+	e->failures++;
+	e->score = (e->score - 2 < ENDPOINT_SCORE_MIN) ? ENDPOINT_SCORE_MIN : e->score - 2;
+	// the broker may have moved
+	e->resolved = false;
+}
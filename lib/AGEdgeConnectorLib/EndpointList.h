@@ -0,0 +1,68 @@
+#ifndef ENDPOINT_LIST_H_
+#define ENDPOINT_LIST_H_
+
+#include <Arduino.h>
+#include <functional>
+#include "IPAddress.h"
+
+#ifndef ENDPOINT_LIST_MAX
+#define ENDPOINT_LIST_MAX 4
+#endif
+#define ENDPOINT_HOST_SIZE 64
+#define ENDPOINT_DNS_TTL 300000		 // milliseconds
+#define ENDPOINT_SCORE_MAX 8
+#define ENDPOINT_SCORE_MIN -8
+#define ENDPOINT_FAILOVER_FAILURES 2 // consecutive failures before moving to another endpoint
+#define ENDPOINT_NONE -1
+
+#define ENDPOINT_RESOLVER_SIGNATURE std::function<bool(const char *, IPAddress &)> resolver
+
+struct Endpoint
+{
+	char host[ENDPOINT_HOST_SIZE];
+	uint16_t port;
+	int8_t score; // +1 per successful connect, -2 per failed one
+	uint8_t failures;
+	bool literal;
+	bool resolved;
+	IPAddress address;
+	unsigned long resolvedAt;
+};
+
+// Ordered broker list. The current endpoint is kept until it fails ENDPOINT_FAILOVER_FAILURES
+// times in a row, then the best scored one (earliest on ties) takes over. Resolved addresses
+// are cached for the DNS TTL and dropped when a connect to them fails.
+class EndpointList
+{
+private:
+	Endpoint mEndpoints[ENDPOINT_LIST_MAX];
+	uint8_t mCount;
+	int8_t mCurrent;
+	unsigned long mDnsTtl;
+
+	ENDPOINT_RESOLVER_SIGNATURE;
+	void fill(Endpoint *e, const char *host, uint16_t port);
+
+public:
+	EndpointList();
+
+	bool add(const char *host, uint16_t port);
+	// Replaces the first endpoint, or adds it to an empty list; the others are kept
+	bool setFirst(const char *host, uint16_t port);
+	void clear();
+	uint8_t count();
+	Endpoint *get(uint8_t index);
+
+	// Resolver returns false when it cannot resolve; the host name is then handed to the client.
+	void setResolver(ENDPOINT_RESOLVER_SIGNATURE);
+	void setDnsTtl(unsigned long ttl);
+
+	Endpoint *select();
+	bool resolve(IPAddress &address);
+	bool prefer(const char *host, uint16_t port);
+	void succeeded();
+	void failed();
+	int8_t current();
+};
+
+#endif
@@ -0,0 +1,655 @@
+#include "JsonIndex.h"
+
+#define JSON_EXPECT_VALUE 0
+#define JSON_EXPECT_VALUE_OR_END 1
+#define JSON_EXPECT_KEY 2
+#define JSON_EXPECT_KEY_OR_END 3
+#define JSON_EXPECT_COLON 4
+#define JSON_EXPECT_COMMA_OR_END 5
+#define JSON_EXPECT_DONE 6
+
+static inline bool delimiter(char c)
+{
+	return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+}
+
+static inline bool space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Position of the closing quote of a string whose text starts at p, length if there is none
+static uint32_t closingQuote(const char *data, uint32_t length, uint32_t p)
+{
+	while (p < length && data[p] != '"' && data[p] != '\0')
+	{
+		p += (data[p] == '\\') ? 2 : 1;
+	}
+	return (p < length && data[p] == '"') ? p : length;
+}
+
+// The one value at p, leading whitespace skipped; a container ends at its matching bracket
+static bool scanValue(const char *data, uint32_t length, uint32_t p, JsonToken *value)
+{
+	while (p < length && space(data[p]))
+	{
+		p++;
+	}
+	if (p >= length || data[p] == '\0')
+	{
+		return false;
+	}
+	char c = data[p];
+	if (c == '"')
+	{
+		value->type = JSON_TYPE_STRING;
+		value->start = p + 1;
+		value->end = closingQuote(data, length, p + 1);
+		return value->end < length;
+	}
+	value->start = p;
+	if (c == '{' || c == '[')
+	{
+		value->type = (c == '{') ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY;
+		uint32_t depth = 0;
+		for (; p < length && data[p] != '\0'; p++)
+		{
+			c = data[p];
+			if (c == '"')
+			{
+				p = closingQuote(data, length, p + 1);
+			}
+			else if (c == '{' || c == '[')
+			{
+				depth++;
+			}
+			else if ((c == '}' || c == ']') && --depth == 0)
+			{
+				value->end = p + 1;
+				return true;
+			}
+		}
+		return false;
+	}
+	value->type = JSON_TYPE_PRIMITIVE;
+	while (p < length && !delimiter(data[p]))
+	{
+		p++;
+	}
+	value->end = p;
+	return true;
+}
+
+// Four hex digits of a \u escape, -1 if malformed
+static int32_t hex4(const char *text)
+{
+	int32_t code = 0;
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		char c = text[i];
+		int32_t digit;
+		if (c >= '0' && c <= '9')
+		{
+			digit = c - '0';
+		}
+		else if (c >= 'a' && c <= 'f')
+		{
+			digit = c - 'a' + 10;
+		}
+		else if (c >= 'A' && c <= 'F')
+		{
+			digit = c - 'A' + 10;
+		}
+		else
+		{
+			return -1;
+		}
+		code = (code << 4) | digit;
+	}
+	return code;
+}
+
+JsonIndex::JsonIndex()
+{
+	this->clear();
+}
+
+void JsonIndex::clear()
+{
+	this->mCount = 0;
+	this->mData = NULL;
+}
+
+int16_t JsonIndex::getCount()
+{
+	return this->mCount;
+}
+
+int16_t JsonIndex::parse(const char *data, uint32_t length)
+{
+	int16_t stack[JSON_INDEX_MAX_DEPTH];
+	uint8_t depth = 0;
+	uint8_t expect = JSON_EXPECT_VALUE;
+	int16_t count = 0;
+	bool valid = true;
+
+	this->clear();
+	this->mData = data;
+
+	uint32_t p = 0;
+	for (; valid && p < length && data[p] != '\0'; p++)
+	{
+		char c = data[p];
+		switch (c)
+		{
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+		case '{':
+		case '[':
+			if (expect != JSON_EXPECT_VALUE && expect != JSON_EXPECT_VALUE_OR_END)
+			{
+				valid = false;
+				break;
+			}
+			if (depth >= JSON_INDEX_MAX_DEPTH)
+			{
+				this->mCount = JSON_ERROR_DEPTH;
+				return this->mCount;
+			}
+			if (count >= JSON_INDEX_MAX_TOKENS)
+			{
+				this->mCount = JSON_ERROR_TOKENS;
+				return this->mCount;
+			}
+			this->mTokens[count].type = (c == '{') ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY;
+			this->mTokens[count].start = p;
+			stack[depth++] = count++;
+			expect = (c == '{') ? JSON_EXPECT_KEY_OR_END : JSON_EXPECT_VALUE_OR_END;
+			break;
+		case '}':
+		case ']':
+		{
+			uint8_t type = (c == '}') ? JSON_TYPE_OBJECT : JSON_TYPE_ARRAY;
+			bool end = (expect == JSON_EXPECT_COMMA_OR_END || expect == JSON_EXPECT_KEY_OR_END || expect == JSON_EXPECT_VALUE_OR_END);
+			if (depth == 0 || !end || this->mTokens[stack[depth - 1]].type != type)
+			{
+				valid = false;
+				break;
+			}
+			JsonToken *token = &this->mTokens[stack[--depth]];
+			token->end = p + 1;
+			token->next = count;
+			expect = (depth == 0) ? JSON_EXPECT_DONE : JSON_EXPECT_COMMA_OR_END;
+			break;
+		}
+		case ':':
+			valid = (expect == JSON_EXPECT_COLON);
+			expect = JSON_EXPECT_VALUE;
+			break;
+		case ',':
+			valid = (expect == JSON_EXPECT_COMMA_OR_END);
+			expect = (valid && this->mTokens[stack[depth - 1]].type == JSON_TYPE_OBJECT) ? JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+			break;
+		default:
+		{
+			bool key = (expect == JSON_EXPECT_KEY || expect == JSON_EXPECT_KEY_OR_END);
+			if (!key && expect != JSON_EXPECT_VALUE && expect != JSON_EXPECT_VALUE_OR_END)
+			{
+				valid = false;
+				break;
+			}
+			uint32_t start = p;
+			uint8_t type = JSON_TYPE_PRIMITIVE;
+			if (c == '"')
+			{
+				type = JSON_TYPE_STRING;
+				start = ++p;
+				while (p < length && data[p] != '"' && data[p] != '\0')
+				{
+					p += (data[p] == '\\') ? 2 : 1;
+				}
+				if (p >= length || data[p] != '"')
+				{
+					valid = false;
+					break;
+				}
+			}
+			else
+			{
+				if (key || !((c >= '0' && c <= '9') || c == '-' || c == 't' || c == 'f' || c == 'n'))
+				{
+					valid = false;
+					break;
+				}
+				while (p < length && !delimiter(data[p]))
+				{
+					p++;
+				}
+			}
+			if (count >= JSON_INDEX_MAX_TOKENS)
+			{
+				this->mCount = JSON_ERROR_TOKENS;
+				return this->mCount;
+			}
+			JsonToken *token = &this->mTokens[count++];
+			token->type = type;
+			token->start = start;
+			token->end = p;
+			token->next = count;
+			if (type == JSON_TYPE_PRIMITIVE)
+			{
+				// the delimiter is looked at again by the loop
+				p--;
+			}
+			if (key)
+			{
+				expect = JSON_EXPECT_COLON;
+			}
+			else
+			{
+				expect = (depth == 0) ? JSON_EXPECT_DONE : JSON_EXPECT_COMMA_OR_END;
+			}
+			break;
+		}
+		}
+	}
+
+	// the loop steps past the character that failed
+	if (!valid || expect != JSON_EXPECT_DONE || (p < length && data[p] != '\0'))
+	{
+		this->mCount = JSON_ERROR_INVALID;
+		return this->mCount;
+	}
+	this->mCount = count;
+	return this->mCount;
+}
+
+const JsonToken *JsonIndex::getToken(int16_t index)
+{
+	if (index < 0 || index >= this->mCount)
+	{
+		return NULL;
+	}
+	return &this->mTokens[index];
+}
+
+int16_t JsonIndex::child(int16_t parent, const char *key, uint32_t keyLength)
+{
+	JsonToken *object = &this->mTokens[parent];
+	if (object->type != JSON_TYPE_OBJECT)
+	{
+		return JSON_INDEX_NONE;
+	}
+	// keys are compared as written, escapes included
+	int16_t k = parent + 1;
+	while (k < object->next)
+	{
+		JsonToken *name = &this->mTokens[k];
+		if (name->end - name->start == keyLength && memcmp(this->mData + name->start, key, keyLength) == 0)
+		{
+			return k + 1;
+		}
+		k = this->mTokens[k + 1].next;
+	}
+	return JSON_INDEX_NONE;
+}
+
+int16_t JsonIndex::element(int16_t parent, uint32_t index)
+{
+	JsonToken *array = &this->mTokens[parent];
+	if (array->type != JSON_TYPE_ARRAY)
+	{
+		return JSON_INDEX_NONE;
+	}
+	int16_t e = parent + 1;
+	for (uint32_t i = 0; i < index && e < array->next; i++)
+	{
+		e = this->mTokens[e].next;
+	}
+	return (e < array->next) ? e : JSON_INDEX_NONE;
+}
+
+int16_t JsonIndex::find(const char *path)
+{
+	if (this->mCount <= 0)
+	{
+		return JSON_INDEX_NONE;
+	}
+	int16_t index = 0;
+	const char *p = path;
+	while (*p != '\0' && index != JSON_INDEX_NONE)
+	{
+		if (*p == '[')
+		{
+			char *end;
+			unsigned long i = strtoul(p + 1, &end, 10);
+			if (end == p + 1 || *end != ']')
+			{
+				return JSON_INDEX_NONE;
+			}
+			index = this->element(index, i);
+			p = end + 1;
+		}
+		else
+		{
+			if (*p == '.')
+			{
+				p++;
+			}
+			const char *end = p;
+			while (*end != '\0' && *end != '.' && *end != '[')
+			{
+				end++;
+			}
+			index = this->child(index, p, end - p);
+			p = end;
+		}
+	}
+	return index;
+}
+
+int32_t JsonIndex::getLength(int16_t index)
+{
+	const JsonToken *token = this->getToken(index);
+	if (token == NULL || (token->type != JSON_TYPE_OBJECT && token->type != JSON_TYPE_ARRAY))
+	{
+		return -1;
+	}
+	int32_t length = 0;
+	for (int16_t e = index + 1; e < token->next; e = this->mTokens[e].next)
+	{
+		length++;
+	}
+	return (token->type == JSON_TYPE_OBJECT) ? length / 2 : length;
+}
+
+int16_t JsonIndex::getElement(int16_t index, uint32_t element)
+{
+	if (this->getToken(index) == NULL)
+	{
+		return JSON_INDEX_NONE;
+	}
+	return this->element(index, element);
+}
+
+const char *JsonIndex::getText(int16_t index, uint32_t *length)
+{
+	const JsonToken *token = this->getToken(index);
+	if (token == NULL)
+	{
+		*length = 0;
+		return NULL;
+	}
+	*length = token->end - token->start;
+	return this->mData + token->start;
+}
+
+bool JsonIndex::getString(int16_t index, char *buffer, uint32_t bufferSize)
+{
+	return decodeString(this->mData, this->getToken(index), buffer, bufferSize);
+}
+
+bool JsonIndex::getInt(int16_t index, int *buffer)
+{
+	return decodeInt(this->mData, this->getToken(index), buffer);
+}
+
+bool JsonIndex::getFloat(int16_t index, float *buffer)
+{
+	return decodeFloat(this->mData, this->getToken(index), buffer);
+}
+
+bool JsonIndex::getBool(int16_t index, bool *buffer)
+{
+	return decodeBool(this->mData, this->getToken(index), buffer);
+}
+
+bool JsonIndex::decodeString(const char *data, const JsonToken *token, char *buffer, uint32_t bufferSize)
+{
+	if (token == NULL || token->type != JSON_TYPE_STRING || bufferSize == 0)
+	{
+		return false;
+	}
+	const char *s = data;
+	uint32_t n = 0;
+	for (uint32_t p = token->start; p < token->end && n + 1 < bufferSize; p++)
+	{
+		if (s[p] != '\\' || p + 1 >= token->end)
+		{
+			buffer[n++] = s[p];
+			continue;
+		}
+		char e = s[++p];
+		int32_t code = (e == 'u' && p + 4 < token->end) ? hex4(s + p + 1) : -1;
+		if (code >= 0)
+		{
+			p += 4;
+			// a surrogate pair is one code point
+			if (code >= 0xD800 && code < 0xDC00 && p + 6 < token->end && s[p + 1] == '\\' && s[p + 2] == 'u')
+			{
+				int32_t low = hex4(s + p + 3);
+				if (low >= 0xDC00 && low < 0xE000)
+				{
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+					p += 6;
+				}
+			}
+			char utf8[4];
+			uint8_t count;
+			if (code < 0x80)
+			{
+				utf8[0] = code;
+				count = 1;
+			}
+			else if (code < 0x800)
+			{
+				utf8[0] = 0xC0 | (code >> 6);
+				utf8[1] = 0x80 | (code & 0x3F);
+				count = 2;
+			}
+			else if (code < 0x10000)
+			{
+				utf8[0] = 0xE0 | (code >> 12);
+				utf8[1] = 0x80 | ((code >> 6) & 0x3F);
+				utf8[2] = 0x80 | (code & 0x3F);
+				count = 3;
+			}
+			else
+			{
+				utf8[0] = 0xF0 | (code >> 18);
+				utf8[1] = 0x80 | ((code >> 12) & 0x3F);
+				utf8[2] = 0x80 | ((code >> 6) & 0x3F);
+				utf8[3] = 0x80 | (code & 0x3F);
+				count = 4;
+			}
+			// a character that does not fit whole is left out
+			if (n + count >= bufferSize)
+			{
+				break;
+			}
+			memcpy(buffer + n, utf8, count);
+			n += count;
+			continue;
+		}
+		switch (e)
+		{
+		case 'n':
+			buffer[n++] = '\n';
+			break;
+		case 'r':
+			buffer[n++] = '\r';
+			break;
+		case 't':
+			buffer[n++] = '\t';
+			break;
+		case 'b':
+			buffer[n++] = '\b';
+			break;
+		case 'f':
+			buffer[n++] = '\f';
+			break;
+		default:
+			buffer[n++] = e;
+			break;
+		}
+	}
+	buffer[n] = '\0';
+	return true;
+}
+
+// Primitive text copied out, since the body is not terminated after the last token
+bool JsonIndex::number(const char *data, const JsonToken *token, char *buffer)
+{
+	if (token == NULL || token->type != JSON_TYPE_PRIMITIVE || token->end - token->start >= JSON_INDEX_NUMBER_SIZE)
+	{
+		return false;
+	}
+	uint32_t length = token->end - token->start;
+	memcpy(buffer, data + token->start, length);
+	buffer[length] = '\0';
+	return (buffer[0] == '-' || (buffer[0] >= '0' && buffer[0] <= '9'));
+}
+
+bool JsonIndex::decodeInt(const char *data, const JsonToken *token, int *buffer)
+{
+	char text[JSON_INDEX_NUMBER_SIZE];
+	if (!number(data, token, text))
+	{
+		return false;
+	}
+	char *end;
+	long value = strtol(text, &end, 10);
+	if (*end == '.' || *end == 'e' || *end == 'E')
+	{
+		// fractions are truncated, as strtol did before
+		value = (long)strtod(text, &end);
+	}
+	if (*end != '\0')
+	{
+		return false;
+	}
+	*buffer = (int)value;
+	return true;
+}
+
+bool JsonIndex::decodeFloat(const char *data, const JsonToken *token, float *buffer)
+{
+	char text[JSON_INDEX_NUMBER_SIZE];
+	if (!number(data, token, text))
+	{
+		return false;
+	}
+	// up to 7 digits are exact: an integer below 10^7 < 2^24 divided by a power of ten up to 10^7
+	const char *p = text + ((text[0] == '-') ? 1 : 0);
+	uint32_t mantissa = 0;
+	int8_t digits = 0;
+	int8_t fraction = -1;
+	for (; *p != '\0'; p++)
+	{
+		if (*p == '.' && fraction < 0)
+		{
+			fraction = 0;
+			continue;
+		}
+		if (*p < '0' || *p > '9' || digits >= 7)
+		{
+			break;
+		}
+		mantissa = mantissa * 10 + (*p - '0');
+		digits++;
+		if (fraction >= 0)
+		{
+			fraction++;
+		}
+	}
+	if (*p == '\0' && digits > 0 && fraction != 0)
+	{
+		static const float powers[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f};
+		float value = (float)mantissa / powers[(fraction < 0) ? 0 : fraction];
+		*buffer = (text[0] == '-') ? -value : value;
+		return true;
+	}
+	char *end;
+	float value = strtof(text, &end);
+	if (*end != '\0')
+	{
+		return false;
+	}
+	*buffer = value;
+	return true;
+}
+
+bool JsonIndex::decodeBool(const char *data, const JsonToken *token, bool *buffer)
+{
+	if (token == NULL || token->type != JSON_TYPE_PRIMITIVE)
+	{
+		return false;
+	}
+	const char *text = data + token->start;
+	uint32_t length = token->end - token->start;
+	if (length == 4 && memcmp(text, "true", 4) == 0)
+	{
+		*buffer = true;
+		return true;
+	}
+	if (length == 5 && memcmp(text, "false", 5) == 0)
+	{
+		*buffer = false;
+		return true;
+	}
+	return false;
+}
+
+bool JsonIndex::scan(const char *data, uint32_t length, const char *key, JsonToken *value)
+{
+	uint32_t keyLength = strlen(key);
+	const char *p = data;
+	const char *last = data + length;
+	while (last - p >= (ptrdiff_t)keyLength + 2 && (p = (const char *)memchr(p, '"', last - p - keyLength - 1)) != NULL)
+	{
+		p++;
+		if (p[keyLength] != '"' || memcmp(p, key, keyLength) != 0)
+		{
+			continue;
+		}
+		uint32_t colon = p - data + keyLength + 1;
+		while (colon < length && space(data[colon]))
+		{
+			colon++;
+		}
+		if (colon < length && data[colon] == ':' && scanValue(data, length, colon + 1, value))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool JsonIndex::scanElement(const char *data, const JsonToken *array, uint32_t *position, JsonToken *element)
+{
+	if (array == NULL || array->type != JSON_TYPE_ARRAY)
+	{
+		return false;
+	}
+	// the closing bracket bounds the elements
+	uint32_t end = array->end - 1;
+	uint32_t p = (*position > array->start) ? *position : array->start + 1;
+	if (!scanValue(data, end, p, element))
+	{
+		return false;
+	}
+	p = (element->type == JSON_TYPE_STRING) ? element->end + 1 : element->end;
+	while (p < end && space(data[p]))
+	{
+		p++;
+	}
+	if (p < end && data[p] == ',')
+	{
+		p++;
+	}
+	*position = p;
+	return true;
+}
@@ -0,0 +1,81 @@
+#ifndef JSON_INDEX_H_
+#define JSON_INDEX_H_
+
+#include <Arduino.h>
+
+#ifndef JSON_INDEX_MAX_TOKENS
+#define JSON_INDEX_MAX_TOKENS 48
+#endif
+#define JSON_INDEX_MAX_DEPTH 16
+#define JSON_INDEX_NUMBER_SIZE 32
+#define JSON_INDEX_NONE -1
+
+#define JSON_ERROR_INVALID -1
+#define JSON_ERROR_TOKENS -2 // more than JSON_INDEX_MAX_TOKENS
+#define JSON_ERROR_DEPTH -3	 // nested deeper than JSON_INDEX_MAX_DEPTH
+
+#define JSON_TYPE_OBJECT 1
+#define JSON_TYPE_ARRAY 2
+#define JSON_TYPE_STRING 3
+#define JSON_TYPE_PRIMITIVE 4 // number, true, false or null
+
+// Strings span the text between the quotes; objects hold key and value tokens alternately.
+struct JsonToken
+{
+	uint32_t start;
+	uint32_t end;
+	uint16_t next; // first token after this one's subtree
+	uint8_t type;
+};
+
+// Token index over a JSON text in the style of jsmn: one pass, no allocation, and the text is
+// referenced rather than copied. Paths such as "sensor.values[2]" are resolved by walking the
+// tokens, skipping whole subtrees through next. The index is sized for JSON_INDEX_MAX_TOKENS, so
+// callers keep one for nested paths or many fields; a single flat key is cheaper through scan().
+class JsonIndex
+{
+private:
+	JsonToken mTokens[JSON_INDEX_MAX_TOKENS];
+	int16_t mCount;
+	const char *mData;
+
+	int16_t child(int16_t parent, const char *key, uint32_t keyLength);
+	int16_t element(int16_t parent, uint32_t index);
+	static bool number(const char *data, const JsonToken *token, char *buffer);
+
+public:
+	JsonIndex();
+
+	// Token count or a JSON_ERROR_*; parsing stops at the first NUL. data must outlive the index
+	int16_t parse(const char *data, uint32_t length);
+	void clear();
+	int16_t getCount();
+
+	// "" is the root; JSON_INDEX_NONE when the path does not resolve
+	int16_t find(const char *path);
+	const JsonToken *getToken(int16_t index);
+	// Elements of an array or members of an object, -1 for other tokens
+	int32_t getLength(int16_t index);
+	int16_t getElement(int16_t index, uint32_t element);
+
+	// Escapes decoded; truncated to bufferSize - 1 and always terminated
+	bool getString(int16_t index, char *buffer, uint32_t bufferSize);
+	bool getInt(int16_t index, int *buffer);
+	bool getFloat(int16_t index, float *buffer);
+	bool getBool(int16_t index, bool *buffer);
+	// Raw token text, not terminated
+	const char *getText(int16_t index, uint32_t *length);
+
+	// Without an index: the value after the first "key": anywhere in the text, the key compared
+	// as written, so keys may contain '.' or '['. Containers are matched but not validated
+	static bool scan(const char *data, uint32_t length, const char *key, JsonToken *value);
+	// Next element of a scanned array; *position starts at 0
+	static bool scanElement(const char *data, const JsonToken *array, uint32_t *position, JsonToken *element);
+	// Token text converted as by the getters above; false for a NULL token
+	static bool decodeString(const char *data, const JsonToken *token, char *buffer, uint32_t bufferSize);
+	static bool decodeInt(const char *data, const JsonToken *token, int *buffer);
+	static bool decodeFloat(const char *data, const JsonToken *token, float *buffer);
+	static bool decodeBool(const char *data, const JsonToken *token, bool *buffer);
+};
+
+#endif
@@ -3,21 +3,174 @@
 Message::Message()
 {
 	this->mPsramEnabled = false;
+	this->mOption = this->mOptionInline;
+	this->mOptionLength = 0;
+	this->mOptionCapacity = MESSAGE_OPTION_INLINE;
+	this->mData = NULL;
+	this->mPool = NULL;
 	this->reset();
 }
 
 Message::~Message()
+{
+	this->release();
+	this->releaseOption();
+}
+
+void Message::enablePsram()
+{
+	this->mPsramEnabled = true;
+}
+
+void Message::setPool(BlockPool *pool)
+{
+	this->reset();
+	this->mPool = pool;
+}
+
+void *Message::acquire(uint32_t size, bool zero)
+{
+	if (this->mPool != NULL)
+	{
+		return this->mPool->allocate(size, zero);
+	}
+	if (this->mPsramEnabled)
+	{
+		return zero ? ps_calloc(size, sizeof(uint8_t)) : ps_malloc(size);
+	}
+	return zero ? calloc(size, sizeof(uint8_t)) : malloc(size);
+}
+
+void Message::dispose(void *block)
+{
+	if (this->mPool != NULL)
+	{
+		this->mPool->release(block);
+	}
+	else
+	{
+		free(block);
+	}
+}
+
+// zero = false for callers that overwrite all size bytes right away; the body is empty on failure
+bool Message::allocate(uint32_t size, bool zero)
+{
+	this->release();
+	this->mData = (uint8_t *)this->acquire(size, zero);
+	this->mSize = (this->mData != NULL) ? size : 0;
+	return this->mData != NULL || size == 0;
+}
+
+void Message::release()
 {
 	if (this->mData != NULL)
 	{
-		free(this->mData);
+		this->dispose(this->mData);
 		this->mData = NULL;
 	}
 }
 
-void Message::enablePsram()
+// Room for length option bytes plus the terminator; the content is kept when moving out of line.
+bool Message::reserveOption(uint32_t length)
 {
-	this->mPsramEnabled = true;
+	if (length < this->mOptionCapacity)
+	{
+		return true;
+	}
+	if (length >= MESSAGE_OPTION_SIZE)
+	{
+		return false;
+	}
+	uint32_t capacity = this->mOptionCapacity * 2;
+	while (capacity <= length)
+	{
+		capacity *= 2;
+	}
+	if (capacity > MESSAGE_OPTION_SIZE)
+	{
+		capacity = MESSAGE_OPTION_SIZE;
+	}
+	char *option = (char *)this->acquire(capacity, false);
+	if (option == NULL)
+	{
+		return false;
+	}
+	memcpy(option, this->mOption, this->mOptionLength + 1);
+	this->releaseOption();
+	this->mOption = option;
+	this->mOptionCapacity = capacity;
+	return true;
+}
+
+void Message::releaseOption()
+{
+	if (this->mOption != this->mOptionInline)
+	{
+		this->dispose(this->mOption);
+		this->mOption = this->mOptionInline;
+		this->mOptionCapacity = MESSAGE_OPTION_INLINE;
+	}
+}
+
+void Message::appendOption(const char *text, uint32_t length)
+{
+	memcpy(this->mOption + this->mOptionLength, text, length);
+	this->mOptionLength += length;
+	this->mOption[this->mOptionLength] = '\0';
+}
+
+// Room must already be reserved. A current index is extended rather than rebuilt on the next lookup.
+void Message::appendEntry(const char *name, uint32_t nameLength, const char *value, uint32_t valueLength)
+{
+	if (this->mOptionLength > 0)
+	{
+		this->appendOption("\r\n", 2);
+	}
+	uint32_t start = this->mOptionLength;
+	this->appendOption(name, nameLength);
+	this->appendOption("=", 1);
+	this->appendOption(value, valueLength);
+
+	if (!this->mOptionIndexed)
+	{
+		return;
+	}
+	if (nameLength > 255 || strpbrk(name, "=\r\n") != NULL || strpbrk(value, "\r\n") != NULL)
+	{
+		// the entry does not parse back as written; let indexOptions decide
+		this->mOptionIndexed = false;
+		return;
+	}
+	if (this->mOptionCount < MESSAGE_MAX_OPTIONS)
+	{
+		this->indexEntry(start, nameLength, valueLength);
+	}
+}
+
+void Message::indexEntry(uint32_t start, uint8_t keyLength, uint16_t valueLength)
+{
+	MessageOption *option = &this->mOptionIndex[this->mOptionCount];
+	option->key = start;
+	option->keyLength = keyLength;
+	option->valueLength = valueLength;
+	option->hash = this->hashKey(this->mOption + start, keyLength);
+
+	// the first occurrence wins, as with a scan
+	int8_t slot = MESSAGE_OPTION_NONE;
+	if (keyLength == 9 && memcmp(this->mOption + start, "data-type", 9) == 0)
+	{
+		slot = MESSAGE_OPTION_DATA_TYPE;
+	}
+	else if (keyLength == 13 && memcmp(this->mOption + start, "last-modified", 13) == 0)
+	{
+		slot = MESSAGE_OPTION_LAST_MODIFIED;
+	}
+	if (slot != MESSAGE_OPTION_NONE && this->mWellKnown[slot] == MESSAGE_OPTION_NONE)
+	{
+		this->mWellKnown[slot] = this->mOptionCount;
+	}
+	this->mOptionCount++;
 }
 
 uint32_t Message::readInt32(uint8_t *src)
@@ -35,117 +188,277 @@ void Message::writeInt32(uint8_t *dst, uint32_t value)
 
 bool Message::getOption(const char *name, char *buffer, uint32_t size)
 {
-	if (this->mOption != NULL)
-	{
-		char key[MESSAGE_KEY_SIZE] = {
-				'\0',
-		};
-		char value[MESSAGE_VALUE_SIZE] = {
-				'\0',
-		};
-		uint8_t t = 0;
-		uint32_t length = strlen(this->mOption);
-		for (uint32_t i = 0, p = 0; i < length; i++)
+	uint32_t length;
+	const char *value = this->getOption(name, &length);
+	if (value == NULL || size == 0)
+	{
+		return false;
+	}
+	if (length >= size)
+	{
+		length = size - 1;
+	}
+	memcpy(buffer, value, length);
+	buffer[length] = '\0';
+	return true;
+}
+
+const char *Message::getOption(const char *name, uint32_t *length)
+{
+	return this->optionValue(this->findOption(name), length);
+}
+
+const char *Message::getDataType(uint32_t *length)
+{
+	if (!this->mOptionIndexed)
+	{
+		this->indexOptions();
+	}
+	return this->optionValue(this->mWellKnown[MESSAGE_OPTION_DATA_TYPE], length);
+}
+
+const char *Message::getLastModified(uint32_t *length)
+{
+	if (!this->mOptionIndexed)
+	{
+		this->indexOptions();
+	}
+	return this->optionValue(this->mWellKnown[MESSAGE_OPTION_LAST_MODIFIED], length);
+}
+
+uint8_t Message::getOptionCount()
+{
+	if (!this->mOptionIndexed)
+	{
+		this->indexOptions();
+	}
+	return this->mOptionCount;
+}
+
+uint16_t Message::hashKey(const char *key, uint32_t length)
+{
+	// FNV-1a folded to 16 bits
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)key[i];
+		hash *= 16777619u;
+	}
+	return (uint16_t)(hash ^ (hash >> 16));
+}
+
+// One pass over the option block: entries are separated by CR/LF and split at the first '='.
+void Message::indexOptions()
+{
+	this->mOptionCount = 0;
+	for (uint8_t i = 0; i < MESSAGE_WELL_KNOWN_OPTIONS; i++)
+	{
+		this->mWellKnown[i] = MESSAGE_OPTION_NONE;
+	}
+
+	uint32_t p = 0;
+	while (p < this->mOptionLength && this->mOptionCount < MESSAGE_MAX_OPTIONS)
+	{
+		uint32_t start = p;
+		while (p < this->mOptionLength && this->mOption[p] != '\r' && this->mOption[p] != '\n')
 		{
-			char c = this->mOption[i];
-			if (c == '=')
-			{
-				t = 1;
-				p = 0;
-			}
-			else if (c == '\r' || i + 1 == length)
-			{
-				if (strcmp(name, key) == 0)
-				{
-					if (i + 1 == length)
-					{
-						value[p] = c;
-					}
-					memset(buffer, 0, size);
-					strncpy(buffer, value, size);
-					return true;
-				}
-				t = 0;
-				p = 0;
-				memset(key, '\0', sizeof(key));
-				memset(value, '\0', sizeof(value));
-				i++;
-			}
-			else
-			{
-				if (t == 0)
-				{
-					key[p] = c;
-					p++;
-				}
-				else if (t == 1)
-				{
-					value[p] = c;
-					p++;
-				}
-			}
+			p++;
+		}
+		uint32_t end = p;
+		while (p < this->mOptionLength && (this->mOption[p] == '\r' || this->mOption[p] == '\n'))
+		{
+			p++;
+		}
+
+		const char *equals = (const char *)memchr(this->mOption + start, '=', end - start);
+		if (equals == NULL || equals - (this->mOption + start) > 255)
+		{
+			continue;
 		}
+		uint32_t keyLength = equals - (this->mOption + start);
+		this->indexEntry(start, keyLength, end - start - keyLength - 1);
 	}
-	return false;
+	this->mOptionIndexed = true;
+}
+
+// Hash and length reject almost every entry before memcmp; the table is a handful of entries.
+int8_t Message::findOption(const char *name)
+{
+	if (!this->mOptionIndexed)
+	{
+		this->indexOptions();
+	}
+	uint32_t length = strlen(name);
+	uint16_t hash = this->hashKey(name, length);
+	for (uint8_t i = 0; i < this->mOptionCount; i++)
+	{
+		MessageOption *option = &this->mOptionIndex[i];
+		if (option->hash == hash && option->keyLength == length && memcmp(this->mOption + option->key, name, length) == 0)
+		{
+			return i;
+		}
+	}
+	return MESSAGE_OPTION_NONE;
+}
+
+const char *Message::optionValue(int8_t index, uint32_t *length)
+{
+	if (index == MESSAGE_OPTION_NONE)
+	{
+		*length = 0;
+		return NULL;
+	}
+	MessageOption *option = &this->mOptionIndex[index];
+	*length = option->valueLength;
+	return this->mOption + option->key + option->keyLength + 1;
 }
 
 size_t Message::getOptionLength()
 {
-	return (this->mOption == NULL) ? 0 : strlen(this->mOption);
+	return this->mOptionLength;
 }
 
-void Message::setOption(const char *name, const char *value)
+const char *Message::getOptions()
 {
-	if (strlen(this->mOption) > 0)
+	return this->mOption;
+}
+
+bool Message::setOption(const char *name, const char *value)
+{
+	uint32_t nameLength = strlen(name);
+	uint32_t valueLength = strlen(value);
+	uint32_t separator = (this->mOptionLength > 0) ? 2 : 0;
+	if (!this->reserveOption(this->mOptionLength + separator + nameLength + 1 + valueLength))
 	{
-		sprintf(this->mOption, "%s\r\n%s=%s", this->mOption, name, value);
+		return false;
 	}
-	else
+	this->appendEntry(name, nameLength, value, valueLength);
+	return true;
+}
+
+bool Message::setOptions(const char *const *names, const char *const *values, uint8_t count)
+{
+	uint32_t nameLengths[MESSAGE_MAX_OPTIONS];
+	uint32_t valueLengths[MESSAGE_MAX_OPTIONS];
+	if (count > MESSAGE_MAX_OPTIONS)
+	{
+		return false;
+	}
+	uint32_t length = this->mOptionLength;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		nameLengths[i] = strlen(names[i]);
+		valueLengths[i] = strlen(values[i]);
+		length += ((length > 0) ? 2 : 0) + nameLengths[i] + 1 + valueLengths[i];
+	}
+	if (!this->reserveOption(length))
 	{
-		sprintf(this->mOption, "%s=%s", name, value);
+		return false;
 	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		this->appendEntry(names[i], nameLengths[i], values[i], valueLengths[i]);
+	}
+	return true;
 }
 
 void Message::setOption(const char *format, ...)
 {
 	va_list va;
 	va_start(va, format);
-	vsnprintf((char *)this->mOption, MESSAGE_OPTION_SIZE, format, va);
+	va_list measure;
+	va_copy(measure, va);
+	int length = vsnprintf(NULL, 0, format, measure);
+	va_end(measure);
+	if (length < 0)
+	{
+		length = 0;
+	}
+	this->mOptionLength = 0;
+	this->mOption[0] = '\0';
+	if (!this->reserveOption(length))
+	{
+		// keeps the part that fits, as before
+		this->reserveOption(MESSAGE_OPTION_SIZE - 1);
+	}
+	vsnprintf(this->mOption, this->mOptionCapacity, format, va);
 	va_end(va);
+	this->mOptionLength = strlen(this->mOption);
+	this->mOptionIndexed = false;
 }
 
-void Message::setLastModified()
+bool Message::setLastModified()
 {
-	this->setLastModified(NULL);
+	return this->setLastModified(NULL);
 }
 
-void Message::setLastModified(const char *value)
+bool Message::setLastModified(const char *value)
 {
 	if (value == NULL)
 	{
-		char str[32] = {
-				0,
-		};
-		time_t now = time(nullptr);
-		struct tm *lt = localtime(&now);
-		sprintf(str, "%04d-%02d-%02d %02d:%02d:%02d",
-						lt->tm_year + 1900,
-						lt->tm_mon + 1,
-						lt->tm_mday,
-						lt->tm_hour,
-						lt->tm_min,
-						lt->tm_sec);
-		this->setOption("last-modified", str);
+		char str[MESSAGE_TIMESTAMP_SIZE];
+		formatTimestamp(str, sizeof(str));
+		return this->setOption("last-modified", str);
 	}
-	else
+	return this->setOption("last-modified", value);
+}
+
+bool Message::setLastModified(Timestamp &timestamp)
+{
+	uint32_t length;
+	return this->setOption("last-modified", timestamp.getText(&length));
+}
+
+bool Message::setLastModifiedMillis(uint64_t epochMs)
+{
+	char str[TIMESTAMP_EPOCH_SIZE];
+	Timestamp::formatEpoch(epochMs, str);
+	return this->setOption("last-modified-ms", str);
+}
+
+bool Message::getLastModifiedMillis(uint64_t *epochMs)
+{
+	uint32_t length;
+	const char *value = this->getOption("last-modified-ms", &length);
+	if (value == NULL || length == 0 || length >= TIMESTAMP_EPOCH_SIZE)
+	{
+		return false;
+	}
+	uint64_t result = 0;
+	for (uint32_t i = 0; i < length; i++)
 	{
-		this->setOption("last-modified", value);
+		if (value[i] < '0' || value[i] > '9')
+		{
+			return false;
+		}
+		result = result * 10 + (value[i] - '0');
 	}
+	*epochMs = result;
+	return true;
 }
 
-void Message::setDataType(const char *value)
+bool Message::setDataType(const char *value)
 {
-	this->setOption("data-type", value);
+	return this->setOption("data-type", value);
+}
+
+// Local time as used by last-modified; returns the length written
+uint32_t Message::formatTimestamp(char *buffer, uint32_t bufferSize)
+{
+	time_t now = time(nullptr);
+	struct tm *lt = localtime(&now);
+	int length = snprintf(buffer, bufferSize, "%04d-%02d-%02d %02d:%02d:%02d",
+												lt->tm_year + 1900,
+												lt->tm_mon + 1,
+												lt->tm_mday,
+												lt->tm_hour,
+												lt->tm_min,
+												lt->tm_sec);
+	if (length < 0)
+	{
+		return 0;
+	}
+	return ((uint32_t)length < bufferSize) ? length : bufferSize - 1;
 }
 
 uint8_t *Message::getData()
@@ -177,146 +490,131 @@ bool Message::getString(char *buffer, uint32_t bufferSize)
 	return false;
 }
 
-// JSON String Format : {"key":"string",..}
-bool Message::getJSON(const char *key, char *buffer, uint32_t bufferSize)
+bool Message::findJSON(const char *key, JsonToken *value)
 {
-	if (this->type == MESSAGE_TYPE_VALUE && this->mData != NULL)
+	if (this->type != MESSAGE_TYPE_VALUE || this->mData == NULL)
 	{
-		const char *data = (char *)this->mData;
-		uint32_t lastIndex = this->mSize - 1;
-		if (data[0] == '{' && data[lastIndex] == '}')
-		{
-			char match[MESSAGE_KEY_SIZE] = {
-					0,
-			};
-			snprintf(match, sizeof(match), "\"%s\":\"", key);
-			char *start = strstr(data, match);
-			if (start)
-			{
-				start += strlen(match);
-				char *end = strchr(start, '"');
-				if (end)
-				{
-					memset(buffer, 0, bufferSize);
-					strncpy(buffer, start, end - start);
-					buffer[end - start] = '\0';
-					return true;
-				}
-			}
-		}
+		return false;
 	}
-	return false;
+	return JsonIndex::scan((const char *)this->mData, this->mSize, key, value);
+}
+
+// JSON String Format : {"key":"string",..}
+bool Message::getJSON(const char *key, char *buffer, uint32_t bufferSize)
+{
+	JsonToken value;
+	return this->findJSON(key, &value) && JsonIndex::decodeString((const char *)this->mData, &value, buffer, bufferSize);
 }
 
 // JSON String Format : {"key":1,..}
 bool Message::getJSON(const char *key, int *buffer)
 {
-	if (this->type == MESSAGE_TYPE_VALUE && this->mData != NULL)
-	{
-		const char *data = (char *)this->mData;
-		uint32_t lastIndex = this->mSize - 1;
-		if (data[0] == '{' && data[lastIndex] == '}')
-		{
-			char match[MESSAGE_KEY_SIZE] = {
-					0,
-			};
-			snprintf(match, sizeof(match), "\"%s\":", key);
-			char *start = strstr(data, match);
-			if (start)
-			{
-				start += strlen(match);
-				*buffer = (int)strtol(start, NULL, 10);
-				return true;
-			}
-		}
-	}
-	return false;
+	JsonToken value;
+	return this->findJSON(key, &value) && JsonIndex::decodeInt((const char *)this->mData, &value, buffer);
 }
 
-// JSON String Format : {"Key":[0, 1, 2 ...], ...}
-bool Message::getJSON(const char *key, int *buffer, uint32_t size)
+// JSON String Format : {"Key":[0, 1, 2 ...], ...}; at most bufferSize elements are stored
+bool Message::getJSON(const char *key, int *buffer, uint32_t bufferSize)
 {
-	if (this->type == MESSAGE_TYPE_VALUE && this->mData != NULL)
+	JsonToken array;
+	if (!this->findJSON(key, &array) || array.type != JSON_TYPE_ARRAY)
 	{
-		const char *data = (char *)this->mData;
-		uint32_t lastIndex = this->mSize - 1;
-		if (data[0] == '{' && data[lastIndex] == '}')
+		return false;
+	}
+	JsonToken element;
+	uint32_t position = 0;
+	for (uint32_t i = 0; i < bufferSize && JsonIndex::scanElement((const char *)this->mData, &array, &position, &element); i++)
+	{
+		if (!JsonIndex::decodeInt((const char *)this->mData, &element, &buffer[i]))
 		{
-			char match[MESSAGE_KEY_SIZE] = {
-					0,
-			};
-			snprintf(match, sizeof(match), "\"%s\":[", key);
-			char *start = strstr(data, match);
-			if (start)
-			{
-				start += strlen(match);
-				char *end = strchr(start, ']');
-				if (end)
-				{
-					char parts[256];
-					strncpy(parts, start, end - start);
-					parts[end - start] = '\0';
-					char *token = strtok(parts, ",");
-					int currentIndex = 0;
-					while (token != NULL)
-					{
-						if (currentIndex < size)
-						{
-							buffer[currentIndex++] = (int)strtol(token, NULL, 10);
-							token = strtok(NULL, ",");
-						}
-					}
-					return true;
-				}
-			}
+			return false;
 		}
 	}
-	return false;
+	return true;
 }
 
 // JSON String Format : {"key":1.25,..}
 bool Message::getJSON(const char *key, float *buffer)
 {
-	if (this->type == MESSAGE_TYPE_VALUE && this->mData != NULL)
+	JsonToken value;
+	return this->findJSON(key, &value) && JsonIndex::decodeFloat((const char *)this->mData, &value, buffer);
+}
+
+bool Message::getJSON(const char *key, float *buffer, uint32_t bufferSize)
+{
+	JsonToken array;
+	if (!this->findJSON(key, &array) || array.type != JSON_TYPE_ARRAY)
 	{
-		const char *data = (char *)this->mData;
-		uint32_t lastIndex = this->mSize - 1;
-		if (data[0] == '{' && data[lastIndex] == '}')
+		return false;
+	}
+	JsonToken element;
+	uint32_t position = 0;
+	for (uint32_t i = 0; i < bufferSize && JsonIndex::scanElement((const char *)this->mData, &array, &position, &element); i++)
+	{
+		if (!JsonIndex::decodeFloat((const char *)this->mData, &element, &buffer[i]))
 		{
-			char match[MESSAGE_KEY_SIZE] = {
-					0,
-			};
-			snprintf(match, sizeof(match), "\"%s\":", key);
-			char *start = strstr(data, match);
-			if (start)
-			{
-				start += strlen(match);
-				*buffer = (float)strtol(start, NULL, 10);
-				return true;
-			}
+			return false;
 		}
 	}
-	return false;
+	return true;
 }
 
-void Message::setData(uint8_t *data, uint32_t dataSize)
+// JSON String Format : {"key":true,..}
+bool Message::getJSON(const char *key, bool *buffer)
 {
-	this->setSize(dataSize, true);
-	memcpy(this->mData, data, dataSize);
+	JsonToken value;
+	return this->findJSON(key, &value) && JsonIndex::decodeBool((const char *)this->mData, &value, buffer);
+}
+
+bool Message::indexJSON(JsonIndex *index)
+{
+	if (this->type != MESSAGE_TYPE_VALUE || this->mData == NULL)
+	{
+		index->clear();
+		return false;
+	}
+	return index->parse((const char *)this->mData, this->mSize) > 0;
+}
+
+bool Message::setData(uint8_t *data, uint32_t dataSize)
+{
+	if (!this->allocate(dataSize, false))
+	{
+		return false;
+	}
+	if (dataSize > 0)
+	{
+		memcpy(this->mData, data, dataSize);
+	}
+	return true;
 }
 
 bool Message::setValue(const char *format, ...)
 {
 	if (this->type == MESSAGE_TYPE_VALUE)
 	{
+		// measured first and formatted straight into the body, capped at MESSAGE_BUFFER_SIZE as before
 		va_list va;
 		va_start(va, format);
-		vsnprintf((char *)this->mBuffer, MESSAGE_BUFFER_SIZE, format, va);
+		va_list measure;
+		va_copy(measure, va);
+		int length = vsnprintf(NULL, 0, format, measure);
+		va_end(measure);
+		if (length < 0)
+		{
+			length = 0;
+		}
+		if (length > MESSAGE_BUFFER_SIZE - 1)
+		{
+			length = MESSAGE_BUFFER_SIZE - 1;
+		}
+		if (!this->allocate(length + 1, false))
+		{
+			va_end(va);
+			return false;
+		}
+		vsnprintf((char *)this->mData, length + 1, format, va);
 		va_end(va);
-
-		uint32_t length = strlen((const char *)this->mBuffer);
-		this->setSize(length + 1, true);
-		memcpy(this->mData, this->mBuffer, length + 1);
 		return true;
 	}
 	return false;
@@ -340,67 +638,72 @@ void Message::setSize(uint32_t size)
 
 void Message::setSize(uint32_t size, bool reallocate)
 {
-	if (reallocate)
+	if (reallocate && !this->allocate(size, true))
 	{
-		if (this->mData != NULL)
-		{
-			free(this->mData);
-		}
-		if (this->mPsramEnabled)
-		{
-			this->mData = (uint8_t *)ps_calloc(size, sizeof(uint8_t));
-		}
-		else
-		{
-			this->mData = (uint8_t *)calloc(size, sizeof(uint8_t));
-		}
+		return;
 	}
 	this->mSize = size;
 }
 
 bool Message::fromPayload(uint8_t *payload, uint32_t payloadSize)
 {
-
-	uint32_t length = 0;
-	uint8_t *p = payload;
-
 	this->reset();
 
-	if (payload[0] == 0xFF && payload[1] == 0xA3)
+	if (payloadSize < MESSAGE_HEADER_SIZE || payload[0] != 0xFF || payload[1] != 0xA3)
 	{
-		this->version = payload[2];
-		this->type = payload[3];
-		p += 4;
-
-		length = this->readInt32(p);
-		p += 4;
-		memcpy(this->mOption, p, length);
-		p += length;
-
-		if (this->type == MESSAGE_TYPE_VALUE)
-		{
-			length = this->readInt32(p);
-			p += 4;
-			this->setSize(length, true);
-			memcpy(this->mData, p, length);
-		}
-		else
+		return this->keepUnknown(payload, payloadSize);
+	}
+	// the option and body lengths come from the sender and are checked against what arrived
+	uint32_t optionLength = this->readInt32(payload + 4);
+	uint32_t left = payloadSize - MESSAGE_HEADER_SIZE;
+	if (optionLength > left)
+	{
+		return this->keepUnknown(payload, payloadSize);
+	}
+	left -= optionLength;
+	uint8_t *p = payload + MESSAGE_HEADER_SIZE + optionLength;
+	uint32_t length = left;
+	if (payload[3] == MESSAGE_TYPE_VALUE)
+	{
+		length = (left >= 4) ? this->readInt32(p) : 0;
+		if (left < 4 || length > left - 4)
 		{
-			length = payloadSize - length;
-			this->setSize(length, true);
-			memcpy(this->mData, p, length);
+			return this->keepUnknown(payload, payloadSize);
 		}
-		return true;
+		p += 4;
 	}
-	else
+
+	this->version = payload[2];
+	this->type = payload[3];
+	uint32_t kept = (optionLength < MESSAGE_OPTION_SIZE) ? optionLength : MESSAGE_OPTION_SIZE - 1;
+	if (this->reserveOption(kept))
+	{
+		memcpy(this->mOption, payload + MESSAGE_HEADER_SIZE, kept);
+		this->mOptionLength = kept;
+		this->mOption[kept] = '\0';
+	}
+	this->indexOptions();
+	if (!this->allocate(length, false))
 	{
-		this->version = 0;
-		this->type = MESSAGE_TYPE_UNKNOWN;
-		this->mOption[0] = '\0';
-		this->setSize(payloadSize, true);
-		memcpy(this->mData, payload, payloadSize);
 		return false;
 	}
+	if (length > 0)
+	{
+		memcpy(this->mData, p, length);
+	}
+	return true;
+}
+
+// Anything that is not a well-formed frame is kept whole, for onUnknownMessage
+bool Message::keepUnknown(uint8_t *payload, uint32_t payloadSize)
+{
+	this->version = 0;
+	this->type = MESSAGE_TYPE_UNKNOWN;
+	if (this->allocate(payloadSize, false) && payloadSize > 0)
+	{
+		memcpy(this->mData, payload, payloadSize);
+	}
+	return false;
 }
 
 uint32_t Message::toPayload(uint8_t *buffer, uint32_t bufferSize)
@@ -409,7 +712,11 @@ uint32_t Message::toPayload(uint8_t *buffer, uint32_t bufferSize)
 	uint32_t length = 0, p = 0;
 	uint32_t size = this->mSize;
 
-	memset(buffer, 0, bufferSize);
+	uint64_t total = (uint64_t)MESSAGE_HEADER_SIZE + this->mOptionLength + ((this->type == MESSAGE_TYPE_VALUE) ? 4 : 0) + size;
+	if (total > bufferSize)
+	{
+		return 0;
+	}
 
 	buffer[0] = 0xFF;
 	buffer[1] = 0xA3;
@@ -417,7 +724,7 @@ uint32_t Message::toPayload(uint8_t *buffer, uint32_t bufferSize)
 	buffer[3] = this->type;
 	p = 4;
 
-	length = strlen(this->mOption);
+	length = this->mOptionLength;
 	this->writeInt32(buffer + p, length);
 	p += 4;
 	memcpy(buffer + p, this->mOption, length);
@@ -444,16 +751,142 @@ uint32_t Message::toPayload(uint8_t *buffer, uint32_t bufferSize)
 	return p;
 }
 
+void Message::beginDecode(uint32_t payloadSize)
+{
+	this->reset();
+	this->mDecodeState = MESSAGE_DECODE_HEADER;
+	this->mDecodePos = 0;
+	this->mDecodeTotal = payloadSize;
+}
+
+void Message::endOption()
+{
+	uint32_t length = (this->mDecodeLength < this->mOptionCapacity) ? this->mDecodeLength : this->mOptionCapacity - 1;
+	this->mOption[length] = '\0';
+	this->mOptionLength = length;
+	this->indexOptions();
+	this->mDecodePos = 0;
+	if (this->type == MESSAGE_TYPE_VALUE)
+	{
+		this->mDecodeState = MESSAGE_DECODE_SIZE;
+	}
+	else
+	{
+		this->mSize = this->mDecodeTotal - MESSAGE_HEADER_SIZE - this->mDecodeLength;
+		this->mDecodeState = MESSAGE_DECODE_BODY;
+	}
+}
+
+// Returns the bytes consumed from chunk; call again with the rest until everything is consumed.
+uint32_t Message::decode(const uint8_t *chunk, uint32_t length, const uint8_t **body, uint32_t *bodyLength)
+{
+	uint32_t p = 0;
+	*bodyLength = 0;
+	while (p < length)
+	{
+		if (this->mDecodeState == MESSAGE_DECODE_HEADER)
+		{
+			if ((this->mDecodePos == 0 && chunk[p] != 0xFF) || (this->mDecodePos == 1 && chunk[p] != 0xA3))
+			{
+				// not a framed Message: everything is body, including a consumed 0xFF
+				this->version = 0;
+				this->type = MESSAGE_TYPE_UNKNOWN;
+				this->mSize = this->mDecodeTotal;
+				this->mDecodeState = MESSAGE_DECODE_RAW;
+				if (this->mDecodePos == 1)
+				{
+					*body = this->mHeader;
+					*bodyLength = 1;
+					return p;
+				}
+				continue;
+			}
+			this->mHeader[this->mDecodePos++] = chunk[p++];
+			if (this->mDecodePos == MESSAGE_HEADER_SIZE)
+			{
+				this->version = this->mHeader[2];
+				this->type = this->mHeader[3];
+				this->mDecodeLength = this->readInt32(this->mHeader + 4);
+				this->mDecodePos = 0;
+				this->mDecodeState = MESSAGE_DECODE_OPTION;
+				// anything past MESSAGE_OPTION_SIZE is skipped
+				this->reserveOption((this->mDecodeLength < MESSAGE_OPTION_SIZE) ? this->mDecodeLength : MESSAGE_OPTION_SIZE - 1);
+				if (this->mDecodeLength == 0)
+				{
+					this->endOption();
+				}
+			}
+		}
+		else if (this->mDecodeState == MESSAGE_DECODE_OPTION)
+		{
+			uint32_t n = this->mDecodeLength - this->mDecodePos;
+			if (n > length - p)
+			{
+				n = length - p;
+			}
+			if (this->mDecodePos < this->mOptionCapacity - 1u)
+			{
+				uint32_t copy = this->mOptionCapacity - 1 - this->mDecodePos;
+				memcpy(this->mOption + this->mDecodePos, chunk + p, (copy < n) ? copy : n);
+			}
+			this->mDecodePos += n;
+			p += n;
+			if (this->mDecodePos == this->mDecodeLength)
+			{
+				this->endOption();
+			}
+		}
+		else if (this->mDecodeState == MESSAGE_DECODE_SIZE)
+		{
+			this->mHeader[this->mDecodePos++] = chunk[p++];
+			if (this->mDecodePos == 4)
+			{
+				this->mSize = this->readInt32(this->mHeader);
+				this->mDecodePos = 0;
+				this->mDecodeState = MESSAGE_DECODE_BODY;
+			}
+		}
+		else
+		{
+			uint32_t n = length - p;
+			if (this->mDecodeState == MESSAGE_DECODE_BODY && n > this->mSize - this->mDecodePos)
+			{
+				n = this->mSize - this->mDecodePos;
+			}
+			this->mDecodePos += n;
+			*body = chunk + p;
+			*bodyLength = n;
+			return length;
+		}
+	}
+	return p;
+}
+
+// Frame prefix (magic, version, type, option length) for publishing the parts without toPayload
+uint32_t Message::toHeader(uint8_t *buffer)
+{
+	buffer[0] = 0xFF;
+	buffer[1] = 0xA3;
+	buffer[2] = this->version;
+	buffer[3] = this->type;
+	this->writeInt32(buffer + 4, this->mOptionLength);
+	return MESSAGE_HEADER_SIZE;
+}
+
 void Message::reset()
 {
 	this->version = MESSAGE_VERSION;
 	this->type = MESSAGE_TYPE_VALUE;
+	this->releaseOption();
 	this->mOption[0] = '\0';
-	this->mBuffer[0] = '\0';
-	if (this->mData != NULL)
+	this->mOptionLength = 0;
+	// an empty block is trivially indexed, so the publish path appends straight into the index
+	this->mOptionCount = 0;
+	for (uint8_t i = 0; i < MESSAGE_WELL_KNOWN_OPTIONS; i++)
 	{
-		free(this->mData);
-		this->mData = NULL;
+		this->mWellKnown[i] = MESSAGE_OPTION_NONE;
 	}
+	this->mOptionIndexed = true;
+	this->release();
 	this->mSize = 0;
 }
\ No newline at end of file
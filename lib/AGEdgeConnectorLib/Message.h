@@ -3,24 +3,84 @@
 
 #include <Arduino.h>
 #include "time.h"
+#include "BlockPool.h"
+#include "Timestamp.h"
+#include "JsonIndex.h"
 
 #define MESSAGE_VERSION 1
 #define MESSAGE_TYPE_UNKNOWN 0
 #define MESSAGE_TYPE_VALUE 1
 #define MESSAGE_TYPE_MAP 2
-#define MESSAGE_OPTION_SIZE 1024
+#define MESSAGE_OPTION_SIZE 1024 // upper bound, terminator included
+#ifndef MESSAGE_OPTION_INLINE
+#define MESSAGE_OPTION_INLINE 96 // last-modified and data-type fit without overflow storage
+#endif
 #define MESSAGE_BUFFER_SIZE 1024
+#ifndef MESSAGE_MAX_OPTIONS
+#define MESSAGE_MAX_OPTIONS 16 // indexed entries; later ones are only reachable through getOptions()
+#endif
+#define MESSAGE_OPTION_NONE -1
+#define MESSAGE_OPTION_DATA_TYPE 0
+#define MESSAGE_OPTION_LAST_MODIFIED 1
+#define MESSAGE_WELL_KNOWN_OPTIONS 2
+#define MESSAGE_TIMESTAMP_SIZE TIMESTAMP_TEXT_SIZE
 #define MESSAGE_KEY_SIZE 64
 #define MESSAGE_VALUE_SIZE 256
+#define MESSAGE_HEADER_SIZE 8
+
+#define MESSAGE_DECODE_HEADER 0
+#define MESSAGE_DECODE_OPTION 1
+#define MESSAGE_DECODE_SIZE 2
+#define MESSAGE_DECODE_BODY 3
+#define MESSAGE_DECODE_RAW 4
+
+// One "key=value" entry of the option block; the value starts right after the '='
+struct MessageOption
+{
+	uint16_t key;
+	uint16_t valueLength;
+	uint16_t hash;
+	uint8_t keyLength;
+};
 
 class Message
 {
 private:
 	bool mPsramEnabled;
-	char mOption[MESSAGE_OPTION_SIZE];
-	char mBuffer[MESSAGE_BUFFER_SIZE];
+	// options live inline until they outgrow it, then in a pool or heap block
+	char *mOption;
+	uint16_t mOptionLength;
+	uint16_t mOptionCapacity;
+	char mOptionInline[MESSAGE_OPTION_INLINE];
+	MessageOption mOptionIndex[MESSAGE_MAX_OPTIONS];
+	uint8_t mOptionCount;
+	bool mOptionIndexed; // false after local edits until the next lookup
+	int8_t mWellKnown[MESSAGE_WELL_KNOWN_OPTIONS];
 	uint8_t *mData;
 	uint32_t mSize;
+	BlockPool *mPool;
+
+	uint8_t mHeader[MESSAGE_HEADER_SIZE];
+	uint8_t mDecodeState;
+	uint32_t mDecodePos;
+	uint32_t mDecodeLength;
+	uint32_t mDecodeTotal;
+	void endOption();
+	void *acquire(uint32_t size, bool zero);
+	void dispose(void *block);
+	bool allocate(uint32_t size, bool zero);
+	void release();
+	bool keepUnknown(uint8_t *payload, uint32_t payloadSize);
+	bool reserveOption(uint32_t length);
+	void releaseOption();
+	void appendOption(const char *text, uint32_t length);
+	void appendEntry(const char *name, uint32_t nameLength, const char *value, uint32_t valueLength);
+	void indexEntry(uint32_t start, uint8_t keyLength, uint16_t valueLength);
+	uint16_t hashKey(const char *key, uint32_t length);
+	void indexOptions();
+	int8_t findOption(const char *name);
+	const char *optionValue(int8_t index, uint32_t *length);
+	bool findJSON(const char *key, JsonToken *value);
 
 public:
 	uint8_t version;
@@ -30,37 +90,70 @@ public:
 	~Message();
 
 	void enablePsram();
+	// Body and overflow option storage come from the pool instead of the heap; NULL goes back to
+	// malloc/free. Clears the message
+	void setPool(BlockPool *pool);
 
 	uint32_t readInt32(uint8_t *src);
 	void writeInt32(uint8_t *dst, uint32_t value);
 
 	bool getOption(const char *name, char *buffer, uint32_t bufferSize);
+	// Views into the option block, not terminated; NULL when the option is absent
+	const char *getOption(const char *name, uint32_t *length);
+	const char *getDataType(uint32_t *length);
+	const char *getLastModified(uint32_t *length);
+	uint8_t getOptionCount();
 	// uint32_t getOptionLength();
 	size_t getOptionLength();
+	const char *getOptions();
 
-	void setOption(const char *name, const char *value);
+	// Appends to the option block; false, and nothing written, when it would exceed MESSAGE_OPTION_SIZE
+	bool setOption(const char *name, const char *value);
+	// All count entries or none, with a single capacity check
+	bool setOptions(const char *const *names, const char *const *values, uint8_t count);
 	void setOption(const char *format, ...);
 
-	void setLastModified();
-	void setLastModified(const char *value);
-	void setDataType(const char *value);
+	bool setLastModified();
+	bool setLastModified(const char *value);
+	// Cached text instead of a localtime() and format per call
+	bool setLastModified(Timestamp &timestamp);
+	// last-modified-ms: milliseconds since 1970, for consumers that do not parse the text
+	bool setLastModifiedMillis(uint64_t epochMs);
+	bool getLastModifiedMillis(uint64_t *epochMs);
+	bool setDataType(const char *value);
+	static uint32_t formatTimestamp(char *buffer, uint32_t bufferSize);
 
 	uint8_t *getData();
 	bool getString(char *buffer, uint32_t bufferSize);
+	// The first "key": in the body, the key taken as written. No index is kept, so every call scans the
+	// body again; to parse once and read many fields, use indexJSON with a caller-owned JsonIndex
 	bool getJSON(const char *key, char *buffer, uint32_t bufferSize);
 	bool getJSON(const char *key, int *buffer);
 	bool getJSON(const char *key, int *buffer, uint32_t bufferSize);
 	bool getJSON(const char *key, float *buffer);
-
-	void setData(uint8_t *data, uint32_t dataSize);
+	bool getJSON(const char *key, float *buffer, uint32_t bufferSize);
+	bool getJSON(const char *key, bool *buffer);
+	// Tokenizes the body into the caller's index, for nested paths such as "sensor.values[2]" or
+	// many fields; valid until the body changes. false when the body is not JSON or has too many tokens
+	bool indexJSON(JsonIndex *index);
+
+	// false, with an empty body, when the body cannot be allocated
+	bool setData(uint8_t *data, uint32_t dataSize);
 	bool setValue(const char *format, ...);
 
 	uint32_t getSize();
 	void setSize(uint32_t size);
 	void setSize(uint32_t size, bool reallocate);
 
+	// false for anything but a well-formed frame, which is then kept whole as an unknown message
 	bool fromPayload(uint8_t *payload, uint32_t payloadSize);
+	// 0 when the frame does not fit bufferSize
 	uint32_t toPayload(uint8_t *buffer, uint32_t bufferSize);
+	uint32_t toHeader(uint8_t *buffer);
+
+	// Incremental fromPayload for payloads delivered in chunks; the body is handed back, not stored
+	void beginDecode(uint32_t payloadSize);
+	uint32_t decode(const uint8_t *chunk, uint32_t length, const uint8_t **body, uint32_t *bodyLength);
 
 	void reset();
 };
@@ -0,0 +1,156 @@
+#include "Metrics.h"
+
+static const uint32_t bucketLimits[METRICS_BUCKETS] = {100, 1000, 10000, 100000, 1000000, 10000000, 0xFFFFFFFFUL};
+
+Metrics::Metrics()
+{
+	this->reset();
+}
+
+void Metrics::reset()
+{
+	for (uint8_t i = 0; i < METRICS_COUNTERS; i++)
+	{
+		this->mCounters[i].store(0, std::memory_order_relaxed);
+	}
+	for (uint8_t i = 0; i < METRICS_PACKET_TYPES; i++)
+	{
+		this->mPacketsIn[i].store(0, std::memory_order_relaxed);
+		this->mPacketsOut[i].store(0, std::memory_order_relaxed);
+	}
+	for (uint8_t i = 0; i < METRICS_HISTOGRAMS; i++)
+	{
+		for (uint8_t b = 0; b < METRICS_BUCKETS; b++)
+		{
+			this->mHistograms[i].buckets[b].store(0, std::memory_order_relaxed);
+		}
+		this->mHistograms[i].count.store(0, std::memory_order_relaxed);
+		this->mHistograms[i].max.store(0, std::memory_order_relaxed);
+	}
+}
+
+void Metrics::increment(uint8_t counter, uint32_t value)
+{
+	if (counter < METRICS_COUNTERS)
+	{
+		this->mCounters[counter].fetch_add(value, std::memory_order_relaxed);
+	}
+}
+
+void Metrics::packetIn(uint8_t header)
+{
+	this->mPacketsIn[header >> 4].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::packetOut(uint8_t header)
+{
+	this->mPacketsOut[header >> 4].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::record(uint8_t histogram, uint32_t duration)
+{
+	if (histogram >= METRICS_HISTOGRAMS)
+	{
+		return;
+	}
+	MetricsHistogram *h = &this->mHistograms[histogram];
+	uint8_t bucket = 0;
+	while (duration > bucketLimits[bucket])
+	{
+		bucket++;
+	}
+	h->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	h->count.fetch_add(1, std::memory_order_relaxed);
+	uint32_t max = h->max.load(std::memory_order_relaxed);
+	while (duration > max && !h->max.compare_exchange_weak(max, duration, std::memory_order_relaxed))
+	{
+	}
+}
+
+uint32_t Metrics::getCounter(uint8_t counter)
+{
+	return (counter < METRICS_COUNTERS) ? this->mCounters[counter].load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t Metrics::getPacketsIn(uint8_t type)
+{
+	return (type < METRICS_PACKET_TYPES) ? this->mPacketsIn[type].load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t Metrics::getPacketsOut(uint8_t type)
+{
+	return (type < METRICS_PACKET_TYPES) ? this->mPacketsOut[type].load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t Metrics::getBucket(uint8_t histogram, uint8_t bucket)
+{
+	if (histogram >= METRICS_HISTOGRAMS || bucket >= METRICS_BUCKETS)
+	{
+		return 0;
+	}
+	return this->mHistograms[histogram].buckets[bucket].load(std::memory_order_relaxed);
+}
+
+uint32_t Metrics::getCount(uint8_t histogram)
+{
+	return (histogram < METRICS_HISTOGRAMS) ? this->mHistograms[histogram].count.load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t Metrics::getMax(uint8_t histogram)
+{
+	return (histogram < METRICS_HISTOGRAMS) ? this->mHistograms[histogram].max.load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t Metrics::getBucketLimit(uint8_t bucket)
+{
+	return (bucket < METRICS_BUCKETS) ? bucketLimits[bucket] : 0;
+}
+
+// {"c":[counters],"i":[packets in by type],"o":[packets out by type],"h":[[count,max,buckets...],...]}
+size_t Metrics::format(char *buffer, size_t size)
+{
+	size_t p = 0;
+	int n;
+
+#define METRICS_APPEND(...)                                 \
+	n = snprintf(buffer + p, size - p, __VA_ARGS__);          \
+	if (n < 0 || (size_t)n >= size - p)                       \
+	{                                                         \
+		return 0;                                               \
+	}                                                         \
+	p += n;
+
+	if (size == 0)
+	{
+		return 0;
+	}
+	METRICS_APPEND("{\"c\":[")
+	for (uint8_t i = 0; i < METRICS_COUNTERS; i++)
+	{
+		METRICS_APPEND("%s%lu", i ? "," : "", (unsigned long)this->getCounter(i))
+	}
+	METRICS_APPEND("],\"i\":[")
+	for (uint8_t i = 0; i < METRICS_PACKET_TYPES; i++)
+	{
+		METRICS_APPEND("%s%lu", i ? "," : "", (unsigned long)this->getPacketsIn(i))
+	}
+	METRICS_APPEND("],\"o\":[")
+	for (uint8_t i = 0; i < METRICS_PACKET_TYPES; i++)
+	{
+		METRICS_APPEND("%s%lu", i ? "," : "", (unsigned long)this->getPacketsOut(i))
+	}
+	METRICS_APPEND("],\"h\":[")
+	for (uint8_t i = 0; i < METRICS_HISTOGRAMS; i++)
+	{
+		METRICS_APPEND("%s[%lu,%lu", i ? "," : "", (unsigned long)this->getCount(i), (unsigned long)this->getMax(i))
+		for (uint8_t b = 0; b < METRICS_BUCKETS; b++)
+		{
+			METRICS_APPEND(",%lu", (unsigned long)this->getBucket(i, b))
+		}
+		METRICS_APPEND("]")
+	}
+	METRICS_APPEND("]}")
+
+#undef METRICS_APPEND
+	return p;
+}
@@ -0,0 +1,66 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <Arduino.h>
+#include <atomic>
+
+#define METRICS_BYTES_IN 0
+#define METRICS_BYTES_OUT 1
+#define METRICS_PUBLISH_FAILURES 2
+#define METRICS_DROPPED_PACKETS 3
+#define METRICS_CONNECTS 4
+#define METRICS_CONNECT_FAILURES 5
+#define METRICS_DISCONNECTS 6
+#define METRICS_QUEUE_DROPS 7 // threaded mode ring overflows
+#define METRICS_DISPATCH_TRUNCATED 8 // matching handlers skipped past CONNECTOR_MAX_DISPATCH
+#define METRICS_COUNTERS 9
+
+#define METRICS_CONNECT_TIME 0
+#define METRICS_CALLBACK_TIME 1
+#define METRICS_LOOP_TIME 2
+#define METRICS_HISTOGRAMS 3
+
+#define METRICS_PACKET_TYPES 16
+#define METRICS_BUCKETS 7 // 100us, 1ms, 10ms, 100ms, 1s, 10s, more
+
+struct MetricsHistogram
+{
+	std::atomic<uint32_t> buckets[METRICS_BUCKETS];
+	std::atomic<uint32_t> count;
+	std::atomic<uint32_t> max;
+};
+
+// Counters and histograms are 32-bit atomics updated with relaxed ordering, so they can be
+// bumped from the network code and read from anywhere without a lock.
+class Metrics
+{
+private:
+	std::atomic<uint32_t> mCounters[METRICS_COUNTERS];
+	std::atomic<uint32_t> mPacketsIn[METRICS_PACKET_TYPES];
+	std::atomic<uint32_t> mPacketsOut[METRICS_PACKET_TYPES];
+	MetricsHistogram mHistograms[METRICS_HISTOGRAMS];
+
+public:
+	Metrics();
+
+	void increment(uint8_t counter, uint32_t value = 1);
+	// header is the first byte of an MQTT packet
+	void packetIn(uint8_t header);
+	void packetOut(uint8_t header);
+	// duration in microseconds
+	void record(uint8_t histogram, uint32_t duration);
+	void reset();
+
+	uint32_t getCounter(uint8_t counter);
+	uint32_t getPacketsIn(uint8_t type);
+	uint32_t getPacketsOut(uint8_t type);
+	uint32_t getBucket(uint8_t histogram, uint8_t bucket);
+	uint32_t getCount(uint8_t histogram);
+	uint32_t getMax(uint8_t histogram);
+	uint32_t getBucketLimit(uint8_t bucket);
+
+	// Compact JSON snapshot; returns the length written (0 if it did not fit)
+	size_t format(char *buffer, size_t size);
+};
+
+#endif
@@ -6,26 +6,105 @@ MqttClient::MqttClient()
     this->_client = NULL;
     this->stream = NULL;
     setCallback(NULL);
+    setSubackCallback(NULL);
+    setChunkCallbacks(NULL, NULL, NULL);
+    this->buffer = NULL;
     this->bufferSize = 0;
+    this->bufferOwned = true;
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
     this->mReadTimeoutEnabled = true;
+    resetReceive();
+    this->inflightCount = 0;
+    this->inboundCount = 0;
+    this->inflightWindow = MQTT_INFLIGHT_WINDOW;
+    this->publishRemaining = 0;
+    this->txScratchUsed = 0;
+    this->txPacketLength = 0;
+    this->txPacketSent = 0;
+    this->txBuffer = NULL;
+    this->txSize = 0;
+    this->txUsed = 0;
+    this->txMaxDelay = 0;
+    this->txFlushOnLoop = true;
+    this->txSegments = 0;
+    this->txFlushes = 0;
+    this->txFlushedBytes = 0;
+    this->inflightStore = NULL;
+    this->inflightStoreSize = 0;
+    this->inflightStoreUsed = 0;
+    this->inflightStoreGrows = true;
+    this->ackCount = 0;
+    this->ackLatency = 0;
+    this->ackLatencyMax = 0;
+    this->ackLatencyTotal = 0;
+    this->connectState = MQTT_CONNECT_STATE_IDLE;
+    setConnectBudget(MQTT_CONNECT_BUDGET);
+    this->metrics = NULL;
+    this->pingSentAt = 0;
+    this->pingJitter = 0;
+    this->pingRtt = 0;
+    this->pingRttMax = 0;
+    this->pingCount = 0;
+    memset(this->pingHistogram, 0, sizeof(this->pingHistogram));
 }
 
 MqttClient::MqttClient(Client &client)
 {
     this->_state = MQTT_DISCONNECTED;
     setClient(client);
+    setSubackCallback(NULL);
+    setChunkCallbacks(NULL, NULL, NULL);
     this->stream = NULL;
+    this->buffer = NULL;
     this->bufferSize = 0;
+    this->bufferOwned = true;
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
     this->mReadTimeoutEnabled = true;
+    resetReceive();
+    this->inflightCount = 0;
+    this->inboundCount = 0;
+    this->inflightWindow = MQTT_INFLIGHT_WINDOW;
+    this->publishRemaining = 0;
+    this->txScratchUsed = 0;
+    this->txPacketLength = 0;
+    this->txPacketSent = 0;
+    this->txBuffer = NULL;
+    this->txSize = 0;
+    this->txUsed = 0;
+    this->txMaxDelay = 0;
+    this->txFlushOnLoop = true;
+    this->txSegments = 0;
+    this->txFlushes = 0;
+    this->txFlushedBytes = 0;
+    this->inflightStore = NULL;
+    this->inflightStoreSize = 0;
+    this->inflightStoreUsed = 0;
+    this->inflightStoreGrows = true;
+    this->ackCount = 0;
+    this->ackLatency = 0;
+    this->ackLatencyMax = 0;
+    this->ackLatencyTotal = 0;
+    this->connectState = MQTT_CONNECT_STATE_IDLE;
+    setConnectBudget(MQTT_CONNECT_BUDGET);
+    this->metrics = NULL;
+    this->pingSentAt = 0;
+    this->pingJitter = 0;
+    this->pingRtt = 0;
+    this->pingRttMax = 0;
+    this->pingCount = 0;
+    memset(this->pingHistogram, 0, sizeof(this->pingHistogram));
 }
 
 MqttClient::~MqttClient()
 {
-    free(this->buffer);
+    if (this->bufferOwned)
+    {
+        free(this->buffer);
+    }
+    free(this->inflightStore);
+    free(this->txBuffer);
 }
 
 boolean MqttClient::connect(const char *id)
@@ -51,6 +130,69 @@ boolean MqttClient::connect(const char *id, const char *user, const char *pass,
 boolean MqttClient::connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, boolean willRetain, const char *willMessage, boolean cleanSession)
 {
     if (!connected())
+    {
+        if (!beginConnect(id, user, pass, willTopic, willQos, willRetain, willMessage, cleanSession))
+        {
+            return false;
+        }
+        while (connecting())
+        {
+            if (!connectStep())
+            {
+                yield();
+            }
+        }
+        return connected();
+    }
+    return true;
+}
+
+boolean MqttClient::beginConnect(const char *id, const char *user, const char *pass)
+{
+    return beginConnect(id, user, pass, 0, 0, 0, 0, 1);
+}
+
+boolean MqttClient::beginConnect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, boolean willRetain, const char *willMessage, boolean cleanSession)
+{
+    if (connected())
+    {
+        return true;
+    }
+    this->connectId = id;
+    this->connectUser = user;
+    this->connectPass = pass;
+    this->connectWillTopic = willTopic;
+    this->connectWillQos = willQos;
+    this->connectWillRetain = willRetain;
+    this->connectWillMessage = willMessage;
+    this->connectCleanSession = cleanSession;
+    this->connectState = MQTT_CONNECT_STATE_TCP;
+
+    // stable per-device offset so a fleet sharing a keep-alive does not ping in lockstep
+    uint32_t hash = 2166136261u;
+    for (const char *p = id; p != NULL && *p; p++)
+    {
+        hash ^= (uint8_t)*p;
+        hash *= 16777619u;
+    }
+    uint32_t spread = this->keepAlive * 1000UL / MQTT_PING_JITTER_DIVISOR;
+    this->pingJitter = (spread == 0) ? 0 : hash % spread;
+    return true;
+}
+
+boolean MqttClient::connecting()
+{
+    return this->connectState != MQTT_CONNECT_STATE_IDLE && this->connectState != MQTT_CONNECT_STATE_CONNECTED;
+}
+
+// Advances the connect state machine by one step.
+// Returns true when the next step can run immediately, false when waiting or finished.
+// Only the TCP step can block (see beginConnect); CONNACK bytes are collected across calls.
+boolean MqttClient::connectStep()
+{
+    switch (this->connectState)
+    {
+    case MQTT_CONNECT_STATE_TCP:
     {
         int result = 0;
         if (_client->connected())
@@ -70,294 +212,572 @@ boolean MqttClient::connect(const char *id, const char *user, const char *pass,
         }
         if (result == 1)
         {
-            nextMsgId = 1;
-            uint32_t length = MQTT_MAX_HEADER_SIZE;
-            unsigned int j;
-
-            uint8_t d[7] = {0x00, 0x04, 'M', 'Q', 'T', 'T', MQTT_VERSION};
-            for (j = 0; j < MQTT_HEADER_VERSION_LENGTH; j++)
+            this->connectState = MQTT_CONNECT_STATE_SEND;
+            return true;
+        }
+        _state = MQTT_CONNECT_FAILED;
+        this->connectState = MQTT_CONNECT_STATE_IDLE;
+        return false;
+    }
+    case MQTT_CONNECT_STATE_SEND:
+        resetReceive();
+        this->txUsed = 0;
+        if (!sendConnect() || !flushTransmit())
+        {
+            this->connectState = MQTT_CONNECT_STATE_IDLE;
+            return false;
+        }
+        lastInActivity = lastOutActivity = millis();
+        this->connectState = MQTT_CONNECT_STATE_CONNACK;
+        return true;
+    case MQTT_CONNECT_STATE_CONNACK:
+    {
+        uint8_t llen;
+        uint32_t len = readPacket(&llen);
+        if (len == 0)
+        {
+            unsigned long t = millis();
+            if (!_client->connected())
             {
-                this->buffer[length++] = d[j];
+                _state = MQTT_CONNECTION_LOST;
+                this->connectState = MQTT_CONNECT_STATE_IDLE;
             }
-
-            uint8_t v;
-            if (willTopic)
+            else if (t - lastInActivity >= ((int32_t)this->socketTimeout * 1000UL))
             {
-                v = 0x04 | (willQos << 3) | (willRetain << 5);
+                _state = MQTT_CONNECTION_TIMEOUT;
+                _client->stop();
+                this->connectState = MQTT_CONNECT_STATE_IDLE;
             }
-            else
+            return false;
+        }
+
+        if (len == 4)
+        {
+            if (buffer[3] == 0)
             {
-                v = 0x00;
+                lastInActivity = millis();
+                pingOutstanding = false;
+                _state = MQTT_CONNECTED;
+                this->connectState = MQTT_CONNECT_STATE_CONNECTED;
+                boolean sessionPresent = (buffer[2] & 0x01) != 0;
+                if (!sessionPresent)
+                {
+                    // no session present: the broker forgot pending QoS 2 receipts
+                    this->inboundCount = 0;
+                }
+                resendInflight(sessionPresent);
+                flush();
+                return false;
             }
-            if (cleanSession)
+            else
             {
-                v = v | 0x02;
+                _state = buffer[3];
             }
+        }
+        _client->stop();
+        this->connectState = MQTT_CONNECT_STATE_IDLE;
+        return false;
+    }
+    default:
+        return false;
+    }
+}
 
-            if (user != NULL)
-            {
-                v = v | 0x80;
+boolean MqttClient::sendConnect()
+{
+    const char *id = this->connectId;
+    const char *user = this->connectUser;
+    const char *pass = this->connectPass;
+    const char *willTopic = this->connectWillTopic;
+    const char *willMessage = this->connectWillMessage;
 
-                if (pass != NULL)
-                {
-                    v = v | (0x80 >> 1);
-                }
-            }
-            this->buffer[length++] = v;
+    if (this->inflightCount == 0)
+    {
+        nextMsgId = 1;
+    }
+    // protocol name and level, flags, keep-alive
+    uint32_t length = MQTT_MAX_HEADER_SIZE + MQTT_HEADER_VERSION_LENGTH + 3;
+
+    uint8_t v;
+    if (willTopic)
+    {
+        v = 0x04 | (this->connectWillQos << 3) | (this->connectWillRetain << 5);
+    }
+    else
+    {
+        v = 0x00;
+    }
+    if (this->connectCleanSession)
+    {
+        v = v | 0x02;
+    }
 
-            this->buffer[length++] = ((this->keepAlive) >> 8);
-            this->buffer[length++] = ((this->keepAlive) & 0xFF);
+    if (user != NULL)
+    {
+        v = v | 0x80;
+
+        if (pass != NULL)
+        {
+            v = v | (0x80 >> 1);
+        }
+    }
 
-            CHECK_STRING_LENGTH(length, id)
-            length = writeString(id, this->buffer, length);
-            if (willTopic)
+    CHECK_STRING_LENGTH(length, id)
+    length += 2 + strlen(id);
+    if (willTopic)
+    {
+        CHECK_STRING_LENGTH(length, willTopic)
+        length += 2 + strlen(willTopic);
+        CHECK_STRING_LENGTH(length, willMessage)
+        length += 2 + strlen(willMessage);
+    }
+    if (user != NULL)
+    {
+        CHECK_STRING_LENGTH(length, user)
+        length += 2 + strlen(user);
+        if (pass != NULL)
+        {
+            CHECK_STRING_LENGTH(length, pass)
+            length += 2 + strlen(pass);
+        }
+    }
+
+    const uint8_t d[MQTT_HEADER_VERSION_LENGTH + 3] = {0x00, 0x04, 'M', 'Q', 'T', 'T', MQTT_VERSION, v, (uint8_t)(this->keepAlive >> 8), (uint8_t)(this->keepAlive & 0xFF)};
+    beginPacket(MQTTCONNECT, length - MQTT_MAX_HEADER_SIZE);
+    appendPacket(d, sizeof(d));
+    appendString(id);
+    if (willTopic)
+    {
+        appendString(willTopic);
+        appendString(willMessage);
+    }
+    if (user != NULL)
+    {
+        appendString(user);
+        if (pass != NULL)
+        {
+            appendString(pass);
+        }
+    }
+    return endPacket();
+}
+
+void MqttClient::resetReceive()
+{
+    this->rxHead = 0;
+    this->rxTail = 0;
+    this->rxState = MQTT_RX_STATE_HEADER;
+    this->rxStreaming = false;
+}
+
+uint32_t MqttClient::fillReceive()
+{
+    uint32_t total = 0;
+    while (this->rxTail - this->rxHead < MQTT_RX_BUFFER_SIZE)
+    {
+        int available = _client->available();
+        if (available <= 0)
+        {
+            break;
+        }
+        uint32_t offset = this->rxTail & (MQTT_RX_BUFFER_SIZE - 1);
+        uint32_t space = MQTT_RX_BUFFER_SIZE - (this->rxTail - this->rxHead);
+        if (space > MQTT_RX_BUFFER_SIZE - offset)
+        {
+            space = MQTT_RX_BUFFER_SIZE - offset;
+        }
+        if (space > (uint32_t)available)
+        {
+            space = available;
+        }
+        int n = _client->read(this->rxRing + offset, space);
+        if (n <= 0)
+        {
+            break;
+        }
+        this->rxTail += n;
+        total += n;
+    }
+    if (total > 0)
+    {
+        this->rxActivityAt = millis();
+        if (this->metrics != NULL)
+        {
+            this->metrics->increment(METRICS_BYTES_IN, total);
+        }
+    }
+    return total;
+}
+
+// Consumes buffered bytes; returns true once a whole packet has been parsed into buffer.
+boolean MqttClient::parseReceive(uint32_t *length, uint8_t *lengthLength)
+{
+    while (this->rxHead != this->rxTail)
+    {
+        uint32_t offset = this->rxHead & (MQTT_RX_BUFFER_SIZE - 1);
+        if (this->rxState == MQTT_RX_STATE_HEADER)
+        {
+            this->buffer[0] = this->rxRing[offset];
+            this->rxHead++;
+            this->rxIndex = 1;
+            this->rxLength = 0;
+            this->rxMultiplier = 1;
+            this->rxActivityAt = millis();
+            this->rxState = MQTT_RX_STATE_LENGTH;
+        }
+        else if (this->rxState == MQTT_RX_STATE_LENGTH)
+        {
+            if (this->rxIndex == 5)
             {
-                CHECK_STRING_LENGTH(length, willTopic)
-                length = writeString(willTopic, this->buffer, length);
-                CHECK_STRING_LENGTH(length, willMessage)
-                length = writeString(willMessage, this->buffer, length);
+                _state = MQTT_DISCONNECTED;
+                _client->stop();
+                resetReceive();
+                return false;
             }
-
-            if (user != NULL)
+            uint8_t digit = this->rxRing[offset];
+            this->rxHead++;
+            this->buffer[this->rxIndex++] = digit;
+            this->rxLength += (digit & 127) * this->rxMultiplier;
+            this->rxMultiplier <<= 7;
+            if ((digit & 128) == 0)
             {
-                CHECK_STRING_LENGTH(length, user)
-                length = writeString(user, this->buffer, length);
-                if (pass != NULL)
-                {
-                    CHECK_STRING_LENGTH(length, pass)
-                    length = writeString(pass, this->buffer, length);
-                }
+                this->rxLengthLength = this->rxIndex - 1;
+                this->rxReceived = 0;
+                this->rxPayloadStart = 0;
+                this->rxState = MQTT_RX_STATE_BODY;
+                // PUBLISH too large for buffer: hand the payload to the chunk callbacks instead of dropping it.
+                // Not QoS 2: its id is only remembered once complete, so a redelivery after a drop mid-packet
+                // would be announced again.
+                this->rxStreaming = chunkData && (this->buffer[0] & 0xF0) == MQTTPUBLISH && (this->buffer[0] & 0x06) != MQTTQOS2 &&
+                                    1 + this->rxLengthLength + this->rxLength > this->bufferSize;
             }
+        }
+        else
+        {
+            bool isPublish = (this->buffer[0] & 0xF0) == MQTTPUBLISH;
+            uint32_t n = this->rxTail - this->rxHead;
+            if (n > MQTT_RX_BUFFER_SIZE - offset)
+            {
+                n = MQTT_RX_BUFFER_SIZE - offset;
+            }
+            if (n > this->rxLength - this->rxReceived)
+            {
+                n = this->rxLength - this->rxReceived;
+            }
+            if (isPublish && this->rxReceived < 2 && n > 2 - this->rxReceived)
+            {
+                // topic length first, so the payload offset is known
+                n = 2 - this->rxReceived;
+            }
+            if (this->rxStreaming && this->rxReceived < this->rxPayloadStart && n > this->rxPayloadStart - this->rxReceived)
+            {
+                n = this->rxPayloadStart - this->rxReceived;
+            }
+            const uint8_t *src = this->rxRing + offset;
+            bool chunk = this->rxStreaming && this->rxPayloadStart > 0 && this->rxReceived >= this->rxPayloadStart;
 
-            write(MQTTCONNECT, this->buffer, length - MQTT_MAX_HEADER_SIZE);
-
-            lastInActivity = lastOutActivity = millis();
-
-            while (!_client->available())
+            if (this->stream && isPublish && this->rxPayloadStart > 0 && this->rxReceived + n > this->rxPayloadStart)
+            {
+                uint32_t skip = (this->rxReceived < this->rxPayloadStart) ? this->rxPayloadStart - this->rxReceived : 0;
+                this->stream->write(src + skip, n - skip);
+            }
+            if (chunk)
             {
-                unsigned long t = millis();
-                if (t - lastInActivity >= ((int32_t)this->socketTimeout * 1000UL))
+                chunkData(this->rxReceived - this->rxPayloadStart, src, n);
+            }
+            else if (this->rxIndex < this->bufferSize)
+            {
+                uint32_t copy = this->bufferSize - this->rxIndex;
+                if (copy > n)
                 {
-                    _state = MQTT_CONNECTION_TIMEOUT;
-                    _client->stop();
-                    return false;
+                    copy = n;
                 }
+                memcpy(this->buffer + this->rxIndex, src, copy);
+                this->rxIndex += copy;
             }
-            uint8_t llen;
-            uint32_t len = readPacket(&llen);
+            this->rxHead += n;
+            this->rxReceived += n;
 
-            if (len == 4)
+            if (isPublish && this->rxPayloadStart == 0 && this->rxReceived == 2)
             {
-                if (buffer[3] == 0)
+                uint32_t llen = this->rxLengthLength;
+                this->rxPayloadStart = 2 + ((this->buffer[llen + 1] << 8) + this->buffer[llen + 2]);
+                if (this->buffer[0] & 0x06)
                 {
-                    lastInActivity = millis();
-                    pingOutstanding = false;
-                    _state = MQTT_CONNECTED;
-                    return true;
+                    // skip message id
+                    this->rxPayloadStart += 2;
                 }
-                else
+                if (this->rxStreaming && 1 + llen + this->rxPayloadStart > this->bufferSize)
                 {
-                    _state = buffer[3];
+                    // the topic itself does not fit
+                    this->rxStreaming = false;
                 }
             }
-            _client->stop();
+            if (this->rxStreaming && !chunk && this->rxPayloadStart > 0 && this->rxReceived == this->rxPayloadStart)
+            {
+                beginChunk();
+            }
         }
-        else
+
+        if (this->rxState == MQTT_RX_STATE_BODY && this->rxReceived == this->rxLength && this->metrics != NULL)
         {
-            _state = MQTT_CONNECT_FAILED;
+            this->metrics->packetIn(this->buffer[0]);
+        }
+        if (this->rxState == MQTT_RX_STATE_BODY && this->rxReceived == this->rxLength && this->rxStreaming)
+        {
+            endChunk();
+            *lengthLength = this->rxLengthLength;
+            *length = 0;
+            this->rxState = MQTT_RX_STATE_HEADER;
+            return true;
+        }
+        if (this->rxState == MQTT_RX_STATE_BODY && this->rxReceived == this->rxLength)
+        {
+            *lengthLength = this->rxLengthLength;
+            *length = this->rxIndex;
+            if (!this->stream && 1 + this->rxLengthLength + this->rxLength > this->bufferSize)
+            {
+                *length = 0;
+                if (this->metrics != NULL)
+                {
+                    this->metrics->increment(METRICS_DROPPED_PACKETS);
+                }
+            }
+            this->rxState = MQTT_RX_STATE_HEADER;
+            return true;
         }
-        return false;
     }
-    return true;
+    return false;
 }
 
-boolean MqttClient::readByte(uint8_t *result)
+// Topic and packet id are complete in buffer; announce the streamed PUBLISH.
+void MqttClient::beginChunk()
 {
-
-    if (this->mReadTimeoutEnabled)
+    uint32_t llen = this->rxLengthLength;
+    uint32_t tl = (this->buffer[llen + 1] << 8) + this->buffer[llen + 2];
+    uint8_t qos = this->buffer[0] & 0x06;
+    this->rxMsgId = 0;
+    if (qos != MQTTQOS0)
     {
-        uint32_t previousMillis = millis();
-        while (!_client->available())
-        {
-            yield();
-            uint32_t currentMillis = millis();
-            if (currentMillis - previousMillis >= ((int32_t)this->socketTimeout * 1000))
-            {
-                return false;
-            }
-        }
+        this->rxMsgId = (this->buffer[llen + 3 + tl] << 8) + this->buffer[llen + 3 + tl + 1];
     }
-    else
+    memmove(this->buffer + llen + 2, this->buffer + llen + 3, tl);
+    this->buffer[llen + 2 + tl] = 0;
+    if (chunkBegin)
     {
-        if (_client->available() == 0)
-        {
-            return false;
-        }
+        chunkBegin((char *)this->buffer + llen + 2, this->rxLength - this->rxPayloadStart);
     }
-    *result = _client->read();
-    return true;
 }
 
-boolean MqttClient::readByte(uint8_t *result, uint32_t *index)
+void MqttClient::endChunk()
 {
-    uint32_t current_index = *index;
-    uint8_t *write_address = &(result[current_index]);
-    if (readByte(write_address))
+    if (chunkEnd)
     {
-        *index = current_index + 1;
-        return true;
+        chunkEnd();
     }
-    return false;
+    if ((this->buffer[0] & 0x06) == MQTTQOS1)
+    {
+        writeAck(MQTTPUBACK, this->rxMsgId);
+    }
+    lastInActivity = millis();
 }
 
+// Never waits: returns 0 while a packet is still arriving and resumes it on the next call.
+// A packet that stalls for socketTimeout fails the link (unless the read timeout is disabled).
 uint32_t MqttClient::readPacket(uint8_t *lengthLength)
 {
     uint32_t len = 0;
-    if (!readByte(this->buffer, &len))
-        return 0;
-
-    bool isPublish = (this->buffer[0] & 0xF0) == MQTTPUBLISH;
-    uint32_t multiplier = 1;
-    uint32_t length = 0;
-    uint8_t digit = 0;
-    uint32_t skip = 0;
-    uint32_t start = 0;
-
-    do
-    {
-        if (len == 5)
-        {
-            _state = MQTT_DISCONNECTED;
-            _client->stop();
-            return 0;
-        }
-        if (!readByte(&digit))
-            return 0;
-        this->buffer[len++] = digit;
-        length += (digit & 127) * multiplier;
-        multiplier <<= 7;
-    } while ((digit & 128) != 0);
-    *lengthLength = len - 1;
-
-    if (isPublish)
-    {
-        if (!readByte(this->buffer, &len))
-            return 0;
-        if (!readByte(this->buffer, &len))
-            return 0;
-        skip = (this->buffer[*lengthLength + 1] << 8) + this->buffer[*lengthLength + 2];
-        start = 2;
-        if (this->buffer[0] & MQTTQOS1)
-        {
-            // skip message id
-            skip += 2;
-        }
-    }
-    uint32_t idx = len;
-
-    for (uint32_t i = start; i < length; i++)
+    while (!parseReceive(&len, lengthLength))
     {
-        if (!readByte(&digit))
-            return 0;
-        if (this->stream)
+        if (fillReceive() == 0)
         {
-            if (isPublish && idx - *lengthLength - 2 > skip)
+            if (this->mReadTimeoutEnabled && this->rxState != MQTT_RX_STATE_HEADER && _client->connected() &&
+                millis() - this->rxActivityAt >= ((int32_t)this->socketTimeout * 1000UL))
             {
-                this->stream->write(digit);
+                _state = MQTT_CONNECTION_TIMEOUT;
+                _client->stop();
+                resetReceive();
             }
+            return 0;
         }
-
-        if (len < this->bufferSize)
-        {
-            this->buffer[len] = digit;
-            len++;
-        }
-        idx++;
     }
+    return len;
+}
 
-    if (!this->stream && idx > this->bufferSize)
+// The flush policy is applied before anything can drop the link and again on the way out,
+// so a due packet is neither held back by an early return nor lost to a timeout
+boolean MqttClient::loop()
+{
+    flushDue();
+    boolean alive = poll();
+    flushDue();
+    return alive;
+}
+
+void MqttClient::flushDue()
+{
+    if (this->txUsed > 0 && (this->txFlushOnLoop || millis() - this->txFirstAt >= this->txMaxDelay))
     {
-        len = 0;
+        flush();
     }
-    return len;
 }
 
-boolean MqttClient::loop()
+boolean MqttClient::poll()
 {
+    if (connecting())
+    {
+        unsigned long started = millis();
+        while (connectStep() && millis() - started < this->connectBudget)
+        {
+            yield();
+        }
+        return connected();
+    }
     if (connected())
     {
         unsigned long t = millis();
-        if ((t - lastInActivity > this->keepAlive * 1000UL) || (t - lastOutActivity > this->keepAlive * 1000UL))
+        unsigned long keepAliveMillis = this->keepAlive * 1000UL;
+        if (pingOutstanding)
         {
-            if (pingOutstanding)
+            // Any inbound byte after the PINGREQ proves the link, even mid-packet: a large PUBLISH can hold the
+            // PINGRESP back for longer than the learned bound. Only silence past that bound is fatal.
+            unsigned long timeout = getPingTimeout();
+            unsigned long waited = t - this->pingSentAt;
+            unsigned long silent = t - this->rxActivityAt;
+            if (waited > timeout && silent > timeout)
             {
                 this->_state = MQTT_CONNECTION_TIMEOUT;
                 _client->stop();
                 return false;
             }
-            else
+        }
+        else if (keepAliveMillis > 0)
+        {
+            // The broker needs a packet from us every keepAlive and we need one from it to know the link is up;
+            // application traffic in both directions covers both, so no ping is sent. The jitter was drawn for
+            // the keepAlive at connect time and may exceed a lower one set since.
+            unsigned long interval = (this->pingJitter < keepAliveMillis) ? keepAliveMillis - this->pingJitter : keepAliveMillis;
+            if (t - lastOutActivity >= interval || t - lastInActivity >= interval)
             {
-                this->buffer[0] = MQTTPINGREQ;
-                this->buffer[1] = 0;
-                _client->write(this->buffer, 2);
+                beginPacket(MQTTPINGREQ, 0);
+                endPacket();
+                flushTransmit();
                 lastOutActivity = t;
-                lastInActivity = t;
+                this->pingSentAt = t;
                 pingOutstanding = true;
             }
         }
-        if (_client->available())
+        uint8_t llen;
+        uint32_t len = readPacket(&llen);
+        uint16_t msgId = 0;
+        uint8_t *payload;
+        if (len > 0)
         {
-            uint8_t llen;
-            uint32_t len = readPacket(&llen);
-            uint16_t msgId = 0;
-            uint8_t *payload;
-            if (len > 0)
+            lastInActivity = t;
+            uint8_t type = this->buffer[0] & 0xF0;
+            if (type == MQTTPUBLISH)
             {
-                lastInActivity = t;
-                uint8_t type = this->buffer[0] & 0xF0;
-                if (type == MQTTPUBLISH)
+                uint8_t qos = this->buffer[0] & 0x06;
+                uint32_t tl = (this->buffer[llen + 1] << 8) + this->buffer[llen + 2];
+                memmove(this->buffer + llen + 2, this->buffer + llen + 3, tl);
+                this->buffer[llen + 2 + tl] = 0;
+                char *topic = (char *)this->buffer + llen + 2;
+                if (qos == MQTTQOS0)
                 {
+                    payload = this->buffer + llen + 3 + tl;
                     if (callback)
                     {
-                        uint32_t tl = (this->buffer[llen + 1] << 8) + this->buffer[llen + 2];
-                        memmove(this->buffer + llen + 2, this->buffer + llen + 3, tl);
-                        this->buffer[llen + 2 + tl] = 0;
-                        char *topic = (char *)this->buffer + llen + 2;
-                        if ((this->buffer[0] & 0x06) == MQTTQOS1)
+                        callback(topic, payload, len - llen - 3 - tl);
+                    }
+                }
+                else
+                {
+                    msgId = (this->buffer[llen + 3 + tl] << 8) + this->buffer[llen + 3 + tl + 1];
+                    payload = this->buffer + llen + 3 + tl + 2;
+                    if (qos == MQTTQOS1)
+                    {
+                        if (callback)
                         {
-                            msgId = (this->buffer[llen + 3 + tl] << 8) + this->buffer[llen + 3 + tl + 1];
-                            payload = this->buffer + llen + 3 + tl + 2;
                             callback(topic, payload, len - llen - 3 - tl - 2);
-
-                            this->buffer[0] = MQTTPUBACK;
-                            this->buffer[1] = 2;
-                            this->buffer[2] = (msgId >> 8);
-                            this->buffer[3] = (msgId & 0xFF);
-                            _client->write(this->buffer, 4);
-                            lastOutActivity = t;
                         }
-                        else
+                        writeAck(MQTTPUBACK, msgId);
+                    }
+                    else if (findInbound(msgId) >= 0)
+                    {
+                        // redelivery of a message already handed to the callback
+                        writeAck(MQTTPUBREC, msgId);
+                    }
+                    else if (this->inboundCount < MQTT_MAX_INBOUND)
+                    {
+                        // no PUBREC when the table is full; the broker redelivers later
+                        this->inbound[this->inboundCount++] = msgId;
+                        if (callback)
                         {
-                            payload = this->buffer + llen + 3 + tl;
-                            callback(topic, payload, len - llen - 3 - tl);
+                            callback(topic, payload, len - llen - 3 - tl - 2);
                         }
+                        writeAck(MQTTPUBREC, msgId);
                     }
                 }
-                else if (type == MQTTPINGREQ)
+            }
+            else if (type == MQTTPUBACK || type == MQTTPUBCOMP)
+            {
+                if (len >= 4)
                 {
-                    this->buffer[0] = MQTTPINGRESP;
-                    this->buffer[1] = 0;
-                    _client->write(this->buffer, 2);
+                    ackInflight((this->buffer[2] << 8) + this->buffer[3], (type == MQTTPUBACK) ? MQTT_INFLIGHT_PUBACK : MQTT_INFLIGHT_PUBCOMP);
                 }
-                else if (type == MQTTPINGRESP)
+            }
+            else if (type == MQTTPUBREC)
+            {
+                if (len >= 4)
                 {
-                    pingOutstanding = false;
+                    msgId = (this->buffer[2] << 8) + this->buffer[3];
+                    int index = findInflight(msgId);
+                    if (index >= 0 && this->inflight[index].state == MQTT_INFLIGHT_PUBREC)
+                    {
+                        trimInflight(index);
+                        this->inflight[index].state = MQTT_INFLIGHT_PUBCOMP;
+                    }
+                    writeAck(MQTTPUBREL | MQTTQOS1, msgId);
                 }
             }
-            else if (!connected())
+            else if (type == MQTTPUBREL)
             {
-                return false;
+                if (len >= 4)
+                {
+                    msgId = (this->buffer[2] << 8) + this->buffer[3];
+                    int index = findInbound(msgId);
+                    if (index >= 0)
+                    {
+                        this->inbound[index] = this->inbound[--this->inboundCount];
+                    }
+                    writeAck(MQTTPUBCOMP, msgId);
+                }
             }
+            else if (type == MQTTSUBACK)
+            {
+                if (subackCallback && len > (uint32_t)llen + 3)
+                {
+                    msgId = (this->buffer[llen + 1] << 8) + this->buffer[llen + 2];
+                    subackCallback(msgId, this->buffer + llen + 3, len - llen - 3);
+                }
+            }
+            else if (type == MQTTPINGREQ)
+            {
+                beginPacket(MQTTPINGRESP, 0);
+                endPacket();
+            }
+            else if (type == MQTTPINGRESP)
+            {
+                if (pingOutstanding)
+                {
+                    recordPing(millis() - this->pingSentAt);
+                }
+                pingOutstanding = false;
+            }
+        }
+        else if (!connected())
+        {
+            return false;
         }
         return true;
     }
@@ -383,25 +803,20 @@ boolean MqttClient::publish(const char *topic, const uint8_t *payload, unsigned
 {
     if (connected())
     {
-        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, this->bufferSize) + plength)
+        uint32_t tlen = strnlen(topic, this->bufferSize);
+        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + tlen + plength)
         {
             return false;
         }
-        uint32_t length = MQTT_MAX_HEADER_SIZE;
-        length = writeString(topic, this->buffer, length);
-
-        uint32_t i;
-        for (i = 0; i < plength; i++)
-        {
-            this->buffer[length++] = payload[i];
-        }
-
-        uint32_t header = MQTTPUBLISH;
+        uint8_t header = MQTTPUBLISH;
         if (retained)
         {
             header |= 1;
         }
-        return write(header, this->buffer, length - MQTT_MAX_HEADER_SIZE);
+        beginPacket(header, 2 + tlen + plength);
+        appendString(topic);
+        appendPacket(payload, plength);
+        return endPacket();
     }
     return false;
 }
@@ -411,163 +826,345 @@ boolean MqttClient::publish(const char *topic, uint8_t *head, unsigned int headl
     if (connected())
     {
         uint32_t plength = headlength + bodylength;
-        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, this->bufferSize) + plength)
+        uint32_t tlen = strnlen(topic, this->bufferSize);
+        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + tlen + plength)
         {
             return false;
         }
-        uint32_t length = MQTT_MAX_HEADER_SIZE;
-        length = writeString(topic, this->buffer, length);
+        uint8_t header = MQTTPUBLISH;
+        if (retained)
+        {
+            header |= 1;
+        }
+        beginPacket(header, 2 + tlen + plength);
+        appendString(topic);
+        appendPacket(head, headlength);
+        appendPacket(body, bodylength);
+        return endPacket();
+    }
+    return false;
+}
 
-        uint32_t i;
-        for (i = 0; i < headlength; i++)
+// Fixed header and topic are gathered; the segments go to the client as they are, whatever their size.
+boolean MqttClient::publish(const char *topic, const MqttSegment *segments, uint8_t count, boolean retained)
+{
+    if (connected())
+    {
+        uint32_t tlen = strnlen(topic, this->bufferSize);
+        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + tlen)
         {
-            this->buffer[length++] = head[i];
+            return false;
         }
-        for (i = 0; i < bodylength; i++)
+        uint32_t plength = 0;
+        uint8_t i;
+        for (i = 0; i < count; i++)
         {
-            yield();
-            this->buffer[length++] = body[i];
+            plength += segments[i].length;
         }
-
         uint8_t header = MQTTPUBLISH;
         if (retained)
         {
             header |= 1;
         }
-        return write(header, this->buffer, length - MQTT_MAX_HEADER_SIZE);
+        beginPacket(header, 2 + tlen + plength);
+        appendString(topic);
+        for (i = 0; i < count; i++)
+        {
+            appendSegment(segments[i].data, segments[i].length);
+        }
+        return endPacket();
     }
     return false;
 }
 
-boolean MqttClient::publish_P(const char *topic, const char *payload, boolean retained)
+boolean MqttClient::publish(const char *topic, const uint8_t *payload, unsigned int plength, boolean retained, uint8_t qos)
 {
-    return publish_P(topic, (const uint8_t *)payload, payload ? strnlen(payload, this->bufferSize) : 0, retained);
+    MqttSegment segment = {payload, plength};
+    return publish(topic, &segment, 1, retained, qos);
 }
 
-boolean MqttClient::publish_P(const char *topic, const uint8_t *payload, unsigned int plength, boolean retained)
+// QoS 1/2: the packet is serialized into the retransmission store and stays there until PUBACK or PUBREC.
+// Returns false when the window or the store is full, or when a short write dropped the connection.
+boolean MqttClient::publish(const char *topic, const MqttSegment *segments, uint8_t count, boolean retained, uint8_t qos)
 {
-    uint8_t llen = 0;
-    uint8_t digit;
-    unsigned int rc = 0;
-    uint32_t tlen;
-    unsigned int pos = 0;
-    unsigned int i;
-    uint8_t header;
-    unsigned int len;
-    int expectedLength;
-
-    if (!connected())
+    if (qos == 0)
+    {
+        return publish(topic, segments, count, retained);
+    }
+    if (qos > 2 || !connected())
     {
         return false;
     }
-
-    tlen = strnlen(topic, this->bufferSize);
-
-    header = MQTTPUBLISH;
-    if (retained)
+    if (this->inflightCount >= this->inflightWindow)
     {
-        header |= 1;
+        return false;
+    }
+    uint32_t tlen = strnlen(topic, this->bufferSize);
+    if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + tlen)
+    {
+        return false;
+    }
+    uint32_t plength = 0;
+    uint8_t i;
+    for (i = 0; i < count; i++)
+    {
+        plength += segments[i].length;
+    }
+    uint32_t remaining = 2 + tlen + 2 + plength;
+    uint32_t total = 1 + remaining;
+    uint32_t len = remaining;
+    do
+    {
+        len >>= 7;
+        total++;
+    } while (len > 0);
+    if (this->inflightStoreUsed + total > this->inflightStoreSize && !growInflight(this->inflightStoreUsed + total))
+    {
+        return false;
     }
-    this->buffer[pos++] = header;
-    len = plength + 2 + tlen;
+
+    uint8_t *packet = this->inflightStore + this->inflightStoreUsed;
+    uint32_t pos = 0;
+    packet[pos++] = MQTTPUBLISH | (qos << 1) | (retained ? 1 : 0);
+    len = remaining;
     do
     {
-        digit = len & 127;
+        uint8_t digit = len & 127;
         len >>= 7;
         if (len > 0)
         {
             digit |= 0x80;
         }
-        this->buffer[pos++] = digit;
-        llen++;
+        packet[pos++] = digit;
     } while (len > 0);
+    pos = writeString(topic, packet, pos);
+    uint16_t msgId = nextPacketId();
+    packet[pos++] = (msgId >> 8);
+    packet[pos++] = (msgId & 0xFF);
+    for (i = 0; i < count; i++)
+    {
+        memcpy(packet + pos, segments[i].data, segments[i].length);
+        pos += segments[i].length;
+    }
 
-    pos = writeString(topic, this->buffer, pos);
+    MqttInflight *entry = &this->inflight[this->inflightCount++];
+    entry->msgId = msgId;
+    entry->state = (qos == 1) ? MQTT_INFLIGHT_PUBACK : MQTT_INFLIGHT_PUBREC;
+    entry->offset = this->inflightStoreUsed;
+    entry->length = total;
+    entry->sentAt = millis();
+    this->inflightStoreUsed += total;
+
+    // a partial PUBLISH would desync the stream, so a short write drops the link; the entry stays stored
+    // and goes out again after the next connect
+    countPacket(packet[0]);
+    if (send(packet, total) != total)
+    {
+        _state = MQTT_CONNECTION_LOST;
+        _client->stop();
+        return false;
+    }
+    lastOutActivity = millis();
+    return true;
+}
 
-    rc += _client->write(this->buffer, pos);
+boolean MqttClient::publish_P(const char *topic, const char *payload, boolean retained)
+{
+    return publish_P(topic, (const uint8_t *)payload, payload ? strnlen(payload, this->bufferSize) : 0, retained);
+}
 
-    for (i = 0; i < plength; i++)
+boolean MqttClient::publish_P(const char *topic, const uint8_t *payload, unsigned int plength, boolean retained)
+{
+    if (!connected())
+    {
+        return false;
+    }
+
+    uint32_t tlen = strnlen(topic, this->bufferSize);
+    uint8_t header = MQTTPUBLISH;
+    if (retained)
+    {
+        header |= 1;
+    }
+    beginPacket(header, plength + 2 + tlen);
+    appendString(topic);
+    for (unsigned int i = 0; i < plength; i++)
     {
-        rc += _client->write((char)pgm_read_byte_near(payload + i));
+        uint8_t data = pgm_read_byte_near(payload + i);
+        appendPacket(&data, 1);
     }
-
-    lastOutActivity = millis();
-
-    expectedLength = 1 + llen + 2 + tlen + plength;
-
-    return (rc == expectedLength);
+    return endPacket();
 }
 
 boolean MqttClient::beginPublish(const char *topic, unsigned int plength, boolean retained)
 {
     if (connected())
     {
-        uint32_t length = MQTT_MAX_HEADER_SIZE;
-        length = writeString(topic, this->buffer, length);
         uint8_t header = MQTTPUBLISH;
         if (retained)
         {
             header |= 1;
         }
-        size_t hlen = buildHeader(header, this->buffer, plength + length - MQTT_MAX_HEADER_SIZE);
-        uint32_t rc = _client->write(this->buffer + (MQTT_MAX_HEADER_SIZE - hlen), length - (MQTT_MAX_HEADER_SIZE - hlen));
-        lastOutActivity = millis();
-        return (rc == (length - (MQTT_MAX_HEADER_SIZE - hlen)));
+        // the packet head only; the payload follows through write()
+        beginPacket(header, 2 + strlen(topic) + plength);
+        this->txPacketLength -= plength;
+        appendString(topic);
+        boolean rc = endPacket();
+        this->publishRemaining = plength;
+        return rc;
     }
     return false;
 }
 
+// A payload shorter than announced by beginPublish leaves the broker waiting mid-packet,
+// so the connection is dropped in that case.
 int MqttClient::endPublish()
 {
-    return 1;
+    if (this->publishRemaining > 0)
+    {
+        this->publishRemaining = 0;
+        this->txUsed = 0;
+        _state = MQTT_CONNECTION_LOST;
+        _client->stop();
+        return 0;
+    }
+    return flushTransmit() ? 1 : 0;
+}
+
+// Every outgoing byte goes through here; with coalescing enabled it is staged until flush().
+size_t MqttClient::send(const uint8_t *data, size_t length)
+{
+    if (this->txSize == 0)
+    {
+        this->txSegments++;
+        return transmit(data, length);
+    }
+    if (this->txUsed + length > this->txSize)
+    {
+        flush();
+    }
+    if (length >= this->txSize)
+    {
+        this->txSegments++;
+        return transmit(data, length);
+    }
+    if (this->txUsed == 0)
+    {
+        this->txFirstAt = millis();
+    }
+    memcpy(this->txBuffer + this->txUsed, data, length);
+    this->txUsed += length;
+    return length;
+}
+
+void MqttClient::flush()
+{
+    flushTransmit();
+}
+
+boolean MqttClient::flushTransmit()
+{
+    if (this->txUsed == 0)
+    {
+        return true;
+    }
+    uint32_t used = this->txUsed;
+    this->txUsed = 0;
+    this->txSegments++;
+    this->txFlushes++;
+    this->txFlushedBytes += used;
+    return (transmit(this->txBuffer, used) == used);
+}
+
+size_t MqttClient::transmit(const uint8_t *data, size_t length)
+{
+    size_t rc = _client->write(data, length);
+    if (this->metrics != NULL)
+    {
+        this->metrics->increment(METRICS_BYTES_OUT, rc);
+    }
+    return rc;
 }
 
 size_t MqttClient::write(uint8_t data)
 {
-    lastOutActivity = millis();
-    return _client->write(data);
+    return write(&data, 1);
 }
 
 size_t MqttClient::write(const uint8_t *buffer, size_t size)
 {
     lastOutActivity = millis();
-    return _client->write(buffer, size);
+    size_t rc = send(buffer, size);
+    this->publishRemaining = (rc < this->publishRemaining) ? this->publishRemaining - rc : 0;
+    return rc;
 }
 
-size_t MqttClient::buildHeader(uint8_t header, uint8_t *buf, uint32_t length)
+void MqttClient::beginPacket(uint8_t header, uint32_t length)
 {
-    uint8_t lenBuf[4];
-    uint8_t llen = 0;
-    uint8_t digit;
-    uint8_t pos = 0;
+    countPacket(header);
+    this->txScratchUsed = 0;
+    this->txPacketSent = 0;
+    this->txScratch[this->txScratchUsed++] = header;
     uint32_t len = length;
     do
     {
-        digit = len & 127;
+        uint8_t digit = len & 127;
         len >>= 7;
         if (len > 0)
         {
             digit |= 0x80;
         }
-        lenBuf[pos++] = digit;
-        llen++;
+        this->txScratch[this->txScratchUsed++] = digit;
     } while (len > 0);
+    this->txPacketLength = this->txScratchUsed + length;
+}
+
+void MqttClient::appendPacket(const uint8_t *data, uint32_t length)
+{
+    if (this->txScratchUsed + length > MQTT_TX_SCRATCH_SIZE && this->txScratchUsed > 0)
+    {
+        this->txPacketSent += send(this->txScratch, this->txScratchUsed);
+        this->txScratchUsed = 0;
+    }
+    if (length > MQTT_TX_SCRATCH_SIZE)
+    {
+        this->txPacketSent += send(data, length);
+        return;
+    }
+    memcpy(this->txScratch + this->txScratchUsed, data, length);
+    this->txScratchUsed += length;
+}
 
-    buf[4 - llen] = header;
-    for (int i = 0; i < llen; i++)
+void MqttClient::appendSegment(const uint8_t *data, uint32_t length)
+{
+    if (this->txScratchUsed > 0)
+    {
+        this->txPacketSent += send(this->txScratch, this->txScratchUsed);
+        this->txScratchUsed = 0;
+    }
+    if (length > 0)
     {
-        buf[MQTT_MAX_HEADER_SIZE - llen + i] = lenBuf[i];
+        this->txPacketSent += send(data, length);
     }
-    return llen + 1;
 }
 
-boolean MqttClient::write(uint8_t header, uint8_t *buf, uint32_t length)
+void MqttClient::appendString(const char *string)
 {
-    uint32_t rc;
-    uint8_t hlen = buildHeader(header, buf, length);
-    rc = _client->write(buf + (MQTT_MAX_HEADER_SIZE - hlen), length + hlen);
+    uint32_t length = strlen(string);
+    const uint8_t prefix[2] = {(uint8_t)(length >> 8), (uint8_t)(length & 0xFF)};
+    appendPacket(prefix, 2);
+    appendPacket((const uint8_t *)string, length);
+}
+
+boolean MqttClient::endPacket()
+{
+    if (this->txScratchUsed > 0)
+    {
+        this->txPacketSent += send(this->txScratch, this->txScratchUsed);
+        this->txScratchUsed = 0;
+    }
     lastOutActivity = millis();
-    return (rc == hlen + length);
+    return (this->txPacketSent == this->txPacketLength);
 }
 
 boolean MqttClient::subscribe(const char *topic)
@@ -577,69 +1174,256 @@ boolean MqttClient::subscribe(const char *topic)
 
 boolean MqttClient::subscribe(const char *topic, uint8_t qos)
 {
-    uint32_t topicLength = strnlen(topic, this->bufferSize);
-    if (topic == 0)
+    return subscribe(&topic, &qos, 1, NULL);
+}
+
+// Packs every filter into one SUBSCRIBE; msgId (optional) receives the id the SUBACK will carry.
+boolean MqttClient::subscribe(const char **topics, const uint8_t *qos, uint8_t count, uint16_t *msgId)
+{
+    if (count == 0)
     {
         return false;
     }
-    if (qos > 1)
+    uint32_t length = MQTT_MAX_HEADER_SIZE + 2;
+    uint8_t i;
+    for (i = 0; i < count; i++)
     {
-        return false;
+        if (topics[i] == 0 || qos[i] > 2)
+        {
+            return false;
+        }
+        length += 2 + strnlen(topics[i], this->bufferSize) + 1;
     }
-    if (this->bufferSize < 9 + topicLength)
+    if (this->bufferSize < length)
     {
         return false;
     }
     if (connected())
     {
-        uint32_t length = MQTT_MAX_HEADER_SIZE;
-        nextMsgId++;
-        if (nextMsgId == 0)
+        uint16_t id = nextPacketId();
+        const uint8_t packetId[2] = {(uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+        beginPacket(MQTTSUBSCRIBE | MQTTQOS1, length - MQTT_MAX_HEADER_SIZE);
+        appendPacket(packetId, 2);
+        for (i = 0; i < count; i++)
         {
-            nextMsgId = 1;
+            appendString(topics[i]);
+            appendPacket(&qos[i], 1);
+        }
+        if (msgId != NULL)
+        {
+            *msgId = id;
         }
-        this->buffer[length++] = (nextMsgId >> 8);
-        this->buffer[length++] = (nextMsgId & 0xFF);
-        length = writeString((char *)topic, this->buffer, length);
-        this->buffer[length++] = qos;
-        return write(MQTTSUBSCRIBE | MQTTQOS1, this->buffer, length - MQTT_MAX_HEADER_SIZE);
+        return endPacket();
     }
     return false;
 }
 
 boolean MqttClient::unsubscribe(const char *topic)
 {
-    uint32_t topicLength = strnlen(topic, this->bufferSize);
-    if (topic == 0)
+    return unsubscribe(&topic, 1);
+}
+
+boolean MqttClient::unsubscribe(const char **topics, uint8_t count)
+{
+    if (count == 0)
     {
         return false;
     }
-    if (this->bufferSize < 9 + topicLength)
+    uint32_t length = MQTT_MAX_HEADER_SIZE + 2;
+    uint8_t i;
+    for (i = 0; i < count; i++)
+    {
+        if (topics[i] == 0)
+        {
+            return false;
+        }
+        length += 2 + strnlen(topics[i], this->bufferSize);
+    }
+    if (this->bufferSize < length)
     {
         return false;
     }
     if (connected())
     {
-        uint32_t length = MQTT_MAX_HEADER_SIZE;
+        uint16_t id = nextPacketId();
+        const uint8_t packetId[2] = {(uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+        beginPacket(MQTTUNSUBSCRIBE | MQTTQOS1, length - MQTT_MAX_HEADER_SIZE);
+        appendPacket(packetId, 2);
+        for (i = 0; i < count; i++)
+        {
+            appendString(topics[i]);
+        }
+        return endPacket();
+    }
+    return false;
+}
+
+uint16_t MqttClient::nextPacketId()
+{
+    do
+    {
         nextMsgId++;
         if (nextMsgId == 0)
         {
             nextMsgId = 1;
         }
-        this->buffer[length++] = (nextMsgId >> 8);
-        this->buffer[length++] = (nextMsgId & 0xFF);
-        length = writeString(topic, this->buffer, length);
-        return write(MQTTUNSUBSCRIBE | MQTTQOS1, this->buffer, length - MQTT_MAX_HEADER_SIZE);
+    } while (findInflight(nextMsgId) >= 0);
+    return nextMsgId;
+}
+
+int MqttClient::findInflight(uint16_t msgId)
+{
+    for (uint8_t i = 0; i < this->inflightCount; i++)
+    {
+        if (this->inflight[i].msgId == msgId)
+        {
+            return i;
+        }
     }
-    return false;
+    return -1;
+}
+
+// Frees an entry's stored packet and shifts the later packets down; the entry itself stays in the table.
+void MqttClient::trimInflight(uint8_t index)
+{
+    MqttInflight *entry = &this->inflight[index];
+    uint32_t end = entry->offset + entry->length;
+    uint32_t length = entry->length;
+    memmove(this->inflightStore + entry->offset, this->inflightStore + end, this->inflightStoreUsed - end);
+    this->inflightStoreUsed -= length;
+    for (uint8_t i = index + 1; i < this->inflightCount; i++)
+    {
+        this->inflight[i].offset -= length;
+    }
+    entry->length = 0;
+}
+
+// Removes an entry and compacts the store so free space stays contiguous.
+void MqttClient::releaseInflight(uint8_t index)
+{
+    trimInflight(index);
+    for (uint8_t i = index + 1; i < this->inflightCount; i++)
+    {
+        this->inflight[i - 1] = this->inflight[i];
+    }
+    this->inflightCount--;
+}
+
+void MqttClient::ackInflight(uint16_t msgId, uint8_t state)
+{
+    int index = findInflight(msgId);
+    if (index >= 0 && this->inflight[index].state == state)
+    {
+        unsigned long latency = millis() - this->inflight[index].sentAt;
+        this->ackCount++;
+        this->ackLatency = latency;
+        this->ackLatencyTotal += latency;
+        if (latency > this->ackLatencyMax)
+        {
+            this->ackLatencyMax = latency;
+        }
+        releaseInflight(index);
+    }
+}
+
+// Reallocates a store without a fixed size; offsets stay valid as they are relative.
+boolean MqttClient::growInflight(uint32_t size)
+{
+    if (!this->inflightStoreGrows)
+    {
+        return false;
+    }
+    uint8_t *store = (uint8_t *)realloc(this->inflightStore, size);
+    if (store == NULL)
+    {
+        return false;
+    }
+    this->inflightStore = store;
+    this->inflightStoreSize = size;
+    return true;
+}
+
+// With the session kept the packets are redelivered with DUP. A new session knows none of them:
+// PUBLISH packets go out again as first deliveries and released QoS 2 packets are done.
+void MqttClient::resendInflight(boolean sessionPresent)
+{
+    uint8_t i = 0;
+    while (i < this->inflightCount)
+    {
+        MqttInflight *entry = &this->inflight[i];
+        if (entry->state == MQTT_INFLIGHT_PUBCOMP)
+        {
+            if (!sessionPresent)
+            {
+                releaseInflight(i);
+                continue;
+            }
+            writeAck(MQTTPUBREL | MQTTQOS1, entry->msgId);
+        }
+        else
+        {
+            uint8_t *packet = this->inflightStore + entry->offset;
+            if (sessionPresent)
+            {
+                packet[0] |= 0x08; // DUP
+            }
+            else
+            {
+                packet[0] &= ~0x08;
+            }
+            countPacket(packet[0]);
+            send(packet, entry->length);
+        }
+        entry->sentAt = millis();
+        i++;
+    }
+    if (this->inflightCount > 0)
+    {
+        lastOutActivity = millis();
+    }
+}
+
+int MqttClient::findInbound(uint16_t msgId)
+{
+    for (uint8_t i = 0; i < this->inboundCount; i++)
+    {
+        if (this->inbound[i] == msgId)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void MqttClient::countPacket(uint8_t header)
+{
+    if (this->metrics != NULL)
+    {
+        this->metrics->packetOut(header);
+    }
+}
+
+MqttClient &MqttClient::setMetrics(Metrics *metrics)
+{
+    this->metrics = metrics;
+    return *this;
+}
+
+boolean MqttClient::writeAck(uint8_t header, uint16_t msgId)
+{
+    uint8_t ack[4] = {header, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+    countPacket(header);
+    lastOutActivity = millis();
+    return (send(ack, 4) == 4);
 }
 
 void MqttClient::disconnect()
 {
-    this->buffer[0] = MQTTDISCONNECT;
-    this->buffer[1] = 0;
-    _client->write(this->buffer, 2);
+    beginPacket(MQTTDISCONNECT, 0);
+    endPacket();
+    flush();
     _state = MQTT_DISCONNECTED;
+    this->connectState = MQTT_CONNECT_STATE_IDLE;
     _client->flush();
     _client->stop();
     lastInActivity = lastOutActivity = millis();
@@ -714,6 +1498,20 @@ MqttClient &MqttClient::setCallback(MQTT_CALLBACK_SIGNATURE)
     return *this;
 }
 
+MqttClient &MqttClient::setSubackCallback(MQTT_SUBACK_SIGNATURE)
+{
+    this->subackCallback = subackCallback;
+    return *this;
+}
+
+MqttClient &MqttClient::setChunkCallbacks(MQTT_CHUNK_BEGIN_SIGNATURE, MQTT_CHUNK_DATA_SIGNATURE, MQTT_CHUNK_END_SIGNATURE)
+{
+    this->chunkBegin = chunkBegin;
+    this->chunkData = chunkData;
+    this->chunkEnd = chunkEnd;
+    return *this;
+}
+
 MqttClient &MqttClient::setClient(Client &client)
 {
     this->_client = &client;
@@ -737,9 +1535,10 @@ boolean MqttClient::setBufferSize(size_t size)
     {
         return false;
     }
-    if (this->bufferSize == 0)
+    if (this->bufferSize == 0 || !this->bufferOwned)
     {
         this->buffer = (uint8_t *)malloc(size);
+        this->bufferOwned = true;
     }
     else
     {
@@ -763,6 +1562,7 @@ boolean MqttClient::setBufferSize(size_t size, bool psram)
     {
         this->buffer = (uint8_t *)ps_malloc(size);
         this->bufferSize = size;
+        this->bufferOwned = true;
         return (this->buffer != NULL);
     }
     else
@@ -771,6 +1571,22 @@ boolean MqttClient::setBufferSize(size_t size, bool psram)
     }
 }
 
+boolean MqttClient::setBuffer(uint8_t *buffer, size_t size)
+{
+    if (buffer == NULL || size == 0)
+    {
+        return false;
+    }
+    if (this->bufferOwned)
+    {
+        free(this->buffer);
+    }
+    this->buffer = buffer;
+    this->bufferSize = size;
+    this->bufferOwned = false;
+    return true;
+}
+
 uint32_t MqttClient::getBufferSize()
 {
     return this->bufferSize;
@@ -785,8 +1601,174 @@ MqttClient &MqttClient::setSocketTimeout(uint16_t timeout)
     this->socketTimeout = timeout;
     return *this;
 }
+MqttClient &MqttClient::setConnectBudget(uint16_t budget)
+{
+    this->connectBudget = budget;
+    return *this;
+}
 
 void MqttClient::setReadTimeoutEnabled(bool enable)
 {
     this->mReadTimeoutEnabled = enable;
-}
\ No newline at end of file
+}
+
+boolean MqttClient::setWriteCoalescing(uint32_t maxBytes, uint16_t maxDelay, boolean flushOnLoop)
+{
+    flush();
+    free(this->txBuffer);
+    this->txBuffer = NULL;
+    if (maxBytes > 0)
+    {
+        this->txBuffer = (uint8_t *)malloc(maxBytes);
+        if (this->txBuffer == NULL)
+        {
+            maxBytes = 0;
+        }
+    }
+    this->txSize = maxBytes;
+    this->txMaxDelay = maxDelay;
+    this->txFlushOnLoop = flushOnLoop;
+    return (this->txBuffer != NULL || maxBytes == 0);
+}
+
+uint32_t MqttClient::getSegmentCount()
+{
+    return this->txSegments;
+}
+
+uint32_t MqttClient::getFlushCount()
+{
+    return this->txFlushes;
+}
+
+uint32_t MqttClient::getFlushedBytes()
+{
+    return this->txFlushedBytes;
+}
+
+boolean MqttClient::setInflightWindow(uint8_t window, uint32_t storeSize)
+{
+    if (window > MQTT_MAX_INFLIGHT)
+    {
+        return false;
+    }
+    free(this->inflightStore);
+    this->inflightStore = NULL;
+    boolean allocated = true;
+    if (storeSize > 0)
+    {
+        this->inflightStore = (uint8_t *)malloc(storeSize);
+        if (this->inflightStore == NULL)
+        {
+            storeSize = 0;
+            allocated = false;
+        }
+    }
+    this->inflightWindow = window;
+    this->inflightStoreSize = storeSize;
+    this->inflightStoreUsed = 0;
+    this->inflightStoreGrows = (storeSize == 0);
+    this->inflightCount = 0;
+    return allocated;
+}
+
+uint8_t MqttClient::getInflightCount()
+{
+    return this->inflightCount;
+}
+
+uint32_t MqttClient::getAckCount()
+{
+    return this->ackCount;
+}
+
+unsigned long MqttClient::getAckLatency()
+{
+    return this->ackLatency;
+}
+
+unsigned long MqttClient::getAckLatencyMax()
+{
+    return this->ackLatencyMax;
+}
+
+unsigned long MqttClient::getAckLatencyAverage()
+{
+    return (this->ackCount == 0) ? 0 : this->ackLatencyTotal / this->ackCount;
+}
+
+static const unsigned long pingBucketLimits[MQTT_PING_BUCKETS] = {25, 50, 100, 250, 500, 1000, 2500, 0xFFFFFFFFUL};
+
+void MqttClient::recordPing(unsigned long rtt)
+{
+    uint8_t bucket = 0;
+    while (rtt > pingBucketLimits[bucket])
+    {
+        bucket++;
+    }
+    this->pingHistogram[bucket]++;
+    this->pingCount++;
+    this->pingRtt = rtt;
+    if (rtt > this->pingRttMax)
+    {
+        this->pingRttMax = rtt;
+    }
+}
+
+unsigned long MqttClient::getPingRtt()
+{
+    return this->pingRtt;
+}
+
+unsigned long MqttClient::getPingRttMax()
+{
+    return this->pingRttMax;
+}
+
+uint32_t MqttClient::getPingCount()
+{
+    return this->pingCount;
+}
+
+uint32_t MqttClient::getPingHistogram(uint8_t bucket)
+{
+    return (bucket < MQTT_PING_BUCKETS) ? this->pingHistogram[bucket] : 0;
+}
+
+unsigned long MqttClient::getPingBucketLimit(uint8_t bucket)
+{
+    return (bucket < MQTT_PING_BUCKETS) ? pingBucketLimits[bucket] : 0;
+}
+
+// PINGRESP deadline: MQTT_PING_TIMEOUT_FACTOR times the limit of the bucket holding the 99th
+// percentile RTT, raised to MQTT_PING_MIN_TIMEOUT and capped at keepAlive. keepAlive itself applies
+// until MQTT_PING_MIN_SAMPLES pings are answered and while the 99th percentile is in the last bucket.
+unsigned long MqttClient::getPingTimeout()
+{
+    unsigned long keepAliveMillis = this->keepAlive * 1000UL;
+    if (this->pingCount < MQTT_PING_MIN_SAMPLES)
+    {
+        return keepAliveMillis;
+    }
+    uint32_t target = this->pingCount - this->pingCount / 100;
+    uint32_t seen = 0;
+    uint8_t bucket = 0;
+    for (; bucket < MQTT_PING_BUCKETS - 1; bucket++)
+    {
+        seen += this->pingHistogram[bucket];
+        if (seen >= target)
+        {
+            break;
+        }
+    }
+    if (bucket == MQTT_PING_BUCKETS - 1)
+    {
+        return keepAliveMillis;
+    }
+    unsigned long timeout = pingBucketLimits[bucket] * MQTT_PING_TIMEOUT_FACTOR;
+    if (timeout < MQTT_PING_MIN_TIMEOUT)
+    {
+        timeout = MQTT_PING_MIN_TIMEOUT;
+    }
+    return (timeout < keepAliveMillis) ? timeout : keepAliveMillis;
+}
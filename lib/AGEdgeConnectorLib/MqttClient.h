@@ -6,6 +6,7 @@
 #include "IPAddress.h"
 #include "Client.h"
 #include "Stream.h"
+#include "Metrics.h"
 
 #define MQTT_VERSION 4
 #define MQTT_KEEPALIVE 30
@@ -21,6 +22,36 @@
 #define MQTT_CONNECT_BAD_CREDENTIALS 4
 #define MQTT_CONNECT_UNAUTHORIZED 5
 
+#define MQTT_CONNECT_BUDGET 20 // milliseconds per loop()
+
+#define MQTT_CONNECT_STATE_IDLE 0
+#define MQTT_CONNECT_STATE_TCP 1
+#define MQTT_CONNECT_STATE_SEND 2
+#define MQTT_CONNECT_STATE_CONNACK 3
+#define MQTT_CONNECT_STATE_CONNECTED 4
+
+#define MQTT_RX_BUFFER_SIZE 512 // power of two
+#define MQTT_TX_SCRATCH_SIZE 128
+
+#define MQTT_MAX_INFLIGHT 16
+#ifndef MQTT_INFLIGHT_WINDOW
+#define MQTT_INFLIGHT_WINDOW 4 // the store grows on demand; setInflightWindow(1, 0) is stop-and-wait
+#endif
+#define MQTT_MAX_INBOUND 16
+#define MQTT_INFLIGHT_PUBACK 1
+#define MQTT_INFLIGHT_PUBREC 2
+#define MQTT_INFLIGHT_PUBCOMP 3
+
+#define MQTT_PING_BUCKETS 8
+#define MQTT_PING_MIN_SAMPLES 4
+#define MQTT_PING_TIMEOUT_FACTOR 4
+#define MQTT_PING_MIN_TIMEOUT 2000	// milliseconds
+#define MQTT_PING_JITTER_DIVISOR 10 // pings start up to keepAlive / 10 early
+
+#define MQTT_RX_STATE_HEADER 0
+#define MQTT_RX_STATE_LENGTH 1
+#define MQTT_RX_STATE_BODY 2
+
 #define MQTTCONNECT 1 << 4		// Client request to connect to Server
 #define MQTTCONNACK 2 << 4		// Connect Acknowledgment
 #define MQTTPUBLISH 3 << 4		// Publish message
@@ -45,6 +76,10 @@
 #define MQTT_HEADER_VERSION_LENGTH 7
 
 #define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+#define MQTT_SUBACK_SIGNATURE std::function<void(uint16_t, uint8_t *, uint8_t)> subackCallback
+#define MQTT_CHUNK_BEGIN_SIGNATURE std::function<void(char *, uint32_t)> chunkBegin
+#define MQTT_CHUNK_DATA_SIGNATURE std::function<void(uint32_t, const uint8_t *, uint32_t)> chunkData
+#define MQTT_CHUNK_END_SIGNATURE std::function<void()> chunkEnd
 #define CHECK_STRING_LENGTH(l, s)                                \
 	if (l + 2 + strnlen(s, this->bufferSize) > this->bufferSize) \
 	{                                                            \
@@ -52,25 +87,48 @@
 		return false;                                            \
 	}
 
+typedef struct
+{
+	const uint8_t *data;
+	uint32_t length;
+} MqttSegment;
+
+typedef struct
+{
+	uint16_t msgId;
+	uint8_t state;
+	uint32_t offset;
+	uint32_t length;
+	unsigned long sentAt;
+} MqttInflight;
+
 class MqttClient : public Print
 {
 private:
 	Client *_client;
 	uint8_t *buffer;
 	uint32_t bufferSize;
+	boolean bufferOwned; // false when the buffer is a slice of caller memory
 	uint16_t keepAlive;
 	uint16_t socketTimeout;
 	uint16_t nextMsgId;
 	unsigned long lastOutActivity;
 	unsigned long lastInActivity;
 	bool pingOutstanding;
+	unsigned long pingSentAt;
+	unsigned long pingJitter;
+	unsigned long pingRtt;
+	unsigned long pingRttMax;
+	uint32_t pingCount;
+	uint32_t pingHistogram[MQTT_PING_BUCKETS];
+	void recordPing(unsigned long rtt);
 	MQTT_CALLBACK_SIGNATURE;
+	MQTT_SUBACK_SIGNATURE;
+	MQTT_CHUNK_BEGIN_SIGNATURE;
+	MQTT_CHUNK_DATA_SIGNATURE;
+	MQTT_CHUNK_END_SIGNATURE;
 	uint32_t readPacket(uint8_t *);
-	boolean readByte(uint8_t *result);
-	boolean readByte(uint8_t *result, uint32_t *index);
-	boolean write(uint8_t header, uint8_t *buf, uint32_t length);
 	uint32_t writeString(const char *string, uint8_t *buf, uint32_t pos);
-	size_t buildHeader(uint8_t header, uint8_t *buf, uint32_t length);
 	IPAddress ip;
 	const char *domain;
 	uint16_t port;
@@ -78,6 +136,98 @@ private:
 	int _state;
 	bool mReadTimeoutEnabled;
 
+	// Resumable connect (TCP -> CONNECT sent -> awaiting CONNACK -> connected)
+	uint8_t connectState;
+	uint16_t connectBudget;
+	const char *connectId;
+	const char *connectUser;
+	const char *connectPass;
+	const char *connectWillTopic;
+	const char *connectWillMessage;
+	uint8_t connectWillQos;
+	boolean connectWillRetain;
+	boolean connectCleanSession;
+	boolean connectStep();
+	boolean sendConnect();
+	boolean poll(); // loop() without the flush policy
+	void flushDue();
+
+	// Receive ring drained with Client::read(buf, n) and parsed incrementally
+	uint8_t rxRing[MQTT_RX_BUFFER_SIZE];
+	uint32_t rxHead;
+	uint32_t rxTail;
+	uint8_t rxState;
+	uint8_t rxLengthLength;
+	uint32_t rxMultiplier;
+	uint32_t rxLength;
+	uint32_t rxReceived;
+	uint32_t rxIndex;
+	uint32_t rxPayloadStart;
+	unsigned long rxActivityAt; // last byte received; stalls and the ping deadline are measured from it
+	boolean rxStreaming;
+	uint16_t rxMsgId;
+	void resetReceive();
+	uint32_t fillReceive();
+	boolean parseReceive(uint32_t *length, uint8_t *lengthLength);
+	void beginChunk();
+	void endChunk();
+
+	// Unacknowledged QoS 1/2 packets, stored serialized for DUP resend
+	MqttInflight inflight[MQTT_MAX_INFLIGHT];
+	uint8_t inflightCount;
+	uint8_t inflightWindow;
+	uint8_t *inflightStore;
+	uint32_t inflightStoreSize;
+	uint32_t inflightStoreUsed;
+	boolean inflightStoreGrows; // no fixed store size: reallocated to fit the packets in flight
+	uint32_t ackCount;
+	unsigned long ackLatency;
+	unsigned long ackLatencyMax;
+	unsigned long ackLatencyTotal;
+	uint16_t nextPacketId();
+	int findInflight(uint16_t msgId);
+	void trimInflight(uint8_t index);
+	void releaseInflight(uint8_t index);
+	void ackInflight(uint16_t msgId, uint8_t state);
+	boolean growInflight(uint32_t size);
+	void resendInflight(boolean sessionPresent);
+
+	// Inbound QoS 2 packet ids between PUBREC and PUBREL
+	uint16_t inbound[MQTT_MAX_INBOUND];
+	uint8_t inboundCount;
+	int findInbound(uint16_t msgId);
+	boolean writeAck(uint8_t header, uint16_t msgId);
+
+	Metrics *metrics;
+	void countPacket(uint8_t header);
+
+	// Outbound coalescing buffer
+	uint8_t *txBuffer;
+	uint32_t txSize;
+	uint32_t txUsed;
+	uint16_t txMaxDelay;
+	boolean txFlushOnLoop;
+	unsigned long txFirstAt;
+	uint32_t txSegments;
+	uint32_t txFlushes;
+	uint32_t txFlushedBytes;
+	size_t send(const uint8_t *data, size_t length);
+	size_t transmit(const uint8_t *data, size_t length);
+	boolean flushTransmit();
+	uint32_t publishRemaining; // payload bytes still owed after beginPublish
+
+	// Outbound framing. buffer belongs to the packet being received, which may be partial across
+	// loop() calls, so packets are framed here: small parts are gathered, larger ones sent as they are
+	uint8_t txScratch[MQTT_TX_SCRATCH_SIZE];
+	uint32_t txScratchUsed;
+	uint32_t txPacketLength;
+	uint32_t txPacketSent;
+	void beginPacket(uint8_t header, uint32_t length);
+	void appendPacket(const uint8_t *data, uint32_t length);
+	void appendSegment(const uint8_t *data, uint32_t length); // never copied into txScratch
+	void appendString(const char *string);
+	boolean endPacket();
+
 public:
 	MqttClient();
 	MqttClient(Client &client);
@@ -88,28 +238,71 @@ public:
 	MqttClient &setServer(uint8_t *ip, uint16_t port);
 	MqttClient &setServer(const char *domain, uint16_t port);
 	MqttClient &setCallback(MQTT_CALLBACK_SIGNATURE);
+	MqttClient &setSubackCallback(MQTT_SUBACK_SIGNATURE);
+	// QoS 0/1 PUBLISH packets larger than the buffer: begin(topic, payloadLength), data(offset, chunk, length)..., end().
+	// Larger QoS 2 packets are dropped and left unacknowledged.
+	MqttClient &setChunkCallbacks(MQTT_CHUNK_BEGIN_SIGNATURE, MQTT_CHUNK_DATA_SIGNATURE, MQTT_CHUNK_END_SIGNATURE);
 	MqttClient &setClient(Client &client);
 	MqttClient &setStream(Stream &stream);
 	MqttClient &setKeepAlive(uint16_t keepAlive);
 	MqttClient &setSocketTimeout(uint16_t timeout);
+	MqttClient &setConnectBudget(uint16_t budget);
+	// Byte, packet and drop counters; NULL disables them
+	MqttClient &setMetrics(Metrics *metrics);
 
 	boolean setBufferSize(size_t size);
 	boolean setBufferSize(size_t size, bool psram);
+	// Uses caller memory (e.g. a slice of a shared arena); it is never resized or freed here
+	boolean setBuffer(uint8_t *buffer, size_t size);
 	uint32_t getBufferSize();
 
 	void setReadTimeoutEnabled(bool enable);
 
+	// maxBytes = 0 writes through; otherwise packets are staged until full, maxDelay ms old, loop() ends (flushOnLoop) or flush()
+	boolean setWriteCoalescing(uint32_t maxBytes, uint16_t maxDelay, boolean flushOnLoop);
+	virtual void flush();
+	uint32_t getSegmentCount();
+	uint32_t getFlushCount();
+	uint32_t getFlushedBytes();
+
+	// Allocates the retransmission store; call before connecting. window <= MQTT_MAX_INFLIGHT.
+	// storeSize 0 allocates it on the first QoS 1/2 publish and grows it as needed.
+	boolean setInflightWindow(uint8_t window, uint32_t storeSize);
+	uint8_t getInflightCount();
+	uint32_t getAckCount();
+	unsigned long getAckLatency();
+	unsigned long getAckLatencyMax();
+	unsigned long getAckLatencyAverage();
+
+	// PINGRESP round trips; bucket i counts RTTs up to getPingBucketLimit(i) ms
+	unsigned long getPingRtt();
+	unsigned long getPingRttMax();
+	uint32_t getPingCount();
+	uint32_t getPingHistogram(uint8_t bucket);
+	unsigned long getPingBucketLimit(uint8_t bucket);
+	unsigned long getPingTimeout();
+
 	boolean connect(const char *id);
 	boolean connect(const char *id, const char *user, const char *pass);
 	boolean connect(const char *id, const char *willTopic, uint8_t willQos, boolean willRetain, const char *willMessage);
 	boolean connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, boolean willRetain, const char *willMessage);
 	boolean connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, boolean willRetain, const char *willMessage, boolean cleanSession);
+	// Non-blocking connect: loop() advances it. The strings must stay valid until connecting() is false.
+	// The one blocking step is the TCP connect itself: the Arduino Client API has no asynchronous
+	// connect, so Client::connect() (and the DNS lookup of setServer(domain)) holds that loop() for up
+	// to the client's own timeout. CONNECT is written and CONNACK read without waiting.
+	boolean beginConnect(const char *id, const char *user, const char *pass);
+	boolean beginConnect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, boolean willRetain, const char *willMessage, boolean cleanSession);
+	boolean connecting();
 	void disconnect();
 	boolean publish(const char *topic, const char *payload);
 	boolean publish(const char *topic, const char *payload, boolean retained);
 	boolean publish(const char *topic, const uint8_t *payload, unsigned int plength);
 	boolean publish(const char *topic, const uint8_t *payload, unsigned int plength, boolean retained);
 	boolean publish(const char *topic, uint8_t *head, unsigned int headlength, uint8_t *body, unsigned int bodylength, boolean retained);
+	boolean publish(const char *topic, const MqttSegment *segments, uint8_t count, boolean retained);
+	boolean publish(const char *topic, const MqttSegment *segments, uint8_t count, boolean retained, uint8_t qos);
+	boolean publish(const char *topic, const uint8_t *payload, unsigned int plength, boolean retained, uint8_t qos);
 
 	boolean publish_P(const char *topic, const char *payload, boolean retained);
 	boolean publish_P(const char *topic, const uint8_t *payload, unsigned int plength, boolean retained);
@@ -119,7 +312,9 @@ public:
 	virtual size_t write(const uint8_t *buffer, size_t size);
 	boolean subscribe(const char *topic);
 	boolean subscribe(const char *topic, uint8_t qos);
+	boolean subscribe(const char **topics, const uint8_t *qos, uint8_t count, uint16_t *msgId);
 	boolean unsubscribe(const char *topic);
+	boolean unsubscribe(const char **topics, uint8_t count);
 	boolean loop();
 	boolean connected();
 	int state();
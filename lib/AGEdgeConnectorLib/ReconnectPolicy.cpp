@@ -0,0 +1,111 @@
+#include "ReconnectPolicy.h"
+
+ReconnectPolicy::ReconnectPolicy()
+{
+	this->setBackoff(RECONNECT_BASE_DELAY, RECONNECT_MAX_DELAY, RECONNECT_STABLE_AFTER);
+	this->setClock(NULL);
+	this->setRandom(NULL);
+	this->reset();
+}
+
+void ReconnectPolicy::setBackoff(unsigned long baseDelay, unsigned long maxDelay, unsigned long stableAfter)
+{
+	this->mBaseDelay = baseDelay;
+	this->mMaxDelay = maxDelay;
+	this->mStableAfter = stableAfter;
+}
+
+void ReconnectPolicy::setClock(RECONNECT_CLOCK_SIGNATURE)
+{
+	if (clock == NULL)
+	{
+		clock = []() -> unsigned long
+		{ return millis(); };
+	}
+	this->clock = clock;
+}
+
+void ReconnectPolicy::setRandom(RECONNECT_RANDOM_SIGNATURE)
+{
+	if (random == NULL)
+	{
+		random = []() -> uint32_t
+		{ return esp_random(); };
+	}
+	this->random = random;
+}
+
+void ReconnectPolicy::reset()
+{
+	this->mAttempts = 0;
+	this->mDelay = 0;
+	this->mScheduledAt = this->clock();
+	this->mConnectedAt = 0;
+	this->mConnected = false;
+}
+
+void ReconnectPolicy::schedule()
+{
+	unsigned long ceiling = this->mBaseDelay;
+	for (uint16_t i = 1; i < this->mAttempts && ceiling < this->mMaxDelay; i++)
+	{
+		ceiling *= 2;
+	}
+	if (ceiling > this->mMaxDelay)
+	{
+		ceiling = this->mMaxDelay;
+	}
+	this->mDelay = (ceiling == 0) ? 0 : this->random() % (ceiling + 1);
+	this->mScheduledAt = this->clock();
+}
+
+bool ReconnectPolicy::ready()
+{
+	return this->clock() - this->mScheduledAt >= this->mDelay;
+}
+
+void ReconnectPolicy::failed()
+{
+	if (this->mAttempts < 0xFFFF)
+	{
+		this->mAttempts++;
+	}
+	this->schedule();
+}
+
+void ReconnectPolicy::connected()
+{
+	this->mConnected = true;
+	this->mConnectedAt = this->clock();
+}
+
+// A session that lasted stableAfter starts the backoff over; a flapping one keeps growing it.
+void ReconnectPolicy::disconnected()
+{
+	if (this->mConnected && this->clock() - this->mConnectedAt >= this->mStableAfter)
+	{
+		this->mAttempts = 0;
+	}
+	this->mConnected = false;
+	if (this->mAttempts < 0xFFFF)
+	{
+		this->mAttempts++;
+	}
+	this->schedule();
+}
+
+uint16_t ReconnectPolicy::getAttempts()
+{
+	return this->mAttempts;
+}
+
+unsigned long ReconnectPolicy::getDelay()
+{
+	return this->mDelay;
+}
+
+unsigned long ReconnectPolicy::getRemaining()
+{
+	unsigned long elapsed = this->clock() - this->mScheduledAt;
+	return (elapsed >= this->mDelay) ? 0 : this->mDelay - elapsed;
+}
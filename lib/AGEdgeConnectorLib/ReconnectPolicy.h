@@ -0,0 +1,53 @@
+#ifndef RECONNECT_POLICY_H_
+#define RECONNECT_POLICY_H_
+
+#include <Arduino.h>
+#include <functional>
+
+#define RECONNECT_BASE_DELAY 1000	 // milliseconds
+#define RECONNECT_MAX_DELAY 60000	 // milliseconds
+#define RECONNECT_STABLE_AFTER 30000 // milliseconds connected before the backoff starts over
+
+#define RECONNECT_CLOCK_SIGNATURE std::function<unsigned long()> clock
+#define RECONNECT_RANDOM_SIGNATURE std::function<uint32_t()> random
+
+// Exponential backoff with full jitter: after the n-th failed attempt the next one waits
+// a uniformly random time in [0, min(maxDelay, baseDelay * 2^n)], so devices dropped by the
+// same broker restart spread their reconnects instead of arriving together.
+class ReconnectPolicy
+{
+private:
+	unsigned long mBaseDelay;
+	unsigned long mMaxDelay;
+	unsigned long mStableAfter;
+	uint16_t mAttempts;
+	unsigned long mDelay;
+	unsigned long mScheduledAt;
+	unsigned long mConnectedAt;
+	bool mConnected;
+
+	RECONNECT_CLOCK_SIGNATURE;
+	RECONNECT_RANDOM_SIGNATURE;
+
+	void schedule();
+
+public:
+	ReconnectPolicy();
+
+	void setBackoff(unsigned long baseDelay, unsigned long maxDelay, unsigned long stableAfter);
+	// Defaults to millis() and esp_random(); replaced in tests
+	void setClock(RECONNECT_CLOCK_SIGNATURE);
+	void setRandom(RECONNECT_RANDOM_SIGNATURE);
+
+	bool ready();
+	void failed();
+	void connected();
+	void disconnected();
+	void reset();
+
+	uint16_t getAttempts();
+	unsigned long getDelay();
+	unsigned long getRemaining();
+};
+
+#endif
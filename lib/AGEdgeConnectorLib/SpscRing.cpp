@@ -0,0 +1,100 @@
+#include "SpscRing.h"
+
+SpscRing::SpscRing()
+{
+	this->mSlots = NULL;
+	this->mCapacity = 0;
+	this->mSlotSize = 0;
+	this->mHead.store(0, std::memory_order_relaxed);
+	this->mTail.store(0, std::memory_order_relaxed);
+	this->mHighWater = 0;
+}
+
+SpscRing::~SpscRing()
+{
+	free(this->mSlots);
+}
+
+bool SpscRing::begin(uint16_t capacity)
+{
+	return this->begin(capacity, SPSC_RING_SLOT_SIZE, false);
+}
+
+bool SpscRing::begin(uint16_t capacity, uint32_t slotSize, bool psram)
+{
+	if (this->mSlots != NULL || capacity == 0 || (capacity & (capacity - 1)) != 0 || slotSize == 0)
+	{
+		return false;
+	}
+	size_t size = (sizeof(RingSlot) + slotSize) * capacity;
+	this->mSlots = (RingSlot *)(psram ? ps_malloc(size) : malloc(size));
+	if (this->mSlots == NULL)
+	{
+		return false;
+	}
+	uint8_t *data = (uint8_t *)(this->mSlots + capacity);
+	for (uint16_t i = 0; i < capacity; i++)
+	{
+		this->mSlots[i].data = data + i * slotSize;
+	}
+	this->mCapacity = capacity;
+	this->mSlotSize = slotSize;
+	return true;
+}
+
+// NULL when full; nothing is visible to the consumer until push()
+RingSlot *SpscRing::claim()
+{
+	uint32_t head = this->mHead.load(std::memory_order_relaxed);
+	if (this->mSlots == NULL || head - this->mTail.load(std::memory_order_acquire) >= this->mCapacity)
+	{
+		return NULL;
+	}
+	return &this->mSlots[head & (this->mCapacity - 1)];
+}
+
+void SpscRing::push()
+{
+	uint32_t head = this->mHead.load(std::memory_order_relaxed) + 1;
+	this->mHead.store(head, std::memory_order_release);
+	uint16_t used = head - this->mTail.load(std::memory_order_relaxed);
+	if (used > this->mHighWater)
+	{
+		this->mHighWater = used;
+	}
+}
+
+RingSlot *SpscRing::peek()
+{
+	uint32_t tail = this->mTail.load(std::memory_order_relaxed);
+	if (this->mSlots == NULL || tail == this->mHead.load(std::memory_order_acquire))
+	{
+		return NULL;
+	}
+	return &this->mSlots[tail & (this->mCapacity - 1)];
+}
+
+void SpscRing::pop()
+{
+	this->mTail.store(this->mTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+uint16_t SpscRing::size()
+{
+	return this->mHead.load(std::memory_order_acquire) - this->mTail.load(std::memory_order_acquire);
+}
+
+uint16_t SpscRing::capacity()
+{
+	return this->mCapacity;
+}
+
+uint32_t SpscRing::getSlotSize()
+{
+	return this->mSlotSize;
+}
+
+uint16_t SpscRing::getHighWater()
+{
+	return this->mHighWater;
+}
@@ -0,0 +1,60 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <Arduino.h>
+#include <atomic>
+
+#ifndef SPSC_RING_TOPIC_SIZE
+#define SPSC_RING_TOPIC_SIZE 128
+#endif
+#ifndef SPSC_RING_SLOT_SIZE
+#define SPSC_RING_SLOT_SIZE 2048 // default data bytes per slot
+#endif
+
+struct RingSlot
+{
+	uint8_t kind;
+	uint8_t session; // route mask outbound, source session inbound
+	uint8_t qos;
+	bool retain;
+	uint32_t length;
+	char topic[SPSC_RING_TOPIC_SIZE];
+	uint8_t *data; // getSlotSize() bytes
+};
+
+// Single-producer single-consumer ring of slots allocated once in begin(). The producer fills
+// the slot returned by claim() in place and hands it over with push(); the consumer reads the
+// slot returned by peek() and frees it with pop(). No locks: head is only written by the
+// producer and tail only by the consumer.
+class SpscRing
+{
+private:
+	RingSlot *mSlots; // data blocks follow the slots in the same allocation
+	uint16_t mCapacity; // power of two
+	uint32_t mSlotSize;
+	std::atomic<uint32_t> mHead;
+	std::atomic<uint32_t> mTail;
+	uint16_t mHighWater;
+
+public:
+	SpscRing();
+	~SpscRing();
+
+	bool begin(uint16_t capacity);
+	bool begin(uint16_t capacity, uint32_t slotSize, bool psram);
+
+	// producer side
+	RingSlot *claim();
+	void push();
+
+	// consumer side
+	RingSlot *peek();
+	void pop();
+
+	uint16_t size();
+	uint16_t capacity();
+	uint32_t getSlotSize();
+	uint16_t getHighWater();
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "Timestamp.h"
+
+std::atomic<uint32_t> Timestamp::sGeneration(0);
+
+Timestamp::Timestamp()
+{
+	this->mFormatCount = 0;
+	this->setClock(NULL);
+	this->invalidate();
+}
+
+void Timestamp::setClock(TIMESTAMP_CLOCK_SIGNATURE)
+{
+	if (clock == NULL)
+	{
+		clock = []() -> uint64_t
+		{
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+		};
+	}
+	this->clock = clock;
+	this->invalidate();
+}
+
+void Timestamp::invalidate()
+{
+	this->mGeneration = sGeneration.load(std::memory_order_relaxed);
+	this->mSecond = TIMESTAMP_NONE;
+	this->mSecondOfMinute = 0;
+	this->mText[0] = '\0';
+	this->mTextLength = 0;
+}
+
+void Timestamp::invalidateAll()
+{
+	sGeneration.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Timestamp::setTimeZone(const char *tz)
+{
+	setenv("TZ", tz, 1);
+	tzset();
+	invalidateAll();
+}
+
+void Timestamp::clockSet(struct timeval * /* tv */)
+{
+	invalidateAll();
+}
+
+uint64_t Timestamp::now()
+{
+	return this->clock();
+}
+
+const char *Timestamp::getText(uint32_t *length)
+{
+	return this->getText(this->now(), length);
+}
+
+const char *Timestamp::getText(uint64_t epochMs, uint32_t *length)
+{
+	time_t second = (time_t)(epochMs / 1000);
+	if (this->mGeneration != sGeneration.load(std::memory_order_relaxed))
+	{
+		this->invalidate();
+	}
+	if (second != this->mSecond)
+	{
+		// time zones move in whole minutes, so the rest of the text holds until the minute rolls over
+		time_t delta = second - this->mSecond;
+		if (this->mSecond != TIMESTAMP_NONE && delta > 0 && this->mSecondOfMinute + delta < 60)
+		{
+			this->mSecondOfMinute += delta;
+			this->mText[17] = '0' + this->mSecondOfMinute / 10;
+			this->mText[18] = '0' + this->mSecondOfMinute % 10;
+			this->mSecond = second;
+		}
+		else
+		{
+			this->format(second);
+		}
+	}
+	*length = this->mTextLength;
+	return this->mText;
+}
+
+void Timestamp::format(time_t second)
+{
+	struct tm lt;
+	localtime_r(&second, &lt);
+	int length = snprintf(this->mText, TIMESTAMP_TEXT_SIZE, "%04d-%02d-%02d %02d:%02d:%02d",
+												lt.tm_year + 1900,
+												lt.tm_mon + 1,
+												lt.tm_mday,
+												lt.tm_hour,
+												lt.tm_min,
+												lt.tm_sec);
+	this->mTextLength = (length == TIMESTAMP_TEXT_SIZE - 1) ? length : strlen(this->mText);
+	// a leap second or an out-of-range year is not patched, the next call formats again
+	this->mSecond = (length == TIMESTAMP_TEXT_SIZE - 1 && lt.tm_sec < 60) ? second : TIMESTAMP_NONE;
+	this->mSecondOfMinute = lt.tm_sec;
+	this->mFormatCount++;
+}
+
+uint32_t Timestamp::formatEpoch(uint64_t epochMs, char *buffer)
+{
+	char digits[TIMESTAMP_EPOCH_SIZE];
+	uint32_t count = 0;
+	do
+	{
+		digits[count++] = '0' + epochMs % 10;
+		epochMs /= 10;
+	} while (epochMs > 0);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		buffer[i] = digits[count - 1 - i];
+	}
+	buffer[count] = '\0';
+	return count;
+}
+
+uint32_t Timestamp::getFormatCount()
+{
+	return this->mFormatCount;
+}
@@ -0,0 +1,59 @@
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include "time.h"
+#include <sys/time.h>
+
+#define TIMESTAMP_TEXT_SIZE 20	// "YYYY-MM-DD hh:mm:ss" and the terminator
+#define TIMESTAMP_EPOCH_SIZE 21 // milliseconds since 1970 in decimal, terminator included
+#define TIMESTAMP_NONE -1
+
+#define TIMESTAMP_CLOCK_SIGNATURE std::function<uint64_t()> clock
+
+// last-modified text for the current second. Within a minute a newer second only rewrites the
+// two seconds digits, so localtime() and the full format run at most once a minute. A time zone
+// change or a clock set through invalidateAll() reaches every instance on its next call.
+class Timestamp
+{
+private:
+	static std::atomic<uint32_t> sGeneration;
+
+	char mText[TIMESTAMP_TEXT_SIZE];
+	uint32_t mTextLength;
+	time_t mSecond;
+	uint8_t mSecondOfMinute;
+	uint32_t mFormatCount;
+	uint32_t mGeneration;
+
+	TIMESTAMP_CLOCK_SIGNATURE;
+
+	void format(time_t second);
+
+public:
+	Timestamp();
+
+	// Defaults to gettimeofday(); replaced in tests
+	void setClock(TIMESTAMP_CLOCK_SIGNATURE);
+	// Forces a full format next time, e.g. after the time zone or the clock was set
+	void invalidate();
+	// invalidate() for every instance; safe from any task
+	static void invalidateAll();
+	// Sets TZ (POSIX rule, e.g. "KST-9") and invalidates every instance
+	static void setTimeZone(const char *tz);
+	// SNTP time sync notification (sntp_set_time_sync_notification_cb); Connector::begin() installs it on ESP32
+	static void clockSet(struct timeval *tv);
+
+	// Milliseconds since 1970
+	uint64_t now();
+	// Valid until the next call
+	const char *getText(uint32_t *length);
+	const char *getText(uint64_t epochMs, uint32_t *length);
+	static uint32_t formatEpoch(uint64_t epochMs, char *buffer);
+
+	uint32_t getFormatCount();
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "TlsClient.h"
+
+#if TLS_CLIENT_ENABLED
+
+TlsClient::TlsClient(Client &client)
+{
+	this->mClient = &client;
+	this->mReady = false;
+	this->mSessionValid = false;
+	this->mCertificateSeen = false;
+	this->mResumed = false;
+	this->mInsecure = false;
+	this->mCaCert = NULL;
+	this->mHost[0] = '\0';
+	this->mPeek = -1;
+	this->mHandshakeTimeout = TLS_CLIENT_HANDSHAKE_TIMEOUT;
+	this->mHandshakeTime = 0;
+	this->mHandshakes = 0;
+	this->mResumptions = 0;
+
+	mbedtls_ssl_init(&this->mSsl);
+	mbedtls_ssl_config_init(&this->mConf);
+	mbedtls_entropy_init(&this->mEntropy);
+	mbedtls_ctr_drbg_init(&this->mDrbg);
+	mbedtls_x509_crt_init(&this->mCa);
+	mbedtls_ssl_session_init(&this->mSession);
+}
+
+TlsClient::~TlsClient()
+{
+	this->stop();
+	mbedtls_ssl_session_free(&this->mSession);
+	mbedtls_x509_crt_free(&this->mCa);
+	mbedtls_ctr_drbg_free(&this->mDrbg);
+	mbedtls_entropy_free(&this->mEntropy);
+	mbedtls_ssl_config_free(&this->mConf);
+	mbedtls_ssl_free(&this->mSsl);
+}
+
+void TlsClient::setCACert(const char *caCert)
+{
+	this->mCaCert = caCert;
+	this->mInsecure = false;
+}
+
+void TlsClient::setInsecure()
+{
+	this->mCaCert = NULL;
+	this->mInsecure = true;
+}
+
+void TlsClient::setHostname(const char *host)
+{
+	snprintf(this->mHost, TLS_CLIENT_HOST_SIZE, "%s", host);
+}
+
+void TlsClient::setHandshakeTimeout(unsigned long timeout)
+{
+	this->mHandshakeTimeout = timeout;
+}
+
+void TlsClient::invalidateSession()
+{
+	mbedtls_ssl_session_free(&this->mSession);
+	mbedtls_ssl_session_init(&this->mSession);
+	this->mSessionValid = false;
+}
+
+bool TlsClient::isResumed()
+{
+	return this->mResumed;
+}
+
+unsigned long TlsClient::getHandshakeTime()
+{
+	return this->mHandshakeTime;
+}
+
+uint32_t TlsClient::getHandshakeCount()
+{
+	return this->mHandshakes;
+}
+
+uint32_t TlsClient::getResumeCount()
+{
+	return this->mResumptions;
+}
+
+// Configuration is built once; later connects only reset the context.
+bool TlsClient::setup()
+{
+	if (this->mReady)
+	{
+		return mbedtls_ssl_session_reset(&this->mSsl) == 0;
+	}
+	const char *personalization = "TlsClient";
+	if (mbedtls_ctr_drbg_seed(&this->mDrbg, mbedtls_entropy_func, &this->mEntropy, (const unsigned char *)personalization, strlen(personalization)) != 0)
+	{
+		return false;
+	}
+	if (mbedtls_ssl_config_defaults(&this->mConf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0)
+	{
+		return false;
+	}
+	if (this->mCaCert != NULL)
+	{
+		if (mbedtls_x509_crt_parse(&this->mCa, (const unsigned char *)this->mCaCert, strlen(this->mCaCert) + 1) != 0)
+		{
+			return false;
+		}
+		mbedtls_ssl_conf_ca_chain(&this->mConf, &this->mCa, NULL);
+		mbedtls_ssl_conf_authmode(&this->mConf, MBEDTLS_SSL_VERIFY_REQUIRED);
+	}
+	else
+	{
+		// OPTIONAL rather than NONE so the verify callback still reports a full handshake
+		mbedtls_ssl_conf_authmode(&this->mConf, this->mInsecure ? MBEDTLS_SSL_VERIFY_OPTIONAL : MBEDTLS_SSL_VERIFY_REQUIRED);
+	}
+	mbedtls_ssl_conf_verify(&this->mConf, verifyCallback, this);
+	mbedtls_ssl_conf_rng(&this->mConf, mbedtls_ctr_drbg_random, &this->mDrbg);
+	mbedtls_ssl_conf_session_tickets(&this->mConf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+	if (mbedtls_ssl_setup(&this->mSsl, &this->mConf) != 0)
+	{
+		return false;
+	}
+	this->mReady = true;
+	return true;
+}
+
+int TlsClient::sendCallback(void *context, const unsigned char *buffer, size_t length)
+{
+	Client *client = (Client *)context;
+	size_t sent = client->write(buffer, length);
+	if (sent == 0)
+	{
+		return client->connected() ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_CONN_RESET;
+	}
+	return sent;
+}
+
+int TlsClient::receiveCallback(void *context, unsigned char *buffer, size_t length)
+{
+	Client *client = (Client *)context;
+	int received = client->read(buffer, length);
+	if (received <= 0)
+	{
+		return client->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+	}
+	return received;
+}
+
+// Only reached when the broker sends its certificate, i.e. the session was not resumed.
+int TlsClient::verifyCallback(void *context, mbedtls_x509_crt * /* crt */, int /* depth */, uint32_t *flags)
+{
+	TlsClient *tls = (TlsClient *)context;
+	tls->mCertificateSeen = true;
+	if (tls->mInsecure)
+	{
+		*flags = 0;
+	}
+	return 0;
+}
+
+int TlsClient::handshake()
+{
+	if (!this->setup())
+	{
+		return 0;
+	}
+	const char *host = (strlen(this->mHost) > 0) ? this->mHost : NULL;
+	if (mbedtls_ssl_set_hostname(&this->mSsl, host) != 0)
+	{
+		return 0;
+	}
+	mbedtls_ssl_set_bio(&this->mSsl, this->mClient, sendCallback, receiveCallback, NULL);
+	bool offered = this->mSessionValid && mbedtls_ssl_set_session(&this->mSsl, &this->mSession) == 0;
+
+	this->mCertificateSeen = false;
+	this->mResumed = false;
+	unsigned long started = millis();
+	int ret;
+	while ((ret = mbedtls_ssl_handshake(&this->mSsl)) != 0)
+	{
+		if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) || millis() - started >= this->mHandshakeTimeout)
+		{
+			// a rejected session must not be offered forever
+			this->invalidateSession();
+			return 0;
+		}
+		yield();
+	}
+	this->mHandshakeTime = millis() - started;
+	this->mHandshakes++;
+	this->mResumed = offered && !this->mCertificateSeen;
+	if (this->mResumed)
+	{
+		this->mResumptions++;
+	}
+
+	mbedtls_ssl_session_free(&this->mSession);
+	mbedtls_ssl_session_init(&this->mSession);
+	this->mSessionValid = mbedtls_ssl_get_session(&this->mSsl, &this->mSession) == 0;
+	return 1;
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port)
+{
+	this->mPeek = -1;
+	if (!this->mClient->connect(ip, port))
+	{
+		return 0;
+	}
+	if (!this->handshake())
+	{
+		this->mClient->stop();
+		return 0;
+	}
+	return 1;
+}
+
+int TlsClient::connect(const char *host, uint16_t port)
+{
+	this->setHostname(host);
+	this->mPeek = -1;
+	if (!this->mClient->connect(host, port))
+	{
+		return 0;
+	}
+	if (!this->handshake())
+	{
+		this->mClient->stop();
+		return 0;
+	}
+	return 1;
+}
+
+size_t TlsClient::write(uint8_t data)
+{
+	return this->write(&data, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buffer, size_t size)
+{
+	size_t written = 0;
+	while (written < size)
+	{
+		int ret = mbedtls_ssl_write(&this->mSsl, buffer + written, size - written);
+		if (ret > 0)
+		{
+			written += ret;
+		}
+		else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+		{
+			break;
+		}
+		else
+		{
+			yield();
+		}
+	}
+	return written;
+}
+
+int TlsClient::available()
+{
+	if (!this->mReady)
+	{
+		return 0;
+	}
+	size_t pending = mbedtls_ssl_get_bytes_avail(&this->mSsl);
+	if (pending == 0 && this->mClient->available() > 0)
+	{
+		// processes the next record without consuming application data
+		mbedtls_ssl_read(&this->mSsl, NULL, 0);
+		pending = mbedtls_ssl_get_bytes_avail(&this->mSsl);
+	}
+	return pending + (this->mPeek >= 0 ? 1 : 0);
+}
+
+int TlsClient::read()
+{
+	uint8_t data;
+	return (this->read(&data, 1) == 1) ? data : -1;
+}
+
+int TlsClient::read(uint8_t *buffer, size_t size)
+{
+	if (!this->mReady || size == 0)
+	{
+		return -1;
+	}
+	int offset = 0;
+	if (this->mPeek >= 0)
+	{
+		buffer[offset++] = this->mPeek;
+		this->mPeek = -1;
+		if (size == 1)
+		{
+			return 1;
+		}
+	}
+	int ret = mbedtls_ssl_read(&this->mSsl, buffer + offset, size - offset);
+	if (ret > 0)
+	{
+		return offset + ret;
+	}
+	if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+	{
+		this->mClient->stop();
+	}
+	return (offset > 0) ? offset : -1;
+}
+
+int TlsClient::peek()
+{
+	if (this->mPeek < 0)
+	{
+		this->mPeek = this->read();
+	}
+	return this->mPeek;
+}
+
+void TlsClient::flush()
+{
+	this->mClient->flush();
+}
+
+// The session is kept so the next connect can resume it.
+void TlsClient::stop()
+{
+	if (this->mReady && this->mClient->connected())
+	{
+		mbedtls_ssl_close_notify(&this->mSsl);
+	}
+	this->mClient->stop();
+	this->mPeek = -1;
+}
+
+uint8_t TlsClient::connected()
+{
+	return this->mClient->connected() || this->mPeek >= 0 || (this->mReady && mbedtls_ssl_get_bytes_avail(&this->mSsl) > 0);
+}
+
+TlsClient::operator bool()
+{
+	return this->connected();
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TLS_CLIENT_H_
+#define TLS_CLIENT_H_
+
+#include <Arduino.h>
+
+// mbedtls ships with the ESP32 core; host builds opt in with -DTLS_CLIENT_ENABLED=1 and the mbedtls libraries
+#ifndef TLS_CLIENT_ENABLED
+#ifdef ESP32
+#define TLS_CLIENT_ENABLED 1
+#else
+#define TLS_CLIENT_ENABLED 0
+#endif
+#endif
+
+#if TLS_CLIENT_ENABLED
+#include "Client.h"
+#include "IPAddress.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+
+#define TLS_CLIENT_HOST_SIZE 64
+#define TLS_CLIENT_HANDSHAKE_TIMEOUT 10000 // milliseconds
+
+// TLS over any Arduino Client (WiFi, Ethernet or a native socket), so the same code runs on
+// every transport. The session from the last handshake is offered again on the next connect;
+// when the broker accepts it no certificate chain is sent or verified.
+class TlsClient : public Client
+{
+private:
+	Client *mClient;
+	mbedtls_ssl_context mSsl;
+	mbedtls_ssl_config mConf;
+	mbedtls_entropy_context mEntropy;
+	mbedtls_ctr_drbg_context mDrbg;
+	mbedtls_x509_crt mCa;
+	mbedtls_ssl_session mSession;
+	bool mReady;
+	bool mSessionValid;
+	bool mCertificateSeen;
+	bool mResumed;
+	bool mInsecure;
+	const char *mCaCert;
+	char mHost[TLS_CLIENT_HOST_SIZE];
+	int mPeek;
+	unsigned long mHandshakeTimeout;
+	unsigned long mHandshakeTime;
+	uint32_t mHandshakes;
+	uint32_t mResumptions;
+
+	bool setup();
+	int handshake();
+	static int sendCallback(void *context, const unsigned char *buffer, size_t length);
+	static int receiveCallback(void *context, unsigned char *buffer, size_t length);
+	static int verifyCallback(void *context, mbedtls_x509_crt *crt, int depth, uint32_t *flags);
+
+public:
+	TlsClient(Client &client);
+	~TlsClient();
+
+	// PEM root certificate; call before the first connect and keep it valid while the client is used
+	void setCACert(const char *caCert);
+	// Encrypts without authenticating the broker
+	void setInsecure();
+	// SNI and certificate name used when connecting by IPAddress
+	void setHostname(const char *host);
+	void setHandshakeTimeout(unsigned long timeout);
+	void invalidateSession();
+
+	bool isResumed();
+	unsigned long getHandshakeTime();
+	uint32_t getHandshakeCount();
+	uint32_t getResumeCount();
+
+	virtual int connect(IPAddress ip, uint16_t port);
+	virtual int connect(const char *host, uint16_t port);
+	virtual size_t write(uint8_t data);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual int available();
+	virtual int read();
+	virtual int read(uint8_t *buffer, size_t size);
+	virtual int peek();
+	virtual void flush();
+	virtual void stop();
+	virtual uint8_t connected();
+	virtual operator bool();
+};
+
+#endif
+
+#endif
@@ -0,0 +1,446 @@
+#include "TopicTree.h"
+
+TopicTree::TopicTree()
+{
+	this->mNodes = NULL;
+	this->mHandles = NULL;
+	this->mSlots = NULL;
+	this->mLabels = NULL;
+	this->mMaxNodes = 0;
+	this->mMaxHandles = 0;
+	this->mSlotCount = 0;
+	this->mLabelCapacity = 0;
+	this->mNodeCount = 0;
+	this->mLabelSize = 0;
+}
+
+TopicTree::~TopicTree()
+{
+	free(this->mNodes);
+	free(this->mHandles);
+	free(this->mSlots);
+	free(this->mLabels);
+}
+
+bool TopicTree::begin()
+{
+	return this->begin(TOPIC_TREE_MAX_NODES, TOPIC_TREE_MAX_HANDLES, TOPIC_TREE_LABEL_SIZE);
+}
+
+bool TopicTree::begin(uint16_t maxNodes, uint16_t maxHandles, uint16_t labelSize)
+{
+	if (this->isReady())
+	{
+		return true;
+	}
+	if (maxNodes == 0 || maxNodes > 16384 || maxHandles == 0 || maxHandles > 16384)
+	{
+		return false;
+	}
+	uint16_t slots = 1;
+	while (slots < maxNodes * 2)
+	{
+		slots <<= 1;
+	}
+	this->mNodes = (TopicNode *)malloc(maxNodes * sizeof(TopicNode));
+	this->mHandles = (TopicHandle *)malloc(maxHandles * sizeof(TopicHandle));
+	this->mSlots = (int16_t *)malloc(slots * sizeof(int16_t));
+	this->mLabels = (char *)malloc(labelSize);
+	if (this->mNodes == NULL || this->mHandles == NULL || this->mSlots == NULL || this->mLabels == NULL)
+	{
+		free(this->mNodes);
+		free(this->mHandles);
+		free(this->mSlots);
+		free(this->mLabels);
+		this->mNodes = NULL;
+		this->mHandles = NULL;
+		this->mSlots = NULL;
+		this->mLabels = NULL;
+		return false;
+	}
+	this->mMaxNodes = maxNodes;
+	this->mMaxHandles = maxHandles;
+	this->mSlotCount = slots;
+	this->mLabelCapacity = labelSize;
+	this->clear();
+	return true;
+}
+
+bool TopicTree::isReady()
+{
+	return this->mNodes != NULL;
+}
+
+uint16_t TopicTree::getMaxHandles()
+{
+	return this->mMaxHandles;
+}
+
+void TopicTree::clear()
+{
+	if (!this->isReady())
+	{
+		return;
+	}
+	for (uint16_t i = 0; i < this->mSlotCount; i++)
+	{
+		this->mSlots[i] = TOPIC_TREE_NONE;
+	}
+	for (uint16_t i = 0; i < this->mMaxHandles; i++)
+	{
+		this->mHandles[i].used = false;
+	}
+
+	// root
+	this->mNodes[0].hash = 0;
+	this->mNodes[0].parent = TOPIC_TREE_NONE;
+	this->mNodes[0].plus = TOPIC_TREE_NONE;
+	this->mNodes[0].handles = TOPIC_TREE_NONE;
+	this->mNodes[0].hashHandles = TOPIC_TREE_NONE;
+	this->mNodes[0].label = 0;
+	this->mNodes[0].length = 0;
+	this->mNodeCount = 1;
+	this->mLabelSize = 0;
+}
+
+uint32_t TopicTree::hashLevel(int16_t parent, const char *label, uint8_t length)
+{
+	// FNV-1a seeded with the parent node
+	uint32_t hash = 2166136261u ^ (uint32_t)parent;
+	hash *= 16777619u;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)label[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+int16_t TopicTree::findChild(int16_t parent, const char *label, uint8_t length)
+{
+	uint32_t hash = this->hashLevel(parent, label, length);
+	for (uint16_t i = 0; i < this->mSlotCount; i++)
+	{
+		int16_t node = this->mSlots[(hash + i) & (this->mSlotCount - 1)];
+		if (node == TOPIC_TREE_NONE)
+		{
+			return TOPIC_TREE_NONE;
+		}
+		TopicNode *n = &this->mNodes[node];
+		if (n->hash == hash && n->parent == parent && n->length == length && memcmp(this->mLabels + n->label, label, length) == 0)
+		{
+			return node;
+		}
+	}
+	return TOPIC_TREE_NONE;
+}
+
+int16_t TopicTree::addChild(int16_t parent, const char *label, uint8_t length)
+{
+	if (this->mNodeCount >= this->mMaxNodes || this->mLabelSize + length > this->mLabelCapacity)
+	{
+		return TOPIC_TREE_NONE;
+	}
+	int16_t node = this->mNodeCount++;
+	TopicNode *n = &this->mNodes[node];
+	n->hash = this->hashLevel(parent, label, length);
+	n->parent = parent;
+	n->plus = TOPIC_TREE_NONE;
+	n->handles = TOPIC_TREE_NONE;
+	n->hashHandles = TOPIC_TREE_NONE;
+	n->label = this->mLabelSize;
+	n->length = length;
+	memcpy(this->mLabels + this->mLabelSize, label, length);
+	this->mLabelSize += length;
+	return node;
+}
+
+// Walks (and optionally grows) the levels of a filter; a trailing '#' is reported through multiLevel.
+int16_t TopicTree::findNode(const char *filter, bool create, bool *multiLevel)
+{
+	int16_t node = 0;
+	const char *p = filter;
+	*multiLevel = false;
+	while (true)
+	{
+		const char *end = strchr(p, '/');
+		if (end == NULL)
+		{
+			end = p + strlen(p);
+		}
+		uint32_t length = end - p;
+		if (length > 255)
+		{
+			return TOPIC_TREE_NONE;
+		}
+		if (length == 1 && *p == '#')
+		{
+			if (*end != '\0')
+			{
+				return TOPIC_TREE_NONE;
+			}
+			*multiLevel = true;
+			return node;
+		}
+		if (memchr(p, '#', length) != NULL || (length > 1 && memchr(p, '+', length) != NULL))
+		{
+			return TOPIC_TREE_NONE;
+		}
+
+		int16_t child;
+		if (length == 1 && *p == '+')
+		{
+			child = this->mNodes[node].plus;
+			if (child == TOPIC_TREE_NONE && create)
+			{
+				child = this->addChild(node, p, 1);
+				this->mNodes[node].plus = child;
+			}
+		}
+		else
+		{
+			child = this->findChild(node, p, length);
+			if (child == TOPIC_TREE_NONE && create)
+			{
+				child = this->addChild(node, p, length);
+				if (child != TOPIC_TREE_NONE)
+				{
+					uint32_t hash = this->mNodes[child].hash;
+					uint16_t i = 0;
+					while (this->mSlots[(hash + i) & (this->mSlotCount - 1)] != TOPIC_TREE_NONE)
+					{
+						i++;
+					}
+					this->mSlots[(hash + i) & (this->mSlotCount - 1)] = child;
+				}
+			}
+		}
+		if (child == TOPIC_TREE_NONE)
+		{
+			return TOPIC_TREE_NONE;
+		}
+		node = child;
+		if (*end == '\0')
+		{
+			return node;
+		}
+		p = end + 1;
+	}
+}
+
+int16_t TopicTree::add(const char *filter)
+{
+	int16_t handle = TOPIC_TREE_NONE;
+	for (int16_t i = 0; i < this->mMaxHandles; i++)
+	{
+		if (!this->mHandles[i].used)
+		{
+			handle = i;
+			break;
+		}
+	}
+	if (handle == TOPIC_TREE_NONE)
+	{
+		return TOPIC_TREE_NONE;
+	}
+
+	bool multiLevel;
+	int16_t node = this->findNode(filter, true, &multiLevel);
+	if (node == TOPIC_TREE_NONE)
+	{
+		return TOPIC_TREE_NONE;
+	}
+
+	TopicHandle *h = &this->mHandles[handle];
+	int16_t *list = multiLevel ? &this->mNodes[node].hashHandles : &this->mNodes[node].handles;
+	h->node = node;
+	h->multiLevel = multiLevel;
+	h->used = true;
+	h->linked = true;
+	h->next = *list;
+	*list = handle;
+	return handle;
+}
+
+// Nodes stay in place so re-adding the same filter reuses them.
+void TopicTree::remove(int16_t handle)
+{
+	this->detach(handle);
+	this->release(handle);
+}
+
+void TopicTree::detach(int16_t handle)
+{
+	if (!this->isLinked(handle))
+	{
+		return;
+	}
+	TopicHandle *h = &this->mHandles[handle];
+	int16_t *list = h->multiLevel ? &this->mNodes[h->node].hashHandles : &this->mNodes[h->node].handles;
+	while (*list != TOPIC_TREE_NONE)
+	{
+		if (*list == handle)
+		{
+			*list = h->next;
+			break;
+		}
+		list = &this->mHandles[*list].next;
+	}
+	h->linked = false;
+}
+
+void TopicTree::release(int16_t handle)
+{
+	if (handle >= 0 && handle < this->mMaxHandles && this->mHandles[handle].used && !this->mHandles[handle].linked)
+	{
+		this->mHandles[handle].used = false;
+	}
+}
+
+bool TopicTree::isLinked(int16_t handle)
+{
+	return handle >= 0 && handle < this->mMaxHandles && this->mHandles[handle].used && this->mHandles[handle].linked;
+}
+
+bool TopicTree::contains(const char *filter)
+{
+	if (!this->isReady())
+	{
+		return false;
+	}
+	bool multiLevel;
+	int16_t node = this->findNode(filter, false, &multiLevel);
+	if (node == TOPIC_TREE_NONE)
+	{
+		return false;
+	}
+	return (multiLevel ? this->mNodes[node].hashHandles : this->mNodes[node].handles) != TOPIC_TREE_NONE;
+}
+
+bool TopicTree::getFilter(int16_t handle, char *buffer, uint32_t bufferSize)
+{
+	if (handle < 0 || handle >= this->mMaxHandles || !this->mHandles[handle].used)
+	{
+		return false;
+	}
+	int16_t levels[TOPIC_TREE_MAX_DEPTH];
+	uint8_t depth = 0;
+	for (int16_t node = this->mHandles[handle].node; node > 0; node = this->mNodes[node].parent)
+	{
+		if (depth == TOPIC_TREE_MAX_DEPTH)
+		{
+			return false;
+		}
+		levels[depth++] = node;
+	}
+
+	uint32_t p = 0;
+	while (depth > 0)
+	{
+		TopicNode *n = &this->mNodes[levels[--depth]];
+		if (p + n->length + 2 > bufferSize)
+		{
+			return false;
+		}
+		memcpy(buffer + p, this->mLabels + n->label, n->length);
+		p += n->length;
+		if (depth > 0)
+		{
+			buffer[p++] = '/';
+		}
+	}
+	if (this->mHandles[handle].multiLevel)
+	{
+		if (p + 3 > bufferSize)
+		{
+			return false;
+		}
+		if (p > 0)
+		{
+			buffer[p++] = '/';
+		}
+		buffer[p++] = '#';
+	}
+	buffer[p] = '\0';
+	return true;
+}
+
+uint8_t TopicTree::collect(int16_t handle, int16_t *handles, uint8_t count, uint8_t maxHandles)
+{
+	for (; handle != TOPIC_TREE_NONE && count < 255; handle = this->mHandles[handle].next)
+	{
+		if (count < maxHandles)
+		{
+			handles[count] = handle;
+		}
+		count++;
+	}
+	return count;
+}
+
+// Single pass over the topic levels, following the exact child and the '+' child of every live node.
+uint8_t TopicTree::match(const char *topic, int16_t *handles, uint8_t maxHandles)
+{
+	if (!this->isReady())
+	{
+		return 0;
+	}
+	int16_t frontier[2][TOPIC_TREE_MAX_FRONTIER];
+	uint8_t current = 0;
+	uint8_t size = 1;
+	uint8_t count = 0;
+	// wildcards at the first level never match $-topics
+	bool system = (topic[0] == '$');
+	const char *p = topic;
+
+	frontier[0][0] = 0;
+	while (true)
+	{
+		const char *end = strchr(p, '/');
+		if (end == NULL)
+		{
+			end = p + strlen(p);
+		}
+		uint32_t length = end - p;
+
+		uint8_t next = 0;
+		for (uint8_t i = 0; i < size; i++)
+		{
+			int16_t node = frontier[current][i];
+			bool wildcards = !(system && node == 0);
+			if (wildcards)
+			{
+				count = this->collect(this->mNodes[node].hashHandles, handles, count, maxHandles);
+			}
+			int16_t child = (length > 255) ? TOPIC_TREE_NONE : this->findChild(node, p, length);
+			if (child != TOPIC_TREE_NONE && next < TOPIC_TREE_MAX_FRONTIER)
+			{
+				frontier[1 - current][next++] = child;
+			}
+			child = this->mNodes[node].plus;
+			if (wildcards && child != TOPIC_TREE_NONE && next < TOPIC_TREE_MAX_FRONTIER)
+			{
+				frontier[1 - current][next++] = child;
+			}
+		}
+		current = 1 - current;
+		size = next;
+		if (size == 0)
+		{
+			return count;
+		}
+		if (*end == '\0')
+		{
+			break;
+		}
+		p = end + 1;
+	}
+
+	for (uint8_t i = 0; i < size; i++)
+	{
+		int16_t node = frontier[current][i];
+		count = this->collect(this->mNodes[node].hashHandles, handles, count, maxHandles);
+		count = this->collect(this->mNodes[node].handles, handles, count, maxHandles);
+	}
+	return count;
+}
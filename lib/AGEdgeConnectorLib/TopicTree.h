@@ -0,0 +1,86 @@
+#ifndef TOPIC_TREE_H_
+#define TOPIC_TREE_H_
+
+#include <Arduino.h>
+
+#ifndef TOPIC_TREE_MAX_NODES
+#define TOPIC_TREE_MAX_NODES 128
+#endif
+#ifndef TOPIC_TREE_MAX_HANDLES
+#define TOPIC_TREE_MAX_HANDLES 64
+#endif
+#ifndef TOPIC_TREE_LABEL_SIZE
+#define TOPIC_TREE_LABEL_SIZE 2048
+#endif
+#define TOPIC_TREE_MAX_FRONTIER 16
+#define TOPIC_TREE_MAX_DEPTH 32
+#define TOPIC_TREE_NONE -1
+
+struct TopicNode
+{
+	uint32_t hash;
+	int16_t parent;
+	int16_t plus;				 // '+' child
+	int16_t handles;		 // filters ending at this level
+	int16_t hashHandles; // filters ending in '#' below this level
+	uint16_t label;
+	uint8_t length;
+};
+
+struct TopicHandle
+{
+	int16_t node;
+	int16_t next;
+	bool used;
+	bool linked; // false once detached, until released
+	bool multiLevel;
+};
+
+// Topic filter trie: one node per level, children found through a shared hash table,
+// so matching a topic costs one probe per level regardless of how many filters exist.
+// The tables are allocated by begin(); an empty tree costs a few pointers.
+class TopicTree
+{
+private:
+	TopicNode *mNodes;
+	TopicHandle *mHandles;
+	int16_t *mSlots;
+	char *mLabels;
+	uint16_t mMaxNodes;
+	uint16_t mMaxHandles;
+	uint16_t mSlotCount; // power of two, at least twice the nodes
+	uint16_t mLabelCapacity;
+	uint16_t mNodeCount;
+	uint16_t mLabelSize;
+
+	uint32_t hashLevel(int16_t parent, const char *label, uint8_t length);
+	int16_t findChild(int16_t parent, const char *label, uint8_t length);
+	int16_t addChild(int16_t parent, const char *label, uint8_t length);
+	int16_t findNode(const char *filter, bool create, bool *multiLevel);
+	uint8_t collect(int16_t handle, int16_t *handles, uint8_t count, uint8_t maxHandles);
+
+public:
+	TopicTree();
+	~TopicTree();
+
+	// Allocates the tables once; until then add() fails and match() finds nothing
+	bool begin();
+	bool begin(uint16_t maxNodes, uint16_t maxHandles, uint16_t labelSize);
+	bool isReady();
+	uint16_t getMaxHandles();
+
+	int16_t add(const char *filter);
+	void remove(int16_t handle);
+	// remove() in two steps: detach() stops the filter matching, release() frees the handle for reuse
+	void detach(int16_t handle);
+	void release(int16_t handle);
+	bool isLinked(int16_t handle);
+	bool contains(const char *filter);
+	bool getFilter(int16_t handle, char *buffer, uint32_t bufferSize);
+	// Returns how many filters match; only the first maxHandles are stored
+	uint8_t match(const char *topic, int16_t *handles, uint8_t maxHandles);
+
+	void clear();
+};
+
+#endif
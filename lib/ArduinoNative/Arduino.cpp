@@ -0,0 +1,153 @@
+#include "Arduino.h"
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/random.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static unsigned long long monotonicMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const unsigned long long startedAt = monotonicMicros();
+
+// Wrap at 32 bits like the ESP32 so overflow handling is exercised on the host too
+unsigned long millis()
+{
+	return (uint32_t)((monotonicMicros() - startedAt) / 1000);
+}
+
+unsigned long micros()
+{
+	return (uint32_t)(monotonicMicros() - startedAt);
+}
+
+void delay(unsigned long ms)
+{
+	usleep(ms * 1000);
+}
+
+void yield()
+{
+}
+
+void *ps_malloc(size_t size)
+{
+	return malloc(size);
+}
+
+void *ps_calloc(size_t count, size_t size)
+{
+	return calloc(count, size);
+}
+
+bool psramInit()
+{
+	return false;
+}
+
+uint32_t esp_random()
+{
+	uint32_t value = 0;
+	if (getrandom(&value, sizeof(value), 0) != sizeof(value))
+	{
+		value = (uint32_t)rand();
+	}
+	return value;
+}
+
+// Locally administered address derived from the host name so every host gets a stable MAC
+void esp_efuse_mac_get_default(uint8_t *mac)
+{
+	char host[64] = {0};
+	gethostname(host, sizeof(host) - 1);
+	uint32_t hash = 2166136261u;
+	for (const char *p = host; *p; p++)
+	{
+		hash ^= (uint8_t)*p;
+		hash *= 16777619u;
+	}
+	mac[0] = 0x02;
+	mac[1] = 0x00;
+	mac[2] = hash >> 24;
+	mac[3] = hash >> 16;
+	mac[4] = hash >> 8;
+	mac[5] = hash;
+}
+
+void HardwareSerial::begin(unsigned long /* baud */)
+{
+	int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+	fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+}
+
+int HardwareSerial::available()
+{
+	return 0;
+}
+
+int HardwareSerial::read()
+{
+	uint8_t data;
+	return (::read(STDIN_FILENO, &data, 1) == 1) ? data : -1;
+}
+
+int HardwareSerial::peek()
+{
+	return -1;
+}
+
+size_t HardwareSerial::write(uint8_t data)
+{
+	return fwrite(&data, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, stdout);
+}
+
+void HardwareSerial::flush()
+{
+	fflush(stdout);
+}
+
+void EspClass::restart()
+{
+	fflush(stdout);
+	exit(0);
+}
+
+uint64_t EspClass::getEfuseMac()
+{
+	uint8_t mac[6];
+	esp_efuse_mac_get_default(mac);
+	uint64_t value = 0;
+	for (int i = 5; i >= 0; i--)
+	{
+		value = (value << 8) | mac[i];
+	}
+	return value;
+}
+
+// Test runners bring their own main()
+#ifndef PIO_UNIT_TESTING
+void setup();
+void loop();
+
+int main()
+{
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	setup();
+	while (true)
+	{
+		loop();
+	}
+	return 0;
+}
+#endif
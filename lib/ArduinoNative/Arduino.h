@@ -0,0 +1,74 @@
+#ifndef ARDUINO_NATIVE_H_
+#define ARDUINO_NATIVE_H_
+
+// Host (native) replacement for the subset of the Arduino/ESP32 core the connector uses.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <math.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+#define pgm_read_byte_near(p) (*(const uint8_t *)(p))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+void *ps_malloc(size_t size);
+void *ps_calloc(size_t count, size_t size);
+bool psramInit();
+uint32_t esp_random();
+void esp_efuse_mac_get_default(uint8_t *mac);
+
+class String
+{
+private:
+	std::string mValue;
+
+public:
+	String() {}
+	String(const char *value) : mValue(value != NULL ? value : "") {}
+	String(const std::string &value) : mValue(value) {}
+	const char *c_str() const { return mValue.c_str(); }
+	unsigned int length() const { return mValue.length(); }
+	bool operator==(const char *value) const { return mValue == value; }
+};
+
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baud);
+	virtual int available();
+	virtual int read();
+	virtual int peek();
+	virtual size_t write(uint8_t data);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual void flush();
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+	void restart();
+	uint64_t getEfuseMac();
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HTTP_CLIENT_NATIVE_H_
+#define HTTP_CLIENT_NATIVE_H_
+
+#include "WiFi.h"
+
+#define HTTP_CODE_OK 200
+
+// OTA is not available on the host; every request fails.
+class HTTPClient
+{
+private:
+	WiFiClient mStream;
+
+public:
+	bool begin(const char * /* url */) { return false; }
+	int GET() { return -1; }
+	int getSize() { return 0; }
+	WiFiClient &getStream() { return mStream; }
+	void end() {}
+};
+
+#endif
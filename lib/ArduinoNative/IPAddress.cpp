@@ -0,0 +1,60 @@
+#include "IPAddress.h"
+
+IPAddress::IPAddress()
+{
+	memset(this->mAddress, 0, sizeof(this->mAddress));
+}
+
+IPAddress::IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth)
+{
+	this->mAddress[0] = first;
+	this->mAddress[1] = second;
+	this->mAddress[2] = third;
+	this->mAddress[3] = fourth;
+}
+
+IPAddress::IPAddress(uint32_t address)
+{
+	memcpy(this->mAddress, &address, sizeof(this->mAddress));
+}
+
+bool IPAddress::fromString(const char *address)
+{
+	unsigned int parts[4];
+	char tail;
+	if (sscanf(address, "%u.%u.%u.%u%c", &parts[0], &parts[1], &parts[2], &parts[3], &tail) != 4)
+	{
+		return false;
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		if (parts[i] > 255)
+		{
+			return false;
+		}
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		this->mAddress[i] = parts[i];
+	}
+	return true;
+}
+
+String IPAddress::toString() const
+{
+	char buffer[16];
+	snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", this->mAddress[0], this->mAddress[1], this->mAddress[2], this->mAddress[3]);
+	return String(buffer);
+}
+
+IPAddress::operator uint32_t() const
+{
+	uint32_t address;
+	memcpy(&address, this->mAddress, sizeof(address));
+	return address;
+}
+
+bool IPAddress::operator==(const IPAddress &other) const
+{
+	return memcmp(this->mAddress, other.mAddress, sizeof(this->mAddress)) == 0;
+}
@@ -0,0 +1,27 @@
+#ifndef IPADDRESS_H_
+#define IPADDRESS_H_
+
+#include <stdint.h>
+#include "Arduino.h"
+
+class IPAddress
+{
+private:
+	uint8_t mAddress[4];
+
+public:
+	IPAddress();
+	IPAddress(uint8_t first, uint8_t second, uint8_t third, uint8_t fourth);
+	// network byte order, as in struct in_addr
+	IPAddress(uint32_t address);
+
+	bool fromString(const char *address);
+	String toString() const;
+
+	operator uint32_t() const;
+	bool operator==(const IPAddress &other) const;
+	uint8_t operator[](int index) const { return mAddress[index]; }
+	uint8_t &operator[](int index) { return mAddress[index]; }
+};
+
+#endif
@@ -0,0 +1,386 @@
+#include "LoopbackBroker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+LoopbackBroker::LoopbackBroker()
+{
+	this->mListener = -1;
+	this->mPort = 0;
+	this->mAccepted = 0;
+	this->mAnswer = true;
+	this->mHoldSubacks = false;
+	this->mAckPublishes = true;
+	this->mSessionPresent = false;
+	memset(this->mPackets, 0, sizeof(this->mPackets));
+	this->mDuplicates = 0;
+	for (uint8_t i = 0; i < LOOPBACK_BROKER_CONNECTIONS; i++)
+	{
+		this->mConnections[i].fd = -1;
+	}
+}
+
+LoopbackBroker::~LoopbackBroker()
+{
+	this->end();
+}
+
+bool LoopbackBroker::begin()
+{
+	this->mListener = socket(AF_INET, SOCK_STREAM, 0);
+	if (this->mListener < 0)
+	{
+		return false;
+	}
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t length = sizeof(address);
+	if (bind(this->mListener, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(this->mListener, LOOPBACK_BROKER_CONNECTIONS) < 0 ||
+			getsockname(this->mListener, (struct sockaddr *)&address, &length) < 0)
+	{
+		this->end();
+		return false;
+	}
+	fcntl(this->mListener, F_SETFL, fcntl(this->mListener, F_GETFL, 0) | O_NONBLOCK);
+	this->mPort = ntohs(address.sin_port);
+	return true;
+}
+
+void LoopbackBroker::end()
+{
+	this->disconnect();
+	if (this->mListener >= 0)
+	{
+		close(this->mListener);
+		this->mListener = -1;
+	}
+}
+
+uint16_t LoopbackBroker::port()
+{
+	return this->mPort;
+}
+
+void LoopbackBroker::poll()
+{
+	int fd;
+	while (this->mListener >= 0 && this->mAccepted < LOOPBACK_BROKER_CONNECTIONS && (fd = accept(this->mListener, NULL, NULL)) >= 0)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		Connection *connection = &this->mConnections[this->mAccepted++];
+		connection->fd = fd;
+		connection->used = 0;
+		connection->filterCount = 0;
+		connection->heldUsed = 0;
+		connection->connectFlags = 0;
+	}
+
+	for (uint8_t i = 0; i < this->mAccepted; i++)
+	{
+		Connection *connection = &this->mConnections[i];
+		if (connection->fd < 0)
+		{
+			continue;
+		}
+		ssize_t n = recv(connection->fd, connection->buffer + connection->used, LOOPBACK_BROKER_BUFFER_SIZE - connection->used, MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			this->drop(connection);
+			continue;
+		}
+		if (n > 0)
+		{
+			connection->used += n;
+		}
+
+		// complete packets: header, remaining length, body
+		while (connection->used >= 2)
+		{
+			uint32_t remaining = 0;
+			uint32_t multiplier = 1;
+			size_t pos = 1;
+			uint8_t digit = 128;
+			while ((digit & 128) != 0 && pos < connection->used)
+			{
+				digit = connection->buffer[pos++];
+				remaining += (digit & 127) * multiplier;
+				multiplier *= 128;
+			}
+			if ((digit & 128) != 0 || connection->used < pos + remaining)
+			{
+				break;
+			}
+			uint8_t header = connection->buffer[0];
+			this->mPackets[header >> 4]++;
+			if ((header & 0xF8) == 0x38)
+			{
+				this->mDuplicates++;
+			}
+			if (this->mAnswer)
+			{
+				this->handle(connection, connection->buffer + pos, remaining, header);
+			}
+			memmove(connection->buffer, connection->buffer + pos + remaining, connection->used - pos - remaining);
+			connection->used -= pos + remaining;
+		}
+	}
+}
+
+void LoopbackBroker::run(unsigned long ms, std::function<void()> step)
+{
+	unsigned long started = millis();
+	while (millis() - started < ms)
+	{
+		this->poll();
+		step();
+		delay(1);
+	}
+}
+
+void LoopbackBroker::handle(Connection *connection, const uint8_t *packet, uint32_t length, uint8_t header)
+{
+	uint8_t type = header & 0xF0;
+	if (type == 0x10) // CONNECT
+	{
+		uint32_t flags = 2 + ((length >= 2) ? ((packet[0] << 8) | packet[1]) : 0) + 1;
+		connection->connectFlags = (flags < length) ? packet[flags] : 0;
+		const uint8_t connack[] = {0x20, 2, (uint8_t)(this->mSessionPresent ? 1 : 0), 0};
+		this->reply(connection, connack, sizeof(connack));
+	}
+	else if (type == 0x80) // SUBSCRIBE
+	{
+		this->subscribe(connection, packet, length);
+	}
+	else if (type == 0xA0) // UNSUBSCRIBE
+	{
+		this->unsubscribe(connection, packet, length);
+	}
+	else if (type == 0xC0) // PINGREQ
+	{
+		static const uint8_t pingresp[] = {0xD0, 0};
+		this->reply(connection, pingresp, sizeof(pingresp));
+	}
+	else if (type == 0x30 && (header & 0x06) == 0x02 && length >= 2 && this->mAckPublishes) // QoS 1 PUBLISH
+	{
+		uint16_t topicLength = (packet[0] << 8) | packet[1];
+		if (length >= 4u + topicLength)
+		{
+			const uint8_t puback[] = {0x40, 2, packet[2 + topicLength], packet[3 + topicLength]};
+			this->reply(connection, puback, sizeof(puback));
+		}
+	}
+}
+
+void LoopbackBroker::subscribe(Connection *connection, const uint8_t *packet, uint32_t length)
+{
+	uint8_t suback[4 + LOOPBACK_BROKER_FILTERS];
+	uint8_t codes = 0;
+	uint32_t pos = 2;
+	while (pos + 2 < length && codes < LOOPBACK_BROKER_FILTERS)
+	{
+		uint16_t topicLength = (packet[pos] << 8) | packet[pos + 1];
+		pos += 2;
+		if (pos + topicLength >= length || topicLength >= LOOPBACK_BROKER_FILTER_SIZE)
+		{
+			break;
+		}
+		char topic[LOOPBACK_BROKER_FILTER_SIZE];
+		memcpy(topic, packet + pos, topicLength);
+		topic[topicLength] = '\0';
+		uint8_t qos = packet[pos + topicLength] & 0x03;
+		pos += topicLength + 1;
+
+		int index = -1;
+		for (uint8_t i = 0; i < connection->filterCount; i++)
+		{
+			if (strcmp(connection->filters[i].topic, topic) == 0)
+			{
+				index = i;
+			}
+		}
+		if (index < 0 && connection->filterCount < LOOPBACK_BROKER_FILTERS)
+		{
+			index = connection->filterCount++;
+			strcpy(connection->filters[index].topic, topic);
+		}
+		if (index >= 0)
+		{
+			connection->filters[index].qos = qos;
+		}
+		suback[4 + codes++] = (index >= 0) ? qos : 0x80;
+	}
+	suback[0] = 0x90;
+	suback[1] = 2 + codes;
+	suback[2] = packet[0];
+	suback[3] = packet[1];
+	if (this->mHoldSubacks && connection->heldUsed + 4 + codes <= LOOPBACK_BROKER_BUFFER_SIZE)
+	{
+		memcpy(connection->held + connection->heldUsed, suback, 4 + codes);
+		connection->heldUsed += 4 + codes;
+		return;
+	}
+	this->reply(connection, suback, 4 + codes);
+}
+
+void LoopbackBroker::unsubscribe(Connection *connection, const uint8_t *packet, uint32_t length)
+{
+	uint32_t pos = 2;
+	while (pos + 2 <= length)
+	{
+		uint16_t topicLength = (packet[pos] << 8) | packet[pos + 1];
+		pos += 2;
+		if (pos + topicLength > length)
+		{
+			break;
+		}
+		for (uint8_t i = 0; i < connection->filterCount; i++)
+		{
+			if (strlen(connection->filters[i].topic) == topicLength && memcmp(connection->filters[i].topic, packet + pos, topicLength) == 0)
+			{
+				connection->filters[i] = connection->filters[--connection->filterCount];
+				break;
+			}
+		}
+		pos += topicLength;
+	}
+	const uint8_t unsuback[] = {0xB0, 2, packet[0], packet[1]};
+	this->reply(connection, unsuback, sizeof(unsuback));
+}
+
+void LoopbackBroker::reply(Connection *connection, const uint8_t *packet, size_t length)
+{
+	if (connection->fd >= 0 && send(connection->fd, packet, length, MSG_NOSIGNAL) != (ssize_t)length)
+	{
+		this->drop(connection);
+	}
+}
+
+void LoopbackBroker::drop(Connection *connection)
+{
+	if (connection->fd >= 0)
+	{
+		close(connection->fd);
+		connection->fd = -1;
+	}
+	connection->used = 0;
+	connection->heldUsed = 0;
+}
+
+void LoopbackBroker::setAnswer(bool answer)
+{
+	this->mAnswer = answer;
+}
+
+void LoopbackBroker::setHoldSubacks(bool hold)
+{
+	this->mHoldSubacks = hold;
+}
+
+void LoopbackBroker::setAckPublishes(bool ack)
+{
+	this->mAckPublishes = ack;
+}
+
+void LoopbackBroker::setSessionPresent(bool present)
+{
+	this->mSessionPresent = present;
+}
+
+void LoopbackBroker::releaseSubacks()
+{
+	for (uint8_t i = 0; i < this->mAccepted; i++)
+	{
+		Connection *connection = &this->mConnections[i];
+		if (connection->heldUsed > 0)
+		{
+			size_t used = connection->heldUsed;
+			connection->heldUsed = 0;
+			this->reply(connection, connection->held, used);
+		}
+	}
+}
+
+void LoopbackBroker::disconnect()
+{
+	for (uint8_t i = 0; i < this->mAccepted; i++)
+	{
+		this->drop(&this->mConnections[i]);
+	}
+}
+
+bool LoopbackBroker::publish(uint8_t connection, const char *topic, const uint8_t *payload, size_t length)
+{
+	if (!this->isConnected(connection))
+	{
+		return false;
+	}
+	uint8_t header[8];
+	size_t topicLength = strlen(topic);
+	uint32_t remaining = 2 + topicLength + length;
+	size_t pos = 0;
+	header[pos++] = 0x30;
+	do
+	{
+		uint8_t digit = remaining % 128;
+		remaining /= 128;
+		header[pos++] = (remaining > 0) ? (digit | 128) : digit;
+	} while (remaining > 0);
+	header[pos++] = topicLength >> 8;
+	header[pos++] = topicLength & 0xFF;
+	Connection *target = &this->mConnections[connection];
+	this->reply(target, header, pos);
+	this->reply(target, (const uint8_t *)topic, topicLength);
+	this->reply(target, payload, length);
+	return target->fd >= 0;
+}
+
+uint8_t LoopbackBroker::getAccepted()
+{
+	return this->mAccepted;
+}
+
+bool LoopbackBroker::isConnected(uint8_t connection)
+{
+	return connection < this->mAccepted && this->mConnections[connection].fd >= 0;
+}
+
+uint32_t LoopbackBroker::getPacketCount(uint8_t type)
+{
+	return this->mPackets[(type >> 4) & 0x0F];
+}
+
+uint32_t LoopbackBroker::getDuplicateCount()
+{
+	return this->mDuplicates;
+}
+
+uint8_t LoopbackBroker::getConnectFlags(uint8_t connection)
+{
+	return (connection < this->mAccepted) ? this->mConnections[connection].connectFlags : 0;
+}
+
+int LoopbackBroker::getSubscribedQos(uint8_t connection, const char *filter)
+{
+	if (connection >= this->mAccepted)
+	{
+		return -1;
+	}
+	for (uint8_t i = 0; i < this->mConnections[connection].filterCount; i++)
+	{
+		if (strcmp(this->mConnections[connection].filters[i].topic, filter) == 0)
+		{
+			return this->mConnections[connection].filters[i].qos;
+		}
+	}
+	return -1;
+}
+
+uint8_t LoopbackBroker::getFilterCount(uint8_t connection)
+{
+	return (connection < this->mAccepted) ? this->mConnections[connection].filterCount : 0;
+}
@@ -0,0 +1,93 @@
+#ifndef LOOPBACK_BROKER_H_
+#define LOOPBACK_BROKER_H_
+
+#include "Arduino.h"
+#include <functional>
+
+#define LOOPBACK_BROKER_CONNECTIONS 4
+#define LOOPBACK_BROKER_BUFFER_SIZE 4096
+#define LOOPBACK_BROKER_FILTERS 16
+#define LOOPBACK_BROKER_FILTER_SIZE 128
+
+// Minimal MQTT 3.1.1 broker on an ephemeral 127.0.0.1 port, pumped by poll() from the test's own
+// thread. It answers CONNECT, SUBSCRIBE (granting the requested QoS), UNSUBSCRIBE, PINGREQ and
+// QoS 1 PUBLISH, keeps the filters of every connection and does not route messages; publish() sends one.
+class LoopbackBroker
+{
+private:
+	struct Filter
+	{
+		char topic[LOOPBACK_BROKER_FILTER_SIZE];
+		uint8_t qos;
+	};
+	struct Connection
+	{
+		int fd;
+		uint8_t buffer[LOOPBACK_BROKER_BUFFER_SIZE];
+		size_t used;
+		Filter filters[LOOPBACK_BROKER_FILTERS];
+		uint8_t filterCount;
+		uint8_t held[LOOPBACK_BROKER_BUFFER_SIZE]; // SUBACKs not yet sent
+		size_t heldUsed;
+		uint8_t connectFlags;
+	};
+
+	int mListener;
+	uint16_t mPort;
+	Connection mConnections[LOOPBACK_BROKER_CONNECTIONS];
+	uint8_t mAccepted;
+	bool mAnswer;
+	bool mHoldSubacks;
+	bool mAckPublishes;
+	bool mSessionPresent;
+	uint32_t mPackets[16];
+	uint32_t mDuplicates;
+
+	void handle(Connection *connection, const uint8_t *packet, uint32_t length, uint8_t header);
+	void subscribe(Connection *connection, const uint8_t *packet, uint32_t length);
+	void unsubscribe(Connection *connection, const uint8_t *packet, uint32_t length);
+	void reply(Connection *connection, const uint8_t *packet, size_t length);
+	void drop(Connection *connection);
+
+public:
+	LoopbackBroker();
+	~LoopbackBroker();
+
+	bool begin();
+	void end();
+	uint16_t port();
+
+	// Accepts, reads and answers whatever is pending; never blocks
+	void poll();
+	// Polls for ms milliseconds, calling step (e.g. Connector::loop) between polls
+	void run(unsigned long ms, std::function<void()> step);
+
+	// false reads everything and answers nothing, like a broker that hangs after accept
+	void setAnswer(bool answer);
+	// true keeps SUBACKs until releaseSubacks()
+	void setHoldSubacks(bool hold);
+	void releaseSubacks();
+	// false leaves QoS 1 PUBLISHes unacknowledged
+	void setAckPublishes(bool ack);
+	// Session present flag of the CONNACKs that follow
+	void setSessionPresent(bool present);
+	// Closes every connection, as a broker restart would
+	void disconnect();
+	// QoS 0 PUBLISH to one connection, whatever it subscribed to
+	bool publish(uint8_t connection, const char *topic, const uint8_t *payload, size_t length);
+
+	// Connections accepted so far, in accept order; closed ones keep their index
+	uint8_t getAccepted();
+	bool isConnected(uint8_t connection);
+	// Packets received by type (MQTTSUBSCRIBE >> 4 and so on)
+	uint32_t getPacketCount(uint8_t type);
+	// PUBLISHes received with DUP set
+	uint32_t getDuplicateCount();
+	// Flags byte of a connection's CONNECT (0x02 is clean session)
+	uint8_t getConnectFlags(uint8_t connection);
+	// QoS a connection is subscribed to a filter with, -1 when it is not
+	int getSubscribedQos(uint8_t connection, const char *filter);
+	uint8_t getFilterCount(uint8_t connection);
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "LoopbackClient.h"
+
+LoopbackClient::LoopbackClient(size_t capacity)
+{
+	this->mRing = (uint8_t *)malloc(capacity);
+	this->mCapacity = (this->mRing == NULL) ? 0 : capacity;
+	this->mHead = 0;
+	this->mTail = 0;
+	this->mConnected = false;
+	this->mEcho = true;
+	this->mWritten = 0;
+}
+
+LoopbackClient::~LoopbackClient()
+{
+	free(this->mRing);
+}
+
+size_t LoopbackClient::feed(const uint8_t *data, size_t length)
+{
+	size_t space = this->mCapacity - (this->mTail - this->mHead);
+	if (length > space)
+	{
+		length = space;
+	}
+	for (size_t copied = 0; copied < length;)
+	{
+		size_t offset = this->mTail % this->mCapacity;
+		size_t chunk = this->mCapacity - offset;
+		if (chunk > length - copied)
+		{
+			chunk = length - copied;
+		}
+		memcpy(this->mRing + offset, data + copied, chunk);
+		copied += chunk;
+		this->mTail += chunk;
+	}
+	return length;
+}
+
+size_t LoopbackClient::size()
+{
+	return this->mTail - this->mHead;
+}
+
+void LoopbackClient::clear()
+{
+	this->mHead = 0;
+	this->mTail = 0;
+}
+
+void LoopbackClient::setEcho(bool echo)
+{
+	this->mEcho = echo;
+}
+
+size_t LoopbackClient::getWritten()
+{
+	return this->mWritten;
+}
+
+int LoopbackClient::connect(IPAddress /* ip */, uint16_t /* port */)
+{
+	this->clear();
+	this->mConnected = true;
+	return 1;
+}
+
+int LoopbackClient::connect(const char * /* host */, uint16_t port)
+{
+	return this->connect(IPAddress(), port);
+}
+
+size_t LoopbackClient::write(uint8_t data)
+{
+	return this->write(&data, 1);
+}
+
+size_t LoopbackClient::write(const uint8_t *buffer, size_t size)
+{
+	if (!this->mConnected)
+	{
+		return 0;
+	}
+	if (this->mEcho)
+	{
+		size = this->feed(buffer, size);
+	}
+	this->mWritten += size;
+	return size;
+}
+
+int LoopbackClient::available()
+{
+	return this->size();
+}
+
+int LoopbackClient::read()
+{
+	uint8_t data;
+	return (this->read(&data, 1) == 1) ? data : -1;
+}
+
+int LoopbackClient::read(uint8_t *buffer, size_t size)
+{
+	size_t pending = this->size();
+	if (pending == 0)
+	{
+		return -1;
+	}
+	if (size > pending)
+	{
+		size = pending;
+	}
+	for (size_t copied = 0; copied < size;)
+	{
+		size_t offset = this->mHead % this->mCapacity;
+		size_t chunk = this->mCapacity - offset;
+		if (chunk > size - copied)
+		{
+			chunk = size - copied;
+		}
+		memcpy(buffer + copied, this->mRing + offset, chunk);
+		copied += chunk;
+		this->mHead += chunk;
+	}
+	return size;
+}
+
+int LoopbackClient::peek()
+{
+	return (this->size() == 0) ? -1 : this->mRing[this->mHead % this->mCapacity];
+}
+
+void LoopbackClient::flush()
+{
+}
+
+void LoopbackClient::stop()
+{
+	this->mConnected = false;
+}
+
+uint8_t LoopbackClient::connected()
+{
+	return this->mConnected;
+}
+
+LoopbackClient::operator bool()
+{
+	return this->mConnected;
+}
@@ -0,0 +1,49 @@
+#ifndef LOOPBACK_CLIENT_H_
+#define LOOPBACK_CLIENT_H_
+
+#include "Arduino.h"
+#include "Client.h"
+
+#define LOOPBACK_CLIENT_CAPACITY 65536
+
+// Client whose written bytes become readable again, over one ring allocated up front, so a
+// publish can be framed, parsed back by the same MqttClient and timed without a socket.
+class LoopbackClient : public Client
+{
+private:
+	uint8_t *mRing;
+	size_t mCapacity;
+	size_t mHead;
+	size_t mTail;
+	bool mConnected;
+	bool mEcho;
+	size_t mWritten;
+
+public:
+	LoopbackClient(size_t capacity = LOOPBACK_CLIENT_CAPACITY);
+	virtual ~LoopbackClient();
+
+	// Queues inbound bytes as if the broker had sent them
+	size_t feed(const uint8_t *data, size_t length);
+	size_t size();
+	void clear();
+	// false drops written bytes instead of queueing them, like a broker that never answers
+	void setEcho(bool echo);
+	// Bytes accepted by write() since construction, echoed or not
+	size_t getWritten();
+
+	virtual int connect(IPAddress ip, uint16_t port);
+	virtual int connect(const char *host, uint16_t port);
+	virtual size_t write(uint8_t data);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual int available();
+	virtual int read();
+	virtual int read(uint8_t *buffer, size_t size);
+	virtual int peek();
+	virtual void flush();
+	virtual void stop();
+	virtual uint8_t connected();
+	virtual operator bool();
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "NativeBench.h"
+#include "NativeHeap.h"
+#include <stdio.h>
+#include <time.h>
+
+static uint64_t clockNanos(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Batches grow until one takes a tenth of the budget, so the clock is read rarely.
+NativeBenchResult nativeBench(const char *name, uint32_t size, NATIVE_BENCH_SIGNATURE)
+{
+	operation();
+
+	uint64_t budget = NATIVE_BENCH_TIME * 1000000ULL;
+	uint64_t batch = 1;
+	uint64_t iterations = 0;
+	uint64_t elapsed = 0;
+	uint64_t allocations = nativeHeapAllocations();
+	uint64_t bytes = nativeHeapBytes();
+	uint64_t cpu = clockNanos(CLOCK_PROCESS_CPUTIME_ID);
+	while (elapsed < budget && iterations < NATIVE_BENCH_MAX_ITERATIONS)
+	{
+		uint64_t started = clockNanos(CLOCK_MONOTONIC);
+		for (uint64_t i = 0; i < batch; i++)
+		{
+			operation();
+		}
+		uint64_t took = clockNanos(CLOCK_MONOTONIC) - started;
+		elapsed += took;
+		iterations += batch;
+		if (took < budget / 10)
+		{
+			batch *= 2;
+		}
+	}
+
+	NativeBenchResult result;
+	result.iterations = iterations;
+	result.ns = (double)elapsed / iterations;
+	result.cpu = (double)(clockNanos(CLOCK_PROCESS_CPUTIME_ID) - cpu) / iterations;
+	result.bytes = (double)(nativeHeapBytes() - bytes) / iterations;
+	result.allocs = (double)(nativeHeapAllocations() - allocations) / iterations;
+	printf("{\"bench\":\"%s\",\"size\":%u,\"iterations\":%llu,\"ns_op\":%.1f,\"cpu_ns_op\":%.1f,\"mb_s\":%.1f,\"bytes_op\":%.1f,\"allocs_op\":%.2f}\n",
+				 name, size, (unsigned long long)result.iterations, result.ns, result.cpu, size * 1000.0 / result.ns, result.bytes, result.allocs);
+	fflush(stdout);
+	return result;
+}
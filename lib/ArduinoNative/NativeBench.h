@@ -0,0 +1,29 @@
+#ifndef NATIVE_BENCH_H_
+#define NATIVE_BENCH_H_
+
+#include <stdint.h>
+#include <functional>
+
+#ifndef NATIVE_BENCH_TIME
+#define NATIVE_BENCH_TIME 50 // milliseconds per measurement
+#endif
+#define NATIVE_BENCH_MAX_ITERATIONS 100000000
+
+#define NATIVE_BENCH_SIGNATURE std::function<void()> operation
+
+struct NativeBenchResult
+{
+	uint64_t iterations;
+	double ns;		 // per operation
+	double cpu;		 // process CPU time per operation, ns
+	double bytes;	 // heap bytes allocated per operation
+	double allocs; // heap allocations per operation
+};
+
+// Repeats operation for NATIVE_BENCH_TIME ms after one untimed warm-up call and prints one JSON
+// line to stdout, for example
+// {"bench":"message.toPayload","size":4096,"iterations":812345,"ns_op":61.5,"cpu_ns_op":61.2,"mb_s":66601.6,"bytes_op":0.0,"allocs_op":0.00}
+// size is the payload the operation works on; mb_s is size / ns_op in MB (10^6 bytes) per second.
+NativeBenchResult nativeBench(const char *name, uint32_t size, NATIVE_BENCH_SIGNATURE);
+
+#endif
@@ -0,0 +1,74 @@
+#include "NativeHeap.h"
+#include <atomic>
+
+extern "C"
+{
+	void *__real_malloc(size_t size);
+	void *__real_calloc(size_t count, size_t size);
+	void *__real_realloc(void *pointer, size_t size);
+	void __real_free(void *pointer);
+}
+
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> frees(0);
+static std::atomic<uint64_t> bytes(0);
+static std::atomic<uint32_t> failing(0);
+
+static bool fail()
+{
+	uint32_t left = failing.load(std::memory_order_relaxed);
+	while (left > 0 && !failing.compare_exchange_weak(left, left - 1, std::memory_order_relaxed))
+	{
+	}
+	return left > 0;
+}
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	bytes.fetch_add(size, std::memory_order_relaxed);
+	return fail() ? NULL : __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	bytes.fetch_add(count * size, std::memory_order_relaxed);
+	return fail() ? NULL : __real_calloc(count, size);
+}
+
+extern "C" void *__wrap_realloc(void *pointer, size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	bytes.fetch_add(size, std::memory_order_relaxed);
+	return fail() ? NULL : __real_realloc(pointer, size);
+}
+
+extern "C" void __wrap_free(void *pointer)
+{
+	if (pointer != NULL)
+	{
+		frees.fetch_add(1, std::memory_order_relaxed);
+	}
+	__real_free(pointer);
+}
+
+uint64_t nativeHeapAllocations()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t nativeHeapFrees()
+{
+	return frees.load(std::memory_order_relaxed);
+}
+
+void nativeHeapFailNext(uint32_t count)
+{
+	failing.store(count, std::memory_order_relaxed);
+}
+
+uint64_t nativeHeapBytes()
+{
+	return bytes.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,15 @@
+#ifndef NATIVE_HEAP_H_
+#define NATIVE_HEAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Heap activity of the whole process (new/delete included). Counted by wrapping malloc, calloc,
+// realloc and free at link time, see build_flags of [env:native].
+uint64_t nativeHeapAllocations();
+uint64_t nativeHeapFrees();
+uint64_t nativeHeapBytes();
+// The next count malloc, calloc and realloc calls fail, for testing out-of-memory paths
+void nativeHeapFailNext(uint32_t count);
+
+#endif
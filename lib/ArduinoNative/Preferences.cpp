@@ -0,0 +1,123 @@
+#include "Preferences.h"
+
+Preferences::Preferences()
+{
+	this->mOpen = false;
+	this->mReadOnly = true;
+	this->mCount = 0;
+	this->mPath[0] = '\0';
+}
+
+Preferences::~Preferences()
+{
+	this->end();
+}
+
+bool Preferences::begin(const char *name, bool readOnly)
+{
+	snprintf(this->mPath, sizeof(this->mPath), "%s.prefs", name);
+	this->mReadOnly = readOnly;
+	this->mCount = 0;
+	this->mOpen = true;
+
+	FILE *file = fopen(this->mPath, "r");
+	if (file == NULL)
+	{
+		return true;
+	}
+	char line[PREFERENCES_KEY_SIZE + PREFERENCES_VALUE_SIZE + 2];
+	while (fgets(line, sizeof(line), file) != NULL && this->mCount < PREFERENCES_MAX_ENTRIES)
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		char *separator = strchr(line, '=');
+		if (separator == NULL)
+		{
+			continue;
+		}
+		*separator = '\0';
+		this->set(line, separator + 1);
+	}
+	fclose(file);
+	return true;
+}
+
+void Preferences::end()
+{
+	this->mOpen = false;
+}
+
+int Preferences::find(const char *key)
+{
+	for (uint8_t i = 0; i < this->mCount; i++)
+	{
+		if (strcmp(this->mKeys[i], key) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool Preferences::set(const char *key, const char *value)
+{
+	int index = this->find(key);
+	if (index < 0)
+	{
+		if (this->mCount >= PREFERENCES_MAX_ENTRIES)
+		{
+			return false;
+		}
+		index = this->mCount++;
+		snprintf(this->mKeys[index], PREFERENCES_KEY_SIZE, "%s", key);
+	}
+	snprintf(this->mValues[index], PREFERENCES_VALUE_SIZE, "%s", value);
+	return true;
+}
+
+void Preferences::save()
+{
+	FILE *file = fopen(this->mPath, "w");
+	if (file == NULL)
+	{
+		return;
+	}
+	for (uint8_t i = 0; i < this->mCount; i++)
+	{
+		fprintf(file, "%s=%s\n", this->mKeys[i], this->mValues[i]);
+	}
+	fclose(file);
+}
+
+size_t Preferences::putString(const char *key, const char *value)
+{
+	if (!this->mOpen || this->mReadOnly || !this->set(key, value))
+	{
+		return 0;
+	}
+	this->save();
+	return strlen(value);
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLength)
+{
+	int index = this->find(key);
+	if (!this->mOpen || index < 0 || maxLength == 0)
+	{
+		return 0;
+	}
+	snprintf(value, maxLength, "%s", this->mValues[index]);
+	return strlen(value);
+}
+
+size_t Preferences::putUShort(const char *key, uint16_t value)
+{
+	char buffer[8];
+	snprintf(buffer, sizeof(buffer), "%u", value);
+	return (this->putString(key, buffer) > 0) ? sizeof(uint16_t) : 0;
+}
+
+uint16_t Preferences::getUShort(const char *key, uint16_t defaultValue)
+{
+	int index = this->find(key);
+	return (!this->mOpen || index < 0) ? defaultValue : (uint16_t)strtoul(this->mValues[index], NULL, 10);
+}
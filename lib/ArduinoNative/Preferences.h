@@ -0,0 +1,38 @@
+#ifndef PREFERENCES_NATIVE_H_
+#define PREFERENCES_NATIVE_H_
+
+#include "Arduino.h"
+
+#define PREFERENCES_MAX_ENTRIES 16
+#define PREFERENCES_KEY_SIZE 16
+#define PREFERENCES_VALUE_SIZE 128
+
+// NVS stand-in: one "<namespace>.prefs" file of key=value lines in the working directory.
+class Preferences
+{
+private:
+	char mPath[64];
+	bool mReadOnly;
+	bool mOpen;
+	uint8_t mCount;
+	char mKeys[PREFERENCES_MAX_ENTRIES][PREFERENCES_KEY_SIZE];
+	char mValues[PREFERENCES_MAX_ENTRIES][PREFERENCES_VALUE_SIZE];
+
+	int find(const char *key);
+	bool set(const char *key, const char *value);
+	void save();
+
+public:
+	Preferences();
+	~Preferences();
+
+	bool begin(const char *name, bool readOnly = false);
+	void end();
+
+	size_t putString(const char *key, const char *value);
+	size_t getString(const char *key, char *value, size_t maxLength);
+	size_t putUShort(const char *key, uint16_t value);
+	uint16_t getUShort(const char *key, uint16_t defaultValue = 0);
+};
+
+#endif
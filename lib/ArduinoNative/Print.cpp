@@ -0,0 +1,130 @@
+#include "Arduino.h"
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t n = 0;
+	while (size--)
+	{
+		n += this->write(*buffer++);
+	}
+	return n;
+}
+
+size_t Print::write(const char *str)
+{
+	return (str == NULL) ? 0 : this->write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::printf(const char *format, ...)
+{
+	char buffer[256];
+	va_list va;
+	va_start(va, format);
+	int length = vsnprintf(buffer, sizeof(buffer), format, va);
+	va_end(va);
+	if (length < 0)
+	{
+		return 0;
+	}
+	if ((size_t)length < sizeof(buffer))
+	{
+		return this->write((const uint8_t *)buffer, length);
+	}
+
+	char *large = (char *)malloc(length + 1);
+	if (large == NULL)
+	{
+		return 0;
+	}
+	va_start(va, format);
+	vsnprintf(large, length + 1, format, va);
+	va_end(va);
+	size_t n = this->write((const uint8_t *)large, length);
+	free(large);
+	return n;
+}
+
+size_t Print::print(const char *value)
+{
+	return this->write(value);
+}
+
+size_t Print::print(const String &value)
+{
+	return this->write(value.c_str());
+}
+
+size_t Print::print(char value)
+{
+	return this->write((uint8_t)value);
+}
+
+size_t Print::print(int value)
+{
+	return this->printf("%d", value);
+}
+
+size_t Print::print(unsigned int value)
+{
+	return this->printf("%u", value);
+}
+
+size_t Print::print(long value)
+{
+	return this->printf("%ld", value);
+}
+
+size_t Print::print(unsigned long value)
+{
+	return this->printf("%lu", value);
+}
+
+size_t Print::print(double value, int digits)
+{
+	return this->printf("%.*f", digits, value);
+}
+
+size_t Print::println()
+{
+	return this->write("\r\n");
+}
+
+size_t Print::println(const char *value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(const String &value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(char value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(int value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(unsigned int value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(long value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(unsigned long value)
+{
+	return this->print(value) + this->println();
+}
+
+size_t Print::println(double value, int digits)
+{
+	return this->print(value, digits) + this->println();
+}
@@ -0,0 +1,41 @@
+#ifndef PRINT_H_
+#define PRINT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+class String;
+
+class Print
+{
+public:
+	virtual ~Print() {}
+
+	virtual size_t write(uint8_t data) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual void flush() {}
+
+	size_t write(const char *str);
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+	size_t print(const char *value);
+	size_t print(const String &value);
+	size_t print(char value);
+	size_t print(int value);
+	size_t print(unsigned int value);
+	size_t print(long value);
+	size_t print(unsigned long value);
+	size_t print(double value, int digits = 2);
+
+	size_t println();
+	size_t println(const char *value);
+	size_t println(const String &value);
+	size_t println(char value);
+	size_t println(int value);
+	size_t println(unsigned int value);
+	size_t println(long value);
+	size_t println(unsigned long value);
+	size_t println(double value, int digits = 2);
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "SocketClient.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+SocketClient::SocketClient()
+{
+	this->mSocket = -1;
+	this->mClosed = true;
+	this->mConnectTimeout = SOCKET_CLIENT_CONNECT_TIMEOUT;
+}
+
+SocketClient::~SocketClient()
+{
+	this->stop();
+}
+
+void SocketClient::setConnectTimeout(unsigned long timeout)
+{
+	this->mConnectTimeout = timeout;
+}
+
+bool SocketClient::waitFor(short events, unsigned long timeout)
+{
+	struct pollfd pfd;
+	pfd.fd = this->mSocket;
+	pfd.events = events;
+	pfd.revents = 0;
+	return poll(&pfd, 1, timeout) == 1 && (pfd.revents & events) != 0;
+}
+
+int SocketClient::connect(IPAddress ip, uint16_t port)
+{
+	this->stop();
+	this->mSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (this->mSocket < 0)
+	{
+		return 0;
+	}
+	int flags = fcntl(this->mSocket, F_GETFL, 0);
+	fcntl(this->mSocket, F_SETFL, flags | O_NONBLOCK);
+	int one = 1;
+	setsockopt(this->mSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = (uint32_t)ip;
+	if (::connect(this->mSocket, (struct sockaddr *)&address, sizeof(address)) < 0)
+	{
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (errno != EINPROGRESS || !this->waitFor(POLLOUT, this->mConnectTimeout) ||
+				getsockopt(this->mSocket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+		{
+			this->stop();
+			return 0;
+		}
+	}
+	this->mClosed = false;
+	return 1;
+}
+
+int SocketClient::connect(const char *host, uint16_t port)
+{
+	IPAddress address;
+	if (!resolve(host, address))
+	{
+		return 0;
+	}
+	return this->connect(address, port);
+}
+
+bool SocketClient::resolve(const char *host, IPAddress &address)
+{
+	if (address.fromString(host))
+	{
+		return true;
+	}
+	struct addrinfo hints;
+	struct addrinfo *result = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, NULL, &hints, &result) != 0 || result == NULL)
+	{
+		return false;
+	}
+	address = IPAddress((uint32_t)((struct sockaddr_in *)result->ai_addr)->sin_addr.s_addr);
+	freeaddrinfo(result);
+	return true;
+}
+
+size_t SocketClient::write(uint8_t data)
+{
+	return this->write(&data, 1);
+}
+
+size_t SocketClient::write(const uint8_t *buffer, size_t size)
+{
+	size_t written = 0;
+	while (!this->mClosed && written < size)
+	{
+		ssize_t n = send(this->mSocket, buffer + written, size - written, MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			written += n;
+		}
+		else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			if (!this->waitFor(POLLOUT, SOCKET_CLIENT_WRITE_TIMEOUT))
+			{
+				break;
+			}
+		}
+		else if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		else
+		{
+			this->mClosed = true;
+		}
+	}
+	return written;
+}
+
+int SocketClient::available()
+{
+	if (this->mClosed)
+	{
+		return 0;
+	}
+	int count = 0;
+	if (ioctl(this->mSocket, FIONREAD, &count) < 0)
+	{
+		return 0;
+	}
+	if (count == 0)
+	{
+		// a readable socket with nothing to read has been closed by the peer
+		uint8_t data;
+		ssize_t n = recv(this->mSocket, &data, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			this->mClosed = true;
+		}
+	}
+	return count;
+}
+
+int SocketClient::read()
+{
+	uint8_t data;
+	return (this->read(&data, 1) == 1) ? data : -1;
+}
+
+int SocketClient::read(uint8_t *buffer, size_t size)
+{
+	if (this->mClosed)
+	{
+		return -1;
+	}
+	ssize_t n = recv(this->mSocket, buffer, size, MSG_DONTWAIT);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+	{
+		this->mClosed = true;
+		return -1;
+	}
+	return (n < 0) ? -1 : n;
+}
+
+int SocketClient::peek()
+{
+	if (this->mClosed)
+	{
+		return -1;
+	}
+	uint8_t data;
+	return (recv(this->mSocket, &data, 1, MSG_PEEK | MSG_DONTWAIT) == 1) ? data : -1;
+}
+
+void SocketClient::flush()
+{
+}
+
+void SocketClient::stop()
+{
+	if (this->mSocket >= 0)
+	{
+		close(this->mSocket);
+	}
+	this->mSocket = -1;
+	this->mClosed = true;
+}
+
+uint8_t SocketClient::connected()
+{
+	if (!this->mClosed)
+	{
+		this->available();
+	}
+	return !this->mClosed;
+}
+
+SocketClient::operator bool()
+{
+	return this->mSocket >= 0;
+}
@@ -0,0 +1,44 @@
+#ifndef SOCKET_CLIENT_H_
+#define SOCKET_CLIENT_H_
+
+#include "Arduino.h"
+#include "Client.h"
+
+#define SOCKET_CLIENT_CONNECT_TIMEOUT 3000 // milliseconds
+#define SOCKET_CLIENT_WRITE_TIMEOUT 5000	 // milliseconds
+
+// TCP Client over a POSIX socket. Connect and write block (bounded by the timeouts above);
+// reads never block, matching what MqttClient expects from WiFiClient.
+class SocketClient : public Client
+{
+private:
+	int mSocket;
+	bool mClosed;
+	unsigned long mConnectTimeout;
+
+	bool waitFor(short events, unsigned long timeout);
+
+public:
+	SocketClient();
+	virtual ~SocketClient();
+
+	void setConnectTimeout(unsigned long timeout);
+	int fd() const { return mSocket; }
+
+	virtual int connect(IPAddress ip, uint16_t port);
+	virtual int connect(const char *host, uint16_t port);
+	virtual size_t write(uint8_t data);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+	virtual int available();
+	virtual int read();
+	virtual int read(uint8_t *buffer, size_t size);
+	virtual int peek();
+	virtual void flush();
+	virtual void stop();
+	virtual uint8_t connected();
+	virtual operator bool();
+
+	static bool resolve(const char *host, IPAddress &address);
+};
+
+#endif
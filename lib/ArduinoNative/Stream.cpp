@@ -0,0 +1,16 @@
+#include "Stream.h"
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+	size_t count = 0;
+	while (count < length)
+	{
+		int c = this->read();
+		if (c < 0)
+		{
+			break;
+		}
+		buffer[count++] = (uint8_t)c;
+	}
+	return count;
+}
@@ -0,0 +1,19 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "Print.h"
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+
+	void setTimeout(unsigned long /* timeout */) {}
+	// Returns what is available now; host streams do not wait out a timeout
+	size_t readBytes(uint8_t *buffer, size_t length);
+	size_t readBytes(char *buffer, size_t length) { return this->readBytes((uint8_t *)buffer, length); }
+};
+
+#endif
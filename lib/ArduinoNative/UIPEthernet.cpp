@@ -0,0 +1,3 @@
+#include "UIPEthernet.h"
+
+EthernetClass Ethernet;
@@ -0,0 +1,27 @@
+#ifndef UIP_ETHERNET_NATIVE_H_
+#define UIP_ETHERNET_NATIVE_H_
+
+#include "Arduino.h"
+#include "SocketClient.h"
+
+#define Unknown 0
+#define LinkON 1
+#define LinkOFF 2
+
+class EthernetClass
+{
+public:
+	int begin(uint8_t * /* mac */) { return 1; }
+	int linkStatus() { return LinkON; }
+	int maintain() { return 0; }
+	IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+	IPAddress gatewayIP() { return IPAddress(127, 0, 0, 0); }
+};
+
+extern EthernetClass Ethernet;
+
+class EthernetClient : public SocketClient
+{
+};
+
+#endif
@@ -0,0 +1,3 @@
+#include "Update.h"
+
+UpdateClass Update;
@@ -0,0 +1,17 @@
+#ifndef UPDATE_NATIVE_H_
+#define UPDATE_NATIVE_H_
+
+#include "Stream.h"
+
+class UpdateClass
+{
+public:
+	bool begin(size_t /* size */) { return false; }
+	size_t writeStream(Stream & /* data */) { return 0; }
+	bool end() { return false; }
+	bool isFinished() { return false; }
+};
+
+extern UpdateClass Update;
+
+#endif
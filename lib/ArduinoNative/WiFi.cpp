@@ -0,0 +1,12 @@
+#include "WiFi.h"
+
+WiFiClass WiFi;
+
+String WiFiClass::macAddress()
+{
+	uint8_t mac[6];
+	char buffer[18];
+	this->macAddress(mac);
+	snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	return String(buffer);
+}
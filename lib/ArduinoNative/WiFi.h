@@ -0,0 +1,35 @@
+#ifndef WIFI_NATIVE_H_
+#define WIFI_NATIVE_H_
+
+#include "Arduino.h"
+#include "SocketClient.h"
+
+#define WL_IDLE_STATUS 0
+#define WL_DISCONNECTED 6
+#define WL_CONNECTED 3
+#define WIFI_STA 1
+
+// The host is always "associated"; addresses come from the loopback interface, so the
+// plug-and-play default host (gateway + 1) is 127.0.0.1.
+class WiFiClass
+{
+public:
+	int status() { return WL_CONNECTED; }
+	void mode(int /* mode */) {}
+	void setAutoReconnect(bool /* autoReconnect */) {}
+	void begin(const char * /* ssid */, const char * /* password */) {}
+	void reconnect() {}
+	IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+	IPAddress gatewayIP() { return IPAddress(127, 0, 0, 0); }
+	String macAddress();
+	void macAddress(uint8_t *mac) { esp_efuse_mac_get_default(mac); }
+	int hostByName(const char *host, IPAddress &address) { return SocketClient::resolve(host, address) ? 1 : 0; }
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient : public SocketClient
+{
+};
+
+#endif
@@ -11,12 +11,11 @@ Connector CON; // MQTT 연결 및 통신을 담당하는 커넥터 인스턴스
 
 void onConnect(Connector *c);
 void onMessage(Connector *c, const char *topic, Message *msg);
+void onGroupMessage(Connector *c, const char *topic, Message *msg);
+void onPublicNotify(Connector *c, const char *topic, Message *msg);
 
-void onConnect(Connector *c) // 연결 성공 시 호출되는 콜백 함수
+void onConnect(Connector * /* c */) // 연결 성공 시 호출되는 콜백 함수
 {
-	c->subscribe(c->getClientGroup(), 0); // 클라이언트 그룹 구독
-	c->subscribe(TOPIC("/notify/#"), 0);	// 알림 토픽 구독
-
 	Serial.println("[Alert] Connected to MQTT broker.");
 	Serial.print("Broker: ");
 	Serial.println(BROKER_SERVER);
@@ -25,7 +24,7 @@ void onConnect(Connector *c) // 연결 성공 시 호출되는 콜백 함수
 	Serial.println();
 }
 
-void onMessage(Connector *c, const char *topic, Message *msg) // 메시지 수신 시 호출되는 콜백 함수
+void onMessage(Connector * /* c */, const char *topic, Message *msg) // 핸들러가 없는 메시지 수신 시 호출되는 콜백 함수
 {
 	Serial.println("--------------------------------");
 	Serial.println("[Alert] Message received.");
@@ -62,26 +61,27 @@ void onMessage(Connector *c, const char *topic, Message *msg) // 메시지 수
 
 	Serial.print("Payload Size: ");
 	Serial.println(size);
+}
 
-	if (strcmp(topic, c->getClientGroup()) == 0) // 클라이언트 그룹 토픽인 경우
-	{
-		// 디바이스 상태 정보 발행
-		c->publishJSON(TOPIC("/status"),
-									 "{\"name\":\"%s\",\"vendor\":\"%s\",\"model\":\"%s\",\"sn\":\"%s\",\"ip\":\"%s\"}",
-									 c->getName(),
-									 c->getVendor(),
-									 c->getModel(),
-									 c->getSerialNumber(),
-									 c->getIPAddress());
-	}
-	else if (strcmp(topic, TOPIC("/notify/public")) == 0) // public 토픽인 경우
-	{
-		// 센서 정보 발행
-		c->publishJSON(TOPIC("/status"),
-									 "{\"DT\":%1.f,\"RH\":%1.f}",
-									 25.4,
-									 56.2);
-	}
+void onGroupMessage(Connector *c, const char * /* topic */, Message * /* msg */) // 클라이언트 그룹 토픽 핸들러
+{
+	// 디바이스 상태 정보 발행
+	c->publishJSON(TOPIC("/status"),
+								 "{\"name\":\"%s\",\"vendor\":\"%s\",\"model\":\"%s\",\"sn\":\"%s\",\"ip\":\"%s\"}",
+								 c->getName(),
+								 c->getVendor(),
+								 c->getModel(),
+								 c->getSerialNumber(),
+								 c->getIPAddress());
+}
+
+void onPublicNotify(Connector *c, const char * /* topic */, Message * /* msg */) // public 토픽 핸들러
+{
+	// 센서 정보 발행
+	c->publishJSON(TOPIC("/status"),
+								 "{\"DT\":%1.f,\"RH\":%1.f}",
+								 25.4,
+								 56.2);
 }
 
 void setup()
@@ -107,6 +107,11 @@ void setup()
 	CON.setOnConnectCallback(onConnect);
 	CON.setOnMessageCallback(onMessage);
 	CON.begin();
+
+	// 구독 목록은 커넥터가 보관하며 재연결 시 SUBSCRIBE 한 번으로 자동 복원됨
+	CON.subscribe(CON.getClientGroup(), 0, onGroupMessage); // 클라이언트 그룹 구독
+	CON.subscribe(TOPIC("/notify/#"), 0);										// 알림 토픽 구독
+	CON.bind(TOPIC("/notify/public"), onPublicNotify);			// public 알림은 구독 없이 핸들러만 연결
 }
 
 void loop()
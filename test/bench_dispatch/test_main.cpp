@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include <TopicTree.h>
+#include <NativeBench.h>
+#include <unity.h>
+
+// Topic matching with hundreds of filters; size is the number of filters in the tree.
+
+static const uint16_t counts[] = {16, 128, 512};
+#define COUNT_COUNT (sizeof(counts) / sizeof(counts[0]))
+#define LARGEST 512
+
+// One exact filter per device, a '+' per device and a '#' per tenth device
+static void fill(TopicTree *tree, uint16_t count)
+{
+	char filter[64];
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (i % 10 == 9)
+		{
+			snprintf(filter, sizeof(filter), "site/%u/#", i / 10);
+		}
+		else if (i % 2 == 0)
+		{
+			snprintf(filter, sizeof(filter), "site/%u/device/%u/value", i / 10, i);
+		}
+		else
+		{
+			snprintf(filter, sizeof(filter), "site/%u/device/+/state", i / 10);
+		}
+		TEST_ASSERT_TRUE(tree->add(filter) != TOPIC_TREE_NONE);
+	}
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void bench_match()
+{
+	int16_t handles[8];
+	for (uint8_t i = 0; i < COUNT_COUNT; i++)
+	{
+		TopicTree tree;
+		TEST_ASSERT_TRUE(tree.begin(LARGEST * 4, LARGEST, LARGEST * 32));
+		fill(&tree, counts[i]);
+		TEST_ASSERT_EQUAL_UINT8(2, tree.match("site/0/device/2/value", handles, 8));
+		nativeBench("topicTree.match.exact", counts[i], [&]()
+								{ tree.match("site/0/device/2/value", handles, 8); });
+		nativeBench("topicTree.match.wildcard", counts[i], [&]()
+								{ tree.match("site/0/device/7/state", handles, 8); });
+		nativeBench("topicTree.match.none", counts[i], [&]()
+								{ tree.match("other/0/device/2/value", handles, 8); });
+	}
+}
+
+void bench_add_remove()
+{
+	for (uint8_t i = 0; i < COUNT_COUNT; i++)
+	{
+		TopicTree tree;
+		TEST_ASSERT_TRUE(tree.begin(LARGEST * 4, LARGEST + 1, LARGEST * 32));
+		fill(&tree, counts[i]);
+		nativeBench("topicTree.addRemove", counts[i], [&]()
+								{ tree.remove(tree.add("site/0/device/+/extra")); });
+	}
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(bench_match);
+	RUN_TEST(bench_add_remove);
+	return UNITY_END();
+}
@@ -0,0 +1,256 @@
+#include <Arduino.h>
+#include <Message.h>
+#include <NativeBench.h>
+#include <unity.h>
+
+// Message encode/decode, options and JSON lookups; one JSON line per measurement (see NativeBench.h).
+
+static const uint32_t sizes[] = {16, 256, 4096, 65536, 1048576};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+#define LARGEST 1048576
+
+static uint8_t *body;
+static uint8_t *payload;
+static uint32_t payloadSize = LARGEST + 1024;
+
+// Flat fields first, then a string padded to the requested body size
+static uint32_t makeJSON(char *buffer, uint32_t size)
+{
+	int length = snprintf(buffer, size, "{\"id\":\"sensor-01\",\"t\":21.5,\"seq\":12345,\"ok\":true,\"list\":[1,2,3,4],\"fl\":[0.5,1.5,2.5],\"pad\":\"");
+	uint32_t padded = (size > (uint32_t)length + 3) ? size - 3 : length;
+	memset(buffer + length, 'x', padded - length);
+	memcpy(buffer + padded, "\"}", 3);
+	return padded + 2;
+}
+
+static void prepare(Message *msg, uint32_t size)
+{
+	msg->reset();
+	msg->version = MESSAGE_VERSION;
+	msg->type = MESSAGE_TYPE_VALUE;
+	msg->setLastModified("2024-01-01 00:00:00");
+	msg->setDataType("application/octet-stream");
+	msg->setData(body, size);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void bench_to_payload()
+{
+	Message msg;
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		prepare(&msg, sizes[i]);
+		uint32_t length = msg.toPayload(payload, payloadSize);
+		TEST_ASSERT_GREATER_THAN(sizes[i], length);
+		nativeBench("message.toPayload", sizes[i], [&]()
+								{ msg.toPayload(payload, payloadSize); });
+	}
+}
+
+void bench_from_payload()
+{
+	Message msg;
+	Message received;
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		prepare(&msg, sizes[i]);
+		uint32_t length = msg.toPayload(payload, payloadSize);
+		TEST_ASSERT_TRUE(received.fromPayload(payload, length));
+		TEST_ASSERT_EQUAL_UINT32(sizes[i], received.getSize());
+		nativeBench("message.fromPayload", sizes[i], [&]()
+								{ received.fromPayload(payload, length); });
+	}
+}
+
+void bench_get_option()
+{
+	Message msg;
+	prepare(&msg, 16);
+	msg.setOption("unit", "C");
+	msg.setOption("location", "line-3/cell-12");
+	char value[MESSAGE_VALUE_SIZE];
+	TEST_ASSERT_TRUE(msg.getOption("location", value, sizeof(value)));
+	TEST_ASSERT_EQUAL_STRING("line-3/cell-12", value);
+	uint32_t size = msg.getOptionLength();
+	nativeBench("message.getOption.copy", size, [&]()
+							{ msg.getOption("location", value, sizeof(value)); });
+	nativeBench("message.getOption.view", size, [&]()
+							{ uint32_t length; msg.getOption("location", &length); });
+	nativeBench("message.getDataType", size, [&]()
+							{ uint32_t length; msg.getDataType(&length); });
+}
+
+// One operation builds the usual publish options on a cleared message
+void bench_set_option()
+{
+	Message msg;
+	const char *names[] = {"last-modified", "data-type", "unit"};
+	const char *values[] = {"2024-01-01 00:00:00", "application/json", "C"};
+	TEST_ASSERT_TRUE(msg.setOptions(names, values, 3));
+	uint32_t size = msg.getOptionLength();
+	nativeBench("message.setOption", size, [&]()
+							{
+		msg.reset();
+		msg.setOption("last-modified", "2024-01-01 00:00:00");
+		msg.setOption("data-type", "application/json");
+		msg.setOption("unit", "C"); });
+	nativeBench("message.setOptions", size, [&]()
+							{
+		msg.reset();
+		msg.setOptions(names, values, 3); });
+}
+
+void bench_get_json()
+{
+	static const uint32_t jsonSizes[] = {128, 4096, 65536, 1048576};
+	Message msg;
+	char text[32];
+	int number;
+	int numbers[4];
+	float real;
+	float reals[3];
+	bool flag;
+	for (uint8_t i = 0; i < sizeof(jsonSizes) / sizeof(jsonSizes[0]); i++)
+	{
+		uint32_t size = makeJSON((char *)body, jsonSizes[i]);
+		msg.reset();
+		msg.version = MESSAGE_VERSION;
+		msg.type = MESSAGE_TYPE_VALUE;
+		msg.setData(body, size);
+
+		TEST_ASSERT_TRUE(msg.getJSON("id", text, sizeof(text)));
+		TEST_ASSERT_EQUAL_STRING("sensor-01", text);
+		TEST_ASSERT_TRUE(msg.getJSON("seq", &number));
+		TEST_ASSERT_EQUAL_INT(12345, number);
+		TEST_ASSERT_TRUE(msg.getJSON("list", numbers, 4));
+		TEST_ASSERT_EQUAL_INT(4, numbers[3]);
+		TEST_ASSERT_TRUE(msg.getJSON("t", &real));
+		TEST_ASSERT_EQUAL_FLOAT(21.5f, real);
+		TEST_ASSERT_TRUE(msg.getJSON("fl", reals, 3));
+		TEST_ASSERT_EQUAL_FLOAT(2.5f, reals[2]);
+		TEST_ASSERT_TRUE(msg.getJSON("ok", &flag));
+		TEST_ASSERT_TRUE(flag);
+
+		nativeBench("message.getJSON.string", size, [&]()
+								{ msg.getJSON("id", text, sizeof(text)); });
+		nativeBench("message.getJSON.int", size, [&]()
+								{ msg.getJSON("seq", &number); });
+		nativeBench("message.getJSON.intArray", size, [&]()
+								{ msg.getJSON("list", numbers, 4); });
+		nativeBench("message.getJSON.float", size, [&]()
+								{ msg.getJSON("t", &real); });
+		nativeBench("message.getJSON.floatArray", size, [&]()
+								{ msg.getJSON("fl", reals, 3); });
+		nativeBench("message.getJSON.bool", size, [&]()
+								{ msg.getJSON("ok", &flag); });
+	}
+}
+
+// One flat key is scanned in place; nested paths and many fields go through a caller's index
+void bench_json_index()
+{
+	static const char nested[] = "{\"sensor\":{\"id\":\"sensor-01\",\"unit\":\"C\",\"values\":[20.5,21.5,22.5]},\"seq\":12345,\"ok\":true}";
+	Message msg;
+	JsonIndex json;
+	char text[32];
+	int number;
+	float real;
+	float reals[3];
+	bool flag;
+	msg.version = MESSAGE_VERSION;
+	msg.type = MESSAGE_TYPE_VALUE;
+	msg.setData((uint8_t *)nested, sizeof(nested) - 1);
+
+	TEST_ASSERT_TRUE(msg.indexJSON(&json));
+	TEST_ASSERT_TRUE(json.getFloat(json.find("sensor.values[1]"), &real));
+	TEST_ASSERT_EQUAL_FLOAT(21.5f, real);
+	nativeBench("message.indexJSON", sizeof(nested) - 1, [&]()
+							{ msg.indexJSON(&json); });
+	nativeBench("jsonIndex.find.nested", sizeof(nested) - 1, [&]()
+							{ json.getFloat(json.find("sensor.values[1]"), &real); });
+
+	// six fields of a small flat body, scanned one by one against one index for all of them
+	uint32_t size = makeJSON((char *)body, 128);
+	msg.setData(body, size);
+	nativeBench("message.getJSON.sixFields", size, [&]()
+							{
+		msg.getJSON("id", text, sizeof(text));
+		msg.getJSON("seq", &number);
+		msg.getJSON("t", &real);
+		msg.getJSON("fl", reals, 3);
+		msg.getJSON("ok", &flag);
+		msg.getJSON("pad", text, sizeof(text)); });
+	nativeBench("message.indexJSON.sixFields", size, [&]()
+							{
+		msg.indexJSON(&json);
+		json.getString(json.find("id"), text, sizeof(text));
+		json.getInt(json.find("seq"), &number);
+		json.getFloat(json.find("t"), &real);
+		for (uint8_t i = 0; i < 3; i++)
+		{
+			json.getFloat(json.getElement(json.find("fl"), i), &reals[i]);
+		}
+		json.getBool(json.find("ok"), &flag);
+		json.getString(json.find("pad"), text, sizeof(text)); });
+}
+
+// Receive cycle of a small body, fromPayload then reset, on the heap and on a BlockPool; allocs_op is
+// the heap calls the pool saves
+void bench_pool()
+{
+	static const uint32_t poolSizes[] = {64, 256, 1024};
+	BlockPool pool;
+	Message msg;
+	Message received;
+	TEST_ASSERT_TRUE(pool.begin());
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		prepare(&msg, poolSizes[i]);
+		uint32_t length = msg.toPayload(payload, payloadSize);
+		received.setPool(NULL);
+		NativeBenchResult heap = nativeBench("message.receive.heap", poolSizes[i], [&]()
+																				 {
+			received.fromPayload(payload, length);
+			received.reset(); });
+		received.setPool(&pool);
+		NativeBenchResult pooled = nativeBench("message.receive.pool", poolSizes[i], [&]()
+																					 {
+			received.fromPayload(payload, length);
+			received.reset(); });
+		TEST_ASSERT_GREATER_THAN(0, heap.allocs);
+		TEST_ASSERT_EQUAL_FLOAT(0, pooled.allocs);
+	}
+	received.setPool(NULL);
+	TEST_ASSERT_EQUAL_UINT32(0, pool.getFallbacks());
+}
+
+int main()
+{
+	body = (uint8_t *)malloc(LARGEST + 1);
+	payload = (uint8_t *)malloc(payloadSize);
+	for (uint32_t i = 0; i < LARGEST; i++)
+	{
+		body[i] = (uint8_t)(i * 31 + 7);
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(bench_to_payload);
+	RUN_TEST(bench_from_payload);
+	RUN_TEST(bench_get_option);
+	RUN_TEST(bench_set_option);
+	RUN_TEST(bench_get_json);
+	RUN_TEST(bench_json_index);
+	RUN_TEST(bench_pool);
+	int failures = UNITY_END();
+
+	free(payload);
+	free(body);
+	return failures;
+}
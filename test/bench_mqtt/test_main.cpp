@@ -0,0 +1,168 @@
+#include <Arduino.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <NativeBench.h>
+#include <unity.h>
+
+// PUBLISH framing and inbound parsing over a LoopbackClient; one JSON line per measurement (see NativeBench.h).
+
+static const uint32_t sizes[] = {16, 256, 4096, 65536, 1048576};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+#define LARGEST 1048576
+#define BENCH_TOPIC "bench/topic"
+#define BENCH_SEGMENT_SIZE 1460 // TCP payload of an Ethernet frame
+
+static uint8_t *payload;
+static LoopbackClient *loopback;
+static MqttClient *mqtt;
+static uint32_t received;
+
+// Written packets are dropped, so the only inbound traffic is what a benchmark feeds
+static void connect()
+{
+	static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+	loopback->connect("loopback", 1883);
+	loopback->setEcho(false);
+	loopback->feed(connack, sizeof(connack));
+	mqtt->beginConnect("bench", NULL, NULL);
+	while (mqtt->connecting())
+	{
+		mqtt->loop();
+	}
+}
+
+// QoS 0 PUBLISH of size payload bytes; packet NULL only measures it
+static uint32_t frame(uint8_t *packet, uint32_t size)
+{
+	uint8_t header[MQTT_MAX_HEADER_SIZE + 2 + sizeof(BENCH_TOPIC)];
+	uint32_t remaining = 2 + strlen(BENCH_TOPIC) + size;
+	uint32_t pos = 0;
+	header[pos++] = MQTTPUBLISH;
+	do
+	{
+		uint8_t digit = remaining & 127;
+		remaining >>= 7;
+		header[pos++] = digit | ((remaining > 0) ? 0x80 : 0);
+	} while (remaining > 0);
+	header[pos++] = 0;
+	header[pos++] = strlen(BENCH_TOPIC);
+	memcpy(header + pos, BENCH_TOPIC, strlen(BENCH_TOPIC));
+	pos += strlen(BENCH_TOPIC);
+	if (packet != NULL)
+	{
+		memcpy(packet, header, pos);
+		memcpy(packet + pos, payload, size);
+	}
+	return pos + size;
+}
+
+void setUp()
+{
+	loopback = new LoopbackClient(LARGEST + 4096);
+	mqtt = new MqttClient(*loopback);
+	mqtt->setBufferSize(LARGEST + 1024);
+	mqtt->setKeepAlive(0);
+	mqtt->setCallback([](char *, uint8_t *, unsigned int length)
+										{ received += length; });
+	connect();
+	TEST_ASSERT_TRUE(mqtt->connected());
+	received = 0;
+}
+
+void tearDown()
+{
+	delete mqtt;
+	delete loopback;
+}
+
+// Payload copied into the MQTT buffer and written as one packet
+void bench_publish_buffered()
+{
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		size_t written = loopback->getWritten();
+		TEST_ASSERT_TRUE(mqtt->publish(BENCH_TOPIC, payload, sizes[i], false));
+		TEST_ASSERT_EQUAL_UINT32(frame(NULL, sizes[i]), loopback->getWritten() - written);
+		nativeBench("mqtt.publish.buffered", sizes[i], [&]()
+								{ mqtt->publish(BENCH_TOPIC, payload, sizes[i], false); });
+	}
+}
+
+// Header, options and body segments of a Message frame written without staging
+void bench_publish_segments()
+{
+	static const uint8_t header[8] = {0xFF, 0xA3, 1, 1, 0, 0, 0, 0};
+	static const uint8_t size[4] = {0, 0, 0, 0};
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		MqttSegment segments[3] = {{header, sizeof(header)}, {size, sizeof(size)}, {payload, sizes[i]}};
+		size_t written = loopback->getWritten();
+		TEST_ASSERT_TRUE(mqtt->publish(BENCH_TOPIC, segments, 3, false));
+		TEST_ASSERT_EQUAL_UINT32(frame(NULL, sizeof(header) + sizeof(size) + sizes[i]), loopback->getWritten() - written);
+		nativeBench("mqtt.publish.segments", sizes[i], [&]()
+								{ mqtt->publish(BENCH_TOPIC, segments, 3, false); });
+	}
+}
+
+// One operation queues a framed PUBLISH on the loopback and lets loop() parse and deliver it
+void bench_read_packet()
+{
+	uint8_t *packet = (uint8_t *)malloc(LARGEST + 64);
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		uint32_t length = frame(packet, sizes[i]);
+		received = 0;
+		loopback->feed(packet, length);
+		mqtt->loop();
+		TEST_ASSERT_EQUAL_UINT32(sizes[i], received);
+		TEST_ASSERT_EQUAL_UINT32(0, loopback->size());
+		nativeBench("mqtt.readPacket", sizes[i], [&]()
+								{
+			loopback->feed(packet, length);
+			mqtt->loop(); });
+	}
+	free(packet);
+}
+
+// The same packets arriving in TCP segments, one loop() per segment; loop() returns between them
+void bench_read_packet_segmented()
+{
+	uint8_t *packet = (uint8_t *)malloc(LARGEST + 64);
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		uint32_t length = frame(packet, sizes[i]);
+		auto deliver = [&]()
+		{
+			for (uint32_t offset = 0; offset < length; offset += BENCH_SEGMENT_SIZE)
+			{
+				loopback->feed(packet + offset, (length - offset < BENCH_SEGMENT_SIZE) ? length - offset : BENCH_SEGMENT_SIZE);
+				mqtt->loop();
+			}
+		};
+		received = 0;
+		deliver();
+		TEST_ASSERT_EQUAL_UINT32(sizes[i], received);
+		TEST_ASSERT_TRUE(mqtt->connected());
+		nativeBench("mqtt.readPacket.segmented", sizes[i], deliver);
+	}
+	free(packet);
+}
+
+int main()
+{
+	payload = (uint8_t *)malloc(LARGEST);
+	for (uint32_t i = 0; i < LARGEST; i++)
+	{
+		payload[i] = (uint8_t)(i * 31 + 7);
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(bench_publish_buffered);
+	RUN_TEST(bench_publish_segments);
+	RUN_TEST(bench_read_packet);
+	RUN_TEST(bench_read_packet_segmented);
+	int failures = UNITY_END();
+
+	free(payload);
+	return failures;
+}
@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include <Message.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <NativeBench.h>
+#include <unity.h>
+
+// Message publish paths from the caller's body to Client::write(): the staged frame (setData and
+// toPayload, as before scatter-gather) against the segments Connector::publishMessage() sends.
+// Besides the nativeBench lines, one copy line per path and size, for example
+// {"bench":"publish.copies","path":"segments","size":4096,"writes_op":4,"body_copies_op":0.00}
+// body_copies_op counts how often the body was copied before it reached the Client.
+
+static const uint32_t sizes[] = {64, 256, 1024, 4096, 16384, 65536};
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+#define LARGEST 65536
+#define BENCH_TOPIC "bench/topic"
+#define BENCH_COALESCING 4096
+
+// Drops what is written, counting writes and the bytes that came straight from the body
+class CountingClient : public LoopbackClient
+{
+public:
+	const uint8_t *body;
+	uint32_t bodySize;
+	uint32_t writes;
+	uint32_t direct;
+
+	virtual size_t write(const uint8_t *buffer, size_t size)
+	{
+		this->writes++;
+		if (buffer >= this->body && buffer < this->body + this->bodySize)
+		{
+			this->direct += size;
+		}
+		return LoopbackClient::write(buffer, size);
+	}
+};
+
+static uint8_t *body;
+static uint8_t *frame;
+static uint32_t frameSize = LARGEST + 1024;
+static CountingClient *client;
+static MqttClient *mqtt;
+static Message *msg;
+
+static void prepare(Message *message)
+{
+	message->reset();
+	message->version = MESSAGE_VERSION;
+	message->type = MESSAGE_TYPE_VALUE;
+	message->setLastModified("2024-01-01 00:00:00");
+	message->setDataType("application/octet-stream");
+}
+
+// Frame staged in one buffer: the body is copied into the Message, then into the frame
+static bool publishStaged(uint32_t size)
+{
+	msg->setData(body, size);
+	uint32_t length = msg->toPayload(frame, frameSize);
+	return mqtt->publish(BENCH_TOPIC, frame, length, false);
+}
+
+// Header, options, size and the caller's body as segments, as Connector::publishMessage() does
+static bool publishSegments(uint32_t size)
+{
+	uint8_t header[MESSAGE_HEADER_SIZE];
+	uint8_t length[4];
+	msg->writeInt32(length, size);
+	MqttSegment segments[4] = {{header, msg->toHeader(header)},
+														 {(const uint8_t *)msg->getOptions(), (uint32_t)msg->getOptionLength()},
+														 {length, sizeof(length)},
+														 {body, size}};
+	bool published = mqtt->publish(BENCH_TOPIC, segments, 4, false);
+	mqtt->flush();
+	return published;
+}
+
+// One publish outside the timing, reported as a copy line
+static void reportCopies(const char *path, uint32_t size, std::function<bool(uint32_t)> publish)
+{
+	client->body = body;
+	client->bodySize = size;
+	client->writes = 0;
+	client->direct = 0;
+	TEST_ASSERT_TRUE(publish(size));
+	uint8_t held = (msg->getSize() == size && msg->getData() != body) ? 1 : 0;
+	double copies = held + (double)(size - client->direct) / size;
+	printf("{\"bench\":\"publish.copies\",\"path\":\"%s\",\"size\":%u,\"writes_op\":%u,\"body_copies_op\":%.2f}\n",
+				 path, size, client->writes, copies);
+}
+
+void setUp()
+{
+	static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+	client = new CountingClient();
+	client->setEcho(false);
+	mqtt = new MqttClient(*client);
+	mqtt->setBufferSize(LARGEST + 1024);
+	mqtt->setKeepAlive(0);
+	client->connect("loopback", 1883);
+	client->feed(connack, sizeof(connack));
+	mqtt->beginConnect("bench", NULL, NULL);
+	while (mqtt->connecting())
+	{
+		mqtt->loop();
+	}
+	TEST_ASSERT_TRUE(mqtt->connected());
+	msg = new Message();
+	prepare(msg);
+}
+
+void tearDown()
+{
+	delete msg;
+	delete mqtt;
+	delete client;
+}
+
+void bench_publish_staged()
+{
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		reportCopies("staged", sizes[i], publishStaged);
+		nativeBench("publish.staged", sizes[i], [&]()
+								{ publishStaged(sizes[i]); });
+	}
+}
+
+void bench_publish_segments()
+{
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		reportCopies("segments", sizes[i], publishSegments);
+		TEST_ASSERT_EQUAL_UINT32(sizes[i], client->direct);
+		nativeBench("publish.segments", sizes[i], [&]()
+								{ publishSegments(sizes[i]); });
+	}
+}
+
+// Segments with write coalescing: bodies below the staging size are copied once to save writes
+void bench_publish_segments_coalesced()
+{
+	TEST_ASSERT_TRUE(mqtt->setWriteCoalescing(BENCH_COALESCING, 0, true));
+	for (uint8_t i = 0; i < SIZE_COUNT; i++)
+	{
+		reportCopies("segments.coalesced", sizes[i], publishSegments);
+		nativeBench("publish.segments.coalesced", sizes[i], [&]()
+								{ publishSegments(sizes[i]); });
+	}
+}
+
+int main()
+{
+	body = (uint8_t *)malloc(LARGEST);
+	frame = (uint8_t *)malloc(frameSize);
+	for (uint32_t i = 0; i < LARGEST; i++)
+	{
+		body[i] = (uint8_t)(i * 31 + 7);
+	}
+
+	UNITY_BEGIN();
+	RUN_TEST(bench_publish_staged);
+	RUN_TEST(bench_publish_segments);
+	RUN_TEST(bench_publish_segments_coalesced);
+	int failures = UNITY_END();
+
+	free(frame);
+	free(body);
+	return failures;
+}
@@ -0,0 +1,62 @@
+#include <Arduino.h>
+#include <Timestamp.h>
+#include <NativeBench.h>
+#include <unity.h>
+
+// last-modified formatting: the cached and patched paths against a full localtime() format.
+
+#define START 1704067200000ULL // 2024-01-01 00:00:00 UTC
+
+static uint64_t clockMs;
+
+void setUp()
+{
+	Timestamp::setTimeZone("UTC0");
+	clockMs = START;
+}
+
+void tearDown()
+{
+}
+
+void bench_get_text()
+{
+	Timestamp timestamp;
+	timestamp.setClock([]() -> uint64_t
+										 { return clockMs; });
+	uint32_t length;
+	TEST_ASSERT_EQUAL_STRING("2024-01-01 00:00:00", timestamp.getText(&length));
+
+	nativeBench("timestamp.getText.sameSecond", TIMESTAMP_TEXT_SIZE - 1, [&]()
+							{ timestamp.getText(&length); });
+	// a new second every call: the seconds digits are patched, a full format once a minute
+	nativeBench("timestamp.getText.nextSecond", TIMESTAMP_TEXT_SIZE - 1, [&]()
+							{
+		clockMs += 1000;
+		timestamp.getText(&length); });
+	nativeBench("timestamp.getText.full", TIMESTAMP_TEXT_SIZE - 1, [&]()
+							{
+		timestamp.invalidate();
+		timestamp.getText(&length); });
+	nativeBench("timestamp.getText.invalidateAll", TIMESTAMP_TEXT_SIZE - 1, [&]()
+							{
+		Timestamp::invalidateAll();
+		timestamp.getText(&length); });
+}
+
+void bench_format_epoch()
+{
+	char buffer[TIMESTAMP_EPOCH_SIZE];
+	TEST_ASSERT_EQUAL_UINT32(13, Timestamp::formatEpoch(START, buffer));
+	TEST_ASSERT_EQUAL_STRING("1704067200000", buffer);
+	nativeBench("timestamp.formatEpoch", 13, [&]()
+							{ Timestamp::formatEpoch(clockMs++, buffer); });
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(bench_get_text);
+	RUN_TEST(bench_format_epoch);
+	return UNITY_END();
+}
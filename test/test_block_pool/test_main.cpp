@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include <BlockPool.h>
+#include <Message.h>
+#include <NativeHeap.h>
+#include <unity.h>
+
+// Size classes, heap fallback on exhaustion, block reuse and refused frees of a small two-class pool.
+
+static const uint32_t sizes[] = {64, 256};
+static const uint16_t counts[] = {2, 1};
+static BlockPool *pool;
+
+void setUp()
+{
+	pool = new BlockPool();
+	TEST_ASSERT_TRUE(pool->begin(sizes, counts, 2, false));
+}
+
+void tearDown()
+{
+	delete pool;
+}
+
+void test_begin_rejects_bad_classes()
+{
+	BlockPool other;
+	const uint32_t unordered[] = {256, 64};
+	const uint32_t unaligned[] = {60};
+	TEST_ASSERT_FALSE(other.begin(unordered, counts, 2, false));
+	TEST_ASSERT_FALSE(other.begin(unaligned, counts, 1, false));
+	TEST_ASSERT_FALSE(pool->begin(sizes, counts, 2, false));
+	TEST_ASSERT_EQUAL_UINT32(64 * 2 + 256, pool->getArenaSize());
+}
+
+// The smallest class that fits; a full class moves up to the next one
+void test_smallest_fitting_class()
+{
+	void *a = pool->allocate(1, false);
+	void *b = pool->allocate(64, false);
+	void *c = pool->allocate(65, false);
+	TEST_ASSERT_EQUAL_UINT32(64, pool->capacity(a));
+	TEST_ASSERT_EQUAL_UINT32(64, pool->capacity(b));
+	TEST_ASSERT_EQUAL_UINT32(256, pool->capacity(c));
+	TEST_ASSERT_EQUAL_UINT16(2, pool->getInUse(0));
+	TEST_ASSERT_EQUAL_UINT16(1, pool->getInUse(1));
+	pool->release(c);
+
+	void *d = pool->allocate(8, false);
+	TEST_ASSERT_EQUAL_UINT32(256, pool->capacity(d));
+	pool->release(a);
+	pool->release(b);
+	pool->release(d);
+	TEST_ASSERT_EQUAL_UINT32(0, pool->getFallbacks());
+}
+
+// Exhausted classes and oversized requests come from the heap and go back to it
+void test_exhaustion_falls_back_to_heap()
+{
+	void *blocks[3];
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		blocks[i] = pool->allocate(16, true);
+		TEST_ASSERT_TRUE(pool->owns(blocks[i]));
+	}
+	uint64_t allocations = nativeHeapAllocations();
+	void *spill = pool->allocate(16, true);
+	void *large = pool->allocate(1024, false);
+	TEST_ASSERT_NOT_NULL(spill);
+	TEST_ASSERT_NOT_NULL(large);
+	TEST_ASSERT_EQUAL_UINT64(allocations + 2, nativeHeapAllocations());
+	TEST_ASSERT_FALSE(pool->owns(spill));
+	TEST_ASSERT_EQUAL_UINT32(0, pool->capacity(spill));
+	TEST_ASSERT_EQUAL_UINT32(2, pool->getFallbacks());
+	TEST_ASSERT_EQUAL_UINT32(16 + 1024, pool->getFallbackBytes());
+
+	uint64_t frees = nativeHeapFrees();
+	TEST_ASSERT_TRUE(pool->release(spill));
+	TEST_ASSERT_TRUE(pool->release(large));
+	TEST_ASSERT_EQUAL_UINT64(frees + 2, nativeHeapFrees());
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		pool->release(blocks[i]);
+	}
+}
+
+// A released block is handed out again, zeroed on request, without touching the heap
+void test_released_block_reused()
+{
+	uint8_t *a = (uint8_t *)pool->allocate(32, false);
+	memset(a, 0xAA, 64);
+	TEST_ASSERT_TRUE(pool->release(a));
+	uint64_t allocations = nativeHeapAllocations();
+	uint8_t *b = (uint8_t *)pool->allocate(32, true);
+	TEST_ASSERT_EQUAL_PTR(a, b);
+	for (uint8_t i = 0; i < 32; i++)
+	{
+		TEST_ASSERT_EQUAL_UINT8(0, b[i]);
+	}
+	TEST_ASSERT_EQUAL_UINT64(allocations, nativeHeapAllocations());
+	TEST_ASSERT_EQUAL_UINT16(1, pool->getHighWater(0));
+	pool->release(b);
+}
+
+// Arena addresses that are not a handed-out block leave the free list alone
+void test_foreign_and_double_free_refused()
+{
+	uint8_t *a = (uint8_t *)pool->allocate(16, false);
+	TEST_ASSERT_FALSE(pool->release(a + 8));
+	TEST_ASSERT_TRUE(pool->release(a));
+	TEST_ASSERT_FALSE(pool->release(a));
+	TEST_ASSERT_EQUAL_UINT16(0, pool->getInUse(0));
+
+	// had a been queued twice, the two blocks of the class would be the same
+	void *b = pool->allocate(16, false);
+	void *c = pool->allocate(16, false);
+	TEST_ASSERT_TRUE(b != c);
+	TEST_ASSERT_EQUAL_UINT16(2, pool->getInUse(0));
+	pool->release(b);
+	pool->release(c);
+}
+
+// A Message on the pool keeps its body there and returns it on reset
+void test_message_bodies_from_pool()
+{
+	Message msg;
+	msg.setPool(pool);
+	uint8_t body[100];
+	memset(body, 'x', sizeof(body));
+	TEST_ASSERT_TRUE(msg.setData(body, sizeof(body)));
+	TEST_ASSERT_TRUE(pool->owns(msg.getData()));
+	TEST_ASSERT_EQUAL_UINT16(1, pool->getInUse(1));
+	msg.reset();
+	TEST_ASSERT_EQUAL_UINT16(0, pool->getInUse(1));
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_begin_rejects_bad_classes);
+	RUN_TEST(test_smallest_fitting_class);
+	RUN_TEST(test_exhaustion_falls_back_to_heap);
+	RUN_TEST(test_released_block_reused);
+	RUN_TEST(test_foreign_and_double_free_refused);
+	RUN_TEST(test_message_bodies_from_pool);
+	return UNITY_END();
+}
@@ -0,0 +1,93 @@
+#include <Arduino.h>
+#include <Connector.h>
+#include <unity.h>
+
+// Per-filter handlers: unbinding from inside a handler and the CONNECTOR_MAX_DISPATCH cap.
+
+static Connector *connector;
+static uint8_t payload[256];
+static uint32_t payloadSize;
+
+static void dispatch(const char *topic)
+{
+	char buffer[CONNECTOR_TOPIC_SIZE];
+	strcpy(buffer, topic);
+	connector->dispatchMessage(buffer, payload, payloadSize);
+}
+
+void setUp()
+{
+	connector = new Connector();
+	Message msg;
+	msg.version = MESSAGE_VERSION;
+	msg.type = MESSAGE_TYPE_VALUE;
+	uint8_t data[] = {'1'};
+	msg.setData(data, sizeof(data));
+	payloadSize = msg.toPayload(payload, sizeof(payload));
+	TEST_ASSERT_GREATER_THAN(0, payloadSize);
+}
+
+void tearDown()
+{
+	delete connector;
+}
+
+void test_null_handler_rejected()
+{
+	TEST_ASSERT_EQUAL_INT16(TOPIC_TREE_NONE, connector->bind("a/b", NULL));
+}
+
+// Whichever handler runs first unbinds itself and the other; the other is skipped and both slots are reused afterwards
+void test_unbind_while_dispatching()
+{
+	static int16_t first;
+	static int16_t second;
+	static int calls;
+	calls = 0;
+	std::string tag = "kept";
+	auto handler = [tag](Connector *c, const char *, Message *)
+	{
+		c->unbind(first);
+		c->unbind(second);
+		// the closure is still alive after unbinding itself
+		TEST_ASSERT_EQUAL_STRING("kept", tag.c_str());
+		calls++;
+	};
+	first = connector->bind("a/+", handler);
+	second = connector->bind("a/#", handler);
+	TEST_ASSERT_TRUE(first != TOPIC_TREE_NONE);
+	TEST_ASSERT_TRUE(second != TOPIC_TREE_NONE);
+
+	dispatch("a/b");
+	TEST_ASSERT_EQUAL_INT(1, calls);
+	dispatch("a/b");
+	TEST_ASSERT_EQUAL_INT(1, calls);
+
+	int16_t x = connector->bind("x", handler);
+	int16_t y = connector->bind("y", handler);
+	TEST_ASSERT_TRUE((x == first && y == second) || (x == second && y == first));
+}
+
+void test_truncated_matches_counted()
+{
+	static int calls;
+	calls = 0;
+	for (uint8_t i = 0; i < CONNECTOR_MAX_DISPATCH + 2; i++)
+	{
+		int16_t handle = connector->bind("a/#", [](Connector *, const char *, Message *)
+																		 { calls++; });
+		TEST_ASSERT_TRUE(handle != TOPIC_TREE_NONE);
+	}
+	dispatch("a/b");
+	TEST_ASSERT_EQUAL_INT(CONNECTOR_MAX_DISPATCH, calls);
+	TEST_ASSERT_EQUAL_UINT32(2, connector->getMetrics()->getCounter(METRICS_DISPATCH_TRUNCATED));
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_null_handler_rejected);
+	RUN_TEST(test_unbind_while_dispatching);
+	RUN_TEST(test_truncated_matches_counted);
+	return UNITY_END();
+}
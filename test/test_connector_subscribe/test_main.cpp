@@ -0,0 +1,212 @@
+#include <Arduino.h>
+#include <Connector.h>
+#include <LoopbackBroker.h>
+#include <unity.h>
+
+// Persistent subscriptions and their SUBACK codes against a LoopbackBroker; the primary connects
+// first (broker connection 0), the extra session second (connection 1).
+
+#define SECOND_SESSION (1 << 1)
+
+static LoopbackBroker *broker;
+static Connector *connector;
+static bool online;
+
+static void step()
+{
+	connector->loop();
+}
+
+void setUp()
+{
+	broker = new LoopbackBroker();
+	TEST_ASSERT_TRUE(broker->begin());
+	connector = new Connector();
+	connector->setDescriptor("test", "vendor", "model", "SN1", "code");
+	connector->setNetwork(CONNECTOR_TYPE_WIFI, "ssid", "password");
+	connector->setConnection("127.0.0.1", broker->port());
+	TEST_ASSERT_EQUAL_INT8(1, connector->addSession("127.0.0.1", broker->port()));
+	online = false;
+	connector->setOnConnectCallback([](Connector *)
+																	{ online = true; });
+	TEST_ASSERT_TRUE(connector->begin());
+	unsigned long started = millis();
+	while (!(online && connector->isSessionConnected(1)) && millis() - started < 2000)
+	{
+		broker->poll();
+		connector->loop();
+		delay(1);
+	}
+	TEST_ASSERT_TRUE(online);
+	TEST_ASSERT_TRUE(connector->isSessionConnected(1));
+}
+
+void tearDown()
+{
+	delete connector;
+	delete broker;
+}
+
+// A filter already subscribed is sent after a new one; each gets the code at its own position
+void test_suback_codes_follow_sent_order()
+{
+	TEST_ASSERT_TRUE(connector->subscribe("old", 0));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getGrantedQos("old"));
+
+	const char *topics[] = {"new", "old"};
+	const uint8_t qos[] = {1, 2};
+	TEST_ASSERT_TRUE(connector->subscribe(topics, qos, 2));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_UINT8(1, connector->getGrantedQos("new"));
+	TEST_ASSERT_EQUAL_UINT8(2, connector->getGrantedQos("old"));
+}
+
+// Unsubscribing moves the last entry into the freed index while the SUBACK is still on its way
+void test_suback_after_unsubscribe()
+{
+	broker->setHoldSubacks(true);
+	const char *topics[] = {"a", "b", "c"};
+	const uint8_t qos[] = {0, 1, 2};
+	TEST_ASSERT_TRUE(connector->subscribe(topics, qos, 3));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_SUBSCRIPTION_PENDING, connector->getGrantedQos("b"));
+
+	TEST_ASSERT_TRUE(connector->unsubscribe("a"));
+	broker->releaseSubacks();
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_SUBSCRIPTION_FAILURE, connector->getGrantedQos("a"));
+	TEST_ASSERT_EQUAL_UINT8(1, connector->getGrantedQos("b"));
+	TEST_ASSERT_EQUAL_UINT8(2, connector->getGrantedQos("c"));
+}
+
+void test_threaded_batch_is_one_subscribe()
+{
+	TEST_ASSERT_TRUE(connector->beginTask());
+	uint32_t subscribes = broker->getPacketCount(MQTTSUBSCRIBE);
+	const char *topics[] = {"x", "y", "z"};
+	const uint8_t qos[] = {0, 1, 0};
+	TEST_ASSERT_TRUE(connector->subscribe(topics, qos, 3));
+	broker->run(100, step);
+	connector->endTask();
+	TEST_ASSERT_EQUAL_UINT32(subscribes + 1, broker->getPacketCount(MQTTSUBSCRIBE));
+	TEST_ASSERT_EQUAL_INT(1, broker->getSubscribedQos(0, "y"));
+	TEST_ASSERT_EQUAL_UINT8(1, connector->getGrantedQos("y"));
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getGrantedQos("z"));
+}
+
+// A rejected batch marks nothing pending: an over-long filter, no room for its new filters, or too many entries
+void test_rejected_batch_changes_nothing()
+{
+	static char longTopic[CONNECTOR_TOPIC_SIZE + 1];
+	memset(longTopic, 't', CONNECTOR_TOPIC_SIZE);
+	const char *withLong[] = {"ok", longTopic};
+	const uint8_t qos[CONNECTOR_MAX_SUBSCRIPTIONS + 1] = {0};
+	TEST_ASSERT_FALSE(connector->subscribe(withLong, qos, 2));
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getSubscriptionCount());
+
+	static char names[CONNECTOR_MAX_SUBSCRIPTIONS][4];
+	const char *topics[CONNECTOR_MAX_SUBSCRIPTIONS + 1];
+	for (uint8_t i = 0; i < CONNECTOR_MAX_SUBSCRIPTIONS; i++)
+	{
+		snprintf(names[i], sizeof(names[i]), "t%u", i);
+		topics[i] = names[i];
+	}
+	TEST_ASSERT_TRUE(connector->subscribe(topics, qos, CONNECTOR_MAX_SUBSCRIPTIONS - 1));
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_MAX_SUBSCRIPTIONS - 1, connector->getSubscriptionCount());
+	const char *twoNew[] = {"n1", "n2"};
+	TEST_ASSERT_FALSE(connector->subscribe(twoNew, qos, 2));
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_MAX_SUBSCRIPTIONS - 1, connector->getSubscriptionCount());
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_SUBSCRIPTION_FAILURE, connector->getGrantedQos("n1"));
+
+	for (uint8_t i = 0; i <= CONNECTOR_MAX_SUBSCRIPTIONS; i++)
+	{
+		topics[i] = "t0";
+	}
+	TEST_ASSERT_FALSE(connector->subscribe(topics, qos, CONNECTOR_MAX_SUBSCRIPTIONS + 1));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getGrantedQos("t0"));
+}
+
+// In threaded mode an empty batch posts nothing and an over-long filter is refused before it is queued
+void test_threaded_batch_validated_before_posting()
+{
+	static char longTopic[CONNECTOR_TOPIC_SIZE + 1];
+	memset(longTopic, 't', CONNECTOR_TOPIC_SIZE);
+	TEST_ASSERT_TRUE(connector->beginTask());
+	uint32_t subscribes = broker->getPacketCount(MQTTSUBSCRIBE);
+	const char *topics[] = {longTopic};
+	const uint8_t qos[] = {0};
+	TEST_ASSERT_TRUE(connector->subscribe(topics, qos, 0));
+	TEST_ASSERT_FALSE(connector->subscribe(topics, qos, 1));
+	broker->run(100, step);
+	connector->endTask();
+	TEST_ASSERT_EQUAL_UINT32(subscribes, broker->getPacketCount(MQTTSUBSCRIBE));
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getSubscriptionCount());
+}
+
+// While the task runs the accessors answer from the copy the engine refreshes after each pass
+void test_threaded_accessors_follow_engine()
+{
+	TEST_ASSERT_TRUE(connector->subscribe("before", 1));
+	broker->run(50, step);
+	TEST_ASSERT_TRUE(connector->beginTask());
+	TEST_ASSERT_EQUAL_UINT8(1, connector->getGrantedQos("before"));
+	TEST_ASSERT_EQUAL_UINT8(1, connector->getSubscriptionCount());
+
+	TEST_ASSERT_TRUE(connector->subscribe("after", 2));
+	unsigned long started = millis();
+	while (connector->getGrantedQos("after") != 2 && millis() - started < 1000)
+	{
+		broker->poll();
+		connector->loop();
+		delay(1);
+	}
+	TEST_ASSERT_EQUAL_UINT8(2, connector->getGrantedQos("after"));
+	TEST_ASSERT_EQUAL_UINT8(2, connector->getSubscriptionCount());
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_SUBSCRIPTION_FAILURE, connector->getGrantedQos("never"));
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getInflightCount());
+	connector->endTask();
+}
+
+// Each session keeps its own QoS for a shared filter and the entry lives until the last one leaves
+void test_sessions_keep_their_own_subscription()
+{
+	TEST_ASSERT_TRUE(connector->subscribe("shared", 0));
+	TEST_ASSERT_TRUE(connector->subscribeTo(SECOND_SESSION, "shared", 2));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_INT(0, broker->getSubscribedQos(0, "shared"));
+	TEST_ASSERT_EQUAL_INT(2, broker->getSubscribedQos(1, "shared"));
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getGrantedQos("shared"));
+
+	// the primary asking again with another QoS leaves the session alone
+	TEST_ASSERT_TRUE(connector->subscribe("shared", 1));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_INT(1, broker->getSubscribedQos(0, "shared"));
+	TEST_ASSERT_EQUAL_INT(2, broker->getSubscribedQos(1, "shared"));
+
+	TEST_ASSERT_TRUE(connector->unsubscribe("shared"));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_INT(-1, broker->getSubscribedQos(0, "shared"));
+	TEST_ASSERT_EQUAL_INT(2, broker->getSubscribedQos(1, "shared"));
+	TEST_ASSERT_EQUAL_UINT8(1, connector->getSubscriptionCount());
+	TEST_ASSERT_EQUAL_UINT8(CONNECTOR_SUBSCRIPTION_FAILURE, connector->getGrantedQos("shared"));
+
+	TEST_ASSERT_TRUE(connector->unsubscribeFrom(SECOND_SESSION, "shared"));
+	broker->run(50, step);
+	TEST_ASSERT_EQUAL_INT(-1, broker->getSubscribedQos(1, "shared"));
+	TEST_ASSERT_EQUAL_UINT8(0, connector->getSubscriptionCount());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_suback_codes_follow_sent_order);
+	RUN_TEST(test_suback_after_unsubscribe);
+	RUN_TEST(test_threaded_batch_is_one_subscribe);
+	RUN_TEST(test_sessions_keep_their_own_subscription);
+	RUN_TEST(test_rejected_batch_changes_nothing);
+	RUN_TEST(test_threaded_batch_validated_before_posting);
+	RUN_TEST(test_threaded_accessors_follow_engine);
+	return UNITY_END();
+}
@@ -0,0 +1,120 @@
+#include <Arduino.h>
+#include <Connector.h>
+#include <LoopbackBroker.h>
+#include <unity.h>
+
+// Threaded mode queues: slot sizing against the MQTT buffers and connection events on a full inbound queue.
+
+static LoopbackBroker *broker;
+static Connector *connector;
+static bool online;
+static uint8_t disconnects;
+static uint32_t received;
+static uint32_t receivedSize;
+
+static void step()
+{
+	connector->loop();
+}
+
+void setUp()
+{
+	broker = new LoopbackBroker();
+	TEST_ASSERT_TRUE(broker->begin());
+	connector = new Connector();
+	connector->setDescriptor("test", "vendor", "model", "SN1", "code");
+	connector->setNetwork(CONNECTOR_TYPE_WIFI, "ssid", "password");
+	connector->setConnection("127.0.0.1", broker->port());
+	online = false;
+	disconnects = 0;
+	received = 0;
+	receivedSize = 0;
+	connector->setOnConnectCallback([](Connector *)
+																	{ online = true; });
+	connector->setOnDisconnectCallback([](Connector *)
+																		 { disconnects++; });
+	connector->setOnUnknownMessageCallback([](Connector *, const char *, Message *)
+																				 { received++; });
+	connector->setOnMessageCallback([](Connector *, const char *, Message *msg)
+																	{
+		received++;
+		receivedSize = msg->getSize(); });
+	TEST_ASSERT_TRUE(connector->begin());
+	unsigned long started = millis();
+	while (!online && millis() - started < 2000)
+	{
+		broker->poll();
+		connector->loop();
+		delay(1);
+	}
+	TEST_ASSERT_TRUE(online);
+}
+
+void tearDown()
+{
+	connector->endTask();
+	delete connector;
+	delete broker;
+}
+
+void test_slot_smaller_than_buffer_rejected()
+{
+	connector->setTaskQueue(4, CONNECTOR_MQTT_BUFFER_SIZE / 2);
+	TEST_ASSERT_FALSE(connector->beginTask());
+	connector->setTaskQueue(4, 0);
+	TEST_ASSERT_TRUE(connector->beginTask());
+	TEST_ASSERT_EQUAL_UINT32(CONNECTOR_MQTT_BUFFER_SIZE, connector->getInboundQueue()->getSlotSize());
+	TEST_ASSERT_EQUAL_UINT16(4, connector->getInboundQueue()->capacity());
+}
+
+// A message the MQTT buffer accepts crosses the queue whole
+void test_large_message_crosses_queue()
+{
+	static uint8_t body[3000];
+	static uint8_t payload[3200];
+	memset(body, 'x', sizeof(body));
+	Message msg;
+	msg.version = MESSAGE_VERSION;
+	msg.type = MESSAGE_TYPE_VALUE;
+	msg.setData(body, sizeof(body));
+	uint32_t length = msg.toPayload(payload, sizeof(payload));
+	TEST_ASSERT_GREATER_THAN(sizeof(body), length);
+
+	TEST_ASSERT_TRUE(connector->beginTask());
+	TEST_ASSERT_TRUE(broker->publish(0, "big", payload, length));
+	broker->run(200, step);
+	TEST_ASSERT_EQUAL_UINT32(1, received);
+	TEST_ASSERT_EQUAL_UINT32(sizeof(body), receivedSize);
+	TEST_ASSERT_EQUAL_UINT32(0, connector->getMetrics()->getCounter(METRICS_QUEUE_DROPS));
+}
+
+// Messages fill the inbound queue while loop() is not called; the disconnect after them still arrives
+void test_disconnect_survives_full_queue()
+{
+	const uint8_t payload[] = "1";
+	connector->setTaskQueue(2, 0);
+	TEST_ASSERT_TRUE(connector->beginTask());
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		TEST_ASSERT_TRUE(broker->publish(0, "m", payload, 1));
+	}
+	delay(100);
+	// closed for good, so reconnect attempts keep failing
+	broker->end();
+	delay(100);
+	TEST_ASSERT_EQUAL_UINT8(0, disconnects);
+
+	connector->loop();
+	TEST_ASSERT_EQUAL_UINT32(2, received);
+	TEST_ASSERT_EQUAL_UINT8(1, disconnects);
+	TEST_ASSERT_EQUAL_UINT32(2, connector->getMetrics()->getCounter(METRICS_QUEUE_DROPS));
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_slot_smaller_than_buffer_rejected);
+	RUN_TEST(test_large_message_crosses_queue);
+	RUN_TEST(test_disconnect_survives_full_queue);
+	return UNITY_END();
+}
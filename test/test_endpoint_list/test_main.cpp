@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include <Connector.h>
+#include <EndpointList.h>
+#include <LoopbackBroker.h>
+#include <unity.h>
+
+// Broker failover order and the DNS cache of EndpointList, then failover through a Connector whose first
+// broker refuses connections and whose second is a LoopbackBroker.
+
+static EndpointList *list;
+static uint8_t lookups;
+static bool resolvable;
+
+void setUp()
+{
+	lookups = 0;
+	resolvable = true;
+	list = new EndpointList();
+	list->setResolver([](const char *, IPAddress &address) -> bool
+										{
+		lookups++;
+		address = IPAddress(10, 0, 0, lookups);
+		return resolvable; });
+}
+
+void tearDown()
+{
+	delete list;
+}
+
+void test_current_kept_until_failover_failures()
+{
+	TEST_ASSERT_TRUE(list->add("a.example", 1883));
+	TEST_ASSERT_TRUE(list->add("b.example", 1883));
+	TEST_ASSERT_TRUE(list->add("c.example", 1883));
+	TEST_ASSERT_EQUAL_STRING("a.example", list->select()->host);
+	for (uint8_t i = 1; i < ENDPOINT_FAILOVER_FAILURES; i++)
+	{
+		list->failed();
+		TEST_ASSERT_EQUAL_STRING("a.example", list->select()->host);
+	}
+	// a success in between starts the count again
+	list->succeeded();
+	list->failed();
+	TEST_ASSERT_EQUAL_STRING("a.example", list->select()->host);
+	for (uint8_t i = 1; i < ENDPOINT_FAILOVER_FAILURES; i++)
+	{
+		list->failed();
+	}
+	// b and c tie, the earlier one takes over
+	TEST_ASSERT_EQUAL_STRING("b.example", list->select()->host);
+	TEST_ASSERT_EQUAL_INT8(1, list->current());
+}
+
+void test_failover_prefers_best_score()
+{
+	list->add("a.example", 1883);
+	list->add("b.example", 1883);
+	list->add("c.example", 1883);
+	list->select();
+	list->succeeded();
+	list->succeeded();
+	for (uint8_t i = 0; i < ENDPOINT_FAILOVER_FAILURES; i++)
+	{
+		list->failed();
+	}
+	TEST_ASSERT_EQUAL_STRING("b.example", list->select()->host);
+	for (uint8_t i = 0; i < ENDPOINT_FAILOVER_FAILURES; i++)
+	{
+		list->failed();
+	}
+	// a scored 2 - 2 * ENDPOINT_FAILOVER_FAILURES, c is still 0
+	TEST_ASSERT_EQUAL_STRING("c.example", list->select()->host);
+}
+
+void test_literal_address_skips_resolver()
+{
+	IPAddress address;
+	list->add("192.168.0.7", 1883);
+	list->select();
+	TEST_ASSERT_TRUE(list->resolve(address));
+	TEST_ASSERT_EQUAL_UINT8(0, lookups);
+	TEST_ASSERT_EQUAL_UINT8(7, address[3]);
+}
+
+void test_resolution_cached_for_ttl()
+{
+	IPAddress address;
+	list->setDnsTtl(50);
+	list->add("a.example", 1883);
+	list->select();
+	TEST_ASSERT_TRUE(list->resolve(address));
+	TEST_ASSERT_TRUE(list->resolve(address));
+	TEST_ASSERT_EQUAL_UINT8(1, lookups);
+	TEST_ASSERT_EQUAL_UINT8(1, address[3]);
+	delay(60);
+	TEST_ASSERT_TRUE(list->resolve(address));
+	TEST_ASSERT_EQUAL_UINT8(2, lookups);
+	TEST_ASSERT_EQUAL_UINT8(2, address[3]);
+}
+
+// A failed connect drops the cached address; an unresolvable host hands the name to the client
+void test_failure_drops_cached_address()
+{
+	IPAddress address;
+	list->add("a.example", 1883);
+	list->select();
+	TEST_ASSERT_TRUE(list->resolve(address));
+	list->failed();
+	resolvable = false;
+	TEST_ASSERT_FALSE(list->resolve(address));
+	TEST_ASSERT_EQUAL_UINT8(2, lookups);
+}
+
+void test_set_first_keeps_failover_entries()
+{
+	TEST_ASSERT_TRUE(list->setFirst("a.example", 1883));
+	TEST_ASSERT_TRUE(list->add("b.example", 8883));
+	TEST_ASSERT_TRUE(list->setFirst("x.example", 1884));
+	TEST_ASSERT_EQUAL_UINT8(2, list->count());
+	TEST_ASSERT_EQUAL_STRING("x.example", list->get(0)->host);
+	TEST_ASSERT_EQUAL_UINT16(1884, list->get(0)->port);
+	TEST_ASSERT_EQUAL_STRING("b.example", list->get(1)->host);
+}
+
+// The first broker refuses; after ENDPOINT_FAILOVER_FAILURES attempts the connector moves to the second.
+// setConnection called again after addConnection keeps the failover broker.
+void test_connector_fails_over()
+{
+	LoopbackBroker closed;
+	TEST_ASSERT_TRUE(closed.begin());
+	uint16_t refused = closed.port();
+	closed.end();
+	LoopbackBroker broker;
+	TEST_ASSERT_TRUE(broker.begin());
+
+	static bool online;
+	online = false;
+	Connector connector;
+	connector.setDescriptor("test", "vendor", "model", "SN1", "code");
+	connector.setNetwork(CONNECTOR_TYPE_WIFI, "ssid", "password");
+	connector.setConnection("127.0.0.1", refused);
+	TEST_ASSERT_TRUE(connector.addConnection("127.0.0.1", broker.port()));
+	connector.setConnection("127.0.0.1", refused);
+	connector.setReconnectBackoff(0, 0, 0);
+	connector.setOnConnectCallback([](Connector *)
+																 { online = true; });
+	TEST_ASSERT_TRUE(connector.begin());
+	broker.run(2000, [&]()
+						 {
+		if (!online)
+		{
+			connector.loop();
+		} });
+	TEST_ASSERT_TRUE(online);
+	TEST_ASSERT_EQUAL_UINT32(ENDPOINT_FAILOVER_FAILURES, connector.getMetrics()->getCounter(METRICS_CONNECT_FAILURES));
+	TEST_ASSERT_EQUAL_UINT8(1, broker.getAccepted());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_current_kept_until_failover_failures);
+	RUN_TEST(test_failover_prefers_best_score);
+	RUN_TEST(test_literal_address_skips_resolver);
+	RUN_TEST(test_resolution_cached_for_ttl);
+	RUN_TEST(test_failure_drops_cached_address);
+	RUN_TEST(test_set_first_keeps_failover_entries);
+	RUN_TEST(test_connector_fails_over);
+	return UNITY_END();
+}
@@ -0,0 +1,97 @@
+#include <Arduino.h>
+#include <Message.h>
+#include <unity.h>
+
+// getJSON scans one flat key in place; nested paths go through a caller's JsonIndex.
+
+static Message *msg;
+
+static void body(const char *json)
+{
+	TEST_ASSERT_TRUE(msg->setData((uint8_t *)json, strlen(json)));
+}
+
+void setUp()
+{
+	msg = new Message();
+	msg->version = MESSAGE_VERSION;
+	msg->type = MESSAGE_TYPE_VALUE;
+}
+
+void tearDown()
+{
+	delete msg;
+}
+
+// Keys are taken as written, so a flat key may contain the characters paths use
+void test_flat_key_with_dot()
+{
+	char text[16];
+	int number;
+	body("{\"sensor.unit\":\"C\", \"a[0]\" : 7}");
+	TEST_ASSERT_TRUE(msg->getJSON("sensor.unit", text, sizeof(text)));
+	TEST_ASSERT_EQUAL_STRING("C", text);
+	TEST_ASSERT_TRUE(msg->getJSON("a[0]", &number));
+	TEST_ASSERT_EQUAL_INT(7, number);
+	TEST_ASSERT_FALSE(msg->getJSON("sensor", text, sizeof(text)));
+}
+
+void test_flat_values()
+{
+	char text[8];
+	int numbers[4] = {0, 0, 0, 0};
+	float reals[2];
+	float real;
+	bool flag;
+	body("{\"s\":\"a\\\"b\\u00e9\",\"t\":21.5,\"ok\":false,\"list\":[1, 2 ,3],\"fl\":[0.5,1.5,2.5]}");
+	TEST_ASSERT_TRUE(msg->getJSON("s", text, sizeof(text)));
+	TEST_ASSERT_EQUAL_STRING("a\"b\xc3\xa9", text);
+	TEST_ASSERT_TRUE(msg->getJSON("t", &real));
+	TEST_ASSERT_EQUAL_FLOAT(21.5f, real);
+	TEST_ASSERT_TRUE(msg->getJSON("ok", &flag));
+	TEST_ASSERT_FALSE(flag);
+	TEST_ASSERT_TRUE(msg->getJSON("list", numbers, 4));
+	TEST_ASSERT_EQUAL_INT(3, numbers[2]);
+	TEST_ASSERT_EQUAL_INT(0, numbers[3]);
+	// at most bufferSize elements are stored
+	TEST_ASSERT_TRUE(msg->getJSON("fl", reals, 2));
+	TEST_ASSERT_EQUAL_FLOAT(1.5f, reals[1]);
+	TEST_ASSERT_FALSE(msg->getJSON("missing", &real));
+}
+
+// setValue keeps the terminator in the body
+void test_flat_key_in_set_value_body()
+{
+	int number;
+	TEST_ASSERT_TRUE(msg->setValue("{\"seq\":%d}", 42));
+	TEST_ASSERT_TRUE(msg->getJSON("seq", &number));
+	TEST_ASSERT_EQUAL_INT(42, number);
+}
+
+void test_nested_paths_through_index()
+{
+	JsonIndex json;
+	char text[8];
+	float real;
+	body("{\"sensor\":{\"unit\":\"C\",\"values\":[20.5,21.5]},\"seq\":1}");
+	TEST_ASSERT_TRUE(msg->indexJSON(&json));
+	TEST_ASSERT_TRUE(json.getString(json.find("sensor.unit"), text, sizeof(text)));
+	TEST_ASSERT_EQUAL_STRING("C", text);
+	TEST_ASSERT_TRUE(json.getFloat(json.find("sensor.values[1]"), &real));
+	TEST_ASSERT_EQUAL_FLOAT(21.5f, real);
+	TEST_ASSERT_EQUAL_INT32(2, json.getLength(json.find("sensor.values")));
+
+	body("{\"unterminated\":");
+	TEST_ASSERT_FALSE(msg->indexJSON(&json));
+	TEST_ASSERT_EQUAL_INT16(JSON_INDEX_NONE, json.find(""));
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_flat_key_with_dot);
+	RUN_TEST(test_flat_values);
+	RUN_TEST(test_flat_key_in_set_value_body);
+	RUN_TEST(test_nested_paths_through_index);
+	return UNITY_END();
+}
@@ -0,0 +1,98 @@
+#include <Arduino.h>
+#include <Message.h>
+#include <NativeHeap.h>
+#include <unity.h>
+
+// Message framing against short buffers, lengths that overrun the payload and failed allocations.
+
+static uint8_t body[] = {'h', 'e', 'l', 'l', 'o'};
+
+static uint32_t frame(uint8_t *buffer, uint32_t size)
+{
+	Message msg;
+	msg.version = MESSAGE_VERSION;
+	msg.type = MESSAGE_TYPE_VALUE;
+	msg.setDataType("text/plain");
+	TEST_ASSERT_TRUE(msg.setData(body, sizeof(body)));
+	return msg.toPayload(buffer, size);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+	nativeHeapFailNext(0);
+}
+
+void test_round_trip()
+{
+	uint8_t payload[128];
+	uint32_t length = frame(payload, sizeof(payload));
+	Message msg;
+	TEST_ASSERT_TRUE(msg.fromPayload(payload, length));
+	TEST_ASSERT_EQUAL_UINT32(sizeof(body), msg.getSize());
+	TEST_ASSERT_EQUAL_MEMORY(body, msg.getData(), sizeof(body));
+}
+
+// Too small by one byte: nothing is written past or into the buffer
+void test_to_payload_does_not_fit()
+{
+	uint8_t payload[128];
+	uint32_t length = frame(payload, sizeof(payload));
+	uint8_t small[128];
+	memset(small, 0xEE, sizeof(small));
+	TEST_ASSERT_EQUAL_UINT32(0, frame(small, length - 1));
+	TEST_ASSERT_EQUAL_HEX8(0xEE, small[0]);
+	TEST_ASSERT_EQUAL_UINT32(length, frame(small, length));
+}
+
+void test_option_length_past_payload()
+{
+	uint8_t payload[128];
+	uint32_t length = frame(payload, sizeof(payload));
+	payload[7] = 0xF0;
+	Message msg;
+	TEST_ASSERT_FALSE(msg.fromPayload(payload, length));
+	TEST_ASSERT_EQUAL_UINT8(MESSAGE_TYPE_UNKNOWN, msg.type);
+	TEST_ASSERT_EQUAL_UINT32(length, msg.getSize());
+}
+
+void test_body_length_past_payload()
+{
+	uint8_t payload[128];
+	uint32_t length = frame(payload, sizeof(payload));
+	Message msg;
+	TEST_ASSERT_FALSE(msg.fromPayload(payload, length - 1));
+	TEST_ASSERT_EQUAL_UINT8(MESSAGE_TYPE_UNKNOWN, msg.type);
+	TEST_ASSERT_FALSE(msg.fromPayload(payload, 6));
+}
+
+void test_failed_allocation()
+{
+	Message msg;
+	nativeHeapFailNext(1);
+	TEST_ASSERT_FALSE(msg.setData(body, sizeof(body)));
+	TEST_ASSERT_EQUAL_UINT32(0, msg.getSize());
+	nativeHeapFailNext(1);
+	TEST_ASSERT_FALSE(msg.setValue("%d", 42));
+	TEST_ASSERT_EQUAL_UINT32(0, msg.getSize());
+
+	uint8_t payload[128];
+	uint32_t length = frame(payload, sizeof(payload));
+	nativeHeapFailNext(1);
+	TEST_ASSERT_FALSE(msg.fromPayload(payload, length));
+	TEST_ASSERT_EQUAL_UINT32(0, msg.getSize());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_round_trip);
+	RUN_TEST(test_to_payload_does_not_fit);
+	RUN_TEST(test_option_length_past_payload);
+	RUN_TEST(test_body_length_past_payload);
+	RUN_TEST(test_failed_allocation);
+	return UNITY_END();
+}
@@ -0,0 +1,70 @@
+#include <Arduino.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <unity.h>
+
+// Write coalescing: staged packets leave on the maxDelay deadline whichever way loop() exits.
+
+#define TEST_MAX_DELAY 20
+
+static LoopbackClient *loopback;
+static MqttClient *mqtt;
+
+void setUp()
+{
+	static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+	loopback = new LoopbackClient();
+	loopback->setEcho(false);
+	mqtt = new MqttClient(*loopback);
+	mqtt->setBufferSize(256);
+	mqtt->setKeepAlive(0);
+	mqtt->setSocketTimeout(1);
+	TEST_ASSERT_TRUE(mqtt->setWriteCoalescing(1024, TEST_MAX_DELAY, false));
+	loopback->connect("loopback", 1883);
+	loopback->feed(connack, sizeof(connack));
+	mqtt->beginConnect("coalescing", NULL, NULL);
+	mqtt->loop();
+	TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+void tearDown()
+{
+	delete mqtt;
+	delete loopback;
+}
+
+void test_flushed_at_max_delay()
+{
+	size_t written = loopback->getWritten();
+	uint32_t flushes = mqtt->getFlushCount();
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", "1"));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", "2"));
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT32(written, loopback->getWritten());
+	delay(TEST_MAX_DELAY + 5);
+	mqtt->loop();
+	TEST_ASSERT_GREATER_THAN(written, loopback->getWritten());
+	TEST_ASSERT_EQUAL_UINT32(flushes + 1, mqtt->getFlushCount());
+}
+
+// A packet due while the link fails in the same loop() still goes out before the link is dropped
+void test_due_packet_sent_before_the_link_fails()
+{
+	static const uint8_t partial[] = {MQTTPUBLISH, 12, 0, 3};
+	loopback->feed(partial, sizeof(partial));
+	mqtt->loop();
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", "1"));
+	size_t written = loopback->getWritten();
+	delay(1100);
+	TEST_ASSERT_FALSE(mqtt->loop());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECTION_TIMEOUT, mqtt->state());
+	TEST_ASSERT_GREATER_THAN(written, loopback->getWritten());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_flushed_at_max_delay);
+	RUN_TEST(test_due_packet_sent_before_the_link_fails);
+	return UNITY_END();
+}
@@ -0,0 +1,118 @@
+#include <Arduino.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <unity.h>
+
+// The non-blocking connect driven by loop() against a LoopbackClient standing in for the broker.
+
+// Fails the TCP step the way a refused or unreachable broker does
+class RefusingClient : public LoopbackClient
+{
+public:
+	virtual int connect(IPAddress, uint16_t) { return 0; }
+	virtual int connect(const char *, uint16_t) { return 0; }
+};
+
+static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+
+static LoopbackClient *loopback;
+static MqttClient *mqtt;
+
+void setUp()
+{
+	loopback = new LoopbackClient();
+	loopback->setEcho(false);
+	mqtt = new MqttClient(*loopback);
+	mqtt->setBufferSize(256);
+	mqtt->setServer("loopback", 1883);
+	mqtt->setKeepAlive(0);
+	mqtt->setSocketTimeout(1);
+}
+
+void tearDown()
+{
+	delete mqtt;
+	delete loopback;
+}
+
+void test_refused_tcp_fails_in_one_loop()
+{
+	RefusingClient refusing;
+	MqttClient client(refusing);
+	client.setBufferSize(256);
+	client.setServer("loopback", 1883);
+	TEST_ASSERT_TRUE(client.beginConnect("connect", NULL, NULL));
+	TEST_ASSERT_FALSE(client.loop());
+	TEST_ASSERT_FALSE(client.connecting());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECT_FAILED, client.state());
+}
+
+void test_connack_split_across_loops()
+{
+	TEST_ASSERT_TRUE(mqtt->beginConnect("connect", NULL, NULL));
+	TEST_ASSERT_FALSE(mqtt->loop());
+	TEST_ASSERT_TRUE(mqtt->connecting());
+	TEST_ASSERT_GREATER_THAN(0, loopback->getWritten());
+	for (uint8_t i = 0; i < sizeof(connack); i++)
+	{
+		loopback->feed(connack + i, 1);
+		TEST_ASSERT_EQUAL((i == sizeof(connack) - 1), mqtt->loop());
+	}
+	TEST_ASSERT_FALSE(mqtt->connecting());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECTED, mqtt->state());
+}
+
+// A broker that accepts TCP but never sends CONNACK never holds loop(); the attempt fails after socketTimeout
+void test_silent_broker_times_out_without_blocking()
+{
+	TEST_ASSERT_TRUE(mqtt->beginConnect("connect", NULL, NULL));
+	unsigned long worst = 0;
+	unsigned long started = millis();
+	while (mqtt->connecting() && millis() - started < 3000)
+	{
+		unsigned long before = micros();
+		mqtt->loop();
+		unsigned long took = micros() - before;
+		if (took > worst)
+		{
+			worst = took;
+		}
+		delay(1);
+	}
+	TEST_ASSERT_FALSE(mqtt->connecting());
+	TEST_ASSERT_FALSE(mqtt->connected());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECTION_TIMEOUT, mqtt->state());
+	TEST_ASSERT_GREATER_OR_EQUAL(1000, millis() - started);
+	TEST_ASSERT_LESS_THAN(1000, worst);
+}
+
+void test_connack_refusal_code()
+{
+	static const uint8_t refused[] = {MQTTCONNACK, 2, 0, MQTT_CONNECT_UNAUTHORIZED};
+	TEST_ASSERT_TRUE(mqtt->beginConnect("connect", NULL, NULL));
+	mqtt->loop();
+	loopback->feed(refused, sizeof(refused));
+	TEST_ASSERT_FALSE(mqtt->loop());
+	TEST_ASSERT_FALSE(mqtt->connecting());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECT_UNAUTHORIZED, mqtt->state());
+	TEST_ASSERT_EQUAL_UINT8(0, loopback->connected());
+}
+
+void test_blocking_connect_wrapper()
+{
+	loopback->connect("loopback", 1883);
+	loopback->feed(connack, sizeof(connack));
+	TEST_ASSERT_TRUE(mqtt->connect("connect"));
+	TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_refused_tcp_fails_in_one_loop);
+	RUN_TEST(test_connack_split_across_loops);
+	RUN_TEST(test_silent_broker_times_out_without_blocking);
+	RUN_TEST(test_connack_refusal_code);
+	RUN_TEST(test_blocking_connect_wrapper);
+	return UNITY_END();
+}
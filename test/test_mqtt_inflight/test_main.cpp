@@ -0,0 +1,209 @@
+#include <Arduino.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <Metrics.h>
+#include <unity.h>
+
+// QoS 1/2 publishes with the default window and their resend after a reconnect.
+
+// Keeps the first byte of every write, which is the packet type when nothing is coalesced
+class CapturingClient : public LoopbackClient
+{
+public:
+	uint8_t types[32];
+	uint8_t count;
+	bool shortWrites; // accept only half of each write
+
+	virtual size_t write(const uint8_t *buffer, size_t size)
+	{
+		if (size > 0 && this->count < sizeof(this->types))
+		{
+			this->types[this->count++] = buffer[0];
+		}
+		return LoopbackClient::write(buffer, this->shortWrites ? size / 2 : size);
+	}
+};
+
+static CapturingClient *client;
+static MqttClient *mqtt;
+
+static void connect(uint8_t sessionPresent)
+{
+	const uint8_t connack[] = {MQTTCONNACK, 2, sessionPresent, 0};
+	client->connect("loopback", 1883);
+	client->feed(connack, sizeof(connack));
+	mqtt->beginConnect("inflight", NULL, NULL, 0, 0, 0, 0, 0);
+	while (mqtt->connecting())
+	{
+		mqtt->loop();
+	}
+	TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+// Packet ids start at 2 after a CONNECT with nothing in flight
+static void ack(uint8_t type, uint16_t msgId)
+{
+	const uint8_t packet[] = {type, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+	client->feed(packet, sizeof(packet));
+	mqtt->loop();
+}
+
+// Drops the link and connects again, capturing only what the reconnect writes
+static void reconnect(uint8_t sessionPresent)
+{
+	client->stop();
+	TEST_ASSERT_FALSE(mqtt->connected());
+	client->count = 0;
+	connect(sessionPresent);
+}
+
+void setUp()
+{
+	client = new CapturingClient();
+	client->setEcho(false);
+	client->count = 0;
+	client->shortWrites = false;
+	mqtt = new MqttClient(*client);
+	mqtt->setBufferSize(256);
+	mqtt->setKeepAlive(0);
+	connect(0);
+	client->count = 0;
+}
+
+void tearDown()
+{
+	delete mqtt;
+	delete client;
+}
+
+void test_default_window_publishes_qos1()
+{
+	const uint8_t payload[] = "21.5";
+	for (uint8_t i = 0; i < MQTT_INFLIGHT_WINDOW; i++)
+	{
+		TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, 4, false, 1));
+	}
+	TEST_ASSERT_EQUAL_UINT8(MQTT_INFLIGHT_WINDOW, mqtt->getInflightCount());
+	TEST_ASSERT_EQUAL_HEX8(MQTTPUBLISH | MQTTQOS1, client->types[0]);
+
+	// the window is full until a PUBACK
+	TEST_ASSERT_FALSE(mqtt->publish("a/b", payload, 4, false, 1));
+	ack(MQTTPUBACK, 2);
+	TEST_ASSERT_EQUAL_UINT8(MQTT_INFLIGHT_WINDOW - 1, mqtt->getInflightCount());
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, 4, false, 2));
+}
+
+void test_window_of_one_is_stop_and_wait()
+{
+	const uint8_t payload[] = "21.5";
+	TEST_ASSERT_TRUE(mqtt->setInflightWindow(1, 0));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, 4, false, 1));
+	TEST_ASSERT_FALSE(mqtt->publish("a/b", payload, 4, false, 1));
+	ack(MQTTPUBACK, 2);
+	TEST_ASSERT_EQUAL_UINT8(0, mqtt->getInflightCount());
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, 4, false, 1));
+}
+
+void test_store_grows_for_larger_packets()
+{
+	uint8_t payload[200];
+	memset(payload, 'x', sizeof(payload));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, 8, false, 1));
+	ack(MQTTPUBACK, 2);
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, sizeof(payload), false, 1));
+}
+
+void test_fixed_store_rejects_what_does_not_fit()
+{
+	uint8_t payload[64];
+	memset(payload, 'x', sizeof(payload));
+	TEST_ASSERT_TRUE(mqtt->setInflightWindow(4, 32));
+	TEST_ASSERT_FALSE(mqtt->publish("a/b", payload, sizeof(payload), false, 1));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", payload, 8, false, 1));
+}
+
+// A topic longer than the buffer is rejected before anything is stored
+void test_overlong_topic_rejected()
+{
+	char topic[300];
+	memset(topic, 't', sizeof(topic) - 1);
+	topic[sizeof(topic) - 1] = 0;
+	TEST_ASSERT_FALSE(mqtt->publish(topic, (const uint8_t *)"x", 1, false, 1));
+	TEST_ASSERT_EQUAL_UINT8(0, mqtt->getInflightCount());
+	TEST_ASSERT_EQUAL_UINT8(0, client->count);
+}
+
+void test_resend_with_session_sets_dup()
+{
+	TEST_ASSERT_TRUE(mqtt->setInflightWindow(4, 0));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"1", 1, false, 1));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"2", 1, false, 2));
+	ack(MQTTPUBREC, 3);
+	reconnect(1);
+	TEST_ASSERT_EQUAL_UINT8(2, mqtt->getInflightCount());
+	// CONNECT, the PUBLISH again with DUP, the PUBREL again
+	TEST_ASSERT_EQUAL_UINT8(3, client->count);
+	TEST_ASSERT_EQUAL_HEX8(MQTTPUBLISH | MQTTQOS1 | 0x08, client->types[1]);
+	TEST_ASSERT_EQUAL_HEX8(MQTTPUBREL | MQTTQOS1, client->types[2]);
+}
+
+// A new session has never seen the packets: no DUP, and the released QoS 2 packet is done
+void test_resend_without_session_clears_dup()
+{
+	TEST_ASSERT_TRUE(mqtt->setInflightWindow(4, 0));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"1", 1, false, 1));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"2", 1, false, 2));
+	ack(MQTTPUBREC, 3);
+	reconnect(1);
+	reconnect(0);
+	TEST_ASSERT_EQUAL_UINT8(1, mqtt->getInflightCount());
+	TEST_ASSERT_EQUAL_UINT8(2, client->count);
+	TEST_ASSERT_EQUAL_HEX8(MQTTPUBLISH | MQTTQOS1, client->types[1]);
+	ack(MQTTPUBACK, 2);
+	TEST_ASSERT_EQUAL_UINT8(0, mqtt->getInflightCount());
+}
+
+// A partial PUBLISH is never left on a live link; the packet is kept and resent after the reconnect
+void test_short_write_drops_connection()
+{
+	client->shortWrites = true;
+	TEST_ASSERT_FALSE(mqtt->publish("a/b", (const uint8_t *)"21.5", 4, false, 1));
+	TEST_ASSERT_FALSE(mqtt->connected());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECTION_LOST, mqtt->state());
+	TEST_ASSERT_EQUAL_UINT8(1, mqtt->getInflightCount());
+
+	client->shortWrites = false;
+	client->count = 0;
+	connect(1);
+	TEST_ASSERT_EQUAL_HEX8(MQTTPUBLISH | MQTTQOS1 | 0x08, client->types[1]);
+	ack(MQTTPUBACK, 2);
+	TEST_ASSERT_EQUAL_UINT8(0, mqtt->getInflightCount());
+}
+
+// First sends and resends both show up in the outbound packet counters
+void test_publishes_counted()
+{
+	Metrics metrics;
+	mqtt->setMetrics(&metrics);
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"1", 1, false, 1));
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"2", 1, false, 2));
+	TEST_ASSERT_EQUAL_UINT32(2, metrics.getPacketsOut(MQTTPUBLISH >> 4));
+	reconnect(1);
+	TEST_ASSERT_EQUAL_UINT32(4, metrics.getPacketsOut(MQTTPUBLISH >> 4));
+	mqtt->setMetrics(NULL);
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_default_window_publishes_qos1);
+	RUN_TEST(test_window_of_one_is_stop_and_wait);
+	RUN_TEST(test_store_grows_for_larger_packets);
+	RUN_TEST(test_fixed_store_rejects_what_does_not_fit);
+	RUN_TEST(test_overlong_topic_rejected);
+	RUN_TEST(test_resend_with_session_sets_dup);
+	RUN_TEST(test_resend_without_session_clears_dup);
+	RUN_TEST(test_publishes_counted);
+	RUN_TEST(test_short_write_drops_connection);
+	return UNITY_END();
+}
@@ -0,0 +1,166 @@
+#include <Arduino.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <unity.h>
+
+// QoS 2 handshakes in both directions, duplicate suppression and oversized QoS 2 packets.
+
+// Keeps every byte written so the acknowledgements can be read back
+class CapturingClient : public LoopbackClient
+{
+public:
+	uint8_t written[256];
+	size_t used;
+
+	virtual size_t write(const uint8_t *buffer, size_t size)
+	{
+		for (size_t i = 0; i < size && this->used < sizeof(this->written); i++)
+		{
+			this->written[this->used++] = buffer[i];
+		}
+		return LoopbackClient::write(buffer, size);
+	}
+};
+
+static CapturingClient *client;
+static MqttClient *mqtt;
+static uint8_t deliveries;
+static uint8_t chunkBegins;
+static uint8_t chunkEnds;
+
+// QoS 2 PUBLISH of "a/b" with payload "hi"
+static void feedPublish(uint16_t msgId, bool dup)
+{
+	const uint8_t packet[] = {(uint8_t)(MQTTPUBLISH | MQTTQOS2 | (dup ? 0x08 : 0)), 9, 0, 3, 'a', '/', 'b', (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF), 'h', 'i'};
+	client->feed(packet, sizeof(packet));
+	mqtt->loop();
+}
+
+static void feedAck(uint8_t type, uint16_t msgId)
+{
+	const uint8_t packet[] = {type, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+	client->feed(packet, sizeof(packet));
+	mqtt->loop();
+}
+
+// The only thing written since the last call is this acknowledgement
+static void assertWritten(uint8_t type, uint16_t msgId)
+{
+	const uint8_t expected[] = {type, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+	TEST_ASSERT_EQUAL_UINT(sizeof(expected), client->used);
+	TEST_ASSERT_EQUAL_MEMORY(expected, client->written, sizeof(expected));
+	client->used = 0;
+}
+
+void setUp()
+{
+	static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+	client = new CapturingClient();
+	client->setEcho(false);
+	mqtt = new MqttClient(*client);
+	mqtt->setBufferSize(64);
+	mqtt->setKeepAlive(0);
+	mqtt->setCallback([](char *, uint8_t *, unsigned int)
+										{ deliveries++; });
+	mqtt->setChunkCallbacks([](char *, uint32_t)
+													{ chunkBegins++; },
+													[](uint32_t, const uint8_t *, uint32_t) {},
+													[]()
+													{ chunkEnds++; });
+	deliveries = 0;
+	chunkBegins = 0;
+	chunkEnds = 0;
+
+	client->connect("loopback", 1883);
+	client->feed(connack, sizeof(connack));
+	mqtt->beginConnect("qos2", NULL, NULL);
+	mqtt->loop();
+	TEST_ASSERT_TRUE(mqtt->connected());
+	client->used = 0;
+}
+
+void tearDown()
+{
+	delete mqtt;
+	delete client;
+}
+
+// PUBLISH, PUBREC from the broker, PUBREL, PUBCOMP from the broker
+void test_outbound_handshake()
+{
+	TEST_ASSERT_TRUE(mqtt->publish("a/b", (const uint8_t *)"hi", 2, false, 2));
+	TEST_ASSERT_EQUAL_HEX8(MQTTPUBLISH | MQTTQOS2, client->written[0]);
+	client->used = 0;
+
+	feedAck(MQTTPUBREC, 2);
+	assertWritten(MQTTPUBREL | MQTTQOS1, 2);
+	TEST_ASSERT_EQUAL_UINT8(1, mqtt->getInflightCount());
+
+	feedAck(MQTTPUBCOMP, 2);
+	TEST_ASSERT_EQUAL_UINT(0, client->used);
+	TEST_ASSERT_EQUAL_UINT8(0, mqtt->getInflightCount());
+}
+
+// PUBLISH from the broker, PUBREC, PUBREL from the broker, PUBCOMP
+void test_inbound_handshake()
+{
+	feedPublish(7, false);
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+	assertWritten(MQTTPUBREC, 7);
+
+	feedAck(MQTTPUBREL | MQTTQOS1, 7);
+	assertWritten(MQTTPUBCOMP, 7);
+}
+
+// A redelivery before PUBREL is acknowledged again but not delivered; after PUBREL the id is free
+void test_duplicate_publish_suppressed()
+{
+	feedPublish(7, false);
+	assertWritten(MQTTPUBREC, 7);
+	feedPublish(7, true);
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+	assertWritten(MQTTPUBREC, 7);
+
+	feedAck(MQTTPUBREL | MQTTQOS1, 7);
+	assertWritten(MQTTPUBCOMP, 7);
+	feedPublish(7, false);
+	TEST_ASSERT_EQUAL_UINT8(2, deliveries);
+}
+
+// Chunks are never announced for QoS 2, so a redelivery after a drop mid-packet cannot be seen twice
+void test_oversized_qos2_not_chunked()
+{
+	uint8_t packet[2 + 2 + 3 + 2 + 100];
+	packet[0] = MQTTPUBLISH | MQTTQOS2;
+	packet[1] = sizeof(packet) - 2;
+	memcpy(packet + 2, "\0\3a/b\0\11", 7);
+	memset(packet + 9, 'x', 100);
+
+	client->feed(packet, 40);
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT8(0, chunkBegins);
+	client->feed(packet + 40, sizeof(packet) - 40);
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT8(0, chunkBegins);
+	TEST_ASSERT_EQUAL_UINT8(0, chunkEnds);
+	TEST_ASSERT_EQUAL_UINT8(0, deliveries);
+	TEST_ASSERT_EQUAL_UINT(0, client->used);
+
+	// the same packet at QoS 1 streams
+	packet[0] = MQTTPUBLISH | MQTTQOS1;
+	client->feed(packet, sizeof(packet));
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT8(1, chunkBegins);
+	TEST_ASSERT_EQUAL_UINT8(1, chunkEnds);
+	assertWritten(MQTTPUBACK, 9);
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_outbound_handshake);
+	RUN_TEST(test_inbound_handshake);
+	RUN_TEST(test_duplicate_publish_suppressed);
+	RUN_TEST(test_oversized_qos2_not_chunked);
+	return UNITY_END();
+}
@@ -0,0 +1,242 @@
+#include <Arduino.h>
+#include <MqttClient.h>
+#include <LoopbackClient.h>
+#include <unity.h>
+
+// Inbound packets split across loop() calls, against a LoopbackClient that drops what the client writes.
+
+static LoopbackClient *loopback;
+static MqttClient *mqtt;
+static char topic[32];
+static uint8_t data[64];
+static unsigned int dataLength;
+static uint8_t deliveries;
+
+static const uint8_t publish[] = {MQTTPUBLISH, 12, 0, 3, 'a', '/', 'b', 'h', 'e', 'l', 'l', 'o', '!', '!'};
+
+void setUp()
+{
+	static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+	loopback = new LoopbackClient();
+	mqtt = new MqttClient(*loopback);
+	mqtt->setBufferSize(256);
+	mqtt->setKeepAlive(0);
+	mqtt->setSocketTimeout(1);
+	mqtt->setCallback([](char *t, uint8_t *payload, unsigned int length)
+										{
+		strncpy(topic, t, sizeof(topic) - 1);
+		memcpy(data, payload, length);
+		dataLength = length;
+		deliveries++; });
+	deliveries = 0;
+
+	loopback->connect("loopback", 1883);
+	loopback->setEcho(false);
+	loopback->feed(connack, sizeof(connack));
+	mqtt->beginConnect("receive", NULL, NULL);
+	mqtt->loop();
+	TEST_ASSERT_TRUE(mqtt->connected());
+}
+
+void tearDown()
+{
+	delete mqtt;
+	delete loopback;
+}
+
+void test_packet_split_across_loops()
+{
+	// header, length, topic and payload each arrive on their own
+	static const uint8_t cuts[] = {1, 2, 5, 9, sizeof(publish)};
+	uint8_t offset = 0;
+	for (uint8_t i = 0; i < sizeof(cuts); i++)
+	{
+		loopback->feed(publish + offset, cuts[i] - offset);
+		offset = cuts[i];
+		TEST_ASSERT_TRUE(mqtt->loop());
+		TEST_ASSERT_EQUAL_UINT8((i == sizeof(cuts) - 1) ? 1 : 0, deliveries);
+	}
+	TEST_ASSERT_EQUAL_STRING("a/b", topic);
+	TEST_ASSERT_EQUAL_UINT(7, dataLength);
+	TEST_ASSERT_EQUAL_MEMORY("hello!!", data, 7);
+}
+
+void test_back_to_back_packets()
+{
+	uint8_t both[2 * sizeof(publish)];
+	memcpy(both, publish, sizeof(publish));
+	memcpy(both + sizeof(publish), publish, sizeof(publish));
+	loopback->feed(both, sizeof(publish) + 3);
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+	loopback->feed(both + sizeof(publish) + 3, sizeof(publish) - 3);
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT8(2, deliveries);
+}
+
+// A stalled body never holds loop(); the link fails once it has been silent for socketTimeout
+void test_stall_times_out_without_blocking()
+{
+	loopback->feed(publish, 6);
+	unsigned long worst = 0;
+	unsigned long started = millis();
+	while (mqtt->connected() && millis() - started < 3000)
+	{
+		unsigned long before = micros();
+		mqtt->loop();
+		unsigned long took = micros() - before;
+		if (took > worst)
+		{
+			worst = took;
+		}
+		delay(1);
+	}
+	TEST_ASSERT_FALSE(mqtt->connected());
+	TEST_ASSERT_EQUAL_INT(MQTT_CONNECTION_TIMEOUT, mqtt->state());
+	TEST_ASSERT_GREATER_OR_EQUAL(1000, millis() - started);
+	TEST_ASSERT_LESS_THAN(1000, worst);
+	TEST_ASSERT_EQUAL_UINT8(0, deliveries);
+}
+
+// Bytes that keep trickling in keep a slow packet alive past socketTimeout
+void test_slow_packet_is_not_a_stall()
+{
+	for (uint8_t i = 0; i < sizeof(publish); i++)
+	{
+		loopback->feed(publish + i, 1);
+		mqtt->loop();
+		delay(150);
+	}
+	TEST_ASSERT_TRUE(mqtt->connected());
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+}
+
+void test_stall_tolerated_without_read_timeout()
+{
+	mqtt->setReadTimeoutEnabled(false);
+	loopback->feed(publish, 6);
+	unsigned long started = millis();
+	while (millis() - started < 1200)
+	{
+		mqtt->loop();
+		delay(5);
+	}
+	TEST_ASSERT_TRUE(mqtt->connected());
+	loopback->feed(publish + 6, sizeof(publish) - 6);
+	mqtt->loop();
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+}
+
+// Outbound packets are framed outside the receive buffer, so they leave a partial packet intact
+void test_publish_while_packet_is_partial()
+{
+	static const uint8_t inbound[] = {MQTTPUBLISH, 15, 0, 8, 'i', 'n', '/', 't', 'o', 'p', 'i', 'c', 'h', 'e', 'l', 'l', 'o'};
+	loopback->feed(inbound, 6);
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_TRUE(mqtt->publish("out/zzzzzzzzzzz", "payload"));
+	const char *filters[] = {"sub/zzzzzzzzzzz"};
+	const uint8_t qos[] = {1};
+	TEST_ASSERT_TRUE(mqtt->subscribe(filters, qos, 1, NULL));
+	TEST_ASSERT_TRUE(mqtt->unsubscribe("sub/zzzzzzzzzzz"));
+	loopback->feed(inbound + 6, sizeof(inbound) - 6);
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+	TEST_ASSERT_EQUAL_STRING("in/topic", topic);
+	TEST_ASSERT_EQUAL_UINT(5, dataLength);
+	TEST_ASSERT_EQUAL_MEMORY("hello", data, 5);
+}
+
+// A keep-alive PINGREQ due while a packet is partial leaves it intact as well
+void test_ping_while_packet_is_partial()
+{
+	mqtt->setKeepAlive(1);
+	mqtt->setSocketTimeout(5);
+	loopback->feed(publish, 6);
+	TEST_ASSERT_TRUE(mqtt->loop());
+	delay(1100);
+	size_t written = loopback->getWritten();
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_EQUAL_UINT(written + 2, loopback->getWritten());
+	loopback->feed(publish + 6, sizeof(publish) - 6);
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_EQUAL_UINT8(1, deliveries);
+	TEST_ASSERT_EQUAL_STRING("a/b", topic);
+}
+
+// Lowering keepAlive below the jitter drawn at connect time still sends pings
+void test_ping_after_keep_alive_lowered()
+{
+	static const uint8_t connack[] = {MQTTCONNACK, 2, 0, 0};
+	loopback->stop();
+	TEST_ASSERT_FALSE(mqtt->connected());
+	loopback->connect("loopback", 1883);
+	loopback->feed(connack, sizeof(connack));
+	// "receive" draws a jitter of about 36 s out of keepAlive / 10
+	mqtt->setKeepAlive(600);
+	mqtt->beginConnect("receive", NULL, NULL);
+	mqtt->loop();
+	TEST_ASSERT_TRUE(mqtt->connected());
+
+	mqtt->setKeepAlive(1);
+	delay(1100);
+	size_t written = loopback->getWritten();
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_EQUAL_UINT(written + 2, loopback->getWritten());
+}
+
+// A PUBLISH streamed in chunks slower than the ping deadline keeps the link up while its bytes arrive
+void test_slow_chunked_publish_while_ping_outstanding()
+{
+	static uint32_t received;
+	static uint8_t ends;
+	received = 0;
+	ends = 0;
+	mqtt->setChunkCallbacks([](char *, uint32_t) {},
+													[](uint32_t, const uint8_t *, uint32_t length)
+													{ received += length; },
+													[]()
+													{ ends++; });
+	mqtt->setKeepAlive(1);
+	mqtt->setSocketTimeout(5);
+
+	uint8_t packet[3 + 5 + 400];
+	packet[0] = MQTTPUBLISH;
+	packet[1] = 0x80 | ((sizeof(packet) - 3) & 0x7F);
+	packet[2] = (sizeof(packet) - 3) >> 7;
+	memcpy(packet + 3, "\0\3a/b", 5);
+	memset(packet + 8, 'x', 400);
+
+	// let the PINGREQ go out; the loopback never answers it
+	delay(1100);
+	size_t written = loopback->getWritten();
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_EQUAL_UINT(written + 2, loopback->getWritten());
+
+	// 2 s of trickle, twice the keep-alive
+	for (size_t offset = 0; offset < sizeof(packet); offset += 40)
+	{
+		size_t n = sizeof(packet) - offset < 40 ? sizeof(packet) - offset : 40;
+		loopback->feed(packet + offset, n);
+		TEST_ASSERT_TRUE(mqtt->loop());
+		delay(200);
+	}
+	TEST_ASSERT_TRUE(mqtt->loop());
+	TEST_ASSERT_TRUE(mqtt->connected());
+	TEST_ASSERT_EQUAL_UINT8(1, ends);
+	TEST_ASSERT_EQUAL_UINT32(400, received);
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_packet_split_across_loops);
+	RUN_TEST(test_back_to_back_packets);
+	RUN_TEST(test_stall_times_out_without_blocking);
+	RUN_TEST(test_slow_packet_is_not_a_stall);
+	RUN_TEST(test_stall_tolerated_without_read_timeout);
+	RUN_TEST(test_publish_while_packet_is_partial);
+	RUN_TEST(test_ping_while_packet_is_partial);
+	RUN_TEST(test_slow_chunked_publish_while_ping_outstanding);
+	RUN_TEST(test_ping_after_keep_alive_lowered);
+	return UNITY_END();
+}
@@ -0,0 +1,200 @@
+#include <Arduino.h>
+#include <Connector.h>
+#include <LoopbackBroker.h>
+#include <ReconnectPolicy.h>
+#include <unity.h>
+
+// Reconnect backoff on an injected clock and random source, the disconnect callback of failed attempts and
+// the resend of unacknowledged publishes into a kept session.
+
+static ReconnectPolicy *policy;
+static unsigned long now;
+static uint32_t draw;
+
+void setUp()
+{
+	now = 1000;
+	draw = 0;
+	policy = new ReconnectPolicy();
+	policy->setClock([]() -> unsigned long
+									 { return now; });
+	policy->setRandom([]() -> uint32_t
+										{ return draw; });
+	policy->setBackoff(100, 1000, 5000);
+	policy->reset();
+}
+
+void tearDown()
+{
+	delete policy;
+}
+
+// draw % (ceiling + 1) == ceiling, so each delay is the ceiling itself
+static void fail(unsigned long ceiling)
+{
+	draw = ceiling;
+	policy->failed();
+	TEST_ASSERT_EQUAL_UINT32(ceiling, policy->getDelay());
+}
+
+void test_first_attempt_is_immediate()
+{
+	TEST_ASSERT_TRUE(policy->ready());
+	TEST_ASSERT_EQUAL_UINT32(0, policy->getRemaining());
+}
+
+void test_ceiling_doubles_up_to_max()
+{
+	fail(100);
+	fail(200);
+	fail(400);
+	fail(800);
+	fail(1000);
+	fail(1000);
+	TEST_ASSERT_EQUAL_UINT16(6, policy->getAttempts());
+}
+
+void test_delay_is_jittered_below_ceiling()
+{
+	draw = 250;
+	policy->failed();
+	policy->failed();
+	// ceiling 200: 250 % 201
+	TEST_ASSERT_EQUAL_UINT32(49, policy->getDelay());
+}
+
+void test_ready_after_delay()
+{
+	fail(100);
+	now += 99;
+	TEST_ASSERT_FALSE(policy->ready());
+	TEST_ASSERT_EQUAL_UINT32(1, policy->getRemaining());
+	now += 1;
+	TEST_ASSERT_TRUE(policy->ready());
+}
+
+void test_ready_across_clock_wrap()
+{
+	now = 0xFFFFFFF0UL;
+	fail(100);
+	now += 50;
+	TEST_ASSERT_FALSE(policy->ready());
+	now += 50;
+	TEST_ASSERT_TRUE(policy->ready());
+}
+
+// A session that outlived stableAfter starts the backoff over; a short one keeps growing it
+void test_stable_session_resets_backoff()
+{
+	fail(100);
+	fail(200);
+	fail(400);
+	policy->connected();
+	now += 4999;
+	draw = 800;
+	policy->disconnected();
+	TEST_ASSERT_EQUAL_UINT16(4, policy->getAttempts());
+	TEST_ASSERT_EQUAL_UINT32(800, policy->getDelay());
+
+	policy->connected();
+	now += 5000;
+	draw = 100;
+	policy->disconnected();
+	TEST_ASSERT_EQUAL_UINT16(1, policy->getAttempts());
+	TEST_ASSERT_EQUAL_UINT32(100, policy->getDelay());
+}
+
+// Nothing listens on the port: every refused attempt reports a disconnect although the connector was never online
+void test_failed_attempts_call_on_disconnect()
+{
+	LoopbackBroker broker;
+	TEST_ASSERT_TRUE(broker.begin());
+	uint16_t port = broker.port();
+	broker.end();
+
+	static uint8_t disconnects;
+	disconnects = 0;
+	Connector connector;
+	connector.setDescriptor("test", "vendor", "model", "SN1", "code");
+	connector.setNetwork(CONNECTOR_TYPE_WIFI, "ssid", "password");
+	connector.setConnection("127.0.0.1", port);
+	connector.setReconnectBackoff(0, 0, 0);
+	connector.setOnDisconnectCallback([](Connector *)
+																		{ disconnects++; });
+	TEST_ASSERT_TRUE(connector.begin());
+	unsigned long started = millis();
+	while (disconnects < 2 && millis() - started < 2000)
+	{
+		connector.loop();
+		delay(1);
+	}
+	TEST_ASSERT_TRUE(disconnects >= 2);
+	TEST_ASSERT_EQUAL_UINT32(disconnects, connector.getMetrics()->getCounter(METRICS_CONNECT_FAILURES));
+	TEST_ASSERT_EQUAL_UINT32(0, connector.getMetrics()->getCounter(METRICS_DISCONNECTS));
+}
+
+// With setCleanSession(false) a publish left unacknowledged by a broker restart is resent with DUP
+void test_kept_session_resends_publish()
+{
+	LoopbackBroker broker;
+	TEST_ASSERT_TRUE(broker.begin());
+
+	static uint8_t connects;
+	connects = 0;
+	Connector connector;
+	connector.setDescriptor("test", "vendor", "model", "SN1", "code");
+	connector.setNetwork(CONNECTOR_TYPE_WIFI, "ssid", "password");
+	connector.setConnection("127.0.0.1", broker.port());
+	connector.setReconnectBackoff(0, 0, 0);
+	connector.setCleanSession(false);
+	connector.setPublishQos(1);
+	connector.setOnConnectCallback([](Connector *)
+																 { connects++; });
+	TEST_ASSERT_TRUE(connector.begin());
+	unsigned long started = millis();
+	while (connects < 1 && millis() - started < 2000)
+	{
+		broker.poll();
+		connector.loop();
+		delay(1);
+	}
+	TEST_ASSERT_EQUAL_UINT8(1, connects);
+	TEST_ASSERT_EQUAL_HEX8(0, broker.getConnectFlags(0) & 0x02);
+
+	broker.setAckPublishes(false);
+	TEST_ASSERT_TRUE(connector.publish("test/topic", "text/plain", "%d", 1));
+	broker.run(50, [&]()
+						 { connector.loop(); });
+	TEST_ASSERT_EQUAL_UINT8(1, connector.getInflightCount());
+	TEST_ASSERT_EQUAL_UINT32(0, broker.getDuplicateCount());
+
+	broker.setAckPublishes(true);
+	broker.setSessionPresent(true);
+	broker.disconnect();
+	started = millis();
+	while (connects < 2 && millis() - started < 2000)
+	{
+		broker.poll();
+		connector.loop();
+		delay(1);
+	}
+	TEST_ASSERT_EQUAL_UINT8(2, connects);
+	broker.run(50, [&]()
+						 { connector.loop(); });
+	TEST_ASSERT_EQUAL_UINT32(1, broker.getDuplicateCount());
+	TEST_ASSERT_EQUAL_UINT8(0, connector.getInflightCount());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_first_attempt_is_immediate);
+	RUN_TEST(test_ceiling_doubles_up_to_max);
+	RUN_TEST(test_delay_is_jittered_below_ceiling);
+	RUN_TEST(test_ready_after_delay);
+	RUN_TEST(test_ready_across_clock_wrap);
+	RUN_TEST(test_stable_session_resets_backoff);
+	RUN_TEST(test_failed_attempts_call_on_disconnect);
+	RUN_TEST(test_kept_session_resends_publish);
+	return UNITY_END();
+}
@@ -0,0 +1,89 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <unity.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Listening socket on an ephemeral loopback port
+static int listener = -1;
+static uint16_t listenerPort = 0;
+
+void setUp()
+{
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(listener, (struct sockaddr *)&address, sizeof(address));
+	listen(listener, 1);
+	socklen_t length = sizeof(address);
+	getsockname(listener, (struct sockaddr *)&address, &length);
+	listenerPort = ntohs(address.sin_port);
+}
+
+void tearDown()
+{
+	close(listener);
+	listener = -1;
+}
+
+void test_resolve_dotted_address()
+{
+	IPAddress address;
+	TEST_ASSERT_TRUE(SocketClient::resolve("127.0.0.1", address));
+	TEST_ASSERT_EQUAL_UINT8(127, address[0]);
+	TEST_ASSERT_EQUAL_UINT8(1, address[3]);
+}
+
+void test_connect_refused()
+{
+	uint16_t port = listenerPort;
+	tearDown();
+	WiFiClient client;
+	unsigned long started = millis();
+	TEST_ASSERT_EQUAL_INT(0, client.connect(IPAddress(127, 0, 0, 1), port));
+	TEST_ASSERT_LESS_THAN(SOCKET_CLIENT_CONNECT_TIMEOUT, millis() - started);
+	TEST_ASSERT_EQUAL_UINT8(0, client.connected());
+}
+
+void test_exchange_and_peer_close()
+{
+	WiFiClient client;
+	TEST_ASSERT_EQUAL_INT(1, client.connect("127.0.0.1", listenerPort));
+	int peer = accept(listener, NULL, NULL);
+	TEST_ASSERT_TRUE(peer >= 0);
+
+	// reads never block
+	uint8_t buffer[8];
+	TEST_ASSERT_EQUAL_INT(0, client.available());
+	TEST_ASSERT_EQUAL_INT(-1, client.read(buffer, sizeof(buffer)));
+	TEST_ASSERT_EQUAL_UINT8(1, client.connected());
+
+	TEST_ASSERT_EQUAL_UINT32(4, client.write((const uint8_t *)"ping", 4));
+	TEST_ASSERT_EQUAL_INT(4, recv(peer, buffer, sizeof(buffer), 0));
+	TEST_ASSERT_EQUAL_MEMORY("ping", buffer, 4);
+
+	send(peer, "pong", 4, 0);
+	delay(10);
+	TEST_ASSERT_EQUAL_INT(4, client.available());
+	TEST_ASSERT_EQUAL_INT('p', client.peek());
+	TEST_ASSERT_EQUAL_INT(4, client.read(buffer, sizeof(buffer)));
+	TEST_ASSERT_EQUAL_MEMORY("pong", buffer, 4);
+
+	close(peer);
+	delay(10);
+	client.available();
+	TEST_ASSERT_EQUAL_UINT8(0, client.connected());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_resolve_dotted_address);
+	RUN_TEST(test_connect_refused);
+	RUN_TEST(test_exchange_and_peer_close);
+	return UNITY_END();
+}
@@ -0,0 +1,67 @@
+#include <Arduino.h>
+#include <Timestamp.h>
+#include <unity.h>
+
+// Cached last-modified text across a time zone change and a clock set within the same minute.
+
+#define START 1704067200000ULL // 2024-01-01 00:00:00 UTC
+
+static uint64_t clockMs;
+static Timestamp *timestamp;
+
+static const char *text()
+{
+	uint32_t length;
+	return timestamp->getText(&length);
+}
+
+void setUp()
+{
+	Timestamp::setTimeZone("UTC0");
+	clockMs = START;
+	timestamp = new Timestamp();
+	timestamp->setClock([]() -> uint64_t
+											{ return clockMs; });
+}
+
+void tearDown()
+{
+	delete timestamp;
+	Timestamp::setTimeZone("UTC0");
+}
+
+void test_patched_within_minute()
+{
+	TEST_ASSERT_EQUAL_STRING("2024-01-01 00:00:00", text());
+	uint32_t formats = timestamp->getFormatCount();
+	clockMs += 5000;
+	TEST_ASSERT_EQUAL_STRING("2024-01-01 00:00:05", text());
+	TEST_ASSERT_EQUAL_UINT32(formats, timestamp->getFormatCount());
+}
+
+void test_time_zone_change_reformats()
+{
+	TEST_ASSERT_EQUAL_STRING("2024-01-01 00:00:00", text());
+	Timestamp::setTimeZone("KST-9");
+	clockMs += 1000;
+	TEST_ASSERT_EQUAL_STRING("2024-01-01 09:00:01", text());
+}
+
+// The SNTP callback reaches instances it does not know about
+void test_clock_set_reformats()
+{
+	TEST_ASSERT_EQUAL_STRING("2024-01-01 00:00:00", text());
+	uint32_t formats = timestamp->getFormatCount();
+	Timestamp::clockSet(NULL);
+	text();
+	TEST_ASSERT_EQUAL_UINT32(formats + 1, timestamp->getFormatCount());
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_patched_within_minute);
+	RUN_TEST(test_time_zone_change_reformats);
+	RUN_TEST(test_clock_set_reformats);
+	return UNITY_END();
+}
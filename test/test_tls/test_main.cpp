@@ -0,0 +1,161 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <TlsClient.h>
+#include <unity.h>
+
+// Runs against openssl s_server on a loopback port as a stand-in broker; needs the openssl
+// command and a build with TLS_CLIENT_ENABLED (env:native_tls).
+#if TLS_CLIENT_ENABLED
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define TEST_TLS_PORT 18883
+#define TEST_TLS_DIR "/tmp/agedge_test_tls"
+
+static pid_t server = -1;
+static char caCert[4096];
+
+static bool startServer()
+{
+	if (system("mkdir -p " TEST_TLS_DIR " && openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost"
+						 " -keyout " TEST_TLS_DIR "/key.pem -out " TEST_TLS_DIR "/cert.pem >/dev/null 2>&1") != 0)
+	{
+		return false;
+	}
+	FILE *file = fopen(TEST_TLS_DIR "/cert.pem", "r");
+	if (file == NULL)
+	{
+		return false;
+	}
+	size_t length = fread(caCert, 1, sizeof(caCert) - 1, file);
+	caCert[length] = '\0';
+	fclose(file);
+
+	server = fork();
+	if (server == 0)
+	{
+		// -rev echoes every line reversed; TLS 1.2 keeps resumption on session tickets
+		execlp("openssl", "openssl", "s_server", "-quiet", "-rev", "-tls1_2", "-accept", "18883",
+					 "-cert", TEST_TLS_DIR "/cert.pem", "-key", TEST_TLS_DIR "/key.pem", (char *)NULL);
+		_exit(127);
+	}
+	delay(500);
+	return server > 0 && waitpid(server, NULL, WNOHANG) == 0;
+}
+
+static void stopServer()
+{
+	if (server > 0)
+	{
+		kill(server, SIGTERM);
+		waitpid(server, NULL, 0);
+		server = -1;
+	}
+}
+
+static bool exchange(TlsClient &tls)
+{
+	if (tls.write((const uint8_t *)"broker\n", 7) != 7)
+	{
+		return false;
+	}
+	char reply[8];
+	uint8_t received = 0;
+	unsigned long started = millis();
+	while (received < 7 && millis() - started < 2000)
+	{
+		int n = tls.read((uint8_t *)reply + received, 7 - received);
+		if (n > 0)
+		{
+			received += n;
+		}
+		delay(1);
+	}
+	return received == 7 && memcmp(reply, "rekorb\n", 7) == 0;
+}
+#endif
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+#if TLS_CLIENT_ENABLED
+void test_verified_handshake_and_resumption()
+{
+	if (!startServer())
+	{
+		stopServer();
+		TEST_IGNORE_MESSAGE("openssl s_server not available");
+	}
+	WiFiClient socket;
+	TlsClient tls(socket);
+	tls.setCACert(caCert);
+
+	TEST_ASSERT_EQUAL_INT(1, tls.connect("localhost", TEST_TLS_PORT));
+	TEST_ASSERT_FALSE(tls.isResumed());
+	TEST_ASSERT_TRUE(exchange(tls));
+	tls.stop();
+
+	// the session of the first handshake is offered and accepted
+	TEST_ASSERT_EQUAL_INT(1, tls.connect("localhost", TEST_TLS_PORT));
+	TEST_ASSERT_TRUE(tls.isResumed());
+	TEST_ASSERT_TRUE(exchange(tls));
+	tls.stop();
+	TEST_ASSERT_EQUAL_UINT32(2, tls.getHandshakeCount());
+	TEST_ASSERT_EQUAL_UINT32(1, tls.getResumeCount());
+
+	// a full handshake again once the session is dropped
+	tls.invalidateSession();
+	TEST_ASSERT_EQUAL_INT(1, tls.connect("localhost", TEST_TLS_PORT));
+	TEST_ASSERT_FALSE(tls.isResumed());
+	tls.stop();
+	stopServer();
+}
+
+void test_name_mismatch_rejected()
+{
+	if (!startServer())
+	{
+		stopServer();
+		TEST_IGNORE_MESSAGE("openssl s_server not available");
+	}
+	WiFiClient socket;
+	TlsClient tls(socket);
+	tls.setCACert(caCert);
+	tls.setHostname("broker.invalid");
+	TEST_ASSERT_EQUAL_INT(0, tls.connect(IPAddress(127, 0, 0, 1), TEST_TLS_PORT));
+	TEST_ASSERT_EQUAL_UINT8(0, tls.connected());
+
+	// encryption without authentication still connects
+	WiFiClient insecureSocket;
+	TlsClient insecure(insecureSocket);
+	insecure.setInsecure();
+	insecure.setHostname("broker.invalid");
+	TEST_ASSERT_EQUAL_INT(1, insecure.connect(IPAddress(127, 0, 0, 1), TEST_TLS_PORT));
+	TEST_ASSERT_TRUE(exchange(insecure));
+	insecure.stop();
+	stopServer();
+}
+#else
+void test_tls_disabled()
+{
+	TEST_IGNORE_MESSAGE("built without TLS_CLIENT_ENABLED");
+}
+#endif
+
+int main()
+{
+	UNITY_BEGIN();
+#if TLS_CLIENT_ENABLED
+	RUN_TEST(test_verified_handshake_and_resumption);
+	RUN_TEST(test_name_mismatch_rejected);
+#else
+	RUN_TEST(test_tls_disabled);
+#endif
+	return UNITY_END();
+}